@@ -438,7 +438,8 @@ bool CBEncodeBase58(BigNumber * bi,char *str,uint32_t maxStrLen)
 }
 
 
-bool encodeBase58(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
+// The original byte at a time cbitcoin implementation; kept as a reference to cross check the fast version against.
+bool encodeBase58Reference(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
 					   uint32_t length,			 // The number of bytes in the 'big-number'; this will be 25 for a bitcoin address
 					   bool isBigEndian,		 // True if the input number is in little-endian format (this will be true for a bitcoin address)
 					   char *output,			 // The address to store the output string.
@@ -465,7 +466,7 @@ bool encodeBase58(const uint8_t *bigNumber, // The block of memory corresponding
 	return CBEncodeBase58(&bytes,output,maxStrLen);
 }
 
-uint32_t decodeBase58(const char *string,		// The base58 encoded string
+uint32_t decodeBase58Reference(const char *string,		// The base58 encoded string
 					   uint8_t *output,			// The output binary buffer
 					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
 					   bool isBigEndian) // If the output needs to be in little endian format
@@ -492,4 +493,230 @@ uint32_t decodeBase58(const char *string,		// The base58 encoded string
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
+
+// The fast encoder/decoder below treats the number as an array of 32 bit words rather than
+// working on it one byte at a time.  Each pass divides (or multiplies) the whole number by 58^5,
+// so five base58 digits are produced (or consumed) per pass using only 64 bit intermediates.
+#define BASE58_POW5 656356768	// 58^5; the largest power of 58 where (remainder << 32) still fits in 64 bits
+#define BASE58_MAX_WORDS (MAX_BIG_NUMBER/4+1)
+
+// Maps an ASCII character to its base58 digit; -1 for characters which are not in the alphabet
+static const int8_t base58Digits[256] = {
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+	-1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+	22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+	-1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+	47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+bool encodeBase58(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
+					   uint32_t length,			 // The number of bytes in the 'big-number'; this will be 25 for a bitcoin address
+					   bool isBigEndian,		 // True if the input number is in big-endian format (this will be true for a bitcoin address)
+					   char *output,			 // The address to store the output string.
+					   uint32_t maxStrLen)		 // the maximum length of the output string
+{
+	if ( length > MAX_BIG_NUMBER )
+	{
+		return false;
+	}
+	// Get the number in big-endian byte order
+	uint8_t bytes[MAX_BIG_NUMBER];
+	if ( isBigEndian )
+	{
+		memcpy(bytes,bigNumber,length);
+	}
+	else
+	{
+		for (uint32_t i=0; i<length; i++)
+		{
+			bytes[i] = bigNumber[length-1-i];
+		}
+	}
+	// Each leading zero byte is encoded as a '1'
+	uint32_t zeros = 0;
+	while ( zeros < length && bytes[zeros] == 0 )
+	{
+		zeros++;
+	}
+	// Pack the remaining bytes into 32 bit words; least significant word first
+	uint32_t words[BASE58_MAX_WORDS];
+	uint32_t wordCount = 0;
+	for (int32_t i=(int32_t)length; i>(int32_t)zeros; i-=4)
+	{
+		uint32_t w = 0;
+		int32_t start = i-4;
+		if ( start < (int32_t)zeros )
+		{
+			start = (int32_t)zeros;
+		}
+		for (int32_t j=start; j<i; j++)
+		{
+			w = (w<<8) | bytes[j];
+		}
+		words[wordCount++] = w;
+	}
+	// Repeatedly divide by 58^5; each remainder yields five digits, least significant first
+	char digits[MAX_BIG_NUMBER*2];
+	uint32_t digitCount = 0;
+	while ( wordCount )
+	{
+		uint64_t rem = 0;
+		for (int32_t i=(int32_t)wordCount-1; i>=0; i--)
+		{
+			uint64_t cur = (rem<<32) | words[i];
+			words[i] = (uint32_t)(cur / BASE58_POW5);
+			rem = cur % BASE58_POW5;
+		}
+		while ( wordCount && words[wordCount-1] == 0 )
+		{
+			wordCount--;
+		}
+		uint32_t r = (uint32_t)rem;
+		for (uint32_t k=0; k<5; k++)
+		{
+			digits[digitCount++] = base58Characters[r%58];
+			r/=58;
+			if ( wordCount == 0 && r == 0 ) // don't emit leading zero digits for the most significant chunk
+			{
+				break;
+			}
+		}
+	}
+	if ( zeros+digitCount+1 > maxStrLen )
+	{
+		return false;
+	}
+	char *dest = output;
+	for (uint32_t i=0; i<zeros; i++)
+	{
+		*dest++ = '1';
+	}
+	while ( digitCount )
+	{
+		*dest++ = digits[--digitCount];
+	}
+	*dest = 0;
+	return true;
+}
+
+uint32_t decodeBase58(const char *string,		// The base58 encoded string
+					   uint8_t *output,			// The output binary buffer
+					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
+					   bool isBigEndian) // If the output needs to be in big endian format (true for bitcoin addresses)
+{
+	// Each leading '1' is a leading zero byte
+	uint32_t zeros = 0;
+	while ( string[zeros] == '1' )
+	{
+		zeros++;
+	}
+	uint32_t words[BASE58_MAX_WORDS]; // least significant word first
+	uint32_t wordCount = 0;
+	const char *scan = &string[zeros];
+	if ( zeros == 0 && *scan == 0 )
+	{
+		return 0;
+	}
+	while ( *scan )
+	{
+		// Consume up to five digits at a time and fold them into the number with a single multiply-add pass
+		uint32_t acc = 0;
+		uint32_t mul = 1;
+		for (uint32_t k=0; k<5 && *scan; k++)
+		{
+			int8_t d = base58Digits[(uint8_t)*scan++];
+			if ( d < 0 )
+			{
+				return 0;
+			}
+			acc = acc*58 + (uint32_t)d;
+			mul*=58;
+		}
+		uint64_t carry = acc;
+		for (uint32_t i=0; i<wordCount; i++)
+		{
+			uint64_t cur = (uint64_t)words[i]*mul + carry;
+			words[i] = (uint32_t)cur;
+			carry = cur>>32;
+		}
+		if ( carry )
+		{
+			if ( wordCount == BASE58_MAX_WORDS )
+			{
+				return 0;
+			}
+			words[wordCount++] = (uint32_t)carry;
+		}
+	}
+	// Unpack the words into big-endian bytes, skipping leading zero bytes
+	uint8_t bytes[MAX_BIG_NUMBER+BASE58_MAX_WORDS*4];
+	uint32_t byteCount = 0;
+	for (uint32_t i=0; i<zeros; i++)
+	{
+		if ( byteCount == MAX_BIG_NUMBER )
+		{
+			return 0;
+		}
+		bytes[byteCount++] = 0;
+	}
+	bool leading = true;
+	for (int32_t i=(int32_t)wordCount-1; i>=0; i--)
+	{
+		for (int32_t shift=24; shift>=0; shift-=8)
+		{
+			uint8_t b = (uint8_t)(words[i]>>shift);
+			if ( leading && b == 0 )
+			{
+				continue;
+			}
+			leading = false;
+			bytes[byteCount++] = b;
+		}
+	}
+	if ( byteCount > maxOutputLength )
+	{
+		return 0;
+	}
+	if ( isBigEndian )
+	{
+		memcpy(output,bytes,byteCount);
+	}
+	else
+	{
+		for (uint32_t i=0; i<byteCount; i++)
+		{
+			output[i] = bytes[byteCount-1-i];
+		}
+	}
+	return byteCount;
+}
+
+uint32_t encodeBase58Batch(const uint8_t *bigNumbers,uint32_t length,uint32_t count,bool isBigEndian,char *output,uint32_t stride)
+{
+	uint32_t ret = 0;
+	for (uint32_t i=0; i<count; i++)
+	{
+		char *dest = &output[i*stride];
+		if ( encodeBase58(&bigNumbers[i*length],length,isBigEndian,dest,stride) )
+		{
+			ret++;
+		}
+		else
+		{
+			dest[0] = 0;
+		}
+	}
+	return ret;
+}
@@ -36,4 +36,19 @@ uint32_t decodeBase58(const char *string,		// The base58 encoded string
 					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
 					   bool outputIsBigEndian);		// Whether or not the output is considered big endian and therefore needs to be byte reverse; true for bitcoin addresses
 
+// Encodes 'count' numbers of 'length' bytes each, stored consecutively in 'bigNumbers'.  Each string is written to its own
+// 'stride' byte slot in 'output' (36 bytes is enough for a 25 byte bitcoin address).  An entry which cannot be encoded is
+// left as an empty string.  Returns the number of entries successfully encoded.
+uint32_t encodeBase58Batch(const uint8_t *bigNumbers,	// The numbers to encode; 'length' bytes each
+						   uint32_t length,				// The number of bytes in each number; this will be 25 for a bitcoin address
+						   uint32_t count,				// The number of entries to encode
+						   bool sourceIsBigEndian,		// True if the input numbers are in big-endian format
+						   char *output,				// The output buffer; must hold count*stride bytes
+						   uint32_t stride);			// The size of each output string slot, including the zero terminator
+
+// The original byte at a time implementation which the routines above replaced; they produce identical results
+// and are only kept around to cross check the faster version.
+bool encodeBase58Reference(const uint8_t *bigNumber,uint32_t length,bool sourceIsBigEndian,char *output,uint32_t maxStrLen);
+uint32_t decodeBase58Reference(const char *string,uint8_t *output,uint32_t maxOutputLength,bool outputIsBigEndian);
+
 #endif
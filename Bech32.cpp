@@ -0,0 +1,366 @@
+#include "Bech32.h"
+#include <string.h>
+
+#ifdef _MSC_VER // Disable the stupid ass absurd warning messages from Visual Studio telling you that using stdlib and stdio is 'not valid ANSI C'
+#pragma warning(disable:4996)
+#endif
+
+// The Bech32 checksum is a BCH code over GF(32); see BIP-173 for the reference implementation this is derived from.
+
+#define BECH32M_CONSTANT 0x2bc830a3	// The value the checksum must equal for Bech32m; plain Bech32 uses 1
+
+static const char bech32Characters[33] = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+
+// Maps an ASCII character to its 5 bit value; -1 for characters which are not in the alphabet.
+// Upper case letters are accepted here; mixed case strings are rejected separately.
+static const int8_t bech32Values[128] = {
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	15,-1,10,17,21,20,26,30, 7, 5,-1,-1,-1,-1,-1,-1,
+	-1,29,-1,24,13,25, 9, 8,23,-1,18,22,31,27,19,-1,
+	 1, 0, 3,16,11,28,12,14, 6, 4, 2,-1,-1,-1,-1,-1,
+	-1,29,-1,24,13,25, 9, 8,23,-1,18,22,31,27,19,-1,
+	 1, 0, 3,16,11,28,12,14, 6, 4, 2,-1,-1,-1,-1,-1
+};
+
+// The polymod works one 5 bit symbol at a time by multiplying the 30 bit checksum state by x and reducing
+// with the generator.  Because the operation is linear, the reduction for the top bits of the state can be
+// looked up in a table; the pair table folds two symbols (10 bits) into the state with a single lookup.
+class Bech32Tables
+{
+public:
+	Bech32Tables(void)
+	{
+		static const uint32_t generator[5] = { 0x3b6a57b2, 0x26508e6d, 0x1ea119fa, 0x3d4233dd, 0x2a1462b3 };
+		for (uint32_t i=0; i<32; i++)
+		{
+			uint32_t c = 0;
+			for (uint32_t b=0; b<5; b++)
+			{
+				if ( (i>>b) & 1 )
+				{
+					c^=generator[b];
+				}
+			}
+			mSingle[i] = c;
+		}
+		for (uint32_t i=0; i<1024; i++)
+		{
+			mPair[i] = step(step(i<<20,0),0);
+		}
+	}
+
+	inline uint32_t step(uint32_t chk,uint32_t v) const
+	{
+		return ((chk & 0x1ffffff) << 5) ^ v ^ mSingle[chk>>25];
+	}
+
+	inline uint32_t polymod(const uint8_t *values,uint32_t count) const
+	{
+		uint32_t chk = 1;
+		uint32_t i = 0;
+		for (; i+1<count; i+=2)
+		{
+			chk = ((chk & 0xfffff) << 10) ^ ((uint32_t)values[i] << 5) ^ values[i+1] ^ mPair[chk>>20];
+		}
+		if ( i < count )
+		{
+			chk = step(chk,values[i]);
+		}
+		return chk;
+	}
+
+	uint32_t	mSingle[32];
+	uint32_t	mPair[1024];
+};
+
+static Bech32Tables gBech32Tables;
+
+#define MAX_SYMBOLS (BECH32_MAX_LENGTH*3) // Room for the expanded human readable part plus the data and checksum
+
+// Expands the human readable part into the symbol stream which prefixes the data in the checksum computation
+static uint32_t expandHrp(const char *hrp,uint32_t hrpLen,uint8_t *symbols)
+{
+	uint32_t count = 0;
+	for (uint32_t i=0; i<hrpLen; i++)
+	{
+		symbols[count++] = (uint8_t)(hrp[i] >> 5);
+	}
+	symbols[count++] = 0;
+	for (uint32_t i=0; i<hrpLen; i++)
+	{
+		symbols[count++] = (uint8_t)(hrp[i] & 31);
+	}
+	return count;
+}
+
+// Regroups a stream of 'fromBits' wide values into 'toBits' wide values; returns false if the input can't be regrouped exactly.
+static bool convertBits(const uint8_t *input,uint32_t inputLen,uint32_t fromBits,uint32_t toBits,bool pad,uint8_t *output,uint32_t maxOutput,uint32_t &outputLen)
+{
+	uint32_t acc = 0;
+	uint32_t bits = 0;
+	uint32_t maxv = (1<<toBits)-1;
+	outputLen = 0;
+	for (uint32_t i=0; i<inputLen; i++)
+	{
+		uint32_t value = input[i];
+		if ( value >> fromBits )
+		{
+			return false;
+		}
+		acc = ((acc << fromBits) | value) & 0xFFFFFF;
+		bits+=fromBits;
+		while ( bits >= toBits )
+		{
+			bits-=toBits;
+			if ( outputLen == maxOutput )
+			{
+				return false;
+			}
+			output[outputLen++] = (uint8_t)((acc >> bits) & maxv);
+		}
+	}
+	if ( pad )
+	{
+		if ( bits )
+		{
+			if ( outputLen == maxOutput )
+			{
+				return false;
+			}
+			output[outputLen++] = (uint8_t)((acc << (toBits-bits)) & maxv);
+		}
+	}
+	else if ( bits >= fromBits || ((acc << (toBits-bits)) & maxv) )
+	{
+		return false;
+	}
+	return true;
+}
+
+bool encodeBech32(const char *hrp,const uint8_t *values,uint32_t valueCount,Bech32Encoding encoding,char *output,uint32_t maxOutputLen)
+{
+	if ( encoding == BECH32_INVALID )
+	{
+		return false;
+	}
+	uint32_t hrpLen = (uint32_t)strlen(hrp);
+	uint32_t totalLen = hrpLen+1+valueCount+6;
+	if ( hrpLen == 0 || totalLen > BECH32_MAX_LENGTH || totalLen+1 > maxOutputLen )
+	{
+		return false;
+	}
+	char lower[BECH32_MAX_LENGTH];
+	for (uint32_t i=0; i<hrpLen; i++)
+	{
+		char c = hrp[i];
+		if ( c < 33 || c > 126 )
+		{
+			return false;
+		}
+		if ( c >= 'A' && c <= 'Z' )
+		{
+			c = (char)(c - 'A' + 'a');
+		}
+		lower[i] = c;
+	}
+	uint8_t symbols[MAX_SYMBOLS];
+	uint32_t count = expandHrp(lower,hrpLen,symbols);
+	for (uint32_t i=0; i<valueCount; i++)
+	{
+		if ( values[i] > 31 )
+		{
+			return false;
+		}
+		symbols[count++] = values[i];
+	}
+	for (uint32_t i=0; i<6; i++)
+	{
+		symbols[count++] = 0;
+	}
+	uint32_t chk = gBech32Tables.polymod(symbols,count) ^ (encoding == BECH32M_ENCODING ? BECH32M_CONSTANT : 1);
+
+	char *dest = output;
+	memcpy(dest,lower,hrpLen);
+	dest+=hrpLen;
+	*dest++ = '1';
+	for (uint32_t i=0; i<valueCount; i++)
+	{
+		*dest++ = bech32Characters[values[i]];
+	}
+	for (uint32_t i=0; i<6; i++)
+	{
+		*dest++ = bech32Characters[(chk >> (5*(5-i))) & 31];
+	}
+	*dest = 0;
+	return true;
+}
+
+Bech32Encoding decodeBech32(const char *input,char *hrp,uint32_t maxHrpLen,uint8_t *values,uint32_t maxValues,uint32_t &valueCount)
+{
+	valueCount = 0;
+	uint32_t len = (uint32_t)strlen(input);
+	if ( len > BECH32_MAX_LENGTH )
+	{
+		return BECH32_INVALID;
+	}
+	bool hasLower = false;
+	bool hasUpper = false;
+	uint32_t separator = len;
+	for (uint32_t i=0; i<len; i++)
+	{
+		char c = input[i];
+		if ( c < 33 || c > 126 )
+		{
+			return BECH32_INVALID;
+		}
+		if ( c >= 'a' && c <= 'z' ) hasLower = true;
+		if ( c >= 'A' && c <= 'Z' ) hasUpper = true;
+		if ( c == '1' )
+		{
+			separator = i;
+		}
+	}
+	if ( (hasLower && hasUpper) || separator == len || separator == 0 || separator+7 > len || separator+1 > maxHrpLen )
+	{
+		return BECH32_INVALID;
+	}
+	uint32_t dataLen = len-separator-1;
+	if ( dataLen-6 > maxValues )
+	{
+		return BECH32_INVALID;
+	}
+	for (uint32_t i=0; i<separator; i++)
+	{
+		char c = input[i];
+		if ( c >= 'A' && c <= 'Z' )
+		{
+			c = (char)(c - 'A' + 'a');
+		}
+		hrp[i] = c;
+	}
+	hrp[separator] = 0;
+
+	uint8_t symbols[MAX_SYMBOLS];
+	uint32_t count = expandHrp(hrp,separator,symbols);
+	for (uint32_t i=0; i<dataLen; i++)
+	{
+		int8_t v = bech32Values[(uint8_t)input[separator+1+i]];
+		if ( v < 0 )
+		{
+			return BECH32_INVALID;
+		}
+		symbols[count++] = (uint8_t)v;
+	}
+	Bech32Encoding ret = BECH32_INVALID;
+	uint32_t chk = gBech32Tables.polymod(symbols,count);
+	if ( chk == 1 )
+	{
+		ret = BECH32_ENCODING;
+	}
+	else if ( chk == BECH32M_CONSTANT )
+	{
+		ret = BECH32M_ENCODING;
+	}
+	if ( ret != BECH32_INVALID )
+	{
+		valueCount = dataLen-6;
+		memcpy(values,&symbols[count-dataLen],valueCount);
+	}
+	return ret;
+}
+
+bool encodeSegwitAddress(const char *hrp,uint32_t witnessVersion,const uint8_t *program,uint32_t programLength,char *output,uint32_t maxOutputLen)
+{
+	if ( witnessVersion > 16 || programLength < 2 || programLength > WITNESS_PROGRAM_MAX )
+	{
+		return false;
+	}
+	if ( witnessVersion == 0 && programLength != 20 && programLength != 32 )
+	{
+		return false;
+	}
+	uint8_t values[1+(WITNESS_PROGRAM_MAX*8+4)/5];
+	uint32_t valueCount = 0;
+	values[0] = (uint8_t)witnessVersion;
+	if ( !convertBits(program,programLength,8,5,true,&values[1],sizeof(values)-1,valueCount) )
+	{
+		return false;
+	}
+	return encodeBech32(hrp,values,valueCount+1,witnessVersion == 0 ? BECH32_ENCODING : BECH32M_ENCODING,output,maxOutputLen);
+}
+
+bool decodeSegwitAddress(const char *hrp,const char *address,uint32_t &witnessVersion,uint8_t program[WITNESS_PROGRAM_MAX],uint32_t &programLength)
+{
+	char decodedHrp[BECH32_MAX_LENGTH];
+	uint8_t values[BECH32_MAX_LENGTH];
+	uint32_t valueCount;
+	programLength = 0;
+	Bech32Encoding encoding = decodeBech32(address,decodedHrp,sizeof(decodedHrp),values,sizeof(values),valueCount);
+	if ( encoding == BECH32_INVALID || valueCount == 0 || strcmp(decodedHrp,hrp) != 0 )
+	{
+		return false;
+	}
+	witnessVersion = values[0];
+	if ( witnessVersion > 16 )
+	{
+		return false;
+	}
+	// Version 0 must use the original checksum and every later version must use Bech32m
+	if ( encoding != (witnessVersion == 0 ? BECH32_ENCODING : BECH32M_ENCODING) )
+	{
+		return false;
+	}
+	if ( !convertBits(&values[1],valueCount-1,5,8,false,program,WITNESS_PROGRAM_MAX,programLength) )
+	{
+		programLength = 0;
+		return false;
+	}
+	if ( programLength < 2 || (witnessVersion == 0 && programLength != 20 && programLength != 32) )
+	{
+		programLength = 0;
+		return false;
+	}
+	return true;
+}
+
+uint32_t encodeSegwitAddressBatch(const char *hrp,uint32_t witnessVersion,const uint8_t *programs,uint32_t programLength,uint32_t count,char *output,uint32_t stride)
+{
+	uint32_t ret = 0;
+	for (uint32_t i=0; i<count; i++)
+	{
+		char *dest = &output[i*stride];
+		if ( encodeSegwitAddress(hrp,witnessVersion,&programs[i*programLength],programLength,dest,stride) )
+		{
+			ret++;
+		}
+		else
+		{
+			dest[0] = 0;
+		}
+	}
+	return ret;
+}
+
+uint32_t decodeSegwitAddressBatch(const char *hrp,const char * const *addresses,uint32_t count,uint32_t witnessVersion,uint8_t *programs,uint32_t programLength)
+{
+	uint32_t ret = 0;
+	for (uint32_t i=0; i<count; i++)
+	{
+		uint8_t *dest = &programs[i*programLength];
+		uint8_t program[WITNESS_PROGRAM_MAX];
+		uint32_t version;
+		uint32_t length;
+		if ( decodeSegwitAddress(hrp,addresses[i],version,program,length) && version == witnessVersion && length == programLength )
+		{
+			memcpy(dest,program,programLength);
+			ret++;
+		}
+		else
+		{
+			memset(dest,0,programLength);
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,79 @@
+#ifndef BECH32_H
+
+#define BECH32_H
+
+#include <stdint.h>
+
+// This code snippet encodes and decodes Bech32 and Bech32m strings, and the native segregated witness
+// addresses (the 'bc1...' addresses) built on top of them.
+//
+// https://github.com/bitcoin/bips/blob/master/bip-0173.mediawiki  (Bech32, witness version 0)
+// https://github.com/bitcoin/bips/blob/master/bip-0350.mediawiki  (Bech32m, witness version 1 and above)
+//
+// Like the Base58 snippet, it performs no memory allocations; all output goes into caller supplied buffers.
+// The checksum is computed with a lookup table which consumes two 5 bit symbols per step, so rendering
+// large numbers of addresses for a report does not become a bottleneck.
+
+enum Bech32Encoding
+{
+	BECH32_INVALID,		// The string failed to decode
+	BECH32_ENCODING,	// The original Bech32 checksum (BIP-173); used for witness version 0
+	BECH32M_ENCODING	// The modified Bech32m checksum (BIP-350); used for witness version 1 and above
+};
+
+#define BECH32_MAX_LENGTH 90		// The longest string allowed by the specification
+#define WITNESS_PROGRAM_MAX 40		// The longest witness program allowed
+
+// Encodes the human readable part and an array of 5 bit values into a Bech32 or Bech32m string.
+bool encodeBech32(const char *hrp,					// The human readable part; 'bc' for main network addresses
+				  const uint8_t *values,			// The data as 5 bit values (0-31)
+				  uint32_t valueCount,				// The number of 5 bit values
+				  Bech32Encoding encoding,			// Which checksum to use
+				  char *output,						// The output string
+				  uint32_t maxOutputLen);			// The size of the output buffer, including the zero terminator
+
+// Decodes a Bech32 or Bech32m string.  Returns which checksum matched or BECH32_INVALID if the string is not valid.
+Bech32Encoding decodeBech32(const char *input,		// The string to decode
+							char *hrp,				// The human readable part is returned here (lower case)
+							uint32_t maxHrpLen,		// The size of the hrp buffer, including the zero terminator
+							uint8_t *values,		// The 5 bit data values (checksum excluded) are returned here
+							uint32_t maxValues,		// The size of the values buffer
+							uint32_t &valueCount);	// The number of values decoded
+
+// Encodes a witness program as a segwit address; version 0 uses Bech32 and all later versions use Bech32m.
+bool encodeSegwitAddress(const char *hrp,			// The human readable part; 'bc' for main network addresses
+						 uint32_t witnessVersion,	// The witness version (0-16)
+						 const uint8_t *program,	// The witness program; 20 bytes for P2WPKH, 32 bytes for P2WSH and P2TR
+						 uint32_t programLength,	// The length of the witness program (2-40 bytes)
+						 char *output,				// The output string
+						 uint32_t maxOutputLen);	// The size of the output buffer, including the zero terminator
+
+// Decodes a segwit address and verifies that it uses the checksum required by its witness version.
+bool decodeSegwitAddress(const char *hrp,			// The expected human readable part
+						 const char *address,		// The address to decode
+						 uint32_t &witnessVersion,	// The decoded witness version
+						 uint8_t program[WITNESS_PROGRAM_MAX], // The decoded witness program
+						 uint32_t &programLength);	// The length of the decoded witness program
+
+// Encodes 'count' witness programs of the same version and length (stored consecutively) into segwit addresses.
+// Each string is written to its own 'stride' byte slot in 'output'; an entry which cannot be encoded is left as an
+// empty string.  Returns the number of addresses encoded.
+uint32_t encodeSegwitAddressBatch(const char *hrp,
+								  uint32_t witnessVersion,
+								  const uint8_t *programs,
+								  uint32_t programLength,
+								  uint32_t count,
+								  char *output,
+								  uint32_t stride);
+
+// Decodes 'count' segwit addresses which must all be of the given witness version and program length.
+// The programs are stored consecutively in 'programs'; entries which fail to decode are zero filled.
+// Returns the number of addresses decoded.
+uint32_t decodeSegwitAddressBatch(const char *hrp,
+								  const char * const *addresses,
+								  uint32_t count,
+								  uint32_t witnessVersion,
+								  uint8_t *programs,
+								  uint32_t programLength);
+
+#endif
@@ -59,6 +59,10 @@ bool bitcoinAsciiToAddress(const char *input,uint8_t output[25]); // convert an
 // Converts a 25 byte bitcoin address into the ASCII versions
 bool bitcoinAddressToAscii(const uint8_t address[25],char *output,uint32_t maxOutputLen);
 
+// Converts 'count' 25 byte bitcoin addresses (stored consecutively) into ASCII.  Each string is written to its own 'stride' byte
+// slot in 'output'; 36 bytes is always enough.  Returns the number of addresses converted.
+uint32_t bitcoinAddressesToAscii(const uint8_t *addresses,uint32_t count,char *output,uint32_t stride);
+
 // Converts a full 65 byte ECDSA public key into an ASCII representation
 bool bitcoinPublicKeyToAscii(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
 						  char *output,				// The output ascii representation.
@@ -68,6 +72,16 @@ bool bitcoinPublicKeyToAscii(const uint8_t input[65], // The 65 bytes long ECDSA
 bool bitcoinPublicKeyToAddress(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
 							   uint8_t output[25]);		// A bitcoin address (in binary( is always 25 bytes long.
 
+// Converts a full 65 byte ECDSA public key directly into its 20 byte hash160 (RIPEMD160 of the SHA256 of the key).
+// This skips the header byte and the two extra SHA256 passes needed for the checksum, so use it when only the hash is wanted.
+bool bitcoinPublicKeyToHash160(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
+							   uint8_t hash160[20]);	// The 20 byte RIPEMD160 hash of the SHA256 hash of the key
+
+// Converts 'count' public keys into their hash160 values at once; 20 bytes per key are written consecutively to 'hash160s'.
+// The keys go through the batch routines of SHA256.cpp and RIPEMD160.cpp, so those have to be linked in as well.
+// Every key must be a valid 65 byte public key (first byte 0x4); the caller is expected to have checked this.
+void bitcoinPublicKeysToHash160(const uint8_t * const *keys,uint32_t count,uint8_t *hash160s);
+
 // If someone gives you a bitcoin address as the already encoded 20 byte RIPEMD, then this will produce the 25 byte 'address' which has the padding and checksum added to it.
 // This puts the one byte header and the 4 byte checksum to conver a 20 byte RIPEMD public key into the padded 25 byte address version
 void bitcoinRIPEMD160ToAddress(const uint8_t ripeMD160[20],uint8_t address[25]);
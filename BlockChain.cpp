@@ -1,4 +1,5 @@
 #include "BlockChain.h"
+#include "Bech32.h"
 
 //
 // Written by John W. Ratcliff : mailto: jratcliffscarab@gmail.com
@@ -28,31 +29,32 @@
 #include <string.h>
 #include <time.h>
 
-// Note, to minimize dynamic memory allocation this parser pre-allocates memory for the maximum ever expected number
-// of bitcoin addresses, transactions, inputs, outputs, and blocks.
-// The numbers here are large enough to read the entire blockchain as of January 1, 2014 with a fair amoutn of room to grow.
-// However, they will need to be increased over time as the blockchain grows.
-// Dynamic memory allocation isn't free, every time you dynamically allocate memory there is a significant overhead; so by pre-allocating
-// all of the memory needed into one continguous block you actually save an enormous amount of memory overall and also make the code run
+// Note, to minimize dynamic memory allocation this parser keeps all of the transactions, inputs, outputs, and blocks in
+// single contiguous arrays rather than allocating them one at a time.
+// The numbers here are not allocated up front; they are how much address space each array reserves, which is
+// committed a chunk at a time as the array fills (see VirtualArena).  They only have to stay below 4 billion so
+// every record can be named by a 32 bit index.
+// Dynamic memory allocation isn't free, every time you dynamically allocate memory there is a significant overhead; so by keeping
+// each kind of record in one continguous block you actually save an enormous amount of memory overall and also make the code run
 // orders of magnitude faster.
 
 #define SMALL_MEMORY_PROFILE 0 // a debug option so I can run/test the code on a small memory configuration machine  If this is
 
 #if SMALL_MEMORY_PROFILE
 
-#define MAX_BITCOIN_ADDRESSES 4000000 // 4 million unique addresses.
 #define MAX_TOTAL_TRANSACTIONS 500000 // 500,000
 #define MAX_TOTAL_INPUTS  1000000 //  one million
 #define MAX_TOTAL_OUTPUTS 1000000 // one million
 #define MAX_TOTAL_BLOCKS 150000		// 150,000 blocks
+#define MAX_PUBLIC_KEY_CACHE_SETS 4096	// 16,384 cached public keys
 
 #else
 
-#define MAX_BITCOIN_ADDRESSES 40000000 // 40 million unique addresses.
-#define MAX_TOTAL_TRANSACTIONS 40000000 // 40 million transactions.
-#define MAX_TOTAL_INPUTS 100000000 // 150 million inputs.
-#define MAX_TOTAL_OUTPUTS 100000000 // 150 million outputs
-#define MAX_TOTAL_BLOCKS 500000		// 1/2 million blocks.
+#define MAX_TOTAL_TRANSACTIONS 2000000000 // 2 billion transactions.
+#define MAX_TOTAL_INPUTS 4000000000u // 4 billion inputs.
+#define MAX_TOTAL_OUTPUTS 4000000000u // 4 billion outputs
+#define MAX_TOTAL_BLOCKS 4000000		// 4 million blocks.
+#define MAX_PUBLIC_KEY_CACHE_SETS 65536	// 262,144 cached public keys (18mb)
 
 #endif
 
@@ -81,6 +83,15 @@ public:
 		mWord3 = h.mWord3;
 	}
 
+	inline Hash256& operator=(const Hash256 &h)
+	{
+		mWord0 = h.mWord0;
+		mWord1 = h.mWord1;
+		mWord2 = h.mWord2;
+		mWord3 = h.mWord3;
+		return *this;
+	}
+
 	inline Hash256(const uint8_t *src)
 	{
 		mWord0 = *(const uint64_t *)(src);
@@ -109,6 +120,187 @@ public:
 
 
 
+// The work behind a block or a chain of blocks: the expected number of hashes it took to find them, a 256 bit number
+// held as eight 32 bit words, least significant first.  A block whose target is T took 2^256 / (T+1) hashes on
+// average; the best chain is the one with the most work, which is not necessarily the one with the most blocks.
+class ChainWork
+{
+public:
+	ChainWork(void)
+	{
+		clear();
+	}
+
+	inline void clear(void)
+	{
+		memset(mWords,0,sizeof(mWords));
+	}
+
+	// The work of a single block with this compact target; zero if the target is negative, zero or overflows
+	void setBlockWork(uint32_t bits)
+	{
+		clear();
+		uint32_t size = bits>>24;
+		uint32_t word = bits & 0x007FFFFF;
+		if ( word == 0 || (bits & 0x00800000) || size > 34 || (word > 0xFF && size > 33) || (word > 0xFFFF && size > 32) )
+		{
+			return;
+		}
+		ChainWork target;
+		if ( size <= 3 )
+		{
+			target.mWords[0] = word>>(8*(3-size));
+		}
+		else
+		{
+			target.mWords[0] = word;
+			target.shiftLeft(8*(size-3));
+		}
+		// 2^256 / (T+1) does not fit in 256 bits, but it is the same as ~T / (T+1) + 1
+		ChainWork numerator;
+		for (uint32_t i=0; i<8; i++)
+		{
+			numerator.mWords[i] = ~target.mWords[i];
+		}
+		ChainWork one;
+		one.mWords[0] = 1;
+		target.add(one);
+		divide(numerator,target);
+		add(one);
+	}
+
+	void add(const ChainWork &w)
+	{
+		uint64_t carry = 0;
+		for (uint32_t i=0; i<8; i++)
+		{
+			uint64_t v = carry+mWords[i]+w.mWords[i];
+			mWords[i] = (uint32_t)v;
+			carry = v>>32;
+		}
+	}
+
+	int compare(const ChainWork &w) const
+	{
+		for (uint32_t i=8; i>0; i--)
+		{
+			if ( mWords[i-1] != w.mWords[i-1] )
+			{
+				return mWords[i-1] < w.mWords[i-1] ? -1 : 1;
+			}
+		}
+		return 0;
+	}
+
+	// As 64 hex digits, the way the reference client shows 'chainwork'
+	const char *getHex(char scratch[65]) const
+	{
+		for (uint32_t i=0; i<8; i++)
+		{
+			sprintf(&scratch[i*8],"%08x", mWords[7-i] );
+		}
+		return scratch;
+	}
+
+private:
+	// Sets this to n / d by shift and subtract long division; d is not zero
+	void divide(ChainWork n,ChainWork d)
+	{
+		clear();
+		uint32_t nBits = n.getBits();
+		uint32_t dBits = d.getBits();
+		if ( dBits > nBits )
+		{
+			return;
+		}
+		uint32_t shift = nBits-dBits;
+		d.shiftLeft(shift);
+		for (;;)
+		{
+			if ( n.compare(d) >= 0 )
+			{
+				n.subtract(d);
+				mWords[shift/32] |= 1u<<(shift&31);
+			}
+			if ( shift == 0 )
+			{
+				break;
+			}
+			d.shiftRightOne();
+			shift--;
+		}
+	}
+
+	void subtract(const ChainWork &w)
+	{
+		uint64_t borrow = 0;
+		for (uint32_t i=0; i<8; i++)
+		{
+			uint64_t v = (uint64_t)mWords[i]-w.mWords[i]-borrow;
+			mWords[i] = (uint32_t)v;
+			borrow = (v>>32) & 1;
+		}
+	}
+
+	void shiftLeft(uint32_t shift)
+	{
+		uint32_t words = shift/32;
+		uint32_t bits = shift%32;
+		for (uint32_t i=8; i>0; i--)
+		{
+			uint32_t j = i-1;
+			uint32_t v = 0;
+			if ( j >= words )
+			{
+				v = mWords[j-words]<<bits;
+				if ( bits && j > words )
+				{
+					v |= mWords[j-words-1]>>(32-bits);
+				}
+			}
+			mWords[j] = v;
+		}
+	}
+
+	void shiftRightOne(void)
+	{
+		for (uint32_t i=0; i<7; i++)
+		{
+			mWords[i] = (mWords[i]>>1) | (mWords[i+1]<<31);
+		}
+		mWords[7]>>=1;
+	}
+
+	// The number of significant bits
+	uint32_t getBits(void) const
+	{
+		for (uint32_t i=8; i>0; i--)
+		{
+			uint32_t w = mWords[i-1];
+			if ( w )
+			{
+				uint32_t bits = 32;
+				while ( !(w & 0x80000000) )
+				{
+					w<<=1;
+					bits--;
+				}
+				return (i-1)*32+bits;
+			}
+		}
+		return 0;
+	}
+
+	uint32_t	mWords[8];
+};
+
+// A header's height before it has been linked to the chain, and once it is known not to reach the genesis block yet
+#define HEADER_UNLINKED 0xFFFFFFFF
+#define HEADER_ORPHAN 0xFFFFFFFE
+#define HEADER_NO_PARENT 0xFFFFFFFF	// The parent link of the genesis block, or of a header whose parent has not been seen
+
+// A block header as scanned.  Every header read goes in the block header map; those on the best chain are also
+// copied, in height order, into one contiguous array.
 class BlockHeader : public Hash256
 {
 public:
@@ -117,17 +309,38 @@ public:
 		mFileIndex = 0;
 		mFileOffset = 0;
 		mBlockLength = 0;
+		mTimeStamp = 0;
+		mVersion = 0;
+		mBits = 0;
+		mNonce = 0;
+		mHeight = HEADER_UNLINKED;
+		mParent = HEADER_NO_PARENT;
+		memset(mPreviousBlockHash,0,sizeof(mPreviousBlockHash));
 	}
 	BlockHeader(const Hash256 &h) : Hash256(h)
 	{
 		mFileIndex = 0;
 		mFileOffset = 0;
 		mBlockLength = 0;
+		mTimeStamp = 0;
+		mVersion = 0;
+		mBits = 0;
+		mNonce = 0;
+		mHeight = HEADER_UNLINKED;
+		mParent = HEADER_NO_PARENT;
+		memset(mPreviousBlockHash,0,sizeof(mPreviousBlockHash));
 	}
 	uint32_t	mFileIndex;
 	uint32_t	mFileOffset;
 	uint32_t	mBlockLength;
+	uint32_t	mTimeStamp;
+	uint32_t	mVersion;
+	uint32_t	mBits;					// The compact difficulty target
+	uint32_t	mNonce;
+	uint32_t	mHeight;				// HEADER_UNLINKED or HEADER_ORPHAN until it is linked
+	uint32_t	mParent;				// The block header map index of the previous block
 	uint8_t		mPreviousBlockHash[32];
+	ChainWork	mChainWork;				// The work of the chain up to and including this block
 };
 
 struct BlockPrefix
@@ -198,37 +411,98 @@ static const char * formatNumber(int32_t number) // JWR  format this integer int
 
 
 
-template < class Key,
-	uint32_t hashTableSize = 512,		// *MUST* be a power of 2!
-	uint32_t hashTableEntries = 2048 >
+// SimpleHash is an open addressing hash table in the style of Google's 'Swiss table'.
+// The keys themselves are stored densely, in insertion order, so that getIndex/getKey can translate between
+// a key and a small integer.  The table proper is two parallel arrays: one control
+// byte per slot (either SLOT_EMPTY or the top 7 bits of the key's hash) and a 32 bit index into mEntries.
+// Slots are grouped into runs of HASH_GROUP_SIZE control bytes which are compared against the 7 bit hash
+// all at once (with SSE2 where available) so a lookup usually touches a single group and only
+// dereferences an entry when its 7 bit hash already matches.  Nothing is ever removed, so there are no tombstones.
 
-class SimpleHash
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_GROUP_SSE2 1
+#include <emmintrin.h>
+#else
+#define HASH_GROUP_SSE2 0
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>	// _BitScanForward, _umul128
+#endif
+
+#define HASH_GROUP_SIZE 16
+#define SLOT_EMPTY 0x80
+
+// Returns a bit mask of which of the HASH_GROUP_SIZE control bytes equal 'value'
+static inline uint32_t matchGroup(const uint8_t *control,uint8_t value)
 {
-public:
-	class HashEntry
+#if HASH_GROUP_SSE2
+	__m128i group = _mm_load_si128((const __m128i *)control);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group,_mm_set1_epi8((char)value)));
+#else
+	uint32_t ret = 0;
+	for (uint32_t i=0; i<HASH_GROUP_SIZE; i++)
 	{
-	public:
-		HashEntry(void)
+		if ( control[i] == value )
 		{
-			mNext = NULL;
+			ret|=(1<<i);
 		}
-		Key			mKey;
-		HashEntry*	mNext;
-	};
+	}
+	return ret;
+#endif
+}
+
+static inline uint32_t lowestBit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index,mask);
+	return (uint32_t)index;
+#else
+	return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+
+// Scrambles the key's own 32 bit hash so both the group index (low bits) and the 7 bit control hash (top bits) are well distributed
+static inline uint32_t mixHash(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
 
+#define HASH_NOT_FOUND 0xFFFFFFFF
+#define HASH_CHUNK_SHIFT 16								// Entries are allocated in chunks of 65,536
+#define HASH_CHUNK_SIZE (1<<HASH_CHUNK_SHIFT)
+#define HASH_INITIAL_GROUPS 64							// 1,024 slots to start with
+#define HASH_MIGRATE_GROUPS 4							// How many groups of the old table are moved to the new one on each insert
+
+// The table grows without limit.  Keys are stored in fixed size chunks which never move, so pointers returned by
+// find/insert stay valid forever.  When the table passes 7/8ths full a table twice the size is allocated and the
+// slots of the old table are migrated a few groups at a time on each subsequent insert; lookups check both tables
+// until the migration is complete.  This keeps the cost of any single insert small rather than stalling for a
+// full rehash of tens of millions of entries.
+template < class Key >
+
+class SimpleHash
+{
+public:
 	class Iterator
 	{
 		friend class SimpleHash;
 	public:
 		Iterator(void)
 		{
-			mHashIndex = 0;
+			mIndex = 0;
 			mEntry = NULL;
 		}
 
 		Key * first(void) const
 		{
-			return mEntry ? &mEntry->mKey : NULL;
+			return mEntry;
 		}
 
 		bool empty(void) const
@@ -237,21 +511,16 @@ public:
 		}
 
 	private:
-		uint32_t	mHashIndex;
-		HashEntry	*mEntry;
+		uint32_t	mIndex;
+		Key			*mEntry;
 	};
 
 	inline Iterator begin(void) const
 	{
 		Iterator ret;
-		for (uint32_t i=0; i<hashTableSize; i++)
+		if ( mHashTableCount )
 		{
-			if ( mHashTable[i] )
-			{
-				ret.mHashIndex = i;
-				ret.mEntry = mHashTable[i];
-				break;
-			}
+			ret.mEntry = getEntry(0);
 		}
 		return ret;
 	}
@@ -259,26 +528,13 @@ public:
 	inline bool next(Iterator &iter) const
 	{
 		bool ret = false;
-
-		if ( iter.mEntry && iter.mEntry->mNext )
+		iter.mEntry = NULL;
+		if ( (iter.mIndex+1) < mHashTableCount )
 		{
-			iter.mEntry = iter.mEntry->mNext;
+			iter.mIndex++;
+			iter.mEntry = getEntry(iter.mIndex);
 			ret = true;
 		}
-		else
-		{
-			iter.mEntry = NULL;
-			for (uint32_t i=iter.mHashIndex+1; i<hashTableSize; i++)
-			{
-				if ( mHashTable[i] )
-				{
-					iter.mHashIndex = i;
-					iter.mEntry = mHashTable[i];
-					ret = true;
-					break;
-				}
-			}
-		}
 		return ret;
 	}
 
@@ -289,32 +545,62 @@ public:
 
 	SimpleHash(void)
 	{
-		mEntries = NULL;
 		mHashTableCount = 0;
-		for (uint32_t i = 0; i < hashTableSize; i++)
-		{
-			mHashTable[i] = NULL;
-		}
+		mChunks = NULL;
+		mChunkCount = 0;
+		mChunkCapacity = 0;
+		mMigrateGroup = 0;
+		mResizeCount = 0;
+		mFindCount = 0;
+		mProbeCount = 0;
+		mMaxProbe = 0;
 	}
 
 	inline void init(void)
 	{
-		if ( mEntries == NULL )
+		if ( mTable.mControl == NULL )
 		{
-			mEntries = new HashEntry[hashTableEntries];
+			mTable.alloc(HASH_INITIAL_GROUPS);
 		}
 	}
 
 	~SimpleHash(void)
 	{
-		delete []mEntries;
+		for (uint32_t i=0; i<mChunkCount; i++)
+		{
+			delete []mChunks[i];
+		}
+		delete []mChunks;
+		mTable.release();
+		mOldTable.release();
 	}
 
+	// Entries live in chunks rather than one array, so the index is found by looking the key up again;
+	// the slot that refers to this exact entry holds its index.
 	inline uint32_t getIndex(const Key *k) const
 	{
 		assert(k);
-		HashEntry *h = (HashEntry *)k;
-		return (uint32_t)(h-mEntries);
+		uint32_t hash = mixHash(k->getHash());
+		uint32_t index = findIndex(mTable,*k,hash);
+		if ( (index == HASH_NOT_FOUND || getEntry(index) != k) && mOldTable.mControl )
+		{
+			index = findIndex(mOldTable,*k,hash);
+		}
+		if ( index == HASH_NOT_FOUND || getEntry(index) != k )
+		{
+			// An entry superseded by a later insert of the same key is no longer in the table; search the chunks for it.
+			index = HASH_NOT_FOUND;
+			for (uint32_t i=0; i<mChunkCount; i++)
+			{
+				if ( k >= mChunks[i] && k < &mChunks[i][HASH_CHUNK_SIZE] )
+				{
+					index = (i<<HASH_CHUNK_SHIFT) + (uint32_t)(k-mChunks[i]);
+					break;
+				}
+			}
+			assert( index != HASH_NOT_FOUND );
+		}
+		return index;
 	}
 
 	inline Key * getKey(uint32_t i) const
@@ -323,54 +609,68 @@ public:
 		assert( i < mHashTableCount );
 		if ( i < mHashTableCount )
 		{
-			ret = &mEntries[i].mKey;
+			ret = getEntry(i);
 		}
 		return ret;
 	}
 
 	inline Key* find(const Key& key)  const
+	{
+		uint32_t index;
+		return find(key,index);
+	}
+
+	// Same as above but also returns the index of the entry found
+	inline Key* find(const Key& key,uint32_t &index)  const
 	{
 		Key* ret = NULL;
-		uint32_t hash = getHash(key);
-		HashEntry* h = mHashTable[hash];
-		while (h)
+		uint32_t hash = mixHash(key.getHash());
+		index = findIndex(mTable,key,hash);
+		if ( index == HASH_NOT_FOUND && mOldTable.mControl )
 		{
-			if (h->mKey == key)
-			{
-				ret = &h->mKey;
-				break;
-			}
-			h = h->mNext;
+			index = findIndex(mOldTable,key,hash);
+		}
+		if ( index != HASH_NOT_FOUND )
+		{
+			ret = getEntry(index);
 		}
 		return ret;
 	}
 
 	// Inserts are not thread safe; use a mutex
+	// The key is always added as a new entry.  If an equal key was already present its slot is pointed at the
+	// new entry, so (just like the old chained version of this table) 'find' returns the most recent insert.
 	inline Key * insert(const Key& key)
 	{
-		Key *ret = NULL;
-		init(); // allocate the entries table
-		if (mHashTableCount < hashTableEntries)
+		init();
+		uint32_t index = mHashTableCount;
+		if ( (index>>HASH_CHUNK_SHIFT) == mChunkCount )
 		{
-			HashEntry* h = &mEntries[mHashTableCount];
-			h->mKey = key;
-			ret = &h->mKey;
-			mHashTableCount++;
-			uint32_t hash = getHash(key);
-			if (mHashTable[hash])
-			{
-				HashEntry* next = mHashTable[hash];
-				mHashTable[hash] = h;
-				h->mNext = next;
-			}
-			else
-			{
-				mHashTable[hash] = h;
-			}
+			addChunk();
+		}
+		Key *ret = getEntry(index);
+		*ret = key;
+		mHashTableCount++;
+
+		uint32_t hash = mixHash(key.getHash());
+		// Migrated groups are not cleared from the old table, so an equal key can be in both tables; find looks in
+		// the current table first, so it has to be repointed there as well as in the old one
+		if ( mOldTable.mControl && mOldTable.replace(key,hash,index,*this) )
+		{
+			mTable.replace(key,hash,index,*this);
 		}
 		else
 		{
-			assert(0); // we should never run out of hash entries
+			mTable.insert(key,hash,index,true,*this);
+		}
+
+		if ( mOldTable.mControl )
+		{
+			migrate(HASH_MIGRATE_GROUPS);
+		}
+		if ( (uint64_t)mTable.mUsed*8 >= (uint64_t)mTable.getSlotCount()*7 )
+		{
+			grow();
 		}
 		return ret;
 	}
@@ -379,1517 +679,4891 @@ public:
 	{
 		return mHashTableCount;
 	}
-private:
 
-	inline uint32_t getHash(const Key& key) const
+	void report(const char *name) const
 	{
-		return key.getHash() & (hashTableSize - 1);
+		uint32_t slots = mTable.getSlotCount() + mOldTable.getSlotCount();
+		printf("%s hash table: %s entries in %s slots; load factor %0.2f, %0.2f groups probed per lookup (longest %d), resized %d times.\r\n",
+			name,
+			formatNumber(mHashTableCount),
+			formatNumber(slots),
+			slots ? (float)(mTable.mUsed+mOldTable.mUsed)/(float)slots : 0.0f,
+			mFindCount ? (double)mProbeCount/(double)mFindCount : 0.0,
+			mMaxProbe,
+			mResizeCount);
 	}
 
+private:
+	// One generation of the open addressing table
+	class Table
+	{
+	public:
+		Table(void)
+		{
+			mControl = NULL;
+			mControlMemory = NULL;
+			mSlots = NULL;
+			mGroupMask = 0;
+			mUsed = 0;
+		}
+
+		void alloc(uint32_t groupCount)
+		{
+			mGroupMask = groupCount-1;
+			mUsed = 0;
+			mControlMemory = new uint8_t[groupCount*HASH_GROUP_SIZE+HASH_GROUP_SIZE];
+			mControl = (uint8_t *)(((size_t)mControlMemory+HASH_GROUP_SIZE-1) & ~(size_t)(HASH_GROUP_SIZE-1)); // groups must be 16 byte aligned
+			memset(mControl,SLOT_EMPTY,groupCount*HASH_GROUP_SIZE);
+			mSlots = new uint32_t[groupCount*HASH_GROUP_SIZE];
+		}
 
-	HashEntry*		mHashTable[hashTableSize];
-	unsigned int	mHashTableCount;
-	HashEntry		*mEntries;
+		void release(void)
+		{
+			delete []mControlMemory;
+			delete []mSlots;
+			mControl = NULL;
+			mControlMemory = NULL;
+			mSlots = NULL;
+			mGroupMask = 0;
+			mUsed = 0;
+		}
 
-};
+		inline uint32_t getGroupCount(void) const
+		{
+			return mControl ? mGroupMask+1 : 0;
+		}
 
+		inline uint32_t getSlotCount(void) const
+		{
+			return getGroupCount()*HASH_GROUP_SIZE;
+		}
 
-class FileLocation : public Hash256
-{
-public:
-	FileLocation(void)
-	{
+		// If the key is present, points its slot at 'index' and returns true
+		inline bool replace(const Key &key,uint32_t hash,uint32_t index,const SimpleHash &owner)
+		{
+			uint8_t tag = (uint8_t)(hash >> 25);
+			uint32_t group = hash & mGroupMask;
+			for (uint32_t step=1; ; step++)
+			{
+				const uint8_t *control = &mControl[group*HASH_GROUP_SIZE];
+				uint32_t match = matchGroup(control,tag);
+				while ( match )
+				{
+					uint32_t slot = group*HASH_GROUP_SIZE + lowestBit(match);
+					if ( *owner.getEntry(mSlots[slot]) == key )
+					{
+						mSlots[slot] = index;
+						return true;
+					}
+					match&=match-1;
+				}
+				if ( matchGroup(control,SLOT_EMPTY) )
+				{
+					break;
+				}
+				group = (group+step) & mGroupMask;
+			}
+			return false;
+		}
+
+		// Adds a slot for the key.  If the key is already present its slot is pointed at 'index' when 'replaceExisting' is true, or left alone otherwise.
+		inline void insert(const Key &key,uint32_t hash,uint32_t index,bool replaceExisting,const SimpleHash &owner)
+		{
+			uint8_t tag = (uint8_t)(hash >> 25);
+			uint32_t group = hash & mGroupMask;
+			for (uint32_t step=1; ; step++)
+			{
+				uint8_t *control = &mControl[group*HASH_GROUP_SIZE];
+				uint32_t match = matchGroup(control,tag);
+				while ( match )
+				{
+					uint32_t slot = group*HASH_GROUP_SIZE + lowestBit(match);
+					if ( *owner.getEntry(mSlots[slot]) == key )
+					{
+						if ( replaceExisting )
+						{
+							mSlots[slot] = index;
+						}
+						return;
+					}
+					match&=match-1;
+				}
+				uint32_t empty = matchGroup(control,SLOT_EMPTY);
+				if ( empty )
+				{
+					uint32_t slot = group*HASH_GROUP_SIZE + lowestBit(empty);
+					mControl[slot] = tag;
+					mSlots[slot] = index;
+					mUsed++;
+					break;
+				}
+				group = (group+step) & mGroupMask;
+			}
+		}
+
+		uint8_t			*mControl;			// One control byte per slot; SLOT_EMPTY or the top 7 bits of the hash
+		uint8_t			*mControlMemory;	// The unaligned allocation mControl points into
+		uint32_t		*mSlots;			// The index of the entry for each occupied slot
+		uint32_t		mGroupMask;			// The number of groups minus one
+		uint32_t		mUsed;				// The number of occupied slots
+	};
 
+	inline Key *getEntry(uint32_t index) const
+	{
+		return &mChunks[index>>HASH_CHUNK_SHIFT][index&(HASH_CHUNK_SIZE-1)];
 	}
-	FileLocation(const Hash256 &h,uint32_t fileIndex,uint32_t fileOffset,uint32_t fileLength,uint32_t transactionIndex) : Hash256(h)
+
+	inline uint32_t findIndex(const Table &t,const Key &key,uint32_t hash) const
 	{
-		mFileIndex = fileIndex;
-		mFileOffset = fileOffset;
-		mFileLength = fileLength;
-		mTransactionIndex = transactionIndex;
+		uint32_t ret = HASH_NOT_FOUND;
+		if ( t.mControl )
+		{
+			uint8_t tag = (uint8_t)(hash >> 25);
+			uint32_t group = hash & t.mGroupMask;
+			uint32_t step = 1;
+			for (;;)
+			{
+				const uint8_t *control = &t.mControl[group*HASH_GROUP_SIZE];
+				uint32_t match = matchGroup(control,tag);
+				while ( match )
+				{
+					uint32_t slot = group*HASH_GROUP_SIZE + lowestBit(match);
+					if ( *getEntry(t.mSlots[slot]) == key )
+					{
+						ret = t.mSlots[slot];
+						break;
+					}
+					match&=match-1;
+				}
+				if ( ret != HASH_NOT_FOUND || matchGroup(control,SLOT_EMPTY) ) // An empty slot ends the probe sequence
+				{
+					break;
+				}
+				group = (group+step) & t.mGroupMask;
+				step++;
+			}
+			mFindCount++;
+			mProbeCount+=step;
+			if ( step > mMaxProbe )
+			{
+				mMaxProbe = step;
+			}
+		}
+		return ret;
 	}
-	uint32_t	mFileIndex;
-	uint32_t	mFileOffset;
-	uint32_t	mFileLength;
-	uint32_t	mTransactionIndex;
-};
 
-typedef SimpleHash< FileLocation, 4194304, MAX_TOTAL_TRANSACTIONS > TransactionHashMap;
-typedef SimpleHash< BlockHeader, 65536, MAX_TOTAL_BLOCKS > BlockHeaderMap;
+	void addChunk(void)
+	{
+		if ( mChunkCount == mChunkCapacity )
+		{
+			uint32_t capacity = mChunkCapacity ? mChunkCapacity*2 : 64;
+			Key **chunks = new Key*[capacity];
+			if ( mChunkCount )
+			{
+				memcpy(chunks,mChunks,sizeof(Key *)*mChunkCount);
+			}
+			delete []mChunks;
+			mChunks = chunks;
+			mChunkCapacity = capacity;
+		}
+		mChunks[mChunkCount++] = new Key[HASH_CHUNK_SIZE];
+	}
 
-//*********** Begin of Source Code for RIPEMD160 hash *********************************
-namespace BLOCKCHAIN_RIPEMD160
-{
-/********************************************************************/
-/* macro definitions */
+	void grow(void)
+	{
+		if ( mOldTable.mControl ) // still migrating from the last resize; finish that first
+		{
+			migrate(mOldTable.getGroupCount());
+		}
+		mOldTable = mTable;
+		mTable.alloc(mOldTable.getGroupCount()*2);
+		mMigrateGroup = 0;
+		mResizeCount++;
+	}
 
-/* collect four bytes into one word: */
-#define BYTES_TO_DWORD(strptr)                    \
-            (((uint32_t) *((strptr)+3) << 24) | \
-             ((uint32_t) *((strptr)+2) << 16) | \
-             ((uint32_t) *((strptr)+1) <<  8) | \
-             ((uint32_t) *(strptr)))
-
-/* ROL(x, n) cyclically rotates x over n bits to the left */
-/* x must be of an unsigned 32 bits type and 0 <= n < 32. */
-#define ROL(x, n)        (((x) << (n)) | ((x) >> (32-(n))))
+	// Moves the slots of 'groupCount' more groups of the old table into the current one
+	void migrate(uint32_t groupCount)
+	{
+		uint32_t total = mOldTable.getGroupCount();
+		for (uint32_t i=0; i<groupCount && mMigrateGroup<total; i++, mMigrateGroup++)
+		{
+			const uint8_t *control = &mOldTable.mControl[mMigrateGroup*HASH_GROUP_SIZE];
+			for (uint32_t j=0; j<HASH_GROUP_SIZE; j++)
+			{
+				if ( control[j] != SLOT_EMPTY )
+				{
+					uint32_t index = mOldTable.mSlots[mMigrateGroup*HASH_GROUP_SIZE+j];
+					const Key &key = *getEntry(index);
+					// A key inserted since the resize started is already in the new table with a newer index; keep that one
+					mTable.insert(key,mixHash(key.getHash()),index,false,*this);
+				}
+			}
+		}
+		if ( mMigrateGroup == total )
+		{
+			mOldTable.release();
+		}
+	}
 
-/* the five basic functions F(), G() and H() */
-#define F(x, y, z)        ((x) ^ (y) ^ (z)) 
-#define G(x, y, z)        (((x) & (y)) | (~(x) & (z))) 
-#define H(x, y, z)        (((x) | ~(y)) ^ (z))
-#define I(x, y, z)        (((x) & (z)) | ((y) & ~(z))) 
-#define J(x, y, z)        ((x) ^ ((y) | ~(z)))
-  
-/* the ten basic operations FF() through III() */
-#define FF(a, b, c, d, e, x, s)        {\
-      (a) += F((b), (c), (d)) + (x);\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define GG(a, b, c, d, e, x, s)        {\
-      (a) += G((b), (c), (d)) + (x) + 0x5a827999UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define HH(a, b, c, d, e, x, s)        {\
-      (a) += H((b), (c), (d)) + (x) + 0x6ed9eba1UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define II(a, b, c, d, e, x, s)        {\
-      (a) += I((b), (c), (d)) + (x) + 0x8f1bbcdcUL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define JJ(a, b, c, d, e, x, s)        {\
-      (a) += J((b), (c), (d)) + (x) + 0xa953fd4eUL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define FFF(a, b, c, d, e, x, s)        {\
-      (a) += F((b), (c), (d)) + (x);\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define GGG(a, b, c, d, e, x, s)        {\
-      (a) += G((b), (c), (d)) + (x) + 0x7a6d76e9UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define HHH(a, b, c, d, e, x, s)        {\
-      (a) += H((b), (c), (d)) + (x) + 0x6d703ef3UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define III(a, b, c, d, e, x, s)        {\
-      (a) += I((b), (c), (d)) + (x) + 0x5c4dd124UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
-#define JJJ(a, b, c, d, e, x, s)        {\
-      (a) += J((b), (c), (d)) + (x) + 0x50a28be6UL;\
-      (a) = ROL((a), (s)) + (e);\
-      (c) = ROL((c), 10);\
-   }
+	unsigned int		mHashTableCount;
+	Key					**mChunks;			// The keys, stored in insertion order in chunks of HASH_CHUNK_SIZE
+	uint32_t			mChunkCount;
+	uint32_t			mChunkCapacity;
+	Table				mTable;				// The current table
+	Table				mOldTable;			// The previous table while its slots are being migrated after a resize
+	uint32_t			mMigrateGroup;		// The next group of the old table to migrate
+	uint32_t			mResizeCount;
+	mutable uint64_t	mFindCount;			// Probe statistics
+	mutable uint64_t	mProbeCount;
+	mutable uint32_t	mMaxProbe;
+};
 
-/********************************************************************/
 
-/* function prototypes */
+#ifdef _MSC_VER
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>	// sysconf
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
-void MDinit(uint32_t *MDbuf);
-/*
- *  initializes MDbuffer to "magic constants"
- */
+// The biggest tables take their memory straight from the operating system rather than the heap.  The factory's
+// record arrays reserve address space for the most they may ever hold and commit it a chunk at a time as they fill,
+// so they never move and untouched space costs nothing.  The hash tables are allocated a whole table at a time.
+// Either can be backed by huge pages, which cuts the TLB misses of their random access.
+#ifndef _MSC_VER
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
 
-void compress(uint32_t *MDbuf, uint32_t *X);
-/*
- *  the compression function.
- *  transforms MDbuf using message bytes X[0] through X[15]
- */
+#define HUGE_PAGE_SIZE (2<<20)						// The usual huge page size on x86-64; arenas and tables are aligned to it
+#define ARENA_COMMIT_CHUNK (32<<20)					// Arenas are committed this much at a time
+#define ARENA_MIN_RESERVE (64<<20)					// An arena which cannot reserve what it asks for settles for less, down to this
+#define PAGE_TABLE_MIN (1<<20)						// Tables smaller than this come from the heap
 
-void MDfinish(uint32_t *MDbuf,const uint8_t *strptr, uint32_t lswlen, uint32_t mswlen);
-/*
- *  puts bytes from strptr into X and pad out; appends length 
- *  and finally, compresses the last block(s)
- *  note: length in bits == 8 * (lswlen + 2^32 mswlen).
- *  note: there are (lswlen mod 64) bytes left in strptr.
- */
+static BlockChain::HugePageMode gHugePages = BlockChain::HP_OFF;
+static bool gHugePagesFailed = false;			// Set once explicit huge pages could not be had
+static bool gAllocFailed = false;				// Set once a table could not grow; processing stops at the end of the block
 
-/********************************************************************/
+// Asks for transparent huge pages over a range; a hint the system is free to ignore
+static void adviseHugePages(void *p,uint64_t size)
+{
+#if !defined(_MSC_VER) && defined(MADV_HUGEPAGE)
+	if ( gHugePages != BlockChain::HP_OFF )
+	{
+		madvise(p,(size_t)size,MADV_HUGEPAGE);
+	}
+#else
+	(void)p;
+	(void)size;
+#endif
+}
 
-void MDinit(uint32_t *MDbuf)
+static void noteHugePagesFailed(void)
 {
-   MDbuf[0] = 0x67452301UL;
-   MDbuf[1] = 0xefcdab89UL;
-   MDbuf[2] = 0x98badcfeUL;
-   MDbuf[3] = 0x10325476UL;
-   MDbuf[4] = 0xc3d2e1f0UL;
+	if ( !gHugePagesFailed )
+	{
+		gHugePagesFailed = true;
+#ifdef _MSC_VER
+		printf("Large pages are not available (they need the 'Lock pages in memory' privilege); using normal pages.\r\n");
+#else
+		printf("Explicit huge pages are not available (see /proc/sys/vm/nr_hugepages); using transparent huge pages.\r\n");
+#endif
+	}
+}
 
-   return;
+// Zero filled memory for a table of 'size' bytes; freePages has to be given the same size.  Returns NULL, and
+// sets gAllocFailed, if the memory could not be had.
+static void *allocPages(uint64_t size)
+{
+	if ( size < PAGE_TABLE_MIN )
+	{
+		uint8_t *ret = new uint8_t[(size_t)size];
+		memset(ret,0,(size_t)size);
+		return ret;
+	}
+	size = (size+HUGE_PAGE_SIZE-1) & ~(uint64_t)(HUGE_PAGE_SIZE-1);
+	void *ret = NULL;
+#ifdef _MSC_VER
+	if ( gHugePages == BlockChain::HP_EXPLICIT )
+	{
+		SIZE_T large = GetLargePageMinimum();
+		if ( large && (size % large) == 0 )
+		{
+			ret = VirtualAlloc(NULL,(SIZE_T)size,MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES,PAGE_READWRITE);
+		}
+		if ( ret == NULL )
+		{
+			noteHugePagesFailed();
+		}
+	}
+	if ( ret == NULL )
+	{
+		ret = VirtualAlloc(NULL,(SIZE_T)size,MEM_RESERVE|MEM_COMMIT,PAGE_READWRITE);
+	}
+#else
+#ifdef MAP_HUGETLB
+	if ( gHugePages == BlockChain::HP_EXPLICIT )
+	{
+		ret = mmap(NULL,(size_t)size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if ( ret == MAP_FAILED )
+		{
+			ret = NULL;
+			noteHugePagesFailed();
+		}
+	}
+#endif
+	if ( ret == NULL )
+	{
+		ret = mmap(NULL,(size_t)size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if ( ret == MAP_FAILED )
+		{
+			ret = NULL;
+		}
+		else
+		{
+			adviseHugePages(ret,size);
+		}
+	}
+#endif
+	if ( ret == NULL && !gAllocFailed )
+	{
+		gAllocFailed = true;
+		printf("Failed to allocate %s MB for a table.\r\n", formatNumber((uint32_t)(size>>20)) );
+	}
+	return ret;
 }
 
-/********************************************************************/
+static void freePages(void *p,uint64_t size)
+{
+	if ( p == NULL )
+	{
+		return;
+	}
+	if ( size < PAGE_TABLE_MIN )
+	{
+		delete [](uint8_t *)p;
+		return;
+	}
+#ifdef _MSC_VER
+	VirtualFree(p,0,MEM_RELEASE);
+#else
+	size = (size+HUGE_PAGE_SIZE-1) & ~(uint64_t)(HUGE_PAGE_SIZE-1);
+	munmap(p,(size_t)size);
+#endif
+}
 
-void compress(uint32_t *MDbuf, uint32_t *X)
+// A range of address space which is committed from the front as it is used
+class VirtualArena
 {
-   uint32_t aa = MDbuf[0],  bb = MDbuf[1],  cc = MDbuf[2],
-         dd = MDbuf[3],  ee = MDbuf[4];
-   uint32_t aaa = MDbuf[0], bbb = MDbuf[1], ccc = MDbuf[2],
-         ddd = MDbuf[3], eee = MDbuf[4];
+public:
+	VirtualArena(void)
+	{
+		mMapping = NULL;
+		mMappingSize = 0;
+		mBase = NULL;
+		mReserved = 0;
+		mCommitted = 0;
+	}
 
-   /* round 1 */
-   FF(aa, bb, cc, dd, ee, X[ 0], 11);
-   FF(ee, aa, bb, cc, dd, X[ 1], 14);
-   FF(dd, ee, aa, bb, cc, X[ 2], 15);
-   FF(cc, dd, ee, aa, bb, X[ 3], 12);
-   FF(bb, cc, dd, ee, aa, X[ 4],  5);
-   FF(aa, bb, cc, dd, ee, X[ 5],  8);
-   FF(ee, aa, bb, cc, dd, X[ 6],  7);
-   FF(dd, ee, aa, bb, cc, X[ 7],  9);
-   FF(cc, dd, ee, aa, bb, X[ 8], 11);
-   FF(bb, cc, dd, ee, aa, X[ 9], 13);
-   FF(aa, bb, cc, dd, ee, X[10], 14);
-   FF(ee, aa, bb, cc, dd, X[11], 15);
-   FF(dd, ee, aa, bb, cc, X[12],  6);
-   FF(cc, dd, ee, aa, bb, X[13],  7);
-   FF(bb, cc, dd, ee, aa, X[14],  9);
-   FF(aa, bb, cc, dd, ee, X[15],  8);
-                             
-   /* round 2 */
-   GG(ee, aa, bb, cc, dd, X[ 7],  7);
-   GG(dd, ee, aa, bb, cc, X[ 4],  6);
-   GG(cc, dd, ee, aa, bb, X[13],  8);
-   GG(bb, cc, dd, ee, aa, X[ 1], 13);
-   GG(aa, bb, cc, dd, ee, X[10], 11);
-   GG(ee, aa, bb, cc, dd, X[ 6],  9);
-   GG(dd, ee, aa, bb, cc, X[15],  7);
-   GG(cc, dd, ee, aa, bb, X[ 3], 15);
-   GG(bb, cc, dd, ee, aa, X[12],  7);
-   GG(aa, bb, cc, dd, ee, X[ 0], 12);
-   GG(ee, aa, bb, cc, dd, X[ 9], 15);
-   GG(dd, ee, aa, bb, cc, X[ 5],  9);
-   GG(cc, dd, ee, aa, bb, X[ 2], 11);
-   GG(bb, cc, dd, ee, aa, X[14],  7);
-   GG(aa, bb, cc, dd, ee, X[11], 13);
-   GG(ee, aa, bb, cc, dd, X[ 8], 12);
+	~VirtualArena(void)
+	{
+		release();
+	}
 
-   /* round 3 */
-   HH(dd, ee, aa, bb, cc, X[ 3], 11);
-   HH(cc, dd, ee, aa, bb, X[10], 13);
-   HH(bb, cc, dd, ee, aa, X[14],  6);
-   HH(aa, bb, cc, dd, ee, X[ 4],  7);
-   HH(ee, aa, bb, cc, dd, X[ 9], 14);
-   HH(dd, ee, aa, bb, cc, X[15],  9);
-   HH(cc, dd, ee, aa, bb, X[ 8], 13);
-   HH(bb, cc, dd, ee, aa, X[ 1], 15);
-   HH(aa, bb, cc, dd, ee, X[ 2], 14);
-   HH(ee, aa, bb, cc, dd, X[ 7],  8);
-   HH(dd, ee, aa, bb, cc, X[ 0], 13);
-   HH(cc, dd, ee, aa, bb, X[ 6],  6);
-   HH(bb, cc, dd, ee, aa, X[13],  5);
-   HH(aa, bb, cc, dd, ee, X[11], 12);
-   HH(ee, aa, bb, cc, dd, X[ 5],  7);
-   HH(dd, ee, aa, bb, cc, X[12],  5);
+	// Reserves room for up to 'size' bytes, or as much less as the system will give; nothing is committed yet
+	bool reserve(uint64_t size)
+	{
+		release();
+		uint64_t limit = (uint64_t)((size_t)-1)/4; // a 32 bit build cannot map anything like the whole request
+		if ( size > limit )
+		{
+			size = limit;
+		}
+		size = (size+ARENA_COMMIT_CHUNK-1) & ~(uint64_t)(ARENA_COMMIT_CHUNK-1);
+		while ( mMapping == NULL )
+		{
+			uint64_t mappingSize = size+HUGE_PAGE_SIZE; // room to align the start to a huge page
+#ifdef _MSC_VER
+			mMapping = VirtualAlloc(NULL,(SIZE_T)mappingSize,MEM_RESERVE,PAGE_NOACCESS);
+#else
+			mMapping = mmap(NULL,(size_t)mappingSize,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+			if ( mMapping == MAP_FAILED )
+			{
+				mMapping = NULL;
+			}
+#endif
+			if ( mMapping )
+			{
+				mMappingSize = mappingSize;
+				mBase = (uint8_t *)(((uintptr_t)mMapping+HUGE_PAGE_SIZE-1) & ~(uintptr_t)(HUGE_PAGE_SIZE-1));
+				mReserved = size;
+			}
+			else if ( size > ARENA_MIN_RESERVE )
+			{
+				size = (size/2) & ~(uint64_t)(ARENA_COMMIT_CHUNK-1);
+			}
+			else
+			{
+				break;
+			}
+		}
+		return mMapping ? true : false;
+	}
 
-   /* round 4 */
-   II(cc, dd, ee, aa, bb, X[ 1], 11);
-   II(bb, cc, dd, ee, aa, X[ 9], 12);
-   II(aa, bb, cc, dd, ee, X[11], 14);
-   II(ee, aa, bb, cc, dd, X[10], 15);
-   II(dd, ee, aa, bb, cc, X[ 0], 14);
-   II(cc, dd, ee, aa, bb, X[ 8], 15);
-   II(bb, cc, dd, ee, aa, X[12],  9);
-   II(aa, bb, cc, dd, ee, X[ 4],  8);
-   II(ee, aa, bb, cc, dd, X[13],  9);
-   II(dd, ee, aa, bb, cc, X[ 3], 14);
-   II(cc, dd, ee, aa, bb, X[ 7],  5);
-   II(bb, cc, dd, ee, aa, X[15],  6);
-   II(aa, bb, cc, dd, ee, X[14],  8);
-   II(ee, aa, bb, cc, dd, X[ 5],  6);
-   II(dd, ee, aa, bb, cc, X[ 6],  5);
-   II(cc, dd, ee, aa, bb, X[ 2], 12);
-
-   /* round 5 */
-   JJ(bb, cc, dd, ee, aa, X[ 4],  9);
-   JJ(aa, bb, cc, dd, ee, X[ 0], 15);
-   JJ(ee, aa, bb, cc, dd, X[ 5],  5);
-   JJ(dd, ee, aa, bb, cc, X[ 9], 11);
-   JJ(cc, dd, ee, aa, bb, X[ 7],  6);
-   JJ(bb, cc, dd, ee, aa, X[12],  8);
-   JJ(aa, bb, cc, dd, ee, X[ 2], 13);
-   JJ(ee, aa, bb, cc, dd, X[10], 12);
-   JJ(dd, ee, aa, bb, cc, X[14],  5);
-   JJ(cc, dd, ee, aa, bb, X[ 1], 12);
-   JJ(bb, cc, dd, ee, aa, X[ 3], 13);
-   JJ(aa, bb, cc, dd, ee, X[ 8], 14);
-   JJ(ee, aa, bb, cc, dd, X[11], 11);
-   JJ(dd, ee, aa, bb, cc, X[ 6],  8);
-   JJ(cc, dd, ee, aa, bb, X[15],  5);
-   JJ(bb, cc, dd, ee, aa, X[13],  6);
-
-   /* parallel round 1 */
-   JJJ(aaa, bbb, ccc, ddd, eee, X[ 5],  8);
-   JJJ(eee, aaa, bbb, ccc, ddd, X[14],  9);
-   JJJ(ddd, eee, aaa, bbb, ccc, X[ 7],  9);
-   JJJ(ccc, ddd, eee, aaa, bbb, X[ 0], 11);
-   JJJ(bbb, ccc, ddd, eee, aaa, X[ 9], 13);
-   JJJ(aaa, bbb, ccc, ddd, eee, X[ 2], 15);
-   JJJ(eee, aaa, bbb, ccc, ddd, X[11], 15);
-   JJJ(ddd, eee, aaa, bbb, ccc, X[ 4],  5);
-   JJJ(ccc, ddd, eee, aaa, bbb, X[13],  7);
-   JJJ(bbb, ccc, ddd, eee, aaa, X[ 6],  7);
-   JJJ(aaa, bbb, ccc, ddd, eee, X[15],  8);
-   JJJ(eee, aaa, bbb, ccc, ddd, X[ 8], 11);
-   JJJ(ddd, eee, aaa, bbb, ccc, X[ 1], 14);
-   JJJ(ccc, ddd, eee, aaa, bbb, X[10], 14);
-   JJJ(bbb, ccc, ddd, eee, aaa, X[ 3], 12);
-   JJJ(aaa, bbb, ccc, ddd, eee, X[12],  6);
-
-   /* parallel round 2 */
-   III(eee, aaa, bbb, ccc, ddd, X[ 6],  9); 
-   III(ddd, eee, aaa, bbb, ccc, X[11], 13);
-   III(ccc, ddd, eee, aaa, bbb, X[ 3], 15);
-   III(bbb, ccc, ddd, eee, aaa, X[ 7],  7);
-   III(aaa, bbb, ccc, ddd, eee, X[ 0], 12);
-   III(eee, aaa, bbb, ccc, ddd, X[13],  8);
-   III(ddd, eee, aaa, bbb, ccc, X[ 5],  9);
-   III(ccc, ddd, eee, aaa, bbb, X[10], 11);
-   III(bbb, ccc, ddd, eee, aaa, X[14],  7);
-   III(aaa, bbb, ccc, ddd, eee, X[15],  7);
-   III(eee, aaa, bbb, ccc, ddd, X[ 8], 12);
-   III(ddd, eee, aaa, bbb, ccc, X[12],  7);
-   III(ccc, ddd, eee, aaa, bbb, X[ 4],  6);
-   III(bbb, ccc, ddd, eee, aaa, X[ 9], 15);
-   III(aaa, bbb, ccc, ddd, eee, X[ 1], 13);
-   III(eee, aaa, bbb, ccc, ddd, X[ 2], 11);
+	// Makes sure the first 'size' bytes are committed; false if that is past the reservation or memory ran out
+	inline bool commit(uint64_t size)
+	{
+		return size <= mCommitted || grow(size);
+	}
 
-   /* parallel round 3 */
-   HHH(ddd, eee, aaa, bbb, ccc, X[15],  9);
-   HHH(ccc, ddd, eee, aaa, bbb, X[ 5],  7);
-   HHH(bbb, ccc, ddd, eee, aaa, X[ 1], 15);
-   HHH(aaa, bbb, ccc, ddd, eee, X[ 3], 11);
-   HHH(eee, aaa, bbb, ccc, ddd, X[ 7],  8);
-   HHH(ddd, eee, aaa, bbb, ccc, X[14],  6);
-   HHH(ccc, ddd, eee, aaa, bbb, X[ 6],  6);
-   HHH(bbb, ccc, ddd, eee, aaa, X[ 9], 14);
-   HHH(aaa, bbb, ccc, ddd, eee, X[11], 12);
-   HHH(eee, aaa, bbb, ccc, ddd, X[ 8], 13);
-   HHH(ddd, eee, aaa, bbb, ccc, X[12],  5);
-   HHH(ccc, ddd, eee, aaa, bbb, X[ 2], 14);
-   HHH(bbb, ccc, ddd, eee, aaa, X[10], 13);
-   HHH(aaa, bbb, ccc, ddd, eee, X[ 0], 13);
-   HHH(eee, aaa, bbb, ccc, ddd, X[ 4],  7);
-   HHH(ddd, eee, aaa, bbb, ccc, X[13],  5);
+	void release(void)
+	{
+		if ( mMapping )
+		{
+#ifdef _MSC_VER
+			VirtualFree(mMapping,0,MEM_RELEASE);
+#else
+			munmap(mMapping,(size_t)mMappingSize);
+#endif
+		}
+		mMapping = NULL;
+		mMappingSize = 0;
+		mBase = NULL;
+		mReserved = 0;
+		mCommitted = 0;
+	}
 
-   /* parallel round 4 */   
-   GGG(ccc, ddd, eee, aaa, bbb, X[ 8], 15);
-   GGG(bbb, ccc, ddd, eee, aaa, X[ 6],  5);
-   GGG(aaa, bbb, ccc, ddd, eee, X[ 4],  8);
-   GGG(eee, aaa, bbb, ccc, ddd, X[ 1], 11);
-   GGG(ddd, eee, aaa, bbb, ccc, X[ 3], 14);
-   GGG(ccc, ddd, eee, aaa, bbb, X[11], 14);
-   GGG(bbb, ccc, ddd, eee, aaa, X[15],  6);
-   GGG(aaa, bbb, ccc, ddd, eee, X[ 0], 14);
-   GGG(eee, aaa, bbb, ccc, ddd, X[ 5],  6);
-   GGG(ddd, eee, aaa, bbb, ccc, X[12],  9);
-   GGG(ccc, ddd, eee, aaa, bbb, X[ 2], 12);
-   GGG(bbb, ccc, ddd, eee, aaa, X[13],  9);
-   GGG(aaa, bbb, ccc, ddd, eee, X[ 9], 12);
-   GGG(eee, aaa, bbb, ccc, ddd, X[ 7],  5);
-   GGG(ddd, eee, aaa, bbb, ccc, X[10], 15);
-   GGG(ccc, ddd, eee, aaa, bbb, X[14],  8);
+	inline uint8_t *getBase(void) const
+	{
+		return mBase;
+	}
 
-   /* parallel round 5 */
-   FFF(bbb, ccc, ddd, eee, aaa, X[12] ,  8);
-   FFF(aaa, bbb, ccc, ddd, eee, X[15] ,  5);
-   FFF(eee, aaa, bbb, ccc, ddd, X[10] , 12);
-   FFF(ddd, eee, aaa, bbb, ccc, X[ 4] ,  9);
-   FFF(ccc, ddd, eee, aaa, bbb, X[ 1] , 12);
-   FFF(bbb, ccc, ddd, eee, aaa, X[ 5] ,  5);
-   FFF(aaa, bbb, ccc, ddd, eee, X[ 8] , 14);
-   FFF(eee, aaa, bbb, ccc, ddd, X[ 7] ,  6);
-   FFF(ddd, eee, aaa, bbb, ccc, X[ 6] ,  8);
-   FFF(ccc, ddd, eee, aaa, bbb, X[ 2] , 13);
-   FFF(bbb, ccc, ddd, eee, aaa, X[13] ,  6);
-   FFF(aaa, bbb, ccc, ddd, eee, X[14] ,  5);
-   FFF(eee, aaa, bbb, ccc, ddd, X[ 0] , 15);
-   FFF(ddd, eee, aaa, bbb, ccc, X[ 3] , 13);
-   FFF(ccc, ddd, eee, aaa, bbb, X[ 9] , 11);
-   FFF(bbb, ccc, ddd, eee, aaa, X[11] , 11);
+	inline uint64_t getReserved(void) const
+	{
+		return mReserved;
+	}
 
-   /* combine results */
-   ddd += cc + MDbuf[1];               /* final result for MDbuf[0] */
-   MDbuf[1] = MDbuf[2] + dd + eee;
-   MDbuf[2] = MDbuf[3] + ee + aaa;
-   MDbuf[3] = MDbuf[4] + aa + bbb;
-   MDbuf[4] = MDbuf[0] + bb + ccc;
-   MDbuf[0] = ddd;
+	inline uint64_t getCommitted(void) const
+	{
+		return mCommitted;
+	}
 
-   return;
-}
+private:
+	bool grow(uint64_t size)
+	{
+		if ( size > mReserved )
+		{
+			return false;
+		}
+		uint64_t committed = (size+ARENA_COMMIT_CHUNK-1) & ~(uint64_t)(ARENA_COMMIT_CHUNK-1);
+		if ( committed > mReserved )
+		{
+			committed = mReserved;
+		}
+		uint8_t *start = mBase+mCommitted;
+		uint64_t length = committed-mCommitted;
+#ifdef _MSC_VER
+		bool ok = VirtualAlloc(start,(SIZE_T)length,MEM_COMMIT,PAGE_READWRITE) != NULL;
+#else
+		bool ok = mprotect(start,(size_t)length,PROT_READ|PROT_WRITE) == 0;
+		if ( ok )
+		{
+			adviseHugePages(start,length);
+		}
+#endif
+		if ( !ok )
+		{
+			printf("Out of memory committing %s MB more.\r\n", formatNumber((uint32_t)(length>>20)) );
+			return false;
+		}
+		mCommitted = committed;
+		return true;
+	}
 
-/********************************************************************/
+	void		*mMapping;
+	uint64_t	mMappingSize;
+	uint8_t		*mBase;			// The start of the mapping rounded up to a huge page
+	uint64_t	mReserved;
+	uint64_t	mCommitted;
+};
 
-void MDfinish(uint32_t *MDbuf,const uint8_t *strptr, uint32_t lswlen, uint32_t mswlen)
+// An array in a VirtualArena; its elements are default constructed as they are committed and never move.  It
+// converts to a plain pointer to the first element, which is NULL until reserve is called.
+template < class T > class ArenaArray
 {
-   unsigned int i;                                 /* counter       */
-   uint32_t        X[16];                             /* message words */
-
-   memset(X, 0, 16*sizeof(uint32_t));
-
-   /* put bytes from strptr into X */
-   for (i=0; i<(lswlen&63); i++) {
-      /* uint8_t i goes into word X[i div 4] at pos.  8*(i mod 4)  */
-      X[i>>2] ^= (uint32_t) *strptr++ << (8 * (i&3));
-   }
-
-   /* append the bit m_n == 1 */
-   X[(lswlen>>2)&15] ^= (uint32_t)1 << (8*(lswlen&3) + 7);
-
-   if ((lswlen & 63) > 55) {
-      /* length goes to next block */
-      compress(MDbuf, X);
-      memset(X, 0, 16*sizeof(uint32_t));
-   }
+public:
+	ArenaArray(void)
+	{
+		mData = NULL;
+		mCount = 0;
+		mCapacity = 0;
+	}
 
-   /* append length in bits*/
-   X[14] = lswlen << 3;
-   X[15] = (lswlen >> 29) | (mswlen << 3);
-   compress(MDbuf, X);
+	bool reserve(uint32_t maxCount)
+	{
+		mCount = 0;
+		mCapacity = 0;
+		mData = mArena.reserve((uint64_t)maxCount*sizeof(T)) ? (T *)mArena.getBase() : NULL;
+		if ( mData )
+		{
+			uint64_t capacity = mArena.getReserved()/sizeof(T);
+			mCapacity = capacity < maxCount ? (uint32_t)capacity : maxCount;
+		}
+		return mData ? true : false;
+	}
 
-   return;
-}
+	// Makes sure there are at least 'count' elements
+	inline bool ensure(uint32_t count)
+	{
+		return count <= mCount || grow(count);
+	}
 
-#define RMDsize 160
+	// The most elements there can ever be; less than asked for if the address space could not be reserved
+	inline uint32_t getCapacity(void) const
+	{
+		return mCapacity;
+	}
 
-void computeRIPEMD160(const void *_message,uint32_t length,uint8_t hashcode[20])
-/*
- * returns RMD(message)
- * message should be a string terminated by '\0'
- */
-{
-	const uint8_t *message = (const uint8_t *)_message;
-	uint32_t         MDbuf[RMDsize/32];   /* contains (A, B, C, D(, E))   */
-	uint32_t         X[16];               /* current 16-word chunk        */
+	inline uint64_t getCommitted(void) const
+	{
+		return mArena.getCommitted();
+	}
 
-	/* initialize */
-	MDinit(MDbuf);
+	inline operator T *(void) const
+	{
+		return mData;
+	}
 
-	/* process message in 16-word chunks */
-	for (uint32_t nbytes=length; nbytes > 63; nbytes-=64) 
+private:
+	bool grow(uint32_t count)
 	{
-		for (uint32_t i=0; i<16; i++) 
+		if ( count > mCapacity || !mArena.commit((uint64_t)count*sizeof(T)) )
 		{
-			X[i] = BYTES_TO_DWORD(message);
-			message += 4;
+			return false;
 		}
-		compress(MDbuf, X);
-	}	/* length mod 64 bytes left */
-
-	/* finish: */
-	MDfinish(MDbuf, message, length, 0);
-
-	for (uint32_t i=0; i<RMDsize/8; i+=4) 
-	{
-		hashcode[i]   = (uint8_t)(MDbuf[i>>2]);         /* implicit cast to uint8_t  */
-		hashcode[i+1] = (uint8_t)(MDbuf[i>>2] >>  8);  /*  extracts the 8 least  */
-		hashcode[i+2] = (uint8_t)(MDbuf[i>>2] >> 16);  /*  significant bits.     */
-		hashcode[i+3] = (uint8_t)(MDbuf[i>>2] >> 24);
+		uint64_t committed = mArena.getCommitted()/sizeof(T);
+		uint32_t newCount = committed < mCapacity ? (uint32_t)committed : mCapacity;
+		for (uint32_t i=mCount; i<newCount; i++)
+		{
+			mData[i] = T();
+		}
+		mCount = newCount;
+		return true;
 	}
 
-}
-
+	T				*mData;
+	uint32_t		mCount;		// How many elements are committed and constructed
+	uint32_t		mCapacity;
+	VirtualArena	mArena;
+};
 
-}; // end of RIPEMD160 hash
+// Runs 'function' on 'threadCount' threads at once and waits for all of them to finish.  Each call is told which
+// thread it is so it can pick its share of the work.
+typedef void (*HashThreadFunction)(void *context,uint32_t thread,uint32_t threadCount);
 
-//********** Beginning of source code for SHA256 hash
+#define HASH_MAX_THREADS 64
 
-namespace BLOCKCHAIN_SHA256
+class HashThread
 {
-#define SHA256_HASH_SIZE  32	/* 256 bit */
-#define SHA256_HASH_WORDS 8
-#define SHA256_UNROLL 64	// This define determines how much loop unrolling is done when computing the hash; 
-
-	// Uncomment this line of code if you want this snippet to compute the endian mode of your processor at run time; rather than at compile time.
-	//#define RUNTIME_ENDIAN
+public:
+	HashThreadFunction	mFunction;
+	void				*mContext;
+	uint32_t			mThread;
+	uint32_t			mThreadCount;
+};
 
-	// Uncomment this line of code if you want this routine to compile for a big-endian processor
-	//#define WORDS_BIGENDIAN
+#ifdef _MSC_VER
+static DWORD WINAPI hashThreadMain(LPVOID p)
+{
+	HashThread *t = (HashThread *)p;
+	(*t->mFunction)(t->mContext,t->mThread,t->mThreadCount);
+	return 0;
+}
+#else
+static void *hashThreadMain(void *p)
+{
+	HashThread *t = (HashThread *)p;
+	(*t->mFunction)(t->mContext,t->mThread,t->mThreadCount);
+	return NULL;
+}
+#endif
 
-	typedef struct 
+static void runThreads(HashThreadFunction function,void *context,uint32_t threadCount)
+{
+	if ( threadCount > HASH_MAX_THREADS )
 	{
-		uint64_t totalLength;
-		uint32_t hash[SHA256_HASH_WORDS];
-		uint32_t bufferLength;
-		union 
-		{
-			uint32_t words[16];
-			uint8_t bytes[64];
-		} buffer;
-	} sha256_ctx_t;
-
-	void sha256_init(sha256_ctx_t * sc);
-	void sha256_update(sha256_ctx_t * sc, const void *data, uint32_t len);
-	void sha256_finalize(sha256_ctx_t * sc, uint8_t hash[SHA256_HASH_SIZE]);
-
-
-#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
-#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
-
-#define Ch(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
-#define Maj(x, y, z) (((x) & ((y) | (z))) | ((y) & (z)))
-#define SIGMA0(x) (ROTR((x), 2) ^ ROTR((x), 13) ^ ROTR((x), 22))
-#define SIGMA1(x) (ROTR((x), 6) ^ ROTR((x), 11) ^ ROTR((x), 25))
-#define sigma0(x) (ROTR((x), 7) ^ ROTR((x), 18) ^ ((x) >> 3))
-#define sigma1(x) (ROTR((x), 17) ^ ROTR((x), 19) ^ ((x) >> 10))
-
-#define DO_ROUND() {							\
-	t1 = h + SIGMA1(e) + Ch(e, f, g) + *(Kp++) + *(W++);	\
-	t2 = SIGMA0(a) + Maj(a, b, c);				\
-	h = g;							\
-	g = f;							\
-	f = e;							\
-	e = d + t1;						\
-	d = c;							\
-	c = b;							\
-	b = a;							\
-	a = t1 + t2;						\
+		threadCount = HASH_MAX_THREADS;
+	}
+	HashThread threads[HASH_MAX_THREADS];
+	for (uint32_t i=0; i<threadCount; i++)
+	{
+		threads[i].mFunction = function;
+		threads[i].mContext = context;
+		threads[i].mThread = i;
+		threads[i].mThreadCount = threadCount;
+	}
+#ifdef _MSC_VER
+	HANDLE handles[HASH_MAX_THREADS];
+	for (uint32_t i=1; i<threadCount; i++)
+	{
+		handles[i] = CreateThread(NULL,0,hashThreadMain,&threads[i],0,NULL);
+	}
+	hashThreadMain(&threads[0]); // the calling thread does the first share itself
+	for (uint32_t i=1; i<threadCount; i++)
+	{
+		WaitForSingleObject(handles[i],INFINITE);
+		CloseHandle(handles[i]);
+	}
+#else
+	pthread_t handles[HASH_MAX_THREADS];
+	for (uint32_t i=1; i<threadCount; i++)
+	{
+		pthread_create(&handles[i],NULL,hashThreadMain,&threads[i]);
 	}
+	hashThreadMain(&threads[0]); // the calling thread does the first share itself
+	for (uint32_t i=1; i<threadCount; i++)
+	{
+		pthread_join(handles[i],NULL);
+	}
+#endif
+}
 
-	static const uint32_t K[64] = {
-		0x428a2f98L, 0x71374491L, 0xb5c0fbcfL, 0xe9b5dba5L,
-		0x3956c25bL, 0x59f111f1L, 0x923f82a4L, 0xab1c5ed5L,
-		0xd807aa98L, 0x12835b01L, 0x243185beL, 0x550c7dc3L,
-		0x72be5d74L, 0x80deb1feL, 0x9bdc06a7L, 0xc19bf174L,
-		0xe49b69c1L, 0xefbe4786L, 0x0fc19dc6L, 0x240ca1ccL,
-		0x2de92c6fL, 0x4a7484aaL, 0x5cb0a9dcL, 0x76f988daL,
-		0x983e5152L, 0xa831c66dL, 0xb00327c8L, 0xbf597fc7L,
-		0xc6e00bf3L, 0xd5a79147L, 0x06ca6351L, 0x14292967L,
-		0x27b70a85L, 0x2e1b2138L, 0x4d2c6dfcL, 0x53380d13L,
-		0x650a7354L, 0x766a0abbL, 0x81c2c92eL, 0x92722c85L,
-		0xa2bfe8a1L, 0xa81a664bL, 0xc24b8b70L, 0xc76c51a3L,
-		0xd192e819L, 0xd6990624L, 0xf40e3585L, 0x106aa070L,
-		0x19a4c116L, 0x1e376c08L, 0x2748774cL, 0x34b0bcb5L,
-		0x391c0cb3L, 0x4ed8aa4aL, 0x5b9cca4fL, 0x682e6ff3L,
-		0x748f82eeL, 0x78a5636fL, 0x84c87814L, 0x8cc70208L,
-		0x90befffaL, 0xa4506cebL, 0xbef9a3f7L, 0xc67178f2L
-	};
+static uint32_t getProcessorCount(void)
+{
+#ifdef _MSC_VER
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	uint32_t ret = (uint32_t)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t ret = count > 0 ? (uint32_t)count : 1;
+#endif
+	return ret < HASH_MAX_THREADS ? ret : HASH_MAX_THREADS;
+}
 
-#ifndef RUNTIME_ENDIAN
+static inline uint64_t atomicOr64(volatile uint64_t *value,uint64_t bits) // returns the previous value
+{
+#ifdef _MSC_VER
+	return (uint64_t)InterlockedOr64((volatile LONGLONG *)value,(LONGLONG)bits);
+#else
+	return __sync_fetch_and_or(value,bits);
+#endif
+}
 
-#ifdef WORDS_BIGENDIAN
+static inline uint32_t popCount64(uint64_t v)
+{
+#ifdef _MSC_VER
+	return (uint32_t)__popcnt64(v);
+#else
+	return (uint32_t)__builtin_popcountll(v);
+#endif
+}
 
-#define BYTESWAP(x) (x)
-#define BYTESWAP64(x) (x)
+// Asks for the cache line holding 'p' to be loaded without waiting for it; a hint only, so any address is safe
+static inline void prefetchMemory(const void *p)
+{
+#ifdef _MSC_VER
+	_mm_prefetch((const char *)p,_MM_HINT_T0);
+#else
+	__builtin_prefetch(p);
+#endif
+}
 
-#else				/* WORDS_BIGENDIAN */
+// MinimalPerfectHash maps a fixed set of N distinct 64 bit key fingerprints onto the slots 0..N-1 with no collisions
+// and no empty slots, using about 3.7 bits per key; the keys themselves are not stored.  It uses the BBHash scheme
+// (Limasset et al., 'Fast and scalable minimal perfect hashing for massive key sets'): each level is a bit array
+// twice the size of the keys still to be placed; a key whose position in the level is not shared with any other key
+// sets its bit there, and the keys which collided move on to the next, smaller, level.  A key's slot is the rank of
+// its bit across all levels, found with a popcount and a rank sample every 512 bits.  The last few keys (always
+// including any whose fingerprints are identical) go into a small sorted overflow list.
+//
+// A fingerprint which was not in the build set returns either MPH_NOT_FOUND or some arbitrary slot, so the caller
+// must always check the key stored for the slot.  The levels are built in parallel, splitting the keys across threads.
+#define MPH_NOT_FOUND 0xFFFFFFFF
+#define MPH_MAX_LEVELS 32
+#define MPH_GAMMA 2										// Bits per remaining key in each level
+#define MPH_RANK_WORDS 8								// A rank sample every 8 words (512 bits)
+#define MPH_MIN_LEVEL_KEYS 64							// Once this few keys are left they go straight into the overflow list
+
+class MinimalPerfectHash
+{
+public:
+	MinimalPerfectHash(void)
+	{
+		mBits = NULL;
+		mRanks = NULL;
+		mOverflow = NULL;
+		mLevelCount = 0;
+		mKeyCount = 0;
+		mLevelKeyCount = 0;
+		mOverflowCount = 0;
+		mWordCount = 0;
+	}
 
-#define BYTESWAP(x) ((ROTR((x), 8) & 0xff00ff00L) |	\
-	(ROTL((x), 8) & 0x00ff00ffL))
-#define BYTESWAP64(x) _byteswap64(x)
+	~MinimalPerfectHash(void)
+	{
+		release();
+	}
 
-	static inline uint64_t _byteswap64(uint64_t x)
+	void release(void)
 	{
-		uint32_t a = x >> 32;
-		uint32_t b = (uint32_t) x;
-		return ((uint64_t) BYTESWAP(b) << 32) | (uint64_t) BYTESWAP(a);
+		delete []mBits;
+		delete []mRanks;
+		delete []mOverflow;
+		mBits = NULL;
+		mRanks = NULL;
+		mOverflow = NULL;
+		mLevelCount = 0;
+		mKeyCount = 0;
+		mLevelKeyCount = 0;
+		mOverflowCount = 0;
+		mWordCount = 0;
 	}
 
-#endif				/* WORDS_BIGENDIAN */
+	// Builds the hash over 'count' fingerprints and returns the slot assigned to each one in 'slots'.
+	// Fingerprints should be distinct; identical ones still get distinct slots, through the overflow list.
+	void build(const uint64_t *fingerprints,uint32_t count,uint32_t *slots,uint32_t threadCount)
+	{
+		release();
+		assert( count < 0x80000000 ); // so that a level never has more than 2^32 bits
+		mKeyCount = count;
+		if ( count == 0 )
+		{
+			return;
+		}
+		if ( threadCount < 1 )
+		{
+			threadCount = 1;
+		}
 
-#else				/* !RUNTIME_ENDIAN */
+		BuildContext b;
+		b.mOwner = this;
+		b.mFingerprints = fingerprints;
+		b.mSlots = slots;
+		b.mKeys = new uint32_t[count];	// the indices of the keys still to be placed
+		b.mKeyCount = count;
+		for (uint32_t i=0; i<count; i++)
+		{
+			b.mKeys[i] = i;
+		}
+		uint64_t *levelBits[MPH_MAX_LEVELS];
+		uint64_t levelWords[MPH_MAX_LEVELS];
 
-	static int littleEndian;
+		while ( b.mKeyCount >= MPH_MIN_LEVEL_KEYS && mLevelCount < MPH_MAX_LEVELS )
+		{
+			uint64_t words = ((uint64_t)b.mKeyCount*MPH_GAMMA+63)/64;
+			b.mLevel = mLevelCount;
+			b.mLevelSize = words*64;
+			b.mBits = new uint64_t[words];
+			b.mCollisions = new uint64_t[words];
+			memset((void *)b.mBits,0,sizeof(uint64_t)*words);
+			memset((void *)b.mCollisions,0,sizeof(uint64_t)*words);
 
-#define BYTESWAP(x) _byteswap(x)
-#define BYTESWAP64(x) _byteswap64(x)
+			uint32_t threads = b.mKeyCount < 65536 ? 1 : threadCount;
+			runThreads(markLevel,&b,threads);
+			runThreads(splitLevel,&b,threads);
+			// The keys which collided were compacted to the front of each thread's share; join the shares together
+			uint32_t remaining = 0;
+			for (uint32_t t=0; t<threads; t++)
+			{
+				uint32_t start = (uint32_t)((uint64_t)b.mKeyCount*t/threads);
+				if ( remaining != start )
+				{
+					memmove(&b.mKeys[remaining],&b.mKeys[start],sizeof(uint32_t)*b.mRemaining[t]);
+				}
+				remaining+=b.mRemaining[t];
+			}
+			b.mKeyCount = remaining;
 
-#define _BYTESWAP(x) ((ROTR((x), 8) & 0xff00ff00L) |	\
-	(ROTL((x), 8) & 0x00ff00ffL))
-#define _BYTESWAP64(x) __byteswap64(x)
+			delete [](uint64_t *)b.mCollisions;
+			levelBits[mLevelCount] = (uint64_t *)b.mBits;
+			levelWords[mLevelCount] = words;
+			mLevelSize[mLevelCount] = b.mLevelSize;
+			mLevelOffset[mLevelCount] = mWordCount*64;
+			mWordCount+=words;
+			mLevelCount++;
+		}
 
-	static inline uint64_t __byteswap64(uint64_t x)
+		// Concatenate the levels and sample the rank
+		mBits = new uint64_t[mWordCount];
+		uint64_t offset = 0;
+		for (uint32_t i=0; i<mLevelCount; i++)
+		{
+			memcpy(&mBits[offset],levelBits[i],sizeof(uint64_t)*levelWords[i]);
+			offset+=levelWords[i];
+			delete []levelBits[i];
+		}
+		uint64_t sampleCount = (mWordCount+MPH_RANK_WORDS-1)/MPH_RANK_WORDS;
+		mRanks = new uint32_t[sampleCount];
+		uint32_t rank = 0;
+		for (uint64_t i=0; i<mWordCount; i++)
+		{
+			if ( (i%MPH_RANK_WORDS) == 0 )
+			{
+				mRanks[i/MPH_RANK_WORDS] = rank;
+			}
+			rank+=popCount64(mBits[i]);
+		}
+		mLevelKeyCount = rank;
+
+		// Whatever is left goes into the overflow list, sorted by fingerprint
+		mOverflowCount = b.mKeyCount;
+		if ( mOverflowCount )
+		{
+			mOverflow = new uint64_t[mOverflowCount];
+			for (uint32_t i=1; i<mOverflowCount; i++) // an insertion sort; there are only ever a few dozen
+			{
+				uint32_t key = b.mKeys[i];
+				uint32_t j = i;
+				while ( j > 0 && fingerprints[b.mKeys[j-1]] > fingerprints[key] )
+				{
+					b.mKeys[j] = b.mKeys[j-1];
+					j--;
+				}
+				b.mKeys[j] = key;
+			}
+			for (uint32_t i=0; i<mOverflowCount; i++)
+			{
+				mOverflow[i] = fingerprints[b.mKeys[i]];
+			}
+		}
+		runThreads(assignSlots,&b,count < 65536 ? 1 : threadCount);
+		for (uint32_t i=0; i<mOverflowCount; i++) // keys with the same fingerprint all looked up the first of them
+		{
+			slots[b.mKeys[i]] = mLevelKeyCount+i;
+		}
+		delete []b.mKeys;
+	}
+
+	// Returns the slot for this fingerprint; see above for fingerprints which were not in the build set
+	inline uint32_t lookup(uint64_t fingerprint) const
 	{
-		uint32_t a = x >> 32;
-		uint32_t b = (uint32_t) x;
-		return ((uint64_t) _BYTESWAP(b) << 32) | (uint64_t) _BYTESWAP(a);
+		for (uint32_t level=0; level<mLevelCount; level++)
+		{
+			uint64_t bit = mLevelOffset[level] + getPosition(fingerprint,level,mLevelSize[level]);
+			if ( mBits[bit>>6] & ((uint64_t)1<<(bit&63)) )
+			{
+				return getRank(bit);
+			}
+		}
+		return lookupOverflow(fingerprint);
 	}
 
-	static inline uint32_t _byteswap(uint32_t x)
+	// Starts loading the first level's bits and rank sample for this fingerprint; most keys are placed in the first level
+	inline void prefetch(uint64_t fingerprint) const
 	{
-		if (!littleEndian)
-			return x;
-		else
-			return _BYTESWAP(x);
+		if ( mLevelCount )
+		{
+			uint64_t bit = getPosition(fingerprint,0,mLevelSize[0]);
+			prefetchMemory(&mBits[bit>>6]);
+			prefetchMemory(&mRanks[(bit>>6)/MPH_RANK_WORDS]);
+		}
 	}
 
-	static inline uint64_t _byteswap64(uint64_t x)
+	// Identical fingerprints can only end up in the overflow list, next to each other; returns the next slot
+	// holding the same fingerprint, if any.
+	inline uint32_t next(uint32_t slot,uint64_t fingerprint) const
 	{
-		if (!littleEndian)
-			return x;
-		else
-			return _BYTESWAP64(x);
+		uint32_t ret = MPH_NOT_FOUND;
+		if ( slot >= mLevelKeyCount && (slot+1-mLevelKeyCount) < mOverflowCount && mOverflow[slot+1-mLevelKeyCount] == fingerprint )
+		{
+			ret = slot+1;
+		}
+		return ret;
 	}
 
-	static inline void setEndian(void)
+	inline uint32_t size(void) const
 	{
-		union {
-			uint32_t w;
-			uint8_t b[4];
-		} endian;
+		return mKeyCount;
+	}
 
-		endian.w = 1L;
-		littleEndian = endian.b[0] != 0;
+	// The memory used, in bytes
+	inline uint64_t getMemory(void) const
+	{
+		return mWordCount*sizeof(uint64_t) + ((mWordCount+MPH_RANK_WORDS-1)/MPH_RANK_WORDS)*sizeof(uint32_t) + mOverflowCount*sizeof(uint64_t);
 	}
 
-#endif				/* !RUNTIME_ENDIAN */
+	inline uint32_t getLevelCount(void) const
+	{
+		return mLevelCount;
+	}
 
-	static const uint8_t padding[64] = {
-		0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+private:
+	class BuildContext
+	{
+	public:
+		MinimalPerfectHash	*mOwner;
+		const uint64_t		*mFingerprints;
+		uint32_t			*mSlots;
+		uint32_t			*mKeys;
+		uint32_t			mKeyCount;
+		uint32_t			mLevel;
+		uint64_t			mLevelSize;
+		volatile uint64_t	*mBits;
+		volatile uint64_t	*mCollisions;
+		uint32_t			mRemaining[HASH_MAX_THREADS];
 	};
 
-	void sha256_init(sha256_ctx_t * sc)
+	static inline uint64_t mixHash64(uint64_t h)
 	{
-#ifdef RUNTIME_ENDIAN
-		setEndian();
-#endif				/* RUNTIME_ENDIAN */
-
-		sc->totalLength = 0LL;
-		sc->hash[0] = 0x6a09e667L;
-		sc->hash[1] = 0xbb67ae85L;
-		sc->hash[2] = 0x3c6ef372L;
-		sc->hash[3] = 0xa54ff53aL;
-		sc->hash[4] = 0x510e527fL;
-		sc->hash[5] = 0x9b05688cL;
-		sc->hash[6] = 0x1f83d9abL;
-		sc->hash[7] = 0x5be0cd19L;
-		sc->bufferLength = 0L;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
 	}
 
-	static void burnStack(int size)
+	// The key's bit position within a level; a different hash for every level
+	static inline uint64_t getPosition(uint64_t fingerprint,uint32_t level,uint64_t levelSize)
 	{
-		char buf[128];
+		uint64_t h = mixHash64(fingerprint + (uint64_t)(level+1)*0x9E3779B97F4A7C15ULL);
+		return (uint64_t)(((h>>32)*levelSize)>>32);	// maps onto 0..levelSize-1 without a divide
+	}
 
-		memset(buf, 0, sizeof(buf));
-		size -= sizeof(buf);
-		if (size > 0)
-			burnStack(size);
+	inline uint32_t getRank(uint64_t bit) const
+	{
+		uint64_t word = bit>>6;
+		uint32_t ret = mRanks[word/MPH_RANK_WORDS];
+		for (uint64_t i=word-(word%MPH_RANK_WORDS); i<word; i++)
+		{
+			ret+=popCount64(mBits[i]);
+		}
+		return ret + popCount64(mBits[word] & (((uint64_t)1<<(bit&63))-1));
 	}
 
-	static void SHA256Guts(sha256_ctx_t * sc, const uint32_t * cbuf)
+	inline uint32_t lookupOverflow(uint64_t fingerprint) const
 	{
-		uint32_t buf[64];
-		uint32_t *W, *W2, *W7, *W15, *W16;
-		uint32_t a, b, c, d, e, f, g, h;
-		uint32_t t1, t2;
-		const uint32_t *Kp;
-		int i;
+		uint32_t low = 0;
+		uint32_t high = mOverflowCount;
+		while ( low < high ) // find the first entry not less than the fingerprint
+		{
+			uint32_t mid = (low+high)/2;
+			if ( mOverflow[mid] < fingerprint )
+			{
+				low = mid+1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		return (low < mOverflowCount && mOverflow[low] == fingerprint) ? mLevelKeyCount+low : MPH_NOT_FOUND;
+	}
 
-		W = buf;
+	// First pass over a level: every key sets its bit, and any bit set twice is marked as a collision
+	static void markLevel(void *context,uint32_t thread,uint32_t threadCount)
+	{
+		BuildContext &b = *(BuildContext *)context;
+		uint32_t start = (uint32_t)((uint64_t)b.mKeyCount*thread/threadCount);
+		uint32_t end = (uint32_t)((uint64_t)b.mKeyCount*(thread+1)/threadCount);
+		for (uint32_t i=start; i<end; i++)
+		{
+			uint64_t bit = getPosition(b.mFingerprints[b.mKeys[i]],b.mLevel,b.mLevelSize);
+			uint64_t mask = (uint64_t)1<<(bit&63);
+			if ( atomicOr64(&b.mBits[bit>>6],mask) & mask )
+			{
+				atomicOr64(&b.mCollisions[bit>>6],mask);
+			}
+		}
+	}
 
-		for (i = 15; i >= 0; i--) {
-			*(W++) = BYTESWAP(*cbuf);
-			cbuf++;
+	// Second pass: clears the collided bits and keeps the keys which landed on them for the next level
+	static void splitLevel(void *context,uint32_t thread,uint32_t threadCount)
+	{
+		BuildContext &b = *(BuildContext *)context;
+		uint64_t words = b.mLevelSize/64;
+		uint64_t wordStart = words*thread/threadCount;
+		uint64_t wordEnd = words*(thread+1)/threadCount;
+		for (uint64_t i=wordStart; i<wordEnd; i++)
+		{
+			b.mBits[i]&=~b.mCollisions[i];
+		}
+		uint32_t start = (uint32_t)((uint64_t)b.mKeyCount*thread/threadCount);
+		uint32_t end = (uint32_t)((uint64_t)b.mKeyCount*(thread+1)/threadCount);
+		uint32_t remaining = start;
+		for (uint32_t i=start; i<end; i++)
+		{
+			uint32_t key = b.mKeys[i];
+			uint64_t bit = getPosition(b.mFingerprints[key],b.mLevel,b.mLevelSize);
+			if ( b.mCollisions[bit>>6] & ((uint64_t)1<<(bit&63)) )
+			{
+				b.mKeys[remaining++] = key;
+			}
 		}
+		b.mRemaining[thread] = remaining-start;
+	}
 
-		W16 = &buf[0];
-		W15 = &buf[1];
-		W7 = &buf[9];
-		W2 = &buf[14];
-
-		for (i = 47; i >= 0; i--) {
-			*(W++) = sigma1(*W2) + *(W7++) + sigma0(*W15) + *(W16++);
-			W2++;
-			W15++;
+	static void assignSlots(void *context,uint32_t thread,uint32_t threadCount)
+	{
+		BuildContext &b = *(BuildContext *)context;
+		uint32_t count = b.mOwner->mKeyCount;
+		uint32_t start = (uint32_t)((uint64_t)count*thread/threadCount);
+		uint32_t end = (uint32_t)((uint64_t)count*(thread+1)/threadCount);
+		for (uint32_t i=start; i<end; i++)
+		{
+			b.mSlots[i] = b.mOwner->lookup(b.mFingerprints[i]);
 		}
+	}
 
-		a = sc->hash[0];
-		b = sc->hash[1];
-		c = sc->hash[2];
-		d = sc->hash[3];
-		e = sc->hash[4];
-		f = sc->hash[5];
-		g = sc->hash[6];
-		h = sc->hash[7];
+	uint64_t	*mBits;							// All of the levels, one after the other
+	uint32_t	*mRanks;						// The number of bits set before every MPH_RANK_WORDS words
+	uint64_t	*mOverflow;						// The sorted fingerprints of keys which could not be placed in any level
+	uint32_t	mLevelCount;
+	uint64_t	mLevelOffset[MPH_MAX_LEVELS];	// The first bit of each level
+	uint64_t	mLevelSize[MPH_MAX_LEVELS];		// The number of bits in each level
+	uint32_t	mKeyCount;
+	uint32_t	mLevelKeyCount;					// The number of keys placed in the levels; overflow slots follow them
+	uint32_t	mOverflowCount;
+	uint64_t	mWordCount;
+};
 
-		Kp = K;
-		W = buf;
+#define HASH_SHARD_BITS 6
+#define HASH_SHARD_COUNT (1<<HASH_SHARD_BITS)				// 64 shards which each grow on their own
+#define HASH_SHARD_INITIAL_SLOTS 256
+#define HASH_SHARD_MIGRATE_SLOTS 64						// How many slots of a shard's old table are moved to the new one on each insert
+#define HASH_MAX_CHUNKS (1<<(32-HASH_CHUNK_SHIFT))		// Enough chunks for every possible 32 bit index
 
-#ifndef SHA256_UNROLL
-#define SHA256_UNROLL 1
-#endif				/* !SHA256_UNROLL */
+// Picks the shard from the top bits of a multiplicative hash so it is independent of the low bits used for the slot
+static inline uint32_t getShard(uint32_t hash)
+{
+	return (hash*0x9E3779B1) >> (32-HASH_SHARD_BITS);
+}
 
-#if SHA256_UNROLL == 1
-		for (i = 63; i >= 0; i--)
-			DO_ROUND();
-#elif SHA256_UNROLL == 2
-		for (i = 31; i >= 0; i--) {
-			DO_ROUND();
-			DO_ROUND();
+// ShardedHash is the address table's counterpart of SimpleHash.  The only way to add a key is 'insert', which returns
+// the existing entry if the key is already present, so every distinct key gets exactly one dense index (0,1,2...);
+// getIndex/getKey translate between the two just as with SimpleHash.
+//
+// The table is split into HASH_SHARD_COUNT shards chosen by hash, each with its own linear probed slots of
+// { hash, index }.  Like SimpleHash a shard grows incrementally: when it fills up a table twice the size is started
+// and the old slots are moved across a few at a time by the inserts which follow, looking in both meanwhile, so no
+// insert ever pays for rehashing more than a handful of slots.  The stored hashes mean the keys are never looked at
+// to do so.  The keys live in fixed size chunks which never move, so getIndex is a binary search over the chunks
+// rather than a lookup of the key.
+//
+// Once a table is complete it can be frozen into a minimal perfect hash (see below) for read only use.
+template < class Key >
+
+class ShardedHash
+{
+public:
+	ShardedHash(void)
+	{
+		mCount = 0;
+		mChunks = new Key*[HASH_MAX_CHUNKS];
+		memset(mChunks,0,sizeof(Key *)*HASH_MAX_CHUNKS);
+		mChunkOrder = new uint32_t[HASH_MAX_CHUNKS];
+		mChunkCount = 0;
+		mFrozenIndex = NULL;
+	}
+
+	~ShardedHash(void)
+	{
+		delete []mFrozenIndex;
+		for (uint32_t i=0; i<mChunkCount; i++)
+		{
+			delete []mChunks[i];
 		}
-#elif SHA256_UNROLL == 4
-		for (i = 15; i >= 0; i--) {
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
+		delete []mChunks;
+		delete []mChunkOrder;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			mShards[i].mTable.release();
+			mShards[i].mOldTable.release();
 		}
-#elif SHA256_UNROLL == 8
-		for (i = 7; i >= 0; i--) {
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
+	}
+
+	// Returns the entry for this key, adding it if it is not already present; 'index' is its dense index.
+	Key * insert(const Key &key,uint32_t &index)
+	{
+		if ( mFrozenIndex )
+		{
+			thaw();
 		}
-#elif SHA256_UNROLL == 16
-		for (i = 3; i >= 0; i--) {
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
+		uint32_t hash = mixHash(key.getHash());
+		Shard &s = mShards[getShard(hash)];
+		index = findIndex(s,s.mTable,key,hash);
+		if ( index == HASH_NOT_FOUND && s.mOldTable.mSlots )
+		{
+			index = findIndex(s,s.mOldTable,key,hash);
 		}
-#elif SHA256_UNROLL == 32
-		for (i = 1; i >= 0; i--) {
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
-			DO_ROUND();
+		if ( index != HASH_NOT_FOUND )
+		{
+			return getEntry(index);
 		}
-#elif SHA256_UNROLL == 64
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-		DO_ROUND();
-#else
-#error "SHA256_UNROLL must be 1, 2, 4, 8, 16, 32, or 64!"
-#endif
+		index = mCount++;
+		assert( index != HASH_NOT_FOUND );
+		Key *ret = allocEntry(index);
+		*ret = key;
+		addSlot(s,hash,index);
+		return ret;
+	}
 
-		sc->hash[0] += a;
-		sc->hash[1] += b;
-		sc->hash[2] += c;
-		sc->hash[3] += d;
-		sc->hash[4] += e;
-		sc->hash[5] += f;
-		sc->hash[6] += g;
-		sc->hash[7] += h;
+	inline Key * insert(const Key &key)
+	{
+		uint32_t index;
+		return insert(key,index);
 	}
 
-	void sha256_update(sha256_ctx_t * sc, const void *data, uint32_t len)
+	inline Key* find(const Key& key) const
 	{
-		uint32_t bufferBytesLeft;
-		uint32_t bytesToCopy;
-		int needBurn = 0;
+		uint32_t index;
+		return find(key,index);
+	}
 
-		if (sc->bufferLength) 
+	// Same as above but also returns the index of the entry found
+	Key* find(const Key& key,uint32_t &index) const
+	{
+		Key *ret = NULL;
+		index = HASH_NOT_FOUND;
+		if ( mFrozenIndex )
 		{
-			bufferBytesLeft = 64L - sc->bufferLength;
-			bytesToCopy = bufferBytesLeft;
-			if (bytesToCopy > len)
-			{
-				bytesToCopy = len;
-			}
-			memcpy(&sc->buffer.bytes[sc->bufferLength], data, bytesToCopy);
-			sc->totalLength += bytesToCopy * 8L;
-			sc->bufferLength += bytesToCopy;
-			data = ((uint8_t *) data) + bytesToCopy;
-			len -= bytesToCopy;
-			if (sc->bufferLength == 64L) 
+			uint64_t fingerprint = key.getHash64();
+			for (uint32_t slot=mPerfectHash.lookup(fingerprint); slot != MPH_NOT_FOUND; slot = mPerfectHash.next(slot,fingerprint))
 			{
-				SHA256Guts(sc, sc->buffer.words);
-				needBurn = 1;
-				sc->bufferLength = 0L;
+				if ( *getEntry(mFrozenIndex[slot]) == key )
+				{
+					index = mFrozenIndex[slot];
+					ret = getEntry(index);
+					break;
+				}
 			}
+			return ret;
 		}
-
-		while (len > 63L) 
+		uint32_t hash = mixHash(key.getHash());
+		Shard &s = mShards[getShard(hash)];
+		index = findIndex(s,s.mTable,key,hash);
+		if ( index == HASH_NOT_FOUND && s.mOldTable.mSlots )
 		{
-			sc->totalLength += 512L;
-
-			SHA256Guts(sc, (const uint32_t *)data);
-			needBurn = 1;
-
-			data = ((uint8_t *) data) + 64L;
-			len -= 64L;
+			index = findIndex(s,s.mOldTable,key,hash);
 		}
-
-		if (len) 
+		if ( index != HASH_NOT_FOUND )
 		{
-			memcpy(&sc->buffer.bytes[sc->bufferLength], data, len);
-			sc->totalLength += len * 8L;
-			sc->bufferLength += len;
+			ret = getEntry(index);
 		}
+		return ret;
+	}
 
-		if (needBurn)
+	// The chunks are kept in address order, so the one holding this key, and with it the key's index, is found
+	// by a binary search over them
+	inline uint32_t getIndex(const Key *k) const
+	{
+		assert(k);
+		uint32_t low = 0;
+		uint32_t high = mChunkCount;
+		while ( high-low > 1 )
 		{
-			burnStack(sizeof(uint32_t[74]) + sizeof(uint32_t *[6]) +  sizeof(int));
+			uint32_t mid = (low+high)/2;
+			if ( (uintptr_t)k < (uintptr_t)mChunks[mChunkOrder[mid]] )
+			{
+				high = mid;
+			}
+			else
+			{
+				low = mid;
+			}
+		}
+		uint32_t ret = HASH_NOT_FOUND;
+		if ( mChunkCount )
+		{
+			const Key *chunk = mChunks[mChunkOrder[low]];
+			if ( (uintptr_t)k >= (uintptr_t)chunk && (uintptr_t)k < (uintptr_t)&chunk[HASH_CHUNK_SIZE] )
+			{
+				ret = (mChunkOrder[low]<<HASH_CHUNK_SHIFT) + (uint32_t)(k-chunk);
+			}
 		}
+		assert( ret < mCount );
+		return ret;
 	}
 
-	void sha256_finalize(sha256_ctx_t * sc, uint8_t hash[SHA256_HASH_SIZE])
+	inline Key * getKey(uint32_t i) const
 	{
-		uint32_t bytesToPad;
-		uint64_t lengthPad;
-		int i;
+		Key *ret = NULL;
+		assert( i < mCount );
+		if ( i < mCount )
+		{
+			ret = getEntry(i);
+		}
+		return ret;
+	}
 
-		bytesToPad = 120L - sc->bufferLength;
-		if (bytesToPad > 64L)
+	inline uint32_t size(void) const
+	{
+		return mCount;
+	}
+
+	// Once no more keys will be added, replaces the shards' probe tables with a minimal perfect hash over the keys
+	// plus one 32 bit index per key.  Requires Key::getHash64, a 64 bit fingerprint.  The first insert afterwards
+	// thaws the table.
+	void freeze(uint32_t threadCount)
+	{
+		if ( mFrozenIndex || mCount == 0 )
 		{
-			bytesToPad -= 64L;
+			return;
+		}
+		uint64_t *fingerprints = new uint64_t[mCount];
+		for (uint32_t i=0; i<mCount; i++)
+		{
+			fingerprints[i] = getEntry(i)->getHash64();
+		}
+		uint32_t *slots = new uint32_t[mCount];
+		mPerfectHash.build(fingerprints,mCount,slots,threadCount);
+		mFrozenIndex = new uint32_t[mCount];
+		for (uint32_t i=0; i<mCount; i++)
+		{
+			mFrozenIndex[slots[i]] = i;
+		}
+		delete []slots;
+		delete []fingerprints;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			mShards[i].mTable.release();
+			mShards[i].mOldTable.release();
+			mShards[i].mMigrateSlot = 0;
 		}
+	}
 
-		lengthPad = BYTESWAP64(sc->totalLength);
+	inline bool isFrozen(void) const
+	{
+		return mFrozenIndex ? true : false;
+	}
 
-		sha256_update(sc, padding, bytesToPad);
-		sha256_update(sc, &lengthPad, 8L);
+	// The state image keeps the keys, which the owner writes by index, and the shards' probe tables, which are
+	// written here as a slot count followed by the slots for each shard; loading them back needs no rehashing.
+	// A frozen table is thawed first since the perfect hash is not saved, and any migration is finished.
+	bool writeSlots(FILE *fph,uint64_t &size)
+	{
+		if ( mFrozenIndex )
+		{
+			thaw();
+		}
+		bool ok = true;
+		size = 0;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT && ok; i++)
+		{
+			Shard &s = mShards[i];
+			if ( s.mOldTable.mSlots )
+			{
+				migrate(s,s.mOldTable.getSlotCount());
+			}
+			uint32_t slotCount = s.mTable.getSlotCount();
+			ok = fwrite(&slotCount,sizeof(slotCount),1,fph) == 1 && fwrite(s.mTable.mSlots,sizeof(Slot),slotCount,fph) == slotCount;
+			size+=sizeof(slotCount)+(uint64_t)slotCount*sizeof(Slot);
+		}
+		return ok;
+	}
 
-		if (hash) 
+	bool readSlots(const uint8_t *data,uint64_t size)
+	{
+		uint64_t offset = 0;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
 		{
-			for (i = 0; i < SHA256_HASH_WORDS; i++) 
+			Shard &s = mShards[i];
+			uint32_t slotCount;
+			if ( offset+sizeof(slotCount) > size )
 			{
-				*((uint32_t *) hash) = BYTESWAP(sc->hash[i]);
-				hash += 4;
+				return false;
+			}
+			memcpy(&slotCount,&data[offset],sizeof(slotCount));
+			offset+=sizeof(slotCount);
+			if ( (slotCount & (slotCount-1)) || offset+(uint64_t)slotCount*sizeof(Slot) > size )
+			{
+				return false;
+			}
+			s.mTable.release();
+			s.mOldTable.release();
+			s.mMigrateSlot = 0;
+			if ( slotCount )
+			{
+				if ( !s.mTable.alloc(slotCount) )
+				{
+					return false;
+				}
+				memcpy(s.mTable.mSlots,&data[offset],sizeof(Slot)*slotCount);
+				offset+=(uint64_t)slotCount*sizeof(Slot);
+				for (uint32_t j=0; j<slotCount; j++)
+				{
+					if ( s.mTable.mSlots[j].mIndex != HASH_NOT_FOUND )
+					{
+						s.mTable.mUsed++;
+					}
+				}
 			}
 		}
+		return offset == size;
 	}
 
+	// Drops every key with an index of 'count' or more, the most recently added ones, as when the blocks which first
+	// used them are disconnected.
+	void truncate(uint32_t count)
+	{
+		if ( count >= mCount )
+		{
+			return;
+		}
+		if ( mFrozenIndex )
+		{
+			thaw();
+		}
+		for (uint32_t index=mCount; index-- > count; )
+		{
+			uint32_t hash = mixHash(getEntry(index)->getHash());
+			Shard &s = mShards[getShard(hash)];
+			if ( s.mOldTable.mSlots )
+			{
+				migrate(s,s.mOldTable.getSlotCount());
+			}
+			uint32_t slot = hash & s.mTable.mMask;
+			while ( s.mTable.mSlots[slot].mIndex != index )
+			{
+				assert( s.mTable.mSlots[slot].mIndex != HASH_NOT_FOUND );
+				slot = (slot+1) & s.mTable.mMask;
+			}
+			s.mTable.remove(slot);
+			*getEntry(index) = Key();
+		}
+		mCount = count;
+	}
 
-	void computeSHA256(const void *input,uint32_t size,uint8_t destHash[32])
+	// Returns the storage for key 'index' while a state image is loaded; the keys are restored in order
+	Key *restoreKey(uint32_t index)
 	{
-		sha256_ctx_t sc;
-		sha256_init(&sc);
-		sha256_update(&sc,input,size);
-		sha256_finalize(&sc,destHash);
+		if ( index >= mCount )
+		{
+			mCount = index+1;
+		}
+		return allocEntry(index);
 	}
 
-}; // End of the SHA-2556 namespace
+	void report(const char *name) const
+	{
+		if ( mFrozenIndex )
+		{
+			uint64_t memory = mPerfectHash.getMemory() + (uint64_t)mCount*sizeof(uint32_t);
+			printf("%s hash table: %s entries frozen into a minimal perfect hash; %d levels, %0.2f bits per key for the hash, %0.2f bytes per key in all.\r\n",
+				name,
+				formatNumber(mCount),
+				mPerfectHash.getLevelCount(),
+				(double)mPerfectHash.getMemory()*8/(double)mCount,
+				(double)memory/(double)mCount);
+			return;
+		}
+		uint32_t slots = 0;
+		uint32_t used = 0;
+		uint32_t resizeCount = 0;
+		uint32_t maxProbe = 0;
+		uint64_t findCount = 0;
+		uint64_t probeCount = 0;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			const Shard &s = mShards[i];
+			slots+=s.mTable.getSlotCount();
+			used+=s.mTable.mUsed;
+			resizeCount+=s.mResizeCount;
+			findCount+=s.mFindCount;
+			probeCount+=s.mProbeCount;
+			if ( s.mMaxProbe > maxProbe )
+			{
+				maxProbe = s.mMaxProbe;
+			}
+		}
+		printf("%s hash table: %s entries in %s slots over %d shards; load factor %0.2f, %0.2f slots probed per lookup (longest %d), %d shard resizes.\r\n",
+			name,
+			formatNumber(mCount),
+			formatNumber(slots),
+			HASH_SHARD_COUNT,
+			slots ? (float)used/(float)slots : 0.0f,
+			findCount ? (double)probeCount/(double)findCount : 0.0,
+			maxProbe,
+			resizeCount);
+	}
 
+private:
+	class Slot
+	{
+	public:
+		uint32_t	mHash;		// The mixed hash of the key, so the shard can be rehashed without touching the keys
+		uint32_t	mIndex;		// HASH_NOT_FOUND if the slot is unused
+	};
 
-// Begin of source to perform Base58 encode/decode
-namespace BLOCKCHAIN_BASE58
-{
+	// One generation of a shard's linear probed table
+	class Table
+	{
+	public:
+		Table(void)
+		{
+			mSlots = NULL;
+			mMask = 0;
+			mUsed = 0;
+		}
 
-//
-//  BigNumber.c
-//  cbitcoin
-//
-//  Created by Matthew Mitchell on 28/04/2012.
-//  Copyright (c) 2012 Matthew Mitchell
-//
-//  This file is part of cbitcoin.
-//
-//  cbitcoin is free software: you can redistribute it and/or modify
-//  it under the terms of the GNU General Public License as published by
-//  the Free Software Foundation, either version 3 of the License, or
-//  (at your option) any later version.
-//
-//  cbitcoin is distributed in the hope that it will be useful, 
-//  but WITHOUT ANY WARRANTY; without even the implied warranty of
-//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-//  GNU General Public License for more details.
-//
-//  You should have received a copy of the GNU General Public License
-//  along with cbitcoin.  If not, see <http://www.gnu.org/licenses/>.
-//
-//
+		// Returns false, leaving the table empty, if the slots could not be allocated
+		bool alloc(uint32_t slotCount)
+		{
+			mUsed = 0;
+			mSlots = (Slot *)allocPages(sizeof(Slot)*(uint64_t)slotCount);
+			if ( mSlots == NULL )
+			{
+				mMask = 0;
+				return false;
+			}
+			mMask = slotCount-1;
+			memset(mSlots,0xFF,sizeof(Slot)*slotCount);
+			return true;
+		}
 
-#define MAX_BIG_NUMBER 256	// this code snippet only supports big nubmers up to 256 bytes in length
-/**
- @brief Contains byte data with the length of this data to represent a large integer. The byte data is in little-endian which stores the smallest byte first.
- */
-class BigNumber
+		void release(void)
+		{
+			if ( mSlots )
+			{
+				freePages(mSlots,sizeof(Slot)*(uint64_t)(mMask+1));
+			}
+			mSlots = NULL;
+			mMask = 0;
+			mUsed = 0;
+		}
+
+		inline uint32_t getSlotCount(void) const
+		{
+			return mSlots ? mMask+1 : 0;
+		}
+
+		// Puts the slot in the first free place of its run; the key must not already be in the table
+		inline void place(const Slot &slot)
+		{
+			uint32_t i = slot.mHash & mMask;
+			while ( mSlots[i].mIndex != HASH_NOT_FOUND )
+			{
+				i = (i+1) & mMask;
+			}
+			mSlots[i] = slot;
+			mUsed++;
+		}
+
+		// Empties slot 'i' and moves back any later slot of the same run which would otherwise become unreachable
+		void remove(uint32_t i)
+		{
+			uint32_t j = i;
+			for (;;)
+			{
+				j = (j+1) & mMask;
+				if ( mSlots[j].mIndex == HASH_NOT_FOUND )
+				{
+					break;
+				}
+				uint32_t home = mSlots[j].mHash & mMask;
+				// The slot at j may move to i only if its home is not cyclically within (i,j]
+				bool between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+				if ( !between )
+				{
+					mSlots[i] = mSlots[j];
+					i = j;
+				}
+			}
+			mSlots[i].mHash = HASH_NOT_FOUND;
+			mSlots[i].mIndex = HASH_NOT_FOUND;
+			mUsed--;
+		}
+
+		Slot		*mSlots;
+		uint32_t	mMask;				// The number of slots minus one
+		uint32_t	mUsed;				// The number of occupied slots
+	};
+
+	class Shard
+	{
+	public:
+		Shard(void)
+		{
+			mMigrateSlot = 0;
+			mResizeCount = 0;
+			mFindCount = 0;
+			mProbeCount = 0;
+			mMaxProbe = 0;
+		}
+
+		Table		mTable;				// The current table
+		Table		mOldTable;			// The previous table while its slots are being migrated after a resize
+		uint32_t	mMigrateSlot;		// The next slot of the old table to migrate
+		uint32_t	mResizeCount;
+		uint64_t	mFindCount;			// Probe statistics
+		uint64_t	mProbeCount;
+		uint32_t	mMaxProbe;
+	};
+
+	inline uint32_t findIndex(Shard &s,const Table &t,const Key &key,uint32_t hash) const
+	{
+		uint32_t ret = HASH_NOT_FOUND;
+		if ( t.mSlots )
+		{
+			uint32_t probe = 1;
+			for (uint32_t slot = hash & t.mMask; t.mSlots[slot].mIndex != HASH_NOT_FOUND; slot = (slot+1) & t.mMask, probe++)
+			{
+				if ( t.mSlots[slot].mHash == hash && *getEntry(t.mSlots[slot].mIndex) == key )
+				{
+					ret = t.mSlots[slot].mIndex;
+					break;
+				}
+			}
+			s.mFindCount++;
+			s.mProbeCount+=probe;
+			if ( probe > s.mMaxProbe )
+			{
+				s.mMaxProbe = probe;
+			}
+		}
+		return ret;
+	}
+
+	// Adds the slot for a new key, moves a few more slots over from the old table and starts a resize if the
+	// shard is now too full
+	void addSlot(Shard &s,uint32_t hash,uint32_t index)
+	{
+		if ( s.mTable.mSlots == NULL )
+		{
+			s.mTable.alloc(HASH_SHARD_INITIAL_SLOTS);
+		}
+		Slot slot;
+		slot.mHash = hash;
+		slot.mIndex = index;
+		s.mTable.place(slot);
+		if ( s.mOldTable.mSlots )
+		{
+			migrate(s,HASH_SHARD_MIGRATE_SLOTS);
+		}
+		if ( (uint64_t)s.mTable.mUsed*4 >= (uint64_t)s.mTable.getSlotCount()*3 )
+		{
+			grow(s);
+		}
+	}
+
+	void grow(Shard &s)
+	{
+		if ( s.mOldTable.mSlots ) // still migrating from the last resize; finish that first
+		{
+			migrate(s,s.mOldTable.getSlotCount());
+		}
+		Table grown;
+		if ( !grown.alloc(s.mTable.getSlotCount()*2) )
+		{
+			return; // the shard keeps filling its current table; processing stops at the end of the block
+		}
+		s.mOldTable = s.mTable;
+		s.mTable = grown;
+		s.mMigrateSlot = 0;
+		s.mResizeCount++;
+	}
+
+	// Moves 'slotCount' more slots of the shard's old table into the current one.  A key is only ever added to the
+	// current table, so none of the old slots can already be there.
+	void migrate(Shard &s,uint32_t slotCount)
+	{
+		uint32_t total = s.mOldTable.getSlotCount();
+		for (uint32_t i=0; i<slotCount && s.mMigrateSlot<total; i++, s.mMigrateSlot++)
+		{
+			if ( s.mOldTable.mSlots[s.mMigrateSlot].mIndex != HASH_NOT_FOUND )
+			{
+				s.mTable.place(s.mOldTable.mSlots[s.mMigrateSlot]);
+			}
+		}
+		if ( s.mMigrateSlot == total )
+		{
+			s.mOldTable.release();
+		}
+	}
+
+	// Rebuilds the shards' probe tables from the keys and drops the perfect hash
+	void thaw(void)
+	{
+		for (uint32_t i=0; i<mCount; i++)
+		{
+			uint32_t hash = mixHash(getEntry(i)->getHash());
+			addSlot(mShards[getShard(hash)],hash,i);
+		}
+		delete []mFrozenIndex;
+		mFrozenIndex = NULL;
+		mPerfectHash.release();
+	}
+
+	inline Key *getEntry(uint32_t index) const
+	{
+		return &mChunks[index>>HASH_CHUNK_SHIFT][index&(HASH_CHUNK_SIZE-1)];
+	}
+
+	// Returns the storage for a newly handed out index, allocating its chunk if this is the first index in it
+	Key *allocEntry(uint32_t index)
+	{
+		uint32_t chunk = index>>HASH_CHUNK_SHIFT;
+		while ( mChunkCount <= chunk ) // chunks are allocated in order so the destructor knows how many there are
+		{
+			Key *keys = new Key[HASH_CHUNK_SIZE];
+			uint32_t j = mChunkCount;
+			while ( j && (uintptr_t)mChunks[mChunkOrder[j-1]] > (uintptr_t)keys )
+			{
+				mChunkOrder[j] = mChunkOrder[j-1];
+				j--;
+			}
+			mChunkOrder[j] = mChunkCount;
+			mChunks[mChunkCount++] = keys;
+		}
+		return getEntry(index);
+	}
+
+	uint32_t			mCount;				// The number of dense indices handed out
+	Key					**mChunks;			// The keys, by index, in chunks of HASH_CHUNK_SIZE
+	uint32_t			*mChunkOrder;		// The chunk numbers sorted by the address of the chunk, for getIndex
+	uint32_t			mChunkCount;
+	mutable Shard		mShards[HASH_SHARD_COUNT];
+	MinimalPerfectHash	mPerfectHash;		// Replaces the shards once the table is frozen
+	uint32_t			*mFrozenIndex;		// The index of the key for each perfect hash slot; NULL unless frozen
+};
+
+// The transaction map is by far the largest table in the parser; there is one entry for every transaction ever
+// made.  Rather than store a full 32 byte hash and location record in every slot, each slot of the probe table
+// holds just a 32 bit fingerprint of the transaction hash and the 32 bit transaction index (8 bytes).  The full
+// hash and the packed file location live in side arrays indexed by the transaction index; the stored hash is only
+// read to verify a lookup once the fingerprint has already matched.  Transaction hashes are the output of a
+// cryptographic hash, so their bits are used directly: the low bits of the first word pick the home slot, its
+// high bits pick the shard and the second word supplies the fingerprint.
+//
+// Like ShardedHash the probe table is split into shards, each of which grows on its own and migrates its old slots
+// a few at a time as later inserts arrive.  Transaction indices are handed out by the caller.
+#define TX_SLOT_EMPTY 0xFFFFFFFF
+#define TX_MIGRATE_SLOTS 64								// How many slots of the old table are moved to the new one on each insert
+#define TX_FILE_BITS 10									// The packed location: 10 bits of file index, 30 bits of file offset, 24 bits of length
+#define TX_OFFSET_BITS 30
+#define TX_LENGTH_BITS 24
+#define TX_FIND_BATCH 64								// How many lookups findBatch keeps in flight
+
+class TransactionHashMap
 {
 public:
-	BigNumber(const uint8_t *sourceData,uint32_t len)
+	TransactionHashMap(void)
 	{
-		assert(len<MAX_BIG_NUMBER);
-		memset(data,0,MAX_BIG_NUMBER);
-		if ( sourceData )
+		mCount = 0;
+		mRecordCount = 0;
+		mHashes = new Hash256*[HASH_MAX_CHUNKS];
+		mLocations = new uint64_t*[HASH_MAX_CHUNKS];
+		memset(mHashes,0,sizeof(Hash256 *)*HASH_MAX_CHUNKS);
+		memset(mLocations,0,sizeof(uint64_t *)*HASH_MAX_CHUNKS);
+		mChunkCount = 0;
+		mFrozenIndex = NULL;
+	}
+
+	~TransactionHashMap(void)
+	{
+		delete []mFrozenIndex;
+		for (uint32_t i=0; i<mChunkCount; i++)
 		{
-			memcpy(data,sourceData,len);
+			delete []mHashes[i];
+			delete []mLocations[i];
+		}
+		delete []mHashes;
+		delete []mLocations;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			mShards[i].mTable.release();
+			mShards[i].mOldTable.release();
 		}
-		length = len;
 	}
-	uint8_t		data[MAX_BIG_NUMBER]; /**< The byte data. Should be little-endian */
-	uint32_t	length; /**< The length of this data in bytes */
-};
 
-//  Enums
+	// Records where transaction 'transactionIndex' lives on disk.  If this hash was already present (the same block
+	// read twice, or one of the two historical duplicate coinbase transactions) the existing slot is pointed at the
+	// new transaction index rather than adding another one, so 'find' always returns the most recent.
+	void insert(const Hash256 &hash,uint32_t transactionIndex,uint32_t fileIndex,uint32_t fileOffset,uint32_t fileLength)
+	{
+		assert( transactionIndex != TX_SLOT_EMPTY );
+		assert( fileIndex < (1<<TX_FILE_BITS) && fileOffset < (1<<TX_OFFSET_BITS) && fileLength < (1<<TX_LENGTH_BITS) );
+		allocRecord(transactionIndex);
+		*getHash(transactionIndex) = hash;
+		*getLocation(transactionIndex) = (uint64_t)fileIndex | ((uint64_t)fileOffset<<TX_FILE_BITS) | ((uint64_t)fileLength<<(TX_FILE_BITS+TX_OFFSET_BITS));
+		if ( transactionIndex >= mRecordCount )
+		{
+			mRecordCount = transactionIndex+1;
+		}
+		if ( mFrozenIndex )
+		{
+			thaw();
+		}
 
-enum BigNumberCompare 
-{
-	CB_COMPARE_MORE_THAN = 1, 
-	CB_COMPARE_EQUAL = 0, 
-	CB_COMPARE_LESS_THAN = -1, 
-};
+		if ( insertSlot(mShards[getShardIndex(hash)],hash,transactionIndex) )
+		{
+			mCount++;
+		}
+	}
 
-/**
- @brief Compares a BigNumber to an 8 bit integer. You can replicate "a op 58" as "BigNumberCompareToUInt8(a, 58) op 0" replacing "op" with a comparison operator.
- @param a The first BigNumber
- @returns The result of the comparison as a BigNumberCompare constant. Returns what a is in relation to b.
- */
-BigNumberCompare BigNumberCompareTo58(BigNumber * a);
-/**
- @brief Compares two BigNumber. You can replicate "a op b" as "BigNumberCompare(a, b) op 0" replacing "op" with a comparison operator.
- @param a The first BigNumber
- @param b The second BigNumber
- @returns The result of the comparison as a BigNumberCompare constant. Returns what a is in relation to b.
- */
-BigNumberCompare BigNumberCompareToBigInt(BigNumber * a, BigNumber * b);
-/**
- @brief Calculates the result of an addition of a BigNumber structure by another BigNumber structure and the first BigNumber becomes this new figure. Like "a += b".
- @param a A pointer to the BigNumber
- @param b A pointer to the second BigNumber
- @returns true on success, false on failure.
- */
-bool BigNumberEqualsAdditionByBigInt(BigNumber * a, BigNumber * b);
-/**
- @brief Calculates the result of a division of a BigNumber structure by 58 and the BigNumber becomes this new figure. Like "a /= 58".
- @param a A pointer to the BigNumber
- @param ans A memory block the same size as the BigNumber data memory block to store temporary data in calculations. Should be set with zeros.
- */
-void BigNumberEqualsDivisionBy58(BigNumber * a, uint8_t * ans);
-/**
- @brief Calculates the result of a multiplication of a BigNumber structure by an 8 bit integer and the BigNumber becomes this new figure. Like "a *= b".
- @param a A pointer to the BigNumber
- @param b An 8 bit integer
- @returns true on success, false on failure
- */
-bool BigNumberEqualsMultiplicationByUInt8(BigNumber * a, uint8_t b);
-/**
- @brief Calculates the result of a subtraction of a BigNumber structure with another BigNumber structure and the BigNumber becomes this new figure. Like "a -= b".
- @param a A pointer to a BigNumber
- @param b A pointer to a BigNumber
- */
-void BigNumberEqualsSubtractionByBigInt(BigNumber * a, BigNumber * b);
-/**
- @brief Calculates the result of a subtraction of a BigNumber structure by an 8 bit integer and the BigNumber becomes this new figure. Like "a -= b".
- @param a A pointer to the BigNumber
- @param b An 8 bit integer
- */
-void BigNumberEqualsSubtractionByUInt8(BigNumber * a, uint8_t b);
-/**
- @brief Assigns a BigNumber as the exponentiation of an unsigned 8 bit intger with another unsigned 8 bit integer. Like "a^b". Data must be freed.
- @param bi The BigNumber. Preallocate this with at least one byte.
- @param a The base
- @param b The exponent.
- @returns true on success, false on failure.
- */
-bool BigNumberFromPowUInt8(BigNumber * bi, uint8_t a, uint8_t b);
-/**
- @brief Returns the result of a modulo of a BigNumber structure and 58. Like "a % 58".
- @param a The BigNumber
- @returns The result of the modulo operation as an 8 bit integer.
- */
-uint8_t BigNumberModuloWith58(BigNumber * a);
-/**
- @brief Normalises a BigNumber so that there are no unnecessary trailing zeros.
- @param a A pointer to the BigNumber
- */
-void BigNumberNormalise(BigNumber * a);
-
-BigNumberCompare BigNumberCompareTo58(BigNumber * a)
-{
-	if(a->length > 1)
-		return CB_COMPARE_MORE_THAN;
-	if (a->data[0] > 58)
-		return CB_COMPARE_MORE_THAN;
-	else if (a->data[0] < 58)
-		return CB_COMPARE_LESS_THAN;
-	return CB_COMPARE_EQUAL;
-}
-
-BigNumberCompare BigNumberCompareToBigInt(BigNumber * a, BigNumber * b)
-{
-	if (a->length > b->length)
-		return CB_COMPARE_MORE_THAN;
-	else if (a->length < b->length)
-		return CB_COMPARE_LESS_THAN;
-	for (uint32_t x = a->length; x--;) 
+	// Returns true and the transaction index if this hash is known
+	bool find(const Hash256 &hash,uint32_t &transactionIndex) const
 	{
-		if (a->data[x] < b->data[x])
-			return CB_COMPARE_LESS_THAN;
-		else if (a->data[x] > b->data[x])
-			return CB_COMPARE_MORE_THAN;
+		if ( mFrozenIndex )
+		{
+			uint64_t fingerprint = getFrozenFingerprint(hash);
+			for (uint32_t slot=mPerfectHash.lookup(fingerprint); slot != MPH_NOT_FOUND; slot = mPerfectHash.next(slot,fingerprint))
+			{
+				if ( *getHash(mFrozenIndex[slot]) == hash )
+				{
+					transactionIndex = mFrozenIndex[slot];
+					return true;
+				}
+			}
+			transactionIndex = TX_SLOT_EMPTY;
+			return false;
+		}
+		Shard &s = mShards[getShardIndex(hash)];
+		transactionIndex = findIndex(s,s.mTable,hash);
+		if ( transactionIndex == TX_SLOT_EMPTY && s.mOldTable.mSlots )
+		{
+			transactionIndex = findIndex(s,s.mOldTable,hash);
+		}
+		return transactionIndex != TX_SLOT_EMPTY;
 	}
-	return CB_COMPARE_EQUAL;
-}
-bool BigNumberEqualsAdditionByBigInt(BigNumber * a, BigNumber * b)
-{
-	if (a->length < b->length) 
+
+	// Returns true and the disk location of the transaction with this hash
+	bool find(const Hash256 &hash,uint32_t &transactionIndex,uint32_t &fileIndex,uint32_t &fileOffset,uint32_t &fileLength) const
 	{
-		// Make certain expansion of data is empty
-		memset(a->data + a->length, 0, b->length - a->length);
-		a->length = b->length;
+		bool ret = find(hash,transactionIndex);
+		if ( ret )
+		{
+			uint64_t location = *getLocation(transactionIndex);
+			fileIndex = (uint32_t)(location & ((1<<TX_FILE_BITS)-1));
+			fileOffset = (uint32_t)((location>>TX_FILE_BITS) & ((1<<TX_OFFSET_BITS)-1));
+			fileLength = (uint32_t)(location>>(TX_FILE_BITS+TX_OFFSET_BITS));
+		}
+		return ret;
 	}
-	// a->length >= b->length
-	bool overflow = 0;
-	uint8_t x = 0;
-	for (; x < b->length; x++) 
+
+	// Looks up 'count' hashes at once, returning TX_SLOT_EMPTY for any which are not found.  A single lookup is
+	// two dependent cache misses (the slot, then the stored hash it is verified against) which would otherwise
+	// be taken one lookup at a time.  Here every home slot is prefetched first, then every candidate's stored
+	// hash, so the misses of the whole batch overlap.
+	void findBatch(const Hash256 *hashes,uint32_t count,uint32_t *transactionIndices) const
 	{
-		a->data[x] += b->data[x] + overflow;
-		// a->data[x] now equals the result of the addition.
-		// The overflow will never go beyond 1. Imagine a->data[x] == 0xff, b->data[x] == 0xff and the overflow is 1, the new overflow is still 1 and a->data[x] is 0xff. Therefore it does work.
-		overflow = (a->data[x] < (b->data[x] + overflow))? 1 : 0;
-	}
-	// Propagate overflow up the whole length of a if necessary
-	while (overflow && x < a->length)
-		overflow = ! ++a->data[x++]; // Index at x, increment x, increment data, test new value for overflow.
-	if (overflow) 
-	{ // Add extra byte
-		a->length++;
-		assert( a->length < MAX_BIG_NUMBER );
-		a->data[a->length - 1] = 1;
+		uint32_t candidates[TX_FIND_BATCH];
+		for (uint32_t base=0; base<count; base+=TX_FIND_BATCH)
+		{
+			uint32_t n = (count-base) < TX_FIND_BATCH ? (count-base) : TX_FIND_BATCH;
+			const Hash256 *h = &hashes[base];
+			for (uint32_t i=0; i<n; i++)
+			{
+				prefetchSlot(h[i]);
+			}
+			for (uint32_t i=0; i<n; i++)
+			{
+				candidates[i] = findCandidate(h[i]);
+				if ( candidates[i] != TX_SLOT_EMPTY )
+				{
+					prefetchMemory(getHash(candidates[i]));
+				}
+			}
+			for (uint32_t i=0; i<n; i++)
+			{
+				if ( candidates[i] != TX_SLOT_EMPTY && *getHash(candidates[i]) == h[i] )
+				{
+					transactionIndices[base+i] = candidates[i];
+				}
+				else if ( !find(h[i],transactionIndices[base+i]) ) // a false fingerprint match or not present; take the normal path
+				{
+					transactionIndices[base+i] = TX_SLOT_EMPTY;
+				}
+			}
+		}
 	}
-	return true;
-}
-void BigNumberEqualsDivisionBy58(BigNumber * a, uint8_t * ans)
-{
-	if (a->length == 1 && ! a->data[0]) // "a" is zero
-		return;
-	// base-256 long division.
-	uint16_t temp = 0;
-	for (uint32_t x = a->length; x--;) 
+
+	// The number of distinct transaction hashes
+	inline uint32_t size(void) const
 	{
-		temp <<= 8;
-		temp |= a->data[x];
-		ans[x] = (uint8_t)(temp / 58);
-		temp -= ans[x] * 58;
+		return mCount;
 	}
-	if (! ans[a->length-1]) // If last byte is zero, adjust length.
-		a->length--;
-	memmove(a->data, ans, a->length); // Done calculation. Move ans to "a".
-}
-bool BigNumberEqualsMultiplicationByUInt8(BigNumber * a, uint8_t b)
-{
-	if (! b) 
+
+	// Once processing is complete, replaces the probe tables with a minimal perfect hash over the distinct hashes
+	// plus one 32 bit transaction index per hash.  The first insert afterwards thaws the index.
+	void freeze(uint32_t threadCount)
 	{
-		// Mutliplication by zero. "a" becomes zero
-		a->length = 1;
-		a->data[0] = 0;
-		return true;
+		if ( mFrozenIndex || mCount == 0 )
+		{
+			return;
+		}
+		uint32_t *transactions = new uint32_t[mCount];
+		uint32_t count = 0;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			Shard &s = mShards[i];
+			if ( s.mOldTable.mSlots )
+			{
+				migrate(s,s.mOldTable.getSlotCount());
+			}
+			for (uint32_t j=0; j<s.mTable.getSlotCount(); j++)
+			{
+				if ( s.mTable.mSlots[j].mTransactionIndex != TX_SLOT_EMPTY )
+				{
+					transactions[count++] = s.mTable.mSlots[j].mTransactionIndex;
+				}
+			}
+			s.mTable.release();
+		}
+		assert( count == mCount );
+		uint64_t *fingerprints = new uint64_t[count];
+		for (uint32_t i=0; i<count; i++)
+		{
+			fingerprints[i] = getFrozenFingerprint(*getHash(transactions[i]));
+		}
+		uint32_t *slots = new uint32_t[count];
+		mPerfectHash.build(fingerprints,count,slots,threadCount);
+		mFrozenIndex = new uint32_t[count];
+		for (uint32_t i=0; i<count; i++)
+		{
+			mFrozenIndex[slots[i]] = transactions[i];
+		}
+		delete []slots;
+		delete []fingerprints;
+		delete []transactions;
 	}
-	if (a->length == 1 && ! a->data[0]) // "a" is zero
-		return true;
-	// Multiply b by each byte and then add to answer
-	uint16_t carry = 0;
-	uint8_t x = 0;
-	for (; x < a->length; x++) 
+
+	inline bool isFrozen(void) const
 	{
-		carry = carry + a->data[x] * b; // Allow for overflow onto next byte.
-		a->data[x] = (uint8_t)carry;
-		carry >>= 8;
-	}
-	if (carry) 
-	{ // If last byte is not zero, adjust length.
-		a->length++;
-		assert( a->length < MAX_BIG_NUMBER );
-		a->data[x] = (uint8_t)carry;
-	}
-	return true;
-}
-void BigNumberEqualsSubtractionByBigInt(BigNumber * a, BigNumber * b)
-{
-	uint8_t x;
-	bool carry = 0;
-	// This can be made much nicer when using signed arithmetic, 
-	// carry and tmp could be merged to be 0 or -1 between rounds.
-	for (x = 0; x < b->length; x++) {
-		uint16_t tmp = carry + b->data[x];
-		carry = a->data[x] < tmp;
-		a->data[x] -= (uint8_t)tmp;
+		return mFrozenIndex ? true : false;
 	}
-	if (carry)
-		a->data[x]--;
-	BigNumberNormalise(a);
-}
 
-void BigNumberEqualsSubtractionByUInt8(BigNumber * a, uint8_t b)
-{
-	uint8_t carry = b;
-	uint8_t x = 0;
-	for (; a->data[x] < carry; x++){
-		a->data[x] = 255 - carry + a->data[x] + 1;
-		carry = 1;
+	// Forgets every transaction with an index of 'recordCount' or more, as when the blocks they were read from are
+	// disconnected.  A hash whose slot was pointed at a later transaction since is left to that one.  When one of the
+	// two duplicate coinbase transactions is dropped the earlier one is not put back, but those are far too deep in
+	// the chain to be disconnected.  Not thread safe.
+	void truncate(uint32_t recordCount)
+	{
+		if ( recordCount >= mRecordCount )
+		{
+			return;
+		}
+		if ( mFrozenIndex )
+		{
+			thaw();
+		}
+		for (uint32_t index=mRecordCount; index-- > recordCount; )
+		{
+			const Hash256 &hash = *getHash(index);
+			Shard &s = mShards[getShardIndex(hash)];
+			if ( s.mOldTable.mSlots )
+			{
+				migrate(s,s.mOldTable.getSlotCount());
+			}
+			if ( s.mTable.mSlots && s.mTable.remove(hash,index,*this) )
+			{
+				mCount--;
+			}
+		}
+		mRecordCount = recordCount;
 	}
-	a->data[x] -= carry;
-	BigNumberNormalise(a);
-}
 
-bool BigNumberFromPowUInt8(BigNumber * bi, uint8_t a, uint8_t b)
-{
-	bi->length = 1;
-	bi->data[0] = 1;
-	for (uint8_t x = 0; x < b; x++) {
-		if (! BigNumberEqualsMultiplicationByUInt8(bi, a))
-			// ERROR
-			return false;
+	// Writes the map for the state image: the record and hash counts, the hashes and locations by transaction index,
+	// then each shard's probe table as a slot count followed by the slots.  Any migration still in progress is
+	// finished and a frozen map is thawed first, so only the current tables need to be kept.
+	bool writeImage(FILE *fph,uint64_t &size)
+	{
+		if ( mFrozenIndex )
+		{
+			thaw();
+		}
+		uint32_t counts[2] = { mRecordCount, mCount };
+		bool ok = fwrite(counts,sizeof(counts),1,fph) == 1;
+		size = sizeof(counts);
+		for (uint32_t i=0; i<mRecordCount && ok; i+=HASH_CHUNK_SIZE)
+		{
+			uint32_t n = (mRecordCount-i) < HASH_CHUNK_SIZE ? (mRecordCount-i) : HASH_CHUNK_SIZE;
+			ok = fwrite(getHash(i),sizeof(Hash256),n,fph) == n;
+		}
+		for (uint32_t i=0; i<mRecordCount && ok; i+=HASH_CHUNK_SIZE)
+		{
+			uint32_t n = (mRecordCount-i) < HASH_CHUNK_SIZE ? (mRecordCount-i) : HASH_CHUNK_SIZE;
+			ok = fwrite(getLocation(i),sizeof(uint64_t),n,fph) == n;
+		}
+		size+=(uint64_t)mRecordCount*(sizeof(Hash256)+sizeof(uint64_t));
+		for (uint32_t i=0; i<HASH_SHARD_COUNT && ok; i++)
+		{
+			Shard &s = mShards[i];
+			if ( s.mOldTable.mSlots )
+			{
+				migrate(s,s.mOldTable.getSlotCount());
+			}
+			uint32_t slotCount = s.mTable.getSlotCount();
+			ok = fwrite(&slotCount,sizeof(slotCount),1,fph) == 1 && fwrite(s.mTable.mSlots,sizeof(Slot),slotCount,fph) == slotCount;
+			size+=sizeof(slotCount)+(uint64_t)slotCount*sizeof(Slot);
+		}
+		return ok;
 	}
-	return true;
-}
 
-uint8_t BigNumberModuloWith58(BigNumber * a)
-{
-	// Use method presented here: http://stackoverflow.com/a/10441333/238411
-	uint16_t result = 0; // Prevent overflow in calculations
-	for(uint32_t x = a->length - 1;; x--){
-		result *= (256 % 58);
-		result %= 58;
-		result += a->data[x] % 58;
-		result %= 58;
-		if (! x)
-			break;
-	}
-	return (uint8_t)result;
-}
-
-void BigNumberNormalise(BigNumber * a)
-{
-	while (a->length > 1 && ! a->data[a->length-1])
-		a->length--;
-}
-
-//                                                  1         2         3         4         5    
-//                                        01234567890123456789012345678901234567890123456789012345678
-static const char base58Characters[59] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
-
-/**
- @brief Decodes base 58 string into byte data as a BigNumber.
- @param bi The BigNumber which should be preallocated with at least one byte.
- @param str Base 58 string to decode.
- @returns true on success, false on failure.
- */
-bool CBDecodeBase58(BigNumber * bi,const char * str)
-{
-	// ??? Quite likely these functions can be improved
-	BigNumber bi2(NULL,1);
-
-	uint32_t slen = (uint32_t)strlen(str);
-
-	for (uint32_t x = slen - 1;; x--)
-	{ // Working backwards
-		// Get index in alphabet array
-		uint8_t alphaIndex = str[x];
-		if (alphaIndex != 49)
-		{ // If not 1
-			if (str[x] < 58)
-			{ // Numbers
-				alphaIndex -= 49;
-			}
-			else if (str[x] < 73)
-			{ // A-H
-				alphaIndex -= 56;
-			}
-			else if (str[x] < 79)
-			{ // J-N
-				alphaIndex -= 57;
-			}
-			else if (str[x] < 91)
-			{ // P-Z
-				alphaIndex -= 58;
-			}
-			else if (str[x] < 108)
-			{ // a-k
-				alphaIndex -= 64;
-			}
-			else
-			{ // m-z
-				alphaIndex -= 65;
-			}
-			if (! BigNumberFromPowUInt8(&bi2, 58, (uint8_t)(slen - 1 - x)))
+	// Restores the map from a state image written by writeImage
+	bool readImage(const uint8_t *data,uint64_t size)
+	{
+		uint32_t counts[2];
+		if ( size < sizeof(counts) )
+		{
+			return false;
+		}
+		memcpy(counts,data,sizeof(counts));
+		uint64_t offset = sizeof(counts);
+		uint32_t recordCount = counts[0];
+		if ( offset+(uint64_t)recordCount*(sizeof(Hash256)+sizeof(uint64_t)) > size )
+		{
+			return false;
+		}
+		if ( recordCount )
+		{
+			allocRecord(recordCount-1);
+		}
+		for (uint32_t i=0; i<recordCount; i+=HASH_CHUNK_SIZE)
+		{
+			uint32_t n = (recordCount-i) < HASH_CHUNK_SIZE ? (recordCount-i) : HASH_CHUNK_SIZE;
+			memcpy((void *)getHash(i),&data[offset+(uint64_t)i*sizeof(Hash256)],sizeof(Hash256)*n);
+			memcpy(getLocation(i),&data[offset+(uint64_t)recordCount*sizeof(Hash256)+(uint64_t)i*sizeof(uint64_t)],sizeof(uint64_t)*n);
+		}
+		offset+=(uint64_t)recordCount*(sizeof(Hash256)+sizeof(uint64_t));
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			Shard &s = mShards[i];
+			uint32_t slotCount;
+			if ( offset+sizeof(slotCount) > size )
 			{
-				// Error occured.
 				return false;
 			}
-			if (! BigNumberEqualsMultiplicationByUInt8(&bi2, alphaIndex))
+			memcpy(&slotCount,&data[offset],sizeof(slotCount));
+			offset+=sizeof(slotCount);
+			if ( (slotCount & (slotCount-1)) || offset+(uint64_t)slotCount*sizeof(Slot) > size )
 			{
-				// Error occured.
 				return false;
 			}
-			if (! BigNumberEqualsAdditionByBigInt(bi, &bi2))
+			s.mTable.release();
+			s.mOldTable.release();
+			s.mMigrateSlot = 0;
+			if ( slotCount )
 			{
-				// Error occured.
-				return false;
+				if ( !s.mTable.alloc(slotCount) )
+				{
+					return false;
+				}
+				memcpy(s.mTable.mSlots,&data[offset],sizeof(Slot)*slotCount);
+				offset+=(uint64_t)slotCount*sizeof(Slot);
+				for (uint32_t j=0; j<slotCount; j++)
+				{
+					if ( s.mTable.mSlots[j].mTransactionIndex != TX_SLOT_EMPTY )
+					{
+						s.mTable.mUsed++;
+					}
+				}
 			}
 		}
-		if (!x)
-			break;
+		mRecordCount = recordCount;
+		mCount = counts[1];
+		return offset == size;
 	}
-	// Got BigNumber from base-58 string. Add zeros on end.
-	uint8_t zeros = 0;
-	for (uint8_t x = 0; x < slen; x++)
+
+	void report(const char *name) const
 	{
-		if (str[x] == '1')
+		if ( mFrozenIndex )
 		{
-			zeros++;
+			uint64_t memory = mPerfectHash.getMemory() + (uint64_t)mCount*sizeof(uint32_t) + (uint64_t)mRecordCount*(sizeof(Hash256)+sizeof(uint64_t));
+			printf("%s index: %s hashes frozen into a minimal perfect hash; %d levels, %0.2f bits per key for the hash, %0.1f bytes per transaction.\r\n",
+				name,
+				formatNumber(mCount),
+				mPerfectHash.getLevelCount(),
+				(double)mPerfectHash.getMemory()*8/(double)mCount,
+				mRecordCount ? (double)memory/(double)mRecordCount : 0.0);
+			return;
 		}
-		else
-		{
-			break;
+		uint32_t slots = 0;
+		uint32_t used = 0;
+		uint32_t resizeCount = 0;
+		uint32_t maxProbe = 0;
+		uint64_t findCount = 0;
+		uint64_t probeCount = 0;
+		uint64_t falseMatchCount = 0;
+		for (uint32_t i=0; i<HASH_SHARD_COUNT; i++)
+		{
+			const Shard &s = mShards[i];
+			slots+=s.mTable.getSlotCount() + s.mOldTable.getSlotCount();
+			used+=s.mTable.mUsed + s.mOldTable.mUsed;
+			resizeCount+=s.mResizeCount;
+			findCount+=s.mFindCount;
+			probeCount+=s.mProbeCount;
+			falseMatchCount+=s.mFalseMatchCount;
+			if ( s.mMaxProbe > maxProbe )
+			{
+				maxProbe = s.mMaxProbe;
+			}
 		}
+		uint64_t memory = (uint64_t)slots*sizeof(Slot) + (uint64_t)mRecordCount*(sizeof(Hash256)+sizeof(uint64_t));
+		printf("%s index: %s hashes in %s slots over %d shards; load factor %0.2f, %0.2f slots probed per lookup (longest %d), %s false fingerprint matches, %d shard resizes, %0.1f bytes per transaction.\r\n",
+			name,
+			formatNumber(mCount),
+			formatNumber(slots),
+			HASH_SHARD_COUNT,
+			slots ? (float)used/(float)slots : 0.0f,
+			findCount ? (double)probeCount/(double)findCount : 0.0,
+			maxProbe,
+			formatNumber((int32_t)falseMatchCount),
+			resizeCount,
+			mRecordCount ? (double)memory/(double)mRecordCount : 0.0);
 	}
-	if (zeros) 
+
+private:
+	class Slot
 	{
-		bi->length += zeros;
-		assert( bi->length < MAX_BIG_NUMBER );
-		memset(bi->data + bi->length - zeros, 0, zeros);
+	public:
+		uint32_t	mFingerprint;
+		uint32_t	mTransactionIndex;	// TX_SLOT_EMPTY if the slot is unused
+	};
+
+	static inline uint32_t getSlotHash(const Hash256 &hash)
+	{
+		return (uint32_t)hash.mWord0;
 	}
-	return true;
-}
 
-bool CBEncodeBase58(BigNumber * bi,char *str,uint32_t maxStrLen)
-{
-	if ( maxStrLen < bi->length ) // must be at least twice the size of the binary
+	static inline uint32_t getFingerprint(const Hash256 &hash)
 	{
-		return false;
+		return (uint32_t)hash.mWord1;
 	}
-	uint32_t x = 0;
-	// Zeros
-	for (uint32_t y = bi->length - 1;; y--)
+
+	// The perfect hash uses bits the probe tables do not
+	static inline uint64_t getFrozenFingerprint(const Hash256 &hash)
 	{
-		if (! bi->data[y])
+		return hash.mWord2;
+	}
+
+	static inline uint32_t getShardIndex(const Hash256 &hash)
+	{
+		return (uint32_t)(hash.mWord0>>(64-HASH_SHARD_BITS));
+	}
+
+	// One generation of the linear probed table
+	class Table
+	{
+	public:
+		Table(void)
 		{
-			str[x] = '1';
-			x++;
-			if (! y)
-				break;
+			mSlots = NULL;
+			mMask = 0;
+			mUsed = 0;
 		}
-		else
+
+		// Returns false, leaving the table empty, if the slots could not be allocated
+		bool alloc(uint32_t slotCount)
 		{
-			break;
+			mUsed = 0;
+			mSlots = (Slot *)allocPages(sizeof(Slot)*(uint64_t)slotCount);
+			if ( mSlots == NULL )
+			{
+				mMask = 0;
+				return false;
+			}
+			mMask = slotCount-1;
+			memset(mSlots,0xFF,sizeof(Slot)*slotCount);
+			return true;
 		}
-	}
-	uint32_t zeros = x;
-	// Make temporary data store
-	uint8_t temp[MAX_BIG_NUMBER];
-	// Encode
-	uint8_t mod;
-	size_t size = bi->length;
-	for (;BigNumberCompareTo58(bi) >= 0;x++) 
-	{
-		mod = BigNumberModuloWith58(bi);
-		if (bi->length < x + 3) 
+
+		void release(void)
 		{
-			size = x + 3;
-			if (size > bi->length) 
+			if ( mSlots )
 			{
-				if ( size > maxStrLen )
+				freePages(mSlots,sizeof(Slot)*(uint64_t)(mMask+1));
+			}
+			mSlots = NULL;
+			mMask = 0;
+			mUsed = 0;
+		}
+
+		inline uint32_t getSlotCount(void) const
+		{
+			return mSlots ? mMask+1 : 0;
+		}
+
+		// If the hash is present, points its slot at 'transactionIndex' and returns true
+		inline bool replace(const Hash256 &hash,uint32_t transactionIndex,const TransactionHashMap &owner)
+		{
+			uint32_t fingerprint = getFingerprint(hash);
+			for (uint32_t slot = getSlotHash(hash) & mMask; mSlots[slot].mTransactionIndex != TX_SLOT_EMPTY; slot = (slot+1) & mMask)
+			{
+				if ( mSlots[slot].mFingerprint == fingerprint && *owner.getHash(mSlots[slot].mTransactionIndex) == hash )
+				{
+					mSlots[slot].mTransactionIndex = transactionIndex;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Adds a slot for the hash and returns true.  If the hash is already present its slot is pointed at
+		// 'transactionIndex' when 'replaceExisting' is true, or left alone otherwise, and false is returned.
+		inline bool insert(const Hash256 &hash,uint32_t transactionIndex,bool replaceExisting,const TransactionHashMap &owner)
+		{
+			uint32_t fingerprint = getFingerprint(hash);
+			uint32_t slot = getSlotHash(hash) & mMask;
+			for (; mSlots[slot].mTransactionIndex != TX_SLOT_EMPTY; slot = (slot+1) & mMask)
+			{
+				if ( mSlots[slot].mFingerprint == fingerprint && *owner.getHash(mSlots[slot].mTransactionIndex) == hash )
 				{
+					if ( replaceExisting )
+					{
+						mSlots[slot].mTransactionIndex = transactionIndex;
+					}
 					return false;
 				}
 			}
+			mSlots[slot].mFingerprint = fingerprint;
+			mSlots[slot].mTransactionIndex = transactionIndex;
+			mUsed++;
+			return true;
 		}
-		str[x] = base58Characters[mod];
-		BigNumberEqualsSubtractionByUInt8(bi, mod);
-		memset(temp, 0, bi->length);
-		BigNumberEqualsDivisionBy58(bi, temp);
-	}
-	str[x] = base58Characters[bi->data[bi->length-1]];
-	x++;
-	// Reversal
-	for (uint8_t y = 0; y < (x-zeros) / 2; y++) 
-	{
-		char temp = str[y+zeros];
-		str[y+zeros] = str[x-y-1];
-		str[x-y-1] = temp;
-	}
-	str[x] = '\0';
-	return true;
-}
 
+		// If the hash's slot holds 'transactionIndex', empties it, moves back any later slot of the same run which
+		// would otherwise become unreachable and returns true
+		inline bool remove(const Hash256 &hash,uint32_t transactionIndex,const TransactionHashMap &owner)
+		{
+			uint32_t i = getSlotHash(hash) & mMask;
+			for (; mSlots[i].mTransactionIndex != transactionIndex; i = (i+1) & mMask)
+			{
+				if ( mSlots[i].mTransactionIndex == TX_SLOT_EMPTY )
+				{
+					return false;
+				}
+			}
+			uint32_t j = i;
+			for (;;)
+			{
+				j = (j+1) & mMask;
+				if ( mSlots[j].mTransactionIndex == TX_SLOT_EMPTY )
+				{
+					break;
+				}
+				uint32_t home = getSlotHash(*owner.getHash(mSlots[j].mTransactionIndex)) & mMask;
+				// The slot at j may move to i only if its home is not cyclically within (i,j]
+				bool between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+				if ( !between )
+				{
+					mSlots[i] = mSlots[j];
+					i = j;
+				}
+			}
+			mSlots[i].mFingerprint = TX_SLOT_EMPTY;
+			mSlots[i].mTransactionIndex = TX_SLOT_EMPTY;
+			mUsed--;
+			return true;
+		}
 
+		Slot			*mSlots;
+		uint32_t		mMask;				// The number of slots minus one
+		uint32_t		mUsed;				// The number of occupied slots
+	};
 
+	class Shard
+	{
+	public:
+		Shard(void)
+		{
+			mMigrateSlot = 0;
+			mResizeCount = 0;
+			mFindCount = 0;
+			mProbeCount = 0;
+			mMaxProbe = 0;
+			mFalseMatchCount = 0;
+		}
+
+		Table		mTable;				// The current table
+		Table		mOldTable;			// The previous table while its slots are being migrated after a resize
+		uint32_t	mMigrateSlot;		// The next slot of the old table to migrate
+		uint32_t	mResizeCount;
+		uint64_t	mFindCount;			// Probe statistics
+		uint64_t	mProbeCount;
+		uint32_t	mMaxProbe;
+		uint64_t	mFalseMatchCount;	// Fingerprint matches which turned out to be a different hash
+	};
 
-bool encodeBase58(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
-					   uint32_t length,			 // The number of bytes in the 'big-number'; this will be 25 for a bitcoin address
-					   bool littleEndian,		 // True if the input number is in little-endian format (this will be true for a bitcoin address)
-					   char *output,			 // The address to store the output string.
-					   uint32_t maxStrLen)		 // the maximum length of the output string
-{
-	// Before passing the hash into the base58 encoder; we need to reverse the byte order.
-	uint8_t hash[25];
-	if ( littleEndian )
+	inline Hash256 *getHash(uint32_t transactionIndex) const
 	{
-		uint32_t index = length-1;
-		for (uint32_t i=0; i<25; i++)
-		{
-			hash[i] = bigNumber[index];
-			index--;
-		}
+		return &mHashes[transactionIndex>>HASH_CHUNK_SHIFT][transactionIndex&(HASH_CHUNK_SIZE-1)];
 	}
-	else
+
+	inline uint64_t *getLocation(uint32_t transactionIndex) const
 	{
-		memcpy(hash,bigNumber,length);
+		return &mLocations[transactionIndex>>HASH_CHUNK_SHIFT][transactionIndex&(HASH_CHUNK_SIZE-1)];
 	}
-	// We now have the 25 byte public key address in binary; we just need to convert it to ASCII
-	// This involves using large integer math to compute the base58 encoding (with check) 
-	BigNumber bytes(hash,length);;
-	return CBEncodeBase58(&bytes,output,maxStrLen);
-}
 
-uint32_t decodeBase58(const char *string,		// The base58 encoded string
-					   uint8_t *output,			// The output binary buffer
-					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
-					   bool littleEndian) // If the output needs to be in little endian format
-{
-	uint32_t ret = 0;
-
-	BigNumber bn(NULL,0);
-	if ( CBDecodeBase58(&bn,string) && bn.length <= maxOutputLength )
+	inline uint32_t findIndex(Shard &s,const Table &t,const Hash256 &hash) const
 	{
-		ret = bn.length;
-		if ( littleEndian ) // if the caller wants the number returned in little endian format; then we byte reverse the output
+		uint32_t ret = TX_SLOT_EMPTY;
+		if ( t.mSlots )
 		{
-			uint32_t index = bn.length-1;
-			for (uint32_t i=0; i<bn.length; i++)
+			uint32_t fingerprint = getFingerprint(hash);
+			uint32_t slot = getSlotHash(hash) & t.mMask;
+			uint32_t probe = 1;
+			for (; t.mSlots[slot].mTransactionIndex != TX_SLOT_EMPTY; slot = (slot+1) & t.mMask, probe++)
 			{
-				output[i] = bn.data[index];
-				index--;
+				if ( t.mSlots[slot].mFingerprint == fingerprint )
+				{
+					if ( *getHash(t.mSlots[slot].mTransactionIndex) == hash )
+					{
+						ret = t.mSlots[slot].mTransactionIndex;
+						break;
+					}
+					s.mFalseMatchCount++;
+				}
+			}
+			s.mFindCount++;
+			s.mProbeCount+=probe;
+			if ( probe > s.mMaxProbe )
+			{
+				s.mMaxProbe = probe;
 			}
 		}
-		else
-		{
-			memcpy(output,bn.data,bn.length);
-		}
+		return ret;
 	}
 
-	return ret;
-}
-
-}; // end of namespace
-
-// ************ Beginning of source to compute bitcoin addresses from public keys, etc.
-namespace BLOCKCHAIN_BITCOIN_ADDRESS
-{
-
-bool bitcoinPublicKeyToAddress(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
-							   uint8_t output[25])		// A bitcoin address (in binary( is always 25 bytes long.
-{
-	bool ret = false;
-
-	if ( input[0] == 0x04)
+	// Makes sure the side array chunk holding this transaction index exists
+	void allocRecord(uint32_t transactionIndex)
 	{
-		uint8_t hash1[32]; // holds the intermediate SHA256 hash computations
-		BLOCKCHAIN_SHA256::computeSHA256(input,65,hash1);	// Compute the SHA256 hash of the input public ECSDA signature
-		output[0] = 0;	// Store a network byte of 0 (i.e. 'main' network)
-		BLOCKCHAIN_RIPEMD160::computeRIPEMD160(hash1,32,&output[1]);	// Compute the RIPEMD160 (20 byte) hash of the SHA256 hash
-		BLOCKCHAIN_SHA256::computeSHA256(output,21,hash1);	// Compute the SHA256 hash of the RIPEMD16 hash + the one byte header (for a checksum)
-		BLOCKCHAIN_SHA256::computeSHA256(hash1,32,hash1); // now compute the SHA256 hash of the previously computed SHA256 hash (for a checksum)
-		output[21] = hash1[0];	// Store the checksum in the last 4 bytes of the public key hash
-		output[22] = hash1[1];
-		output[23] = hash1[2];
-		output[24] = hash1[3];
-		ret = true;
+		uint32_t chunk = transactionIndex>>HASH_CHUNK_SHIFT;
+		while ( mChunkCount <= chunk ) // chunks are allocated in order so the destructor knows how many there are
+		{
+			mHashes[mChunkCount] = new Hash256[HASH_CHUNK_SIZE];
+			mLocations[mChunkCount] = new uint64_t[HASH_CHUNK_SIZE];
+			mChunkCount++;
+		}
 	}
-	return ret;
-}
 
+	// Starts loading the slot (or perfect hash bits) where a lookup of this hash begins
+	inline void prefetchSlot(const Hash256 &hash) const
+	{
+		if ( mFrozenIndex )
+		{
+			mPerfectHash.prefetch(getFrozenFingerprint(hash));
+		}
+		else
+		{
+			const Table &t = mShards[getShardIndex(hash)].mTable;
+			if ( t.mSlots )
+			{
+				prefetchMemory(&t.mSlots[getSlotHash(hash) & t.mMask]);
+			}
+		}
+	}
 
-bool bitcoinPublicKeyToAscii(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
-							 char *output,				// The output ascii representation.
-							 uint32_t maxOutputLen) // convert a binary bitcoin address into ASCII
-{
-	bool ret = false;
+	// Returns the transaction index of the first slot whose fingerprint matches, without verifying the full hash
+	uint32_t findCandidate(const Hash256 &hash) const
+	{
+		uint32_t ret = TX_SLOT_EMPTY;
+		if ( mFrozenIndex )
+		{
+			uint32_t slot = mPerfectHash.lookup(getFrozenFingerprint(hash));
+			if ( slot != MPH_NOT_FOUND )
+			{
+				ret = mFrozenIndex[slot];
+			}
+			return ret;
+		}
+		Shard &s = mShards[getShardIndex(hash)];
+		uint32_t fingerprint = getFingerprint(hash);
+		for (uint32_t pass=0; pass<2 && ret == TX_SLOT_EMPTY; pass++)
+		{
+			const Table &t = pass ? s.mOldTable : s.mTable;
+			if ( t.mSlots )
+			{
+				uint32_t probe = 1;
+				for (uint32_t slot = getSlotHash(hash) & t.mMask; t.mSlots[slot].mTransactionIndex != TX_SLOT_EMPTY; slot = (slot+1) & t.mMask, probe++)
+				{
+					if ( t.mSlots[slot].mFingerprint == fingerprint )
+					{
+						ret = t.mSlots[slot].mTransactionIndex;
+						break;
+					}
+				}
+				s.mFindCount++;
+				s.mProbeCount+=probe;
+				if ( probe > s.mMaxProbe )
+				{
+					s.mMaxProbe = probe;
+				}
+			}
+		}
+		return ret;
+	}
 
-	output[0] = 0;
+	// Adds or repoints the slot for this hash in the shard; returns true if the hash is new
+	bool insertSlot(Shard &s,const Hash256 &hash,uint32_t transactionIndex)
+	{
+		if ( s.mTable.mSlots == NULL )
+		{
+			s.mTable.alloc(HASH_SHARD_INITIAL_SLOTS);
+		}
+		// Migrated slots are not cleared from the old table, so the hash can be in both tables; find looks in the
+		// current table first, so it has to be repointed there as well as in the old one
+		bool ret;
+		if ( s.mOldTable.mSlots && s.mOldTable.replace(hash,transactionIndex,*this) )
+		{
+			s.mTable.replace(hash,transactionIndex,*this);
+			ret = false;
+		}
+		else
+		{
+			ret = s.mTable.insert(hash,transactionIndex,true,*this);
+		}
+		if ( s.mOldTable.mSlots )
+		{
+			migrate(s,TX_MIGRATE_SLOTS);
+		}
+		if ( (uint64_t)s.mTable.mUsed*4 >= (uint64_t)s.mTable.getSlotCount()*3 )
+		{
+			grow(s);
+		}
+		return ret;
+	}
 
-	uint8_t hash2[25];
+	// Rebuilds the probe tables from the perfect hash and drops it
+	void thaw(void)
+	{
+		for (uint32_t i=0; i<mPerfectHash.size(); i++)
+		{
+			uint32_t transactionIndex = mFrozenIndex[i];
+			insertSlot(mShards[getShardIndex(*getHash(transactionIndex))],*getHash(transactionIndex),transactionIndex);
+		}
+		delete []mFrozenIndex;
+		mFrozenIndex = NULL;
+		mPerfectHash.release();
+	}
 
-	if ( bitcoinPublicKeyToAddress(input,hash2))
+	void grow(Shard &s)
 	{
-		ret = BLOCKCHAIN_BASE58::encodeBase58(hash2,25,true,output,maxOutputLen);
+		if ( s.mOldTable.mSlots ) // still migrating from the last resize; finish that first
+		{
+			migrate(s,s.mOldTable.getSlotCount());
+		}
+		Table grown;
+		if ( !grown.alloc(s.mTable.getSlotCount()*2) )
+		{
+			return; // the shard keeps filling its current table; processing stops at the end of the block
+		}
+		s.mOldTable = s.mTable;
+		s.mTable = grown;
+		s.mMigrateSlot = 0;
+		s.mResizeCount++;
 	}
-	return ret;
-}
 
-bool bitcoinAsciiToAddress(const char *input,uint8_t output[25]) // convert an ASCII bitcoin address into binary.
-{
-	bool ret = false;
-	uint32_t len = BLOCKCHAIN_BASE58::decodeBase58(input,output,25,true);
-	if ( len == 25 ) // the output must be *exactly* 25 bytes!
+	// Moves 'slotCount' more slots of the shard's old table into the current one
+	void migrate(Shard &s,uint32_t slotCount)
 	{
-		uint8_t checksum[32];
-		BLOCKCHAIN_SHA256::computeSHA256(output,21,checksum);
-		BLOCKCHAIN_SHA256::computeSHA256(checksum,32,checksum);
-		if ( output[21] == checksum[0] ||
-			 output[22] == checksum[1] ||
-			 output[23] == checksum[2] ||
-			 output[24] == checksum[3] )
+		uint32_t total = s.mOldTable.getSlotCount();
+		for (uint32_t i=0; i<slotCount && s.mMigrateSlot<total; i++, s.mMigrateSlot++)
 		{
-			ret = true; // the cheksum matches!
+			uint32_t transactionIndex = s.mOldTable.mSlots[s.mMigrateSlot].mTransactionIndex;
+			if ( transactionIndex != TX_SLOT_EMPTY )
+			{
+				// A hash inserted since the resize started is already in the new table with a newer index; keep that one
+				s.mTable.insert(*getHash(transactionIndex),transactionIndex,false,*this);
+			}
+		}
+		if ( s.mMigrateSlot == total )
+		{
+			s.mOldTable.release();
 		}
 	}
-	return ret;
-}
 
+	uint32_t			mCount;				// The number of distinct hashes
+	uint32_t			mRecordCount;		// One more than the highest transaction index recorded
+	Hash256				**mHashes;			// The full hash of each transaction, by transaction index, in chunks of HASH_CHUNK_SIZE
+	uint64_t			**mLocations;		// The packed file location of each transaction, by transaction index
+	uint32_t			mChunkCount;
+	mutable Shard		mShards[HASH_SHARD_COUNT];
+	MinimalPerfectHash	mPerfectHash;		// Replaces the probe tables once the index is frozen
+	uint32_t			*mFrozenIndex;		// The transaction index for each perfect hash slot; NULL unless frozen
+};
 
+typedef SimpleHash< BlockHeader > BlockHeaderMap;
 
-void bitcoinRIPEMD160ToAddress(const uint8_t ripeMD160[20],uint8_t output[25])
+//*********** Begin of Source Code for RIPEMD160 hash *********************************
+namespace BLOCKCHAIN_RIPEMD160
 {
-	uint8_t hash1[32]; // holds the intermediate SHA256 hash computations
-	output[0] = 0;	// Store a network byte of 0 (i.e. 'main' network)
-	memcpy(&output[1],ripeMD160,20); // copy the 20 byte of the public key address
-	BLOCKCHAIN_SHA256::computeSHA256(output,21,hash1);	// Compute the SHA256 hash of the RIPEMD16 hash + the one byte header (for a checksum)
-	BLOCKCHAIN_SHA256::computeSHA256(hash1,32,hash1); // now compute the SHA256 hash of the previously computed SHA256 hash (for a checksum)
-	output[21] = hash1[0];	// Store the checksum in the last 4 bytes of the public key hash
-	output[22] = hash1[1];
-	output[23] = hash1[2];
-	output[24] = hash1[3];
-}
+/********************************************************************/
+/* macro definitions */
 
-bool bitcoinAddressToAscii(const uint8_t address[25],char *output,uint32_t maxOutputLen)
-{
-	bool ret = false;
+/* collect four bytes into one word: */
+#define BYTES_TO_DWORD(strptr)                    \
+            (((uint32_t) *((strptr)+3) << 24) | \
+             ((uint32_t) *((strptr)+2) << 16) | \
+             ((uint32_t) *((strptr)+1) <<  8) | \
+             ((uint32_t) *(strptr)))
 
-	ret = BLOCKCHAIN_BASE58::encodeBase58(address,25,true,output,maxOutputLen);
+/* ROL(x, n) cyclically rotates x over n bits to the left */
+/* x must be of an unsigned 32 bits type and 0 <= n < 32. */
+#define ROL(x, n)        (((x) << (n)) | ((x) >> (32-(n))))
 
-	return ret;
-}
+/* the five basic functions F(), G() and H() */
+#define F(x, y, z)        ((x) ^ (y) ^ (z)) 
+#define G(x, y, z)        (((x) & (y)) | (~(x) & (z))) 
+#define H(x, y, z)        (((x) | ~(y)) ^ (z))
+#define I(x, y, z)        (((x) & (z)) | ((y) & ~(z))) 
+#define J(x, y, z)        ((x) ^ ((y) | ~(z)))
+  
+/* the ten basic operations FF() through III() */
+#define FF(a, b, c, d, e, x, s)        {\
+      (a) += F((b), (c), (d)) + (x);\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define GG(a, b, c, d, e, x, s)        {\
+      (a) += G((b), (c), (d)) + (x) + 0x5a827999UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define HH(a, b, c, d, e, x, s)        {\
+      (a) += H((b), (c), (d)) + (x) + 0x6ed9eba1UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define II(a, b, c, d, e, x, s)        {\
+      (a) += I((b), (c), (d)) + (x) + 0x8f1bbcdcUL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define JJ(a, b, c, d, e, x, s)        {\
+      (a) += J((b), (c), (d)) + (x) + 0xa953fd4eUL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define FFF(a, b, c, d, e, x, s)        {\
+      (a) += F((b), (c), (d)) + (x);\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define GGG(a, b, c, d, e, x, s)        {\
+      (a) += G((b), (c), (d)) + (x) + 0x7a6d76e9UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define HHH(a, b, c, d, e, x, s)        {\
+      (a) += H((b), (c), (d)) + (x) + 0x6d703ef3UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define III(a, b, c, d, e, x, s)        {\
+      (a) += I((b), (c), (d)) + (x) + 0x5c4dd124UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
+#define JJJ(a, b, c, d, e, x, s)        {\
+      (a) += J((b), (c), (d)) + (x) + 0x50a28be6UL;\
+      (a) = ROL((a), (s)) + (e);\
+      (c) = ROL((c), 10);\
+   }
 
-}; // end of namespace
+/********************************************************************/
 
+/* function prototypes */
 
-enum ScriptOpcodes
+void MDinit(uint32_t *MDbuf);
+/*
+ *  initializes MDbuffer to "magic constants"
+ */
+
+void compress(uint32_t *MDbuf, uint32_t *X);
+/*
+ *  the compression function.
+ *  transforms MDbuf using message bytes X[0] through X[15]
+ */
+
+void MDfinish(uint32_t *MDbuf,const uint8_t *strptr, uint32_t lswlen, uint32_t mswlen);
+/*
+ *  puts bytes from strptr into X and pad out; appends length 
+ *  and finally, compresses the last block(s)
+ *  note: length in bits == 8 * (lswlen + 2^32 mswlen).
+ *  note: there are (lswlen mod 64) bytes left in strptr.
+ */
+
+/********************************************************************/
+
+void MDinit(uint32_t *MDbuf)
 {
-	OP_0 			=  0x00,
-	OP_PUSHDATA1 	=  0x4c,
-	OP_PUSHDATA2 	=  0x4d,
-	OP_PUSHDATA4 	=  0x4e,
-	OP_1NEGATE 		=  0x4f,
-	OP_RESERVED 	=  0x50,
-	OP_1 			=  0x51,
-	OP_2 			=  0x52,
-	OP_3 			=  0x53,
-	OP_4 			=  0x54,
-	OP_5 			=  0x55,
-	OP_6 			=  0x56,
-	OP_7 			=  0x57,
-	OP_8 			=  0x58,
-	OP_9 			=  0x59,
-	OP_10 			=  0x5a,
-	OP_11 			=  0x5b,
-	OP_12 			=  0x5c,
-	OP_13 			=  0x5d,
-	OP_14 			=  0x5e,
-	OP_15 			=  0x5f,
-	OP_16 			=  0x60,
-	OP_NOP 			=  0x61,
-	OP_VER 			=  0x62,
-	OP_IF 			=  0x63,
-	OP_NOTIF 		=  0x64,
-	OP_VERIF 		=  0x65,
-	OP_VERNOTIF 	=  0x66,
+   MDbuf[0] = 0x67452301UL;
+   MDbuf[1] = 0xefcdab89UL;
+   MDbuf[2] = 0x98badcfeUL;
+   MDbuf[3] = 0x10325476UL;
+   MDbuf[4] = 0xc3d2e1f0UL;
+
+   return;
+}
+
+/********************************************************************/
+
+void compress(uint32_t *MDbuf, uint32_t *X)
+{
+   uint32_t aa = MDbuf[0],  bb = MDbuf[1],  cc = MDbuf[2],
+         dd = MDbuf[3],  ee = MDbuf[4];
+   uint32_t aaa = MDbuf[0], bbb = MDbuf[1], ccc = MDbuf[2],
+         ddd = MDbuf[3], eee = MDbuf[4];
+
+   /* round 1 */
+   FF(aa, bb, cc, dd, ee, X[ 0], 11);
+   FF(ee, aa, bb, cc, dd, X[ 1], 14);
+   FF(dd, ee, aa, bb, cc, X[ 2], 15);
+   FF(cc, dd, ee, aa, bb, X[ 3], 12);
+   FF(bb, cc, dd, ee, aa, X[ 4],  5);
+   FF(aa, bb, cc, dd, ee, X[ 5],  8);
+   FF(ee, aa, bb, cc, dd, X[ 6],  7);
+   FF(dd, ee, aa, bb, cc, X[ 7],  9);
+   FF(cc, dd, ee, aa, bb, X[ 8], 11);
+   FF(bb, cc, dd, ee, aa, X[ 9], 13);
+   FF(aa, bb, cc, dd, ee, X[10], 14);
+   FF(ee, aa, bb, cc, dd, X[11], 15);
+   FF(dd, ee, aa, bb, cc, X[12],  6);
+   FF(cc, dd, ee, aa, bb, X[13],  7);
+   FF(bb, cc, dd, ee, aa, X[14],  9);
+   FF(aa, bb, cc, dd, ee, X[15],  8);
+                             
+   /* round 2 */
+   GG(ee, aa, bb, cc, dd, X[ 7],  7);
+   GG(dd, ee, aa, bb, cc, X[ 4],  6);
+   GG(cc, dd, ee, aa, bb, X[13],  8);
+   GG(bb, cc, dd, ee, aa, X[ 1], 13);
+   GG(aa, bb, cc, dd, ee, X[10], 11);
+   GG(ee, aa, bb, cc, dd, X[ 6],  9);
+   GG(dd, ee, aa, bb, cc, X[15],  7);
+   GG(cc, dd, ee, aa, bb, X[ 3], 15);
+   GG(bb, cc, dd, ee, aa, X[12],  7);
+   GG(aa, bb, cc, dd, ee, X[ 0], 12);
+   GG(ee, aa, bb, cc, dd, X[ 9], 15);
+   GG(dd, ee, aa, bb, cc, X[ 5],  9);
+   GG(cc, dd, ee, aa, bb, X[ 2], 11);
+   GG(bb, cc, dd, ee, aa, X[14],  7);
+   GG(aa, bb, cc, dd, ee, X[11], 13);
+   GG(ee, aa, bb, cc, dd, X[ 8], 12);
+
+   /* round 3 */
+   HH(dd, ee, aa, bb, cc, X[ 3], 11);
+   HH(cc, dd, ee, aa, bb, X[10], 13);
+   HH(bb, cc, dd, ee, aa, X[14],  6);
+   HH(aa, bb, cc, dd, ee, X[ 4],  7);
+   HH(ee, aa, bb, cc, dd, X[ 9], 14);
+   HH(dd, ee, aa, bb, cc, X[15],  9);
+   HH(cc, dd, ee, aa, bb, X[ 8], 13);
+   HH(bb, cc, dd, ee, aa, X[ 1], 15);
+   HH(aa, bb, cc, dd, ee, X[ 2], 14);
+   HH(ee, aa, bb, cc, dd, X[ 7],  8);
+   HH(dd, ee, aa, bb, cc, X[ 0], 13);
+   HH(cc, dd, ee, aa, bb, X[ 6],  6);
+   HH(bb, cc, dd, ee, aa, X[13],  5);
+   HH(aa, bb, cc, dd, ee, X[11], 12);
+   HH(ee, aa, bb, cc, dd, X[ 5],  7);
+   HH(dd, ee, aa, bb, cc, X[12],  5);
+
+   /* round 4 */
+   II(cc, dd, ee, aa, bb, X[ 1], 11);
+   II(bb, cc, dd, ee, aa, X[ 9], 12);
+   II(aa, bb, cc, dd, ee, X[11], 14);
+   II(ee, aa, bb, cc, dd, X[10], 15);
+   II(dd, ee, aa, bb, cc, X[ 0], 14);
+   II(cc, dd, ee, aa, bb, X[ 8], 15);
+   II(bb, cc, dd, ee, aa, X[12],  9);
+   II(aa, bb, cc, dd, ee, X[ 4],  8);
+   II(ee, aa, bb, cc, dd, X[13],  9);
+   II(dd, ee, aa, bb, cc, X[ 3], 14);
+   II(cc, dd, ee, aa, bb, X[ 7],  5);
+   II(bb, cc, dd, ee, aa, X[15],  6);
+   II(aa, bb, cc, dd, ee, X[14],  8);
+   II(ee, aa, bb, cc, dd, X[ 5],  6);
+   II(dd, ee, aa, bb, cc, X[ 6],  5);
+   II(cc, dd, ee, aa, bb, X[ 2], 12);
+
+   /* round 5 */
+   JJ(bb, cc, dd, ee, aa, X[ 4],  9);
+   JJ(aa, bb, cc, dd, ee, X[ 0], 15);
+   JJ(ee, aa, bb, cc, dd, X[ 5],  5);
+   JJ(dd, ee, aa, bb, cc, X[ 9], 11);
+   JJ(cc, dd, ee, aa, bb, X[ 7],  6);
+   JJ(bb, cc, dd, ee, aa, X[12],  8);
+   JJ(aa, bb, cc, dd, ee, X[ 2], 13);
+   JJ(ee, aa, bb, cc, dd, X[10], 12);
+   JJ(dd, ee, aa, bb, cc, X[14],  5);
+   JJ(cc, dd, ee, aa, bb, X[ 1], 12);
+   JJ(bb, cc, dd, ee, aa, X[ 3], 13);
+   JJ(aa, bb, cc, dd, ee, X[ 8], 14);
+   JJ(ee, aa, bb, cc, dd, X[11], 11);
+   JJ(dd, ee, aa, bb, cc, X[ 6],  8);
+   JJ(cc, dd, ee, aa, bb, X[15],  5);
+   JJ(bb, cc, dd, ee, aa, X[13],  6);
+
+   /* parallel round 1 */
+   JJJ(aaa, bbb, ccc, ddd, eee, X[ 5],  8);
+   JJJ(eee, aaa, bbb, ccc, ddd, X[14],  9);
+   JJJ(ddd, eee, aaa, bbb, ccc, X[ 7],  9);
+   JJJ(ccc, ddd, eee, aaa, bbb, X[ 0], 11);
+   JJJ(bbb, ccc, ddd, eee, aaa, X[ 9], 13);
+   JJJ(aaa, bbb, ccc, ddd, eee, X[ 2], 15);
+   JJJ(eee, aaa, bbb, ccc, ddd, X[11], 15);
+   JJJ(ddd, eee, aaa, bbb, ccc, X[ 4],  5);
+   JJJ(ccc, ddd, eee, aaa, bbb, X[13],  7);
+   JJJ(bbb, ccc, ddd, eee, aaa, X[ 6],  7);
+   JJJ(aaa, bbb, ccc, ddd, eee, X[15],  8);
+   JJJ(eee, aaa, bbb, ccc, ddd, X[ 8], 11);
+   JJJ(ddd, eee, aaa, bbb, ccc, X[ 1], 14);
+   JJJ(ccc, ddd, eee, aaa, bbb, X[10], 14);
+   JJJ(bbb, ccc, ddd, eee, aaa, X[ 3], 12);
+   JJJ(aaa, bbb, ccc, ddd, eee, X[12],  6);
+
+   /* parallel round 2 */
+   III(eee, aaa, bbb, ccc, ddd, X[ 6],  9); 
+   III(ddd, eee, aaa, bbb, ccc, X[11], 13);
+   III(ccc, ddd, eee, aaa, bbb, X[ 3], 15);
+   III(bbb, ccc, ddd, eee, aaa, X[ 7],  7);
+   III(aaa, bbb, ccc, ddd, eee, X[ 0], 12);
+   III(eee, aaa, bbb, ccc, ddd, X[13],  8);
+   III(ddd, eee, aaa, bbb, ccc, X[ 5],  9);
+   III(ccc, ddd, eee, aaa, bbb, X[10], 11);
+   III(bbb, ccc, ddd, eee, aaa, X[14],  7);
+   III(aaa, bbb, ccc, ddd, eee, X[15],  7);
+   III(eee, aaa, bbb, ccc, ddd, X[ 8], 12);
+   III(ddd, eee, aaa, bbb, ccc, X[12],  7);
+   III(ccc, ddd, eee, aaa, bbb, X[ 4],  6);
+   III(bbb, ccc, ddd, eee, aaa, X[ 9], 15);
+   III(aaa, bbb, ccc, ddd, eee, X[ 1], 13);
+   III(eee, aaa, bbb, ccc, ddd, X[ 2], 11);
+
+   /* parallel round 3 */
+   HHH(ddd, eee, aaa, bbb, ccc, X[15],  9);
+   HHH(ccc, ddd, eee, aaa, bbb, X[ 5],  7);
+   HHH(bbb, ccc, ddd, eee, aaa, X[ 1], 15);
+   HHH(aaa, bbb, ccc, ddd, eee, X[ 3], 11);
+   HHH(eee, aaa, bbb, ccc, ddd, X[ 7],  8);
+   HHH(ddd, eee, aaa, bbb, ccc, X[14],  6);
+   HHH(ccc, ddd, eee, aaa, bbb, X[ 6],  6);
+   HHH(bbb, ccc, ddd, eee, aaa, X[ 9], 14);
+   HHH(aaa, bbb, ccc, ddd, eee, X[11], 12);
+   HHH(eee, aaa, bbb, ccc, ddd, X[ 8], 13);
+   HHH(ddd, eee, aaa, bbb, ccc, X[12],  5);
+   HHH(ccc, ddd, eee, aaa, bbb, X[ 2], 14);
+   HHH(bbb, ccc, ddd, eee, aaa, X[10], 13);
+   HHH(aaa, bbb, ccc, ddd, eee, X[ 0], 13);
+   HHH(eee, aaa, bbb, ccc, ddd, X[ 4],  7);
+   HHH(ddd, eee, aaa, bbb, ccc, X[13],  5);
+
+   /* parallel round 4 */   
+   GGG(ccc, ddd, eee, aaa, bbb, X[ 8], 15);
+   GGG(bbb, ccc, ddd, eee, aaa, X[ 6],  5);
+   GGG(aaa, bbb, ccc, ddd, eee, X[ 4],  8);
+   GGG(eee, aaa, bbb, ccc, ddd, X[ 1], 11);
+   GGG(ddd, eee, aaa, bbb, ccc, X[ 3], 14);
+   GGG(ccc, ddd, eee, aaa, bbb, X[11], 14);
+   GGG(bbb, ccc, ddd, eee, aaa, X[15],  6);
+   GGG(aaa, bbb, ccc, ddd, eee, X[ 0], 14);
+   GGG(eee, aaa, bbb, ccc, ddd, X[ 5],  6);
+   GGG(ddd, eee, aaa, bbb, ccc, X[12],  9);
+   GGG(ccc, ddd, eee, aaa, bbb, X[ 2], 12);
+   GGG(bbb, ccc, ddd, eee, aaa, X[13],  9);
+   GGG(aaa, bbb, ccc, ddd, eee, X[ 9], 12);
+   GGG(eee, aaa, bbb, ccc, ddd, X[ 7],  5);
+   GGG(ddd, eee, aaa, bbb, ccc, X[10], 15);
+   GGG(ccc, ddd, eee, aaa, bbb, X[14],  8);
+
+   /* parallel round 5 */
+   FFF(bbb, ccc, ddd, eee, aaa, X[12] ,  8);
+   FFF(aaa, bbb, ccc, ddd, eee, X[15] ,  5);
+   FFF(eee, aaa, bbb, ccc, ddd, X[10] , 12);
+   FFF(ddd, eee, aaa, bbb, ccc, X[ 4] ,  9);
+   FFF(ccc, ddd, eee, aaa, bbb, X[ 1] , 12);
+   FFF(bbb, ccc, ddd, eee, aaa, X[ 5] ,  5);
+   FFF(aaa, bbb, ccc, ddd, eee, X[ 8] , 14);
+   FFF(eee, aaa, bbb, ccc, ddd, X[ 7] ,  6);
+   FFF(ddd, eee, aaa, bbb, ccc, X[ 6] ,  8);
+   FFF(ccc, ddd, eee, aaa, bbb, X[ 2] , 13);
+   FFF(bbb, ccc, ddd, eee, aaa, X[13] ,  6);
+   FFF(aaa, bbb, ccc, ddd, eee, X[14] ,  5);
+   FFF(eee, aaa, bbb, ccc, ddd, X[ 0] , 15);
+   FFF(ddd, eee, aaa, bbb, ccc, X[ 3] , 13);
+   FFF(ccc, ddd, eee, aaa, bbb, X[ 9] , 11);
+   FFF(bbb, ccc, ddd, eee, aaa, X[11] , 11);
+
+   /* combine results */
+   ddd += cc + MDbuf[1];               /* final result for MDbuf[0] */
+   MDbuf[1] = MDbuf[2] + dd + eee;
+   MDbuf[2] = MDbuf[3] + ee + aaa;
+   MDbuf[3] = MDbuf[4] + aa + bbb;
+   MDbuf[4] = MDbuf[0] + bb + ccc;
+   MDbuf[0] = ddd;
+
+   return;
+}
+
+/********************************************************************/
+
+void MDfinish(uint32_t *MDbuf,const uint8_t *strptr, uint32_t lswlen, uint32_t mswlen)
+{
+   unsigned int i;                                 /* counter       */
+   uint32_t        X[16];                             /* message words */
+
+   memset(X, 0, 16*sizeof(uint32_t));
+
+   /* put bytes from strptr into X */
+   for (i=0; i<(lswlen&63); i++) {
+      /* uint8_t i goes into word X[i div 4] at pos.  8*(i mod 4)  */
+      X[i>>2] ^= (uint32_t) *strptr++ << (8 * (i&3));
+   }
+
+   /* append the bit m_n == 1 */
+   X[(lswlen>>2)&15] ^= (uint32_t)1 << (8*(lswlen&3) + 7);
+
+   if ((lswlen & 63) > 55) {
+      /* length goes to next block */
+      compress(MDbuf, X);
+      memset(X, 0, 16*sizeof(uint32_t));
+   }
+
+   /* append length in bits*/
+   X[14] = lswlen << 3;
+   X[15] = (lswlen >> 29) | (mswlen << 3);
+   compress(MDbuf, X);
+
+   return;
+}
+
+#define RMDsize 160
+
+void computeRIPEMD160(const void *_message,uint32_t length,uint8_t hashcode[20])
+/*
+ * returns RMD(message)
+ * message should be a string terminated by '\0'
+ */
+{
+	const uint8_t *message = (const uint8_t *)_message;
+	uint32_t         MDbuf[RMDsize/32];   /* contains (A, B, C, D(, E))   */
+	uint32_t         X[16];               /* current 16-word chunk        */
+
+	/* initialize */
+	MDinit(MDbuf);
+
+	/* process message in 16-word chunks */
+	for (uint32_t nbytes=length; nbytes > 63; nbytes-=64) 
+	{
+		for (uint32_t i=0; i<16; i++) 
+		{
+			X[i] = BYTES_TO_DWORD(message);
+			message += 4;
+		}
+		compress(MDbuf, X);
+	}	/* length mod 64 bytes left */
+
+	/* finish: */
+	MDfinish(MDbuf, message, length, 0);
+
+	for (uint32_t i=0; i<RMDsize/8; i+=4) 
+	{
+		hashcode[i]   = (uint8_t)(MDbuf[i>>2]);         /* implicit cast to uint8_t  */
+		hashcode[i+1] = (uint8_t)(MDbuf[i>>2] >>  8);  /*  extracts the 8 least  */
+		hashcode[i+2] = (uint8_t)(MDbuf[i>>2] >> 16);  /*  significant bits.     */
+		hashcode[i+3] = (uint8_t)(MDbuf[i>>2] >> 24);
+	}
+
+}
+
+
+/********************************************************************/
+
+// Multi-buffer version of the compression function.  Each state word and each message word is stored as
+// RIPEMD160_LANES independent lanes so that the compiler can turn every round into a short vector operation.
+#define RIPEMD160_LANES 4
+
+#define RMD_LANES(op, a, b, c, d, e, x, s) \
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) op(a[l], b[l], c[l], d[l], e[l], X[x][l], s)
+
+static void compressLanes(uint32_t MDbuf[5][RIPEMD160_LANES], uint32_t X[16][RIPEMD160_LANES])
+{
+   uint32_t aa[RIPEMD160_LANES], bb[RIPEMD160_LANES], cc[RIPEMD160_LANES], dd[RIPEMD160_LANES], ee[RIPEMD160_LANES];
+   uint32_t aaa[RIPEMD160_LANES], bbb[RIPEMD160_LANES], ccc[RIPEMD160_LANES], ddd[RIPEMD160_LANES], eee[RIPEMD160_LANES];
+
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) {
+      aa[l] = aaa[l] = MDbuf[0][l];
+      bb[l] = bbb[l] = MDbuf[1][l];
+      cc[l] = ccc[l] = MDbuf[2][l];
+      dd[l] = ddd[l] = MDbuf[3][l];
+      ee[l] = eee[l] = MDbuf[4][l];
+   }
+
+   /* round 1 */
+   RMD_LANES(FF, aa, bb, cc, dd, ee,  0, 11);
+   RMD_LANES(FF, ee, aa, bb, cc, dd,  1, 14);
+   RMD_LANES(FF, dd, ee, aa, bb, cc,  2, 15);
+   RMD_LANES(FF, cc, dd, ee, aa, bb,  3, 12);
+   RMD_LANES(FF, bb, cc, dd, ee, aa,  4,  5);
+   RMD_LANES(FF, aa, bb, cc, dd, ee,  5,  8);
+   RMD_LANES(FF, ee, aa, bb, cc, dd,  6,  7);
+   RMD_LANES(FF, dd, ee, aa, bb, cc,  7,  9);
+   RMD_LANES(FF, cc, dd, ee, aa, bb,  8, 11);
+   RMD_LANES(FF, bb, cc, dd, ee, aa,  9, 13);
+   RMD_LANES(FF, aa, bb, cc, dd, ee, 10, 14);
+   RMD_LANES(FF, ee, aa, bb, cc, dd, 11, 15);
+   RMD_LANES(FF, dd, ee, aa, bb, cc, 12,  6);
+   RMD_LANES(FF, cc, dd, ee, aa, bb, 13,  7);
+   RMD_LANES(FF, bb, cc, dd, ee, aa, 14,  9);
+   RMD_LANES(FF, aa, bb, cc, dd, ee, 15,  8);
+
+   /* round 2 */
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  7,  7);
+   RMD_LANES(GG, dd, ee, aa, bb, cc,  4,  6);
+   RMD_LANES(GG, cc, dd, ee, aa, bb, 13,  8);
+   RMD_LANES(GG, bb, cc, dd, ee, aa,  1, 13);
+   RMD_LANES(GG, aa, bb, cc, dd, ee, 10, 11);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  6,  9);
+   RMD_LANES(GG, dd, ee, aa, bb, cc, 15,  7);
+   RMD_LANES(GG, cc, dd, ee, aa, bb,  3, 15);
+   RMD_LANES(GG, bb, cc, dd, ee, aa, 12,  7);
+   RMD_LANES(GG, aa, bb, cc, dd, ee,  0, 12);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  9, 15);
+   RMD_LANES(GG, dd, ee, aa, bb, cc,  5,  9);
+   RMD_LANES(GG, cc, dd, ee, aa, bb,  2, 11);
+   RMD_LANES(GG, bb, cc, dd, ee, aa, 14,  7);
+   RMD_LANES(GG, aa, bb, cc, dd, ee, 11, 13);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  8, 12);
+
+   /* round 3 */
+   RMD_LANES(HH, dd, ee, aa, bb, cc,  3, 11);
+   RMD_LANES(HH, cc, dd, ee, aa, bb, 10, 13);
+   RMD_LANES(HH, bb, cc, dd, ee, aa, 14,  6);
+   RMD_LANES(HH, aa, bb, cc, dd, ee,  4,  7);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  9, 14);
+   RMD_LANES(HH, dd, ee, aa, bb, cc, 15,  9);
+   RMD_LANES(HH, cc, dd, ee, aa, bb,  8, 13);
+   RMD_LANES(HH, bb, cc, dd, ee, aa,  1, 15);
+   RMD_LANES(HH, aa, bb, cc, dd, ee,  2, 14);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  7,  8);
+   RMD_LANES(HH, dd, ee, aa, bb, cc,  0, 13);
+   RMD_LANES(HH, cc, dd, ee, aa, bb,  6,  6);
+   RMD_LANES(HH, bb, cc, dd, ee, aa, 13,  5);
+   RMD_LANES(HH, aa, bb, cc, dd, ee, 11, 12);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  5,  7);
+   RMD_LANES(HH, dd, ee, aa, bb, cc, 12,  5);
+
+   /* round 4 */
+   RMD_LANES(II, cc, dd, ee, aa, bb,  1, 11);
+   RMD_LANES(II, bb, cc, dd, ee, aa,  9, 12);
+   RMD_LANES(II, aa, bb, cc, dd, ee, 11, 14);
+   RMD_LANES(II, ee, aa, bb, cc, dd, 10, 15);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  0, 14);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  8, 15);
+   RMD_LANES(II, bb, cc, dd, ee, aa, 12,  9);
+   RMD_LANES(II, aa, bb, cc, dd, ee,  4,  8);
+   RMD_LANES(II, ee, aa, bb, cc, dd, 13,  9);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  3, 14);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  7,  5);
+   RMD_LANES(II, bb, cc, dd, ee, aa, 15,  6);
+   RMD_LANES(II, aa, bb, cc, dd, ee, 14,  8);
+   RMD_LANES(II, ee, aa, bb, cc, dd,  5,  6);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  6,  5);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  2, 12);
+
+   /* round 5 */
+   RMD_LANES(JJ, bb, cc, dd, ee, aa,  4,  9);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  0, 15);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd,  5,  5);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc,  9, 11);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb,  7,  6);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa, 12,  8);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  2, 13);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd, 10, 12);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc, 14,  5);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb,  1, 12);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa,  3, 13);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  8, 14);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd, 11, 11);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc,  6,  8);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb, 15,  5);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa, 13,  6);
+
+   /* parallel round 1 */
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee,  5,  8);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd, 14,  9);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  7,  9);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb,  0, 11);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  9, 13);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee,  2, 15);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd, 11, 15);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  4,  5);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb, 13,  7);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  6,  7);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee, 15,  8);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd,  8, 11);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  1, 14);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb, 10, 14);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  3, 12);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee, 12,  6);
+
+   /* parallel round 2 */
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  6,  9);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc, 11, 13);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb,  3, 15);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa,  7,  7);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee,  0, 12);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd, 13,  8);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc,  5,  9);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb, 10, 11);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa, 14,  7);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee, 15,  7);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  8, 12);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc, 12,  7);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb,  4,  6);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa,  9, 15);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee,  1, 13);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  2, 11);
+
+   /* parallel round 3 */
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 15,  9);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  5,  7);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa,  1, 15);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee,  3, 11);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  7,  8);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 14,  6);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  6,  6);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa,  9, 14);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee, 11, 12);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  8, 13);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 12,  5);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  2, 14);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa, 10, 13);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee,  0, 13);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  4,  7);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 13,  5);
+
+   /* parallel round 4 */
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb,  8, 15);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa,  6,  5);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  4,  8);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  1, 11);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc,  3, 14);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb, 11, 14);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa, 15,  6);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  0, 14);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  5,  6);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc, 12,  9);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb,  2, 12);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa, 13,  9);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  9, 12);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  7,  5);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc, 10, 15);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb, 14,  8);
+
+   /* parallel round 5 */
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 12,  8);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee, 15,  5);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd, 10, 12);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  4,  9);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  1, 12);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa,  5,  5);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee,  8, 14);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd,  7,  6);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  6,  8);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  2, 13);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 13,  6);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee, 14,  5);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd,  0, 15);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  3, 13);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  9, 11);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 11, 11);
+
+   /* combine results */
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) {
+      ddd[l] += cc[l] + MDbuf[1][l];               /* final result for MDbuf[0] */
+      MDbuf[1][l] = MDbuf[2][l] + dd[l] + eee[l];
+      MDbuf[2][l] = MDbuf[3][l] + ee[l] + aaa[l];
+      MDbuf[3][l] = MDbuf[4][l] + aa[l] + bbb[l];
+      MDbuf[4][l] = MDbuf[0][l] + bb[l] + ccc[l];
+      MDbuf[0][l] = ddd[l];
+   }
+}
+
+void computeRIPEMD160Batch(const void * const *inputs,uint32_t length,uint32_t count,uint8_t *hashcodes)
+{
+	uint32_t MDbuf[5][RIPEMD160_LANES];
+	uint32_t X[16][RIPEMD160_LANES];
+	const uint8_t *message[RIPEMD160_LANES];
+
+	for (uint32_t base=0; base<count; base+=RIPEMD160_LANES)
+	{
+		uint32_t lanes = count-base;
+		if ( lanes > RIPEMD160_LANES )
+		{
+			lanes = RIPEMD160_LANES;
+		}
+		// A partial group just recomputes its first message in the unused lanes; those results are discarded.
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			message[l] = (const uint8_t *)inputs[base + (l < lanes ? l : 0)];
+			MDbuf[0][l] = 0x67452301UL;
+			MDbuf[1][l] = 0xefcdab89UL;
+			MDbuf[2][l] = 0x98badcfeUL;
+			MDbuf[3][l] = 0x10325476UL;
+			MDbuf[4][l] = 0xc3d2e1f0UL;
+		}
+
+		/* process message in 16-word chunks */
+		for (uint32_t nbytes=length; nbytes > 63; nbytes-=64)
+		{
+			for (uint32_t i=0; i<16; i++)
+			{
+				for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+				{
+					X[i][l] = BYTES_TO_DWORD(message[l]+i*4);
+				}
+			}
+			for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+			{
+				message[l]+=64;
+			}
+			compressLanes(MDbuf, X);
+		}
+
+		/* finish: same padding as MDfinish, applied to every lane */
+		memset(X, 0, sizeof(X));
+		for (uint32_t i=0; i<(length&63); i++)
+		{
+			for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+			{
+				X[i>>2][l] ^= (uint32_t) message[l][i] << (8 * (i&3));
+			}
+		}
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			X[(length>>2)&15][l] ^= (uint32_t)1 << (8*(length&3) + 7);
+		}
+		if ((length & 63) > 55)
+		{
+			compressLanes(MDbuf, X);
+			memset(X, 0, sizeof(X));
+		}
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			X[14][l] = length << 3;
+			X[15][l] = length >> 29;
+		}
+		compressLanes(MDbuf, X);
+
+		for (uint32_t l=0; l<lanes; l++)
+		{
+			uint8_t *hashcode = &hashcodes[(base+l)*(RMDsize/8)];
+			for (uint32_t i=0; i<RMDsize/8; i+=4)
+			{
+				hashcode[i]   = (uint8_t)(MDbuf[i>>2][l]);
+				hashcode[i+1] = (uint8_t)(MDbuf[i>>2][l] >>  8);
+				hashcode[i+2] = (uint8_t)(MDbuf[i>>2][l] >> 16);
+				hashcode[i+3] = (uint8_t)(MDbuf[i>>2][l] >> 24);
+			}
+		}
+	}
+}
+
+}; // end of RIPEMD160 hash
+
+//********** Beginning of source code for SHA256 hash
+
+namespace BLOCKCHAIN_SHA256
+{
+#define SHA256_HASH_SIZE  32	/* 256 bit */
+#define SHA256_HASH_WORDS 8
+#define SHA256_UNROLL 64	// This define determines how much loop unrolling is done when computing the hash; 
+
+	// Uncomment this line of code if you want this snippet to compute the endian mode of your processor at run time; rather than at compile time.
+	//#define RUNTIME_ENDIAN
+
+	// Uncomment this line of code if you want this routine to compile for a big-endian processor
+	//#define WORDS_BIGENDIAN
+
+	typedef struct 
+	{
+		uint64_t totalLength;
+		uint32_t hash[SHA256_HASH_WORDS];
+		uint32_t bufferLength;
+		union 
+		{
+			uint32_t words[16];
+			uint8_t bytes[64];
+		} buffer;
+	} sha256_ctx_t;
+
+	void sha256_init(sha256_ctx_t * sc);
+	void sha256_update(sha256_ctx_t * sc, const void *data, uint32_t len);
+	void sha256_finalize(sha256_ctx_t * sc, uint8_t hash[SHA256_HASH_SIZE]);
+
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define Ch(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define Maj(x, y, z) (((x) & ((y) | (z))) | ((y) & (z)))
+#define SIGMA0(x) (ROTR((x), 2) ^ ROTR((x), 13) ^ ROTR((x), 22))
+#define SIGMA1(x) (ROTR((x), 6) ^ ROTR((x), 11) ^ ROTR((x), 25))
+#define sigma0(x) (ROTR((x), 7) ^ ROTR((x), 18) ^ ((x) >> 3))
+#define sigma1(x) (ROTR((x), 17) ^ ROTR((x), 19) ^ ((x) >> 10))
+
+#define DO_ROUND() {							\
+	t1 = h + SIGMA1(e) + Ch(e, f, g) + *(Kp++) + *(W++);	\
+	t2 = SIGMA0(a) + Maj(a, b, c);				\
+	h = g;							\
+	g = f;							\
+	f = e;							\
+	e = d + t1;						\
+	d = c;							\
+	c = b;							\
+	b = a;							\
+	a = t1 + t2;						\
+	}
+
+	static const uint32_t K[64] = {
+		0x428a2f98L, 0x71374491L, 0xb5c0fbcfL, 0xe9b5dba5L,
+		0x3956c25bL, 0x59f111f1L, 0x923f82a4L, 0xab1c5ed5L,
+		0xd807aa98L, 0x12835b01L, 0x243185beL, 0x550c7dc3L,
+		0x72be5d74L, 0x80deb1feL, 0x9bdc06a7L, 0xc19bf174L,
+		0xe49b69c1L, 0xefbe4786L, 0x0fc19dc6L, 0x240ca1ccL,
+		0x2de92c6fL, 0x4a7484aaL, 0x5cb0a9dcL, 0x76f988daL,
+		0x983e5152L, 0xa831c66dL, 0xb00327c8L, 0xbf597fc7L,
+		0xc6e00bf3L, 0xd5a79147L, 0x06ca6351L, 0x14292967L,
+		0x27b70a85L, 0x2e1b2138L, 0x4d2c6dfcL, 0x53380d13L,
+		0x650a7354L, 0x766a0abbL, 0x81c2c92eL, 0x92722c85L,
+		0xa2bfe8a1L, 0xa81a664bL, 0xc24b8b70L, 0xc76c51a3L,
+		0xd192e819L, 0xd6990624L, 0xf40e3585L, 0x106aa070L,
+		0x19a4c116L, 0x1e376c08L, 0x2748774cL, 0x34b0bcb5L,
+		0x391c0cb3L, 0x4ed8aa4aL, 0x5b9cca4fL, 0x682e6ff3L,
+		0x748f82eeL, 0x78a5636fL, 0x84c87814L, 0x8cc70208L,
+		0x90befffaL, 0xa4506cebL, 0xbef9a3f7L, 0xc67178f2L
+	};
+
+#ifndef RUNTIME_ENDIAN
+
+#ifdef WORDS_BIGENDIAN
+
+#define BYTESWAP(x) (x)
+#define BYTESWAP64(x) (x)
+
+#else				/* WORDS_BIGENDIAN */
+
+#define BYTESWAP(x) ((ROTR((x), 8) & 0xff00ff00L) |	\
+	(ROTL((x), 8) & 0x00ff00ffL))
+#define BYTESWAP64(x) _byteswap64(x)
+
+	static inline uint64_t _byteswap64(uint64_t x)
+	{
+		uint32_t a = x >> 32;
+		uint32_t b = (uint32_t) x;
+		return ((uint64_t) BYTESWAP(b) << 32) | (uint64_t) BYTESWAP(a);
+	}
+
+#endif				/* WORDS_BIGENDIAN */
+
+#else				/* !RUNTIME_ENDIAN */
+
+	static int littleEndian;
+
+#define BYTESWAP(x) _byteswap(x)
+#define BYTESWAP64(x) _byteswap64(x)
+
+#define _BYTESWAP(x) ((ROTR((x), 8) & 0xff00ff00L) |	\
+	(ROTL((x), 8) & 0x00ff00ffL))
+#define _BYTESWAP64(x) __byteswap64(x)
+
+	static inline uint64_t __byteswap64(uint64_t x)
+	{
+		uint32_t a = x >> 32;
+		uint32_t b = (uint32_t) x;
+		return ((uint64_t) _BYTESWAP(b) << 32) | (uint64_t) _BYTESWAP(a);
+	}
+
+	static inline uint32_t _byteswap(uint32_t x)
+	{
+		if (!littleEndian)
+			return x;
+		else
+			return _BYTESWAP(x);
+	}
+
+	static inline uint64_t _byteswap64(uint64_t x)
+	{
+		if (!littleEndian)
+			return x;
+		else
+			return _BYTESWAP64(x);
+	}
+
+	static inline void setEndian(void)
+	{
+		union {
+			uint32_t w;
+			uint8_t b[4];
+		} endian;
+
+		endian.w = 1L;
+		littleEndian = endian.b[0] != 0;
+	}
+
+#endif				/* !RUNTIME_ENDIAN */
+
+	static const uint8_t padding[64] = {
+		0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+
+	void sha256_init(sha256_ctx_t * sc)
+	{
+#ifdef RUNTIME_ENDIAN
+		setEndian();
+#endif				/* RUNTIME_ENDIAN */
+
+		sc->totalLength = 0LL;
+		sc->hash[0] = 0x6a09e667L;
+		sc->hash[1] = 0xbb67ae85L;
+		sc->hash[2] = 0x3c6ef372L;
+		sc->hash[3] = 0xa54ff53aL;
+		sc->hash[4] = 0x510e527fL;
+		sc->hash[5] = 0x9b05688cL;
+		sc->hash[6] = 0x1f83d9abL;
+		sc->hash[7] = 0x5be0cd19L;
+		sc->bufferLength = 0L;
+	}
+
+	static void burnStack(int size)
+	{
+		char buf[128];
+
+		memset(buf, 0, sizeof(buf));
+		size -= sizeof(buf);
+		if (size > 0)
+			burnStack(size);
+	}
+
+	static void SHA256Guts(sha256_ctx_t * sc, const uint32_t * cbuf)
+	{
+		uint32_t buf[64];
+		uint32_t *W, *W2, *W7, *W15, *W16;
+		uint32_t a, b, c, d, e, f, g, h;
+		uint32_t t1, t2;
+		const uint32_t *Kp;
+		int i;
+
+		W = buf;
+
+		for (i = 15; i >= 0; i--) {
+			*(W++) = BYTESWAP(*cbuf);
+			cbuf++;
+		}
+
+		W16 = &buf[0];
+		W15 = &buf[1];
+		W7 = &buf[9];
+		W2 = &buf[14];
+
+		for (i = 47; i >= 0; i--) {
+			*(W++) = sigma1(*W2) + *(W7++) + sigma0(*W15) + *(W16++);
+			W2++;
+			W15++;
+		}
+
+		a = sc->hash[0];
+		b = sc->hash[1];
+		c = sc->hash[2];
+		d = sc->hash[3];
+		e = sc->hash[4];
+		f = sc->hash[5];
+		g = sc->hash[6];
+		h = sc->hash[7];
+
+		Kp = K;
+		W = buf;
+
+#ifndef SHA256_UNROLL
+#define SHA256_UNROLL 1
+#endif				/* !SHA256_UNROLL */
+
+#if SHA256_UNROLL == 1
+		for (i = 63; i >= 0; i--)
+			DO_ROUND();
+#elif SHA256_UNROLL == 2
+		for (i = 31; i >= 0; i--) {
+			DO_ROUND();
+			DO_ROUND();
+		}
+#elif SHA256_UNROLL == 4
+		for (i = 15; i >= 0; i--) {
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+		}
+#elif SHA256_UNROLL == 8
+		for (i = 7; i >= 0; i--) {
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+		}
+#elif SHA256_UNROLL == 16
+		for (i = 3; i >= 0; i--) {
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+		}
+#elif SHA256_UNROLL == 32
+		for (i = 1; i >= 0; i--) {
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+			DO_ROUND();
+		}
+#elif SHA256_UNROLL == 64
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+		DO_ROUND();
+#else
+#error "SHA256_UNROLL must be 1, 2, 4, 8, 16, 32, or 64!"
+#endif
+
+		sc->hash[0] += a;
+		sc->hash[1] += b;
+		sc->hash[2] += c;
+		sc->hash[3] += d;
+		sc->hash[4] += e;
+		sc->hash[5] += f;
+		sc->hash[6] += g;
+		sc->hash[7] += h;
+	}
+
+	void sha256_update(sha256_ctx_t * sc, const void *data, uint32_t len)
+	{
+		uint32_t bufferBytesLeft;
+		uint32_t bytesToCopy;
+		int needBurn = 0;
+
+		if (sc->bufferLength) 
+		{
+			bufferBytesLeft = 64L - sc->bufferLength;
+			bytesToCopy = bufferBytesLeft;
+			if (bytesToCopy > len)
+			{
+				bytesToCopy = len;
+			}
+			memcpy(&sc->buffer.bytes[sc->bufferLength], data, bytesToCopy);
+			sc->totalLength += bytesToCopy * 8L;
+			sc->bufferLength += bytesToCopy;
+			data = ((uint8_t *) data) + bytesToCopy;
+			len -= bytesToCopy;
+			if (sc->bufferLength == 64L) 
+			{
+				SHA256Guts(sc, sc->buffer.words);
+				needBurn = 1;
+				sc->bufferLength = 0L;
+			}
+		}
+
+		while (len > 63L) 
+		{
+			sc->totalLength += 512L;
+
+			SHA256Guts(sc, (const uint32_t *)data);
+			needBurn = 1;
+
+			data = ((uint8_t *) data) + 64L;
+			len -= 64L;
+		}
+
+		if (len) 
+		{
+			memcpy(&sc->buffer.bytes[sc->bufferLength], data, len);
+			sc->totalLength += len * 8L;
+			sc->bufferLength += len;
+		}
+
+		if (needBurn)
+		{
+			burnStack(sizeof(uint32_t[74]) + sizeof(uint32_t *[6]) +  sizeof(int));
+		}
+	}
+
+	void sha256_finalize(sha256_ctx_t * sc, uint8_t hash[SHA256_HASH_SIZE])
+	{
+		uint32_t bytesToPad;
+		uint64_t lengthPad;
+		int i;
+
+		bytesToPad = 120L - sc->bufferLength;
+		if (bytesToPad > 64L)
+		{
+			bytesToPad -= 64L;
+		}
+
+		lengthPad = BYTESWAP64(sc->totalLength);
+
+		sha256_update(sc, padding, bytesToPad);
+		sha256_update(sc, &lengthPad, 8L);
+
+		if (hash) 
+		{
+			for (i = 0; i < SHA256_HASH_WORDS; i++) 
+			{
+				*((uint32_t *) hash) = BYTESWAP(sc->hash[i]);
+				hash += 4;
+			}
+		}
+	}
+
+
+	void computeSHA256(const void *input,uint32_t size,uint8_t destHash[32])
+	{
+		sha256_ctx_t sc;
+		sha256_init(&sc);
+		sha256_update(&sc,input,size);
+		sha256_finalize(&sc,destHash);
+	}
+
+	// Multi-buffer SHA256.  The state and message schedule of SHA256_LANES independent messages are stored
+	// interleaved so that each round operates on every lane with the same instruction sequence; this lets the
+	// compiler turn the inner lane loops into vector operations.
+#define SHA256_LANES 4
+
+#define BYTES_TO_BE_DWORD(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+	static void SHA256GutsLanes(uint32_t hash[SHA256_HASH_WORDS][SHA256_LANES], uint32_t W[64][SHA256_LANES])
+	{
+		uint32_t a[SHA256_LANES], b[SHA256_LANES], c[SHA256_LANES], d[SHA256_LANES];
+		uint32_t e[SHA256_LANES], f[SHA256_LANES], g[SHA256_LANES], h[SHA256_LANES];
+		uint32_t i, l;
+
+		for (i = 16; i < 64; i++)
+		{
+			for (l = 0; l < SHA256_LANES; l++)
+			{
+				W[i][l] = sigma1(W[i-2][l]) + W[i-7][l] + sigma0(W[i-15][l]) + W[i-16][l];
+			}
+		}
+
+		for (l = 0; l < SHA256_LANES; l++)
+		{
+			a[l] = hash[0][l];
+			b[l] = hash[1][l];
+			c[l] = hash[2][l];
+			d[l] = hash[3][l];
+			e[l] = hash[4][l];
+			f[l] = hash[5][l];
+			g[l] = hash[6][l];
+			h[l] = hash[7][l];
+		}
+
+		for (i = 0; i < 64; i++)
+		{
+			for (l = 0; l < SHA256_LANES; l++)
+			{
+				uint32_t t1 = h[l] + SIGMA1(e[l]) + Ch(e[l], f[l], g[l]) + K[i] + W[i][l];
+				uint32_t t2 = SIGMA0(a[l]) + Maj(a[l], b[l], c[l]);
+				h[l] = g[l];
+				g[l] = f[l];
+				f[l] = e[l];
+				e[l] = d[l] + t1;
+				d[l] = c[l];
+				c[l] = b[l];
+				b[l] = a[l];
+				a[l] = t1 + t2;
+			}
+		}
+
+		for (l = 0; l < SHA256_LANES; l++)
+		{
+			hash[0][l] += a[l];
+			hash[1][l] += b[l];
+			hash[2][l] += c[l];
+			hash[3][l] += d[l];
+			hash[4][l] += e[l];
+			hash[5][l] += f[l];
+			hash[6][l] += g[l];
+			hash[7][l] += h[l];
+		}
+	}
+
+	void computeSHA256Batch(const void * const *inputs,uint32_t size,uint32_t count,uint8_t *destHashes)
+	{
+		uint32_t hash[SHA256_HASH_WORDS][SHA256_LANES];
+		uint32_t W[64][SHA256_LANES];
+		const uint8_t *data[SHA256_LANES];
+		uint8_t tail[SHA256_LANES][128];
+
+		uint32_t fullBlocks = size / 64;
+		uint32_t tailBytes = size & 63;
+		uint32_t tailBlocks = (tailBytes + 9 > 64) ? 2 : 1;
+		uint64_t totalLength = (uint64_t)size * 8;
+
+		for (uint32_t base = 0; base < count; base += SHA256_LANES)
+		{
+			uint32_t lanes = count - base;
+			if ( lanes > SHA256_LANES )
+			{
+				lanes = SHA256_LANES;
+			}
+			// A partial group just recomputes its first message in the unused lanes; those results are discarded.
+			for (uint32_t l = 0; l < SHA256_LANES; l++)
+			{
+				data[l] = (const uint8_t *)inputs[base + (l < lanes ? l : 0)];
+				hash[0][l] = 0x6a09e667L;
+				hash[1][l] = 0xbb67ae85L;
+				hash[2][l] = 0x3c6ef372L;
+				hash[3][l] = 0xa54ff53aL;
+				hash[4][l] = 0x510e527fL;
+				hash[5][l] = 0x9b05688cL;
+				hash[6][l] = 0x1f83d9abL;
+				hash[7][l] = 0x5be0cd19L;
+			}
+
+			for (uint32_t block = 0; block < fullBlocks; block++)
+			{
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					for (uint32_t l = 0; l < SHA256_LANES; l++)
+					{
+						W[i][l] = BYTES_TO_BE_DWORD(data[l] + block*64 + i*4);
+					}
+				}
+				SHA256GutsLanes(hash, W);
+			}
+
+			// Build the padded final block(s) for every lane
+			for (uint32_t l = 0; l < SHA256_LANES; l++)
+			{
+				uint8_t *t = tail[l];
+				memcpy(t, data[l] + fullBlocks*64, tailBytes);
+				memset(t + tailBytes, 0, tailBlocks*64 - tailBytes);
+				t[tailBytes] = 0x80;
+				for (uint32_t i = 0; i < 8; i++)
+				{
+					t[tailBlocks*64 - 1 - i] = (uint8_t)(totalLength >> (i*8));
+				}
+			}
+			for (uint32_t block = 0; block < tailBlocks; block++)
+			{
+				for (uint32_t i = 0; i < 16; i++)
+				{
+					for (uint32_t l = 0; l < SHA256_LANES; l++)
+					{
+						W[i][l] = BYTES_TO_BE_DWORD(tail[l] + block*64 + i*4);
+					}
+				}
+				SHA256GutsLanes(hash, W);
+			}
+
+			for (uint32_t l = 0; l < lanes; l++)
+			{
+				uint8_t *dest = &destHashes[(base + l)*SHA256_HASH_SIZE];
+				for (uint32_t i = 0; i < SHA256_HASH_WORDS; i++)
+				{
+					dest[i*4]   = (uint8_t)(hash[i][l] >> 24);
+					dest[i*4+1] = (uint8_t)(hash[i][l] >> 16);
+					dest[i*4+2] = (uint8_t)(hash[i][l] >> 8);
+					dest[i*4+3] = (uint8_t)(hash[i][l]);
+				}
+			}
+		}
+	}
+
+}; // End of the SHA-2556 namespace
+
+
+//********** Beginning of source code for the MuHash3072 set hash
+
+namespace BLOCKCHAIN_MUHASH
+{
+
+// MuHash3072 is the rolling hash of a set which the reference client uses for the UTXO set commitment reported by
+// 'gettxoutsetinfo muhash'.
+//
+// https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf  (the multiplicative incremental hash)
+// https://github.com/bitcoin/bitcoin/pull/19055     (MuHash3072 as used by the reference client)
+//
+// Each element is hashed to a 3072 bit number (the 32 byte SHA256 of the element, expanded with ChaCha20) and the set
+// is the product of its elements modulo the prime 2^3072 - 1103717.  Elements which are removed are multiplied into
+// a separate denominator, so adding or removing an element costs a single multiplication and the order they come
+// and go in does not matter.  Only finalize pays for the modular inverse.
+
+#define MUHASH_LIMBS 48		// 64 bit limbs in a 3072 bit number
+#define MUHASH_BYTES 384	// The size of a 3072 bit number
+
+// The numbers are little endian arrays of 64 bit limbs.  The modulus is p = 2^3072 - MUHASH_PRIME_DIFF, so
+// 2^3072 = MUHASH_PRIME_DIFF (mod p) and the top half of a product folds into the bottom half with one more row of
+// multiplications by a small constant instead of a division.
+
+#define MUHASH_PRIME_DIFF 1103717
+
+// Returns the low 64 bits of a*b+c+carry and leaves the high 64 bits in carry; the sum cannot overflow 128 bits.
+#if defined(__SIZEOF_INT128__)
+
+static inline uint64_t mulAdd(uint64_t a,uint64_t b,uint64_t c,uint64_t &carry)
+{
+	__extension__ typedef unsigned __int128 uint128;
+	uint128 t = (uint128)a*b + c + carry;
+	carry = (uint64_t)(t>>64);
+	return (uint64_t)t;
+}
+
+#elif defined(_MSC_VER) && defined(_M_X64)
+
+static inline uint64_t mulAdd(uint64_t a,uint64_t b,uint64_t c,uint64_t &carry)
+{
+	uint64_t hi;
+	uint64_t lo = _umul128(a,b,&hi);
+	lo+=c;
+	hi+= lo < c ? 1 : 0;
+	lo+=carry;
+	hi+= lo < carry ? 1 : 0;
+	carry = hi;
+	return lo;
+}
+
+#else
+
+static inline uint64_t mulAdd(uint64_t a,uint64_t b,uint64_t c,uint64_t &carry)
+{
+	uint64_t a0 = (uint32_t)a;
+	uint64_t a1 = a>>32;
+	uint64_t b0 = (uint32_t)b;
+	uint64_t b1 = b>>32;
+	uint64_t p00 = a0*b0;
+	uint64_t p01 = a0*b1;
+	uint64_t p10 = a1*b0;
+	uint64_t mid = (p00>>32) + (uint32_t)p01 + (uint32_t)p10;
+	uint64_t lo = (mid<<32) | (uint32_t)p00;
+	uint64_t hi = a1*b1 + (p01>>32) + (p10>>32) + (mid>>32);
+	lo+=c;
+	hi+= lo < c ? 1 : 0;
+	lo+=carry;
+	hi+= lo < carry ? 1 : 0;
+	carry = hi;
+	return lo;
+}
+
+#endif
+
+static void setOne(uint64_t r[MUHASH_LIMBS])
+{
+	r[0] = 1;
+	for (uint32_t i=1; i<MUHASH_LIMBS; i++)
+	{
+		r[i] = 0;
+	}
+}
+
+// True if r is p or more; since r < 2^3072 that means every limb but the lowest is all ones
+static bool isOverflow(const uint64_t r[MUHASH_LIMBS])
+{
+	if ( r[0] <= ~(uint64_t)0 - MUHASH_PRIME_DIFF )
+	{
+		return false;
+	}
+	for (uint32_t i=1; i<MUHASH_LIMBS; i++)
+	{
+		if ( r[i] != ~(uint64_t)0 )
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// r = a*b mod p, fully reduced.  r may be the same array as a or b.
+static void multiply(uint64_t r[MUHASH_LIMBS],const uint64_t a[MUHASH_LIMBS],const uint64_t b[MUHASH_LIMBS])
+{
+	uint64_t product[MUHASH_LIMBS*2];
+	for (uint32_t i=0; i<MUHASH_LIMBS; i++)
+	{
+		product[i] = 0;
+	}
+	for (uint32_t i=0; i<MUHASH_LIMBS; i++)
+	{
+		uint64_t carry = 0;
+		for (uint32_t j=0; j<MUHASH_LIMBS; j++)
+		{
+			product[i+j] = mulAdd(a[i],b[j],product[i+j],carry);
+		}
+		product[i+MUHASH_LIMBS] = carry;
+	}
+	// Fold the top half in; what carries out of the top is below 2^21 and is folded in again
+	uint64_t carry = 0;
+	for (uint32_t i=0; i<MUHASH_LIMBS; i++)
+	{
+		r[i] = mulAdd(product[i+MUHASH_LIMBS],MUHASH_PRIME_DIFF,product[i],carry);
+	}
+	while ( carry )
+	{
+		uint64_t add = carry*MUHASH_PRIME_DIFF;
+		for (uint32_t i=0; i<MUHASH_LIMBS && add; i++)
+		{
+			r[i]+=add;
+			add = r[i] < add ? 1 : 0;
+		}
+		carry = add;
+	}
+	// Subtracting p is adding MUHASH_PRIME_DIFF and dropping the carry out of the top
+	if ( isOverflow(r) )
+	{
+		uint64_t add = MUHASH_PRIME_DIFF;
+		for (uint32_t i=0; i<MUHASH_LIMBS && add; i++)
+		{
+			r[i]+=add;
+			add = r[i] < add ? 1 : 0;
+		}
+	}
+}
+
+// r = a^(p-2) mod p, the inverse of a since p is prime; a plain square and multiply, which is fine for the one
+// inverse finalize needs.
+static void inverse(uint64_t r[MUHASH_LIMBS],const uint64_t a[MUHASH_LIMBS])
+{
+	uint64_t exponent[MUHASH_LIMBS];
+	exponent[0] = ~(uint64_t)0 - (MUHASH_PRIME_DIFF+1);	// p-2
+	for (uint32_t i=1; i<MUHASH_LIMBS; i++)
+	{
+		exponent[i] = ~(uint64_t)0;
+	}
+	uint64_t result[MUHASH_LIMBS];
+	setOne(result);
+	for (uint32_t i=MUHASH_LIMBS*64; i>0; i--)
+	{
+		uint32_t bit = i-1;
+		multiply(result,result,result);
+		if ( (exponent[bit/64]>>(bit%64)) & 1 )
+		{
+			multiply(result,result,a);
+		}
+	}
+	memcpy(r,result,sizeof(result));
+}
+
+// ChaCha20 (RFC 8439) with a zero nonce, which is all MuHash needs to stretch a 32 byte digest to 3072 bits.
+#define CHACHA_ROTATE(v,n) (((v)<<(n)) | ((v)>>(32-(n))))
+#define CHACHA_QUARTER_ROUND(a,b,c,d) \
+	a+=b; d^=a; d = CHACHA_ROTATE(d,16); \
+	c+=d; b^=c; b = CHACHA_ROTATE(b,12); \
+	a+=b; d^=a; d = CHACHA_ROTATE(d,8); \
+	c+=d; b^=c; b = CHACHA_ROTATE(b,7);
+
+static inline uint32_t readLE32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static void chaCha20Keystream(const uint8_t key[32],uint8_t *output,uint32_t blockCount)
+{
+	uint32_t input[16];
+	input[0] = 0x61707865;	// "expand 32-byte k"
+	input[1] = 0x3320646e;
+	input[2] = 0x79622d32;
+	input[3] = 0x6b206574;
+	for (uint32_t i=0; i<8; i++)
+	{
+		input[4+i] = readLE32(&key[i*4]);
+	}
+	input[12] = 0;			// the block counter
+	input[13] = 0;			// and the nonce
+	input[14] = 0;
+	input[15] = 0;
+	for (uint32_t block=0; block<blockCount; block++)
+	{
+		uint32_t x[16];
+		memcpy(x,input,sizeof(x));
+		for (uint32_t i=0; i<10; i++)
+		{
+			CHACHA_QUARTER_ROUND(x[0],x[4],x[8],x[12]);
+			CHACHA_QUARTER_ROUND(x[1],x[5],x[9],x[13]);
+			CHACHA_QUARTER_ROUND(x[2],x[6],x[10],x[14]);
+			CHACHA_QUARTER_ROUND(x[3],x[7],x[11],x[15]);
+			CHACHA_QUARTER_ROUND(x[0],x[5],x[10],x[15]);
+			CHACHA_QUARTER_ROUND(x[1],x[6],x[11],x[12]);
+			CHACHA_QUARTER_ROUND(x[2],x[7],x[8],x[13]);
+			CHACHA_QUARTER_ROUND(x[3],x[4],x[9],x[14]);
+		}
+		for (uint32_t i=0; i<16; i++)
+		{
+			uint32_t v = x[i]+input[i];
+			output[0] = (uint8_t)v;
+			output[1] = (uint8_t)(v>>8);
+			output[2] = (uint8_t)(v>>16);
+			output[3] = (uint8_t)(v>>24);
+			output+=4;
+		}
+		input[12]++;
+	}
+}
+
+// The 3072 bit number an element stands for; the ChaCha20 keystream keyed with its SHA256, read little endian
+static void expandDigest(const uint8_t digest[32],uint64_t r[MUHASH_LIMBS])
+{
+	uint8_t bytes[MUHASH_BYTES];
+	chaCha20Keystream(digest,bytes,MUHASH_BYTES/64);
+	for (uint32_t i=0; i<MUHASH_LIMBS; i++)
+	{
+		uint64_t v = 0;
+		for (uint32_t j=8; j>0; j--)
+		{
+			v = (v<<8) | bytes[i*8+j-1];
+		}
+		r[i] = v;
+	}
+}
+
+class MuHash3072
+{
+public:
+	MuHash3072(void)
+	{
+		clear();
+	}
+
+	// Back to the empty set
+	void clear(void)
+	{
+		setOne(mNumerator);
+		setOne(mDenominator);
+	}
+
+	// Adds the element whose SHA256 is 'digest'
+	void insert(const uint8_t digest[32])
+	{
+		uint64_t element[MUHASH_LIMBS];
+		expandDigest(digest,element);
+		multiply(mNumerator,mNumerator,element);
+	}
+
+	// Removes the element whose SHA256 is 'digest'
+	void remove(const uint8_t digest[32])
+	{
+		uint64_t element[MUHASH_LIMBS];
+		expandDigest(digest,element);
+		multiply(mDenominator,mDenominator,element);
+	}
+
+	// The 32 byte hash of the set.  The reference client displays it byte reversed, as it does block hashes.
+	void finalize(uint8_t hash[32]) const
+	{
+		uint64_t value[MUHASH_LIMBS];
+		inverse(value,mDenominator);
+		multiply(value,value,mNumerator);
+		uint8_t bytes[MUHASH_BYTES];
+		for (uint32_t i=0; i<MUHASH_LIMBS; i++)
+		{
+			for (uint32_t j=0; j<8; j++)
+			{
+				bytes[i*8+j] = (uint8_t)(value[i]>>(j*8));
+			}
+		}
+		BLOCKCHAIN_SHA256::computeSHA256(bytes,MUHASH_BYTES,hash);
+	}
+
+	// The state is plain data; it can be copied or written out as it is.
+	uint64_t	mNumerator[MUHASH_LIMBS];
+	uint64_t	mDenominator[MUHASH_LIMBS];
+};
+
+}; // End of the MuHash3072 namespace
+
+
+// Begin of source to perform Base58 encode/decode
+namespace BLOCKCHAIN_BASE58
+{
+
+//
+//  BigNumber.c
+//  cbitcoin
+//
+//  Created by Matthew Mitchell on 28/04/2012.
+//  Copyright (c) 2012 Matthew Mitchell
+//
+//  This file is part of cbitcoin.
+//
+//  cbitcoin is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  cbitcoin is distributed in the hope that it will be useful, 
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with cbitcoin.  If not, see <http://www.gnu.org/licenses/>.
+//
+//
+
+#define MAX_BIG_NUMBER 256	// this code snippet only supports big nubmers up to 256 bytes in length
+/**
+ @brief Contains byte data with the length of this data to represent a large integer. The byte data is in little-endian which stores the smallest byte first.
+ */
+class BigNumber
+{
+public:
+	BigNumber(const uint8_t *sourceData,uint32_t len)
+	{
+		assert(len<MAX_BIG_NUMBER);
+		memset(data,0,MAX_BIG_NUMBER);
+		if ( sourceData )
+		{
+			memcpy(data,sourceData,len);
+		}
+		length = len;
+	}
+	uint8_t		data[MAX_BIG_NUMBER]; /**< The byte data. Should be little-endian */
+	uint32_t	length; /**< The length of this data in bytes */
+};
+
+//  Enums
+
+enum BigNumberCompare 
+{
+	CB_COMPARE_MORE_THAN = 1, 
+	CB_COMPARE_EQUAL = 0, 
+	CB_COMPARE_LESS_THAN = -1, 
+};
+
+/**
+ @brief Compares a BigNumber to an 8 bit integer. You can replicate "a op 58" as "BigNumberCompareToUInt8(a, 58) op 0" replacing "op" with a comparison operator.
+ @param a The first BigNumber
+ @returns The result of the comparison as a BigNumberCompare constant. Returns what a is in relation to b.
+ */
+BigNumberCompare BigNumberCompareTo58(BigNumber * a);
+/**
+ @brief Compares two BigNumber. You can replicate "a op b" as "BigNumberCompare(a, b) op 0" replacing "op" with a comparison operator.
+ @param a The first BigNumber
+ @param b The second BigNumber
+ @returns The result of the comparison as a BigNumberCompare constant. Returns what a is in relation to b.
+ */
+BigNumberCompare BigNumberCompareToBigInt(BigNumber * a, BigNumber * b);
+/**
+ @brief Calculates the result of an addition of a BigNumber structure by another BigNumber structure and the first BigNumber becomes this new figure. Like "a += b".
+ @param a A pointer to the BigNumber
+ @param b A pointer to the second BigNumber
+ @returns true on success, false on failure.
+ */
+bool BigNumberEqualsAdditionByBigInt(BigNumber * a, BigNumber * b);
+/**
+ @brief Calculates the result of a division of a BigNumber structure by 58 and the BigNumber becomes this new figure. Like "a /= 58".
+ @param a A pointer to the BigNumber
+ @param ans A memory block the same size as the BigNumber data memory block to store temporary data in calculations. Should be set with zeros.
+ */
+void BigNumberEqualsDivisionBy58(BigNumber * a, uint8_t * ans);
+/**
+ @brief Calculates the result of a multiplication of a BigNumber structure by an 8 bit integer and the BigNumber becomes this new figure. Like "a *= b".
+ @param a A pointer to the BigNumber
+ @param b An 8 bit integer
+ @returns true on success, false on failure
+ */
+bool BigNumberEqualsMultiplicationByUInt8(BigNumber * a, uint8_t b);
+/**
+ @brief Calculates the result of a subtraction of a BigNumber structure with another BigNumber structure and the BigNumber becomes this new figure. Like "a -= b".
+ @param a A pointer to a BigNumber
+ @param b A pointer to a BigNumber
+ */
+void BigNumberEqualsSubtractionByBigInt(BigNumber * a, BigNumber * b);
+/**
+ @brief Calculates the result of a subtraction of a BigNumber structure by an 8 bit integer and the BigNumber becomes this new figure. Like "a -= b".
+ @param a A pointer to the BigNumber
+ @param b An 8 bit integer
+ */
+void BigNumberEqualsSubtractionByUInt8(BigNumber * a, uint8_t b);
+/**
+ @brief Assigns a BigNumber as the exponentiation of an unsigned 8 bit intger with another unsigned 8 bit integer. Like "a^b". Data must be freed.
+ @param bi The BigNumber. Preallocate this with at least one byte.
+ @param a The base
+ @param b The exponent.
+ @returns true on success, false on failure.
+ */
+bool BigNumberFromPowUInt8(BigNumber * bi, uint8_t a, uint8_t b);
+/**
+ @brief Returns the result of a modulo of a BigNumber structure and 58. Like "a % 58".
+ @param a The BigNumber
+ @returns The result of the modulo operation as an 8 bit integer.
+ */
+uint8_t BigNumberModuloWith58(BigNumber * a);
+/**
+ @brief Normalises a BigNumber so that there are no unnecessary trailing zeros.
+ @param a A pointer to the BigNumber
+ */
+void BigNumberNormalise(BigNumber * a);
+
+BigNumberCompare BigNumberCompareTo58(BigNumber * a)
+{
+	if(a->length > 1)
+		return CB_COMPARE_MORE_THAN;
+	if (a->data[0] > 58)
+		return CB_COMPARE_MORE_THAN;
+	else if (a->data[0] < 58)
+		return CB_COMPARE_LESS_THAN;
+	return CB_COMPARE_EQUAL;
+}
+
+BigNumberCompare BigNumberCompareToBigInt(BigNumber * a, BigNumber * b)
+{
+	if (a->length > b->length)
+		return CB_COMPARE_MORE_THAN;
+	else if (a->length < b->length)
+		return CB_COMPARE_LESS_THAN;
+	for (uint32_t x = a->length; x--;) 
+	{
+		if (a->data[x] < b->data[x])
+			return CB_COMPARE_LESS_THAN;
+		else if (a->data[x] > b->data[x])
+			return CB_COMPARE_MORE_THAN;
+	}
+	return CB_COMPARE_EQUAL;
+}
+bool BigNumberEqualsAdditionByBigInt(BigNumber * a, BigNumber * b)
+{
+	if (a->length < b->length) 
+	{
+		// Make certain expansion of data is empty
+		memset(a->data + a->length, 0, b->length - a->length);
+		a->length = b->length;
+	}
+	// a->length >= b->length
+	bool overflow = 0;
+	uint8_t x = 0;
+	for (; x < b->length; x++) 
+	{
+		a->data[x] += b->data[x] + overflow;
+		// a->data[x] now equals the result of the addition.
+		// The overflow will never go beyond 1. Imagine a->data[x] == 0xff, b->data[x] == 0xff and the overflow is 1, the new overflow is still 1 and a->data[x] is 0xff. Therefore it does work.
+		overflow = (a->data[x] < (b->data[x] + overflow))? 1 : 0;
+	}
+	// Propagate overflow up the whole length of a if necessary
+	while (overflow && x < a->length)
+		overflow = ! ++a->data[x++]; // Index at x, increment x, increment data, test new value for overflow.
+	if (overflow) 
+	{ // Add extra byte
+		a->length++;
+		assert( a->length < MAX_BIG_NUMBER );
+		a->data[a->length - 1] = 1;
+	}
+	return true;
+}
+void BigNumberEqualsDivisionBy58(BigNumber * a, uint8_t * ans)
+{
+	if (a->length == 1 && ! a->data[0]) // "a" is zero
+		return;
+	// base-256 long division.
+	uint16_t temp = 0;
+	for (uint32_t x = a->length; x--;) 
+	{
+		temp <<= 8;
+		temp |= a->data[x];
+		ans[x] = (uint8_t)(temp / 58);
+		temp -= ans[x] * 58;
+	}
+	if (! ans[a->length-1]) // If last byte is zero, adjust length.
+		a->length--;
+	memmove(a->data, ans, a->length); // Done calculation. Move ans to "a".
+}
+bool BigNumberEqualsMultiplicationByUInt8(BigNumber * a, uint8_t b)
+{
+	if (! b) 
+	{
+		// Mutliplication by zero. "a" becomes zero
+		a->length = 1;
+		a->data[0] = 0;
+		return true;
+	}
+	if (a->length == 1 && ! a->data[0]) // "a" is zero
+		return true;
+	// Multiply b by each byte and then add to answer
+	uint16_t carry = 0;
+	uint8_t x = 0;
+	for (; x < a->length; x++) 
+	{
+		carry = carry + a->data[x] * b; // Allow for overflow onto next byte.
+		a->data[x] = (uint8_t)carry;
+		carry >>= 8;
+	}
+	if (carry) 
+	{ // If last byte is not zero, adjust length.
+		a->length++;
+		assert( a->length < MAX_BIG_NUMBER );
+		a->data[x] = (uint8_t)carry;
+	}
+	return true;
+}
+void BigNumberEqualsSubtractionByBigInt(BigNumber * a, BigNumber * b)
+{
+	uint8_t x;
+	bool carry = 0;
+	// This can be made much nicer when using signed arithmetic, 
+	// carry and tmp could be merged to be 0 or -1 between rounds.
+	for (x = 0; x < b->length; x++) {
+		uint16_t tmp = carry + b->data[x];
+		carry = a->data[x] < tmp;
+		a->data[x] -= (uint8_t)tmp;
+	}
+	if (carry)
+		a->data[x]--;
+	BigNumberNormalise(a);
+}
+
+void BigNumberEqualsSubtractionByUInt8(BigNumber * a, uint8_t b)
+{
+	uint8_t carry = b;
+	uint8_t x = 0;
+	for (; a->data[x] < carry; x++){
+		a->data[x] = 255 - carry + a->data[x] + 1;
+		carry = 1;
+	}
+	a->data[x] -= carry;
+	BigNumberNormalise(a);
+}
+
+bool BigNumberFromPowUInt8(BigNumber * bi, uint8_t a, uint8_t b)
+{
+	bi->length = 1;
+	bi->data[0] = 1;
+	for (uint8_t x = 0; x < b; x++) {
+		if (! BigNumberEqualsMultiplicationByUInt8(bi, a))
+			// ERROR
+			return false;
+	}
+	return true;
+}
+
+uint8_t BigNumberModuloWith58(BigNumber * a)
+{
+	// Use method presented here: http://stackoverflow.com/a/10441333/238411
+	uint16_t result = 0; // Prevent overflow in calculations
+	for(uint32_t x = a->length - 1;; x--){
+		result *= (256 % 58);
+		result %= 58;
+		result += a->data[x] % 58;
+		result %= 58;
+		if (! x)
+			break;
+	}
+	return (uint8_t)result;
+}
+
+void BigNumberNormalise(BigNumber * a)
+{
+	while (a->length > 1 && ! a->data[a->length-1])
+		a->length--;
+}
+
+//                                                  1         2         3         4         5    
+//                                        01234567890123456789012345678901234567890123456789012345678
+static const char base58Characters[59] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+/**
+ @brief Decodes base 58 string into byte data as a BigNumber.
+ @param bi The BigNumber which should be preallocated with at least one byte.
+ @param str Base 58 string to decode.
+ @returns true on success, false on failure.
+ */
+bool CBDecodeBase58(BigNumber * bi,const char * str)
+{
+	// ??? Quite likely these functions can be improved
+	BigNumber bi2(NULL,1);
+
+	uint32_t slen = (uint32_t)strlen(str);
+
+	for (uint32_t x = slen - 1;; x--)
+	{ // Working backwards
+		// Get index in alphabet array
+		uint8_t alphaIndex = str[x];
+		if (alphaIndex != 49)
+		{ // If not 1
+			if (str[x] < 58)
+			{ // Numbers
+				alphaIndex -= 49;
+			}
+			else if (str[x] < 73)
+			{ // A-H
+				alphaIndex -= 56;
+			}
+			else if (str[x] < 79)
+			{ // J-N
+				alphaIndex -= 57;
+			}
+			else if (str[x] < 91)
+			{ // P-Z
+				alphaIndex -= 58;
+			}
+			else if (str[x] < 108)
+			{ // a-k
+				alphaIndex -= 64;
+			}
+			else
+			{ // m-z
+				alphaIndex -= 65;
+			}
+			if (! BigNumberFromPowUInt8(&bi2, 58, (uint8_t)(slen - 1 - x)))
+			{
+				// Error occured.
+				return false;
+			}
+			if (! BigNumberEqualsMultiplicationByUInt8(&bi2, alphaIndex))
+			{
+				// Error occured.
+				return false;
+			}
+			if (! BigNumberEqualsAdditionByBigInt(bi, &bi2))
+			{
+				// Error occured.
+				return false;
+			}
+		}
+		if (!x)
+			break;
+	}
+	// Got BigNumber from base-58 string. Add zeros on end.
+	uint8_t zeros = 0;
+	for (uint8_t x = 0; x < slen; x++)
+	{
+		if (str[x] == '1')
+		{
+			zeros++;
+		}
+		else
+		{
+			break;
+		}
+	}
+	if (zeros) 
+	{
+		bi->length += zeros;
+		assert( bi->length < MAX_BIG_NUMBER );
+		memset(bi->data + bi->length - zeros, 0, zeros);
+	}
+	return true;
+}
+
+bool CBEncodeBase58(BigNumber * bi,char *str,uint32_t maxStrLen)
+{
+	if ( maxStrLen < bi->length ) // must be at least twice the size of the binary
+	{
+		return false;
+	}
+	uint32_t x = 0;
+	// Zeros
+	for (uint32_t y = bi->length - 1;; y--)
+	{
+		if (! bi->data[y])
+		{
+			str[x] = '1';
+			x++;
+			if (! y)
+				break;
+		}
+		else
+		{
+			break;
+		}
+	}
+	uint32_t zeros = x;
+	// Make temporary data store
+	uint8_t temp[MAX_BIG_NUMBER];
+	// Encode
+	uint8_t mod;
+	size_t size = bi->length;
+	for (;BigNumberCompareTo58(bi) >= 0;x++) 
+	{
+		mod = BigNumberModuloWith58(bi);
+		if (bi->length < x + 3) 
+		{
+			size = x + 3;
+			if (size > bi->length) 
+			{
+				if ( size > maxStrLen )
+				{
+					return false;
+				}
+			}
+		}
+		str[x] = base58Characters[mod];
+		BigNumberEqualsSubtractionByUInt8(bi, mod);
+		memset(temp, 0, bi->length);
+		BigNumberEqualsDivisionBy58(bi, temp);
+	}
+	str[x] = base58Characters[bi->data[bi->length-1]];
+	x++;
+	// Reversal
+	for (uint8_t y = 0; y < (x-zeros) / 2; y++) 
+	{
+		char temp = str[y+zeros];
+		str[y+zeros] = str[x-y-1];
+		str[x-y-1] = temp;
+	}
+	str[x] = '\0';
+	return true;
+}
+
+
+
+
+// The original byte at a time cbitcoin implementation; kept as a reference to cross check the fast version against.
+bool encodeBase58Reference(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
+					   uint32_t length,			 // The number of bytes in the 'big-number'; this will be 25 for a bitcoin address
+					   bool littleEndian,		 // True if the input number is in little-endian format (this will be true for a bitcoin address)
+					   char *output,			 // The address to store the output string.
+					   uint32_t maxStrLen)		 // the maximum length of the output string
+{
+	// Before passing the hash into the base58 encoder; we need to reverse the byte order.
+	uint8_t hash[25];
+	if ( littleEndian )
+	{
+		uint32_t index = length-1;
+		for (uint32_t i=0; i<25; i++)
+		{
+			hash[i] = bigNumber[index];
+			index--;
+		}
+	}
+	else
+	{
+		memcpy(hash,bigNumber,length);
+	}
+	// We now have the 25 byte public key address in binary; we just need to convert it to ASCII
+	// This involves using large integer math to compute the base58 encoding (with check) 
+	BigNumber bytes(hash,length);;
+	return CBEncodeBase58(&bytes,output,maxStrLen);
+}
+
+uint32_t decodeBase58Reference(const char *string,		// The base58 encoded string
+					   uint8_t *output,			// The output binary buffer
+					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
+					   bool littleEndian) // If the output needs to be in little endian format
+{
+	uint32_t ret = 0;
+
+	BigNumber bn(NULL,0);
+	if ( CBDecodeBase58(&bn,string) && bn.length <= maxOutputLength )
+	{
+		ret = bn.length;
+		if ( littleEndian ) // if the caller wants the number returned in little endian format; then we byte reverse the output
+		{
+			uint32_t index = bn.length-1;
+			for (uint32_t i=0; i<bn.length; i++)
+			{
+				output[i] = bn.data[index];
+				index--;
+			}
+		}
+		else
+		{
+			memcpy(output,bn.data,bn.length);
+		}
+	}
+
+	return ret;
+}
+
+// The fast encoder/decoder below treats the number as an array of 32 bit words rather than
+// working on it one byte at a time.  Each pass divides (or multiplies) the whole number by 58^5,
+// so five base58 digits are produced (or consumed) per pass using only 64 bit intermediates.
+#define BASE58_POW5 656356768	// 58^5; the largest power of 58 where (remainder << 32) still fits in 64 bits
+#define BASE58_MAX_WORDS (MAX_BIG_NUMBER/4+1)
+
+// Maps an ASCII character to its base58 digit; -1 for characters which are not in the alphabet
+static const int8_t base58Digits[256] = {
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+	-1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+	22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+	-1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+	47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+bool encodeBase58(const uint8_t *bigNumber, // The block of memory corresponding to the 'big number'
+					   uint32_t length,			 // The number of bytes in the 'big-number'; this will be 25 for a bitcoin address
+					   bool isBigEndian,		 // True if the input number is in big-endian format (this will be true for a bitcoin address)
+					   char *output,			 // The address to store the output string.
+					   uint32_t maxStrLen)		 // the maximum length of the output string
+{
+	if ( length > MAX_BIG_NUMBER )
+	{
+		return false;
+	}
+	// Get the number in big-endian byte order
+	uint8_t bytes[MAX_BIG_NUMBER];
+	if ( isBigEndian )
+	{
+		memcpy(bytes,bigNumber,length);
+	}
+	else
+	{
+		for (uint32_t i=0; i<length; i++)
+		{
+			bytes[i] = bigNumber[length-1-i];
+		}
+	}
+	// Each leading zero byte is encoded as a '1'
+	uint32_t zeros = 0;
+	while ( zeros < length && bytes[zeros] == 0 )
+	{
+		zeros++;
+	}
+	// Pack the remaining bytes into 32 bit words; least significant word first
+	uint32_t words[BASE58_MAX_WORDS];
+	uint32_t wordCount = 0;
+	for (int32_t i=(int32_t)length; i>(int32_t)zeros; i-=4)
+	{
+		uint32_t w = 0;
+		int32_t start = i-4;
+		if ( start < (int32_t)zeros )
+		{
+			start = (int32_t)zeros;
+		}
+		for (int32_t j=start; j<i; j++)
+		{
+			w = (w<<8) | bytes[j];
+		}
+		words[wordCount++] = w;
+	}
+	// Repeatedly divide by 58^5; each remainder yields five digits, least significant first
+	char digits[MAX_BIG_NUMBER*2];
+	uint32_t digitCount = 0;
+	while ( wordCount )
+	{
+		uint64_t rem = 0;
+		for (int32_t i=(int32_t)wordCount-1; i>=0; i--)
+		{
+			uint64_t cur = (rem<<32) | words[i];
+			words[i] = (uint32_t)(cur / BASE58_POW5);
+			rem = cur % BASE58_POW5;
+		}
+		while ( wordCount && words[wordCount-1] == 0 )
+		{
+			wordCount--;
+		}
+		uint32_t r = (uint32_t)rem;
+		for (uint32_t k=0; k<5; k++)
+		{
+			digits[digitCount++] = base58Characters[r%58];
+			r/=58;
+			if ( wordCount == 0 && r == 0 ) // don't emit leading zero digits for the most significant chunk
+			{
+				break;
+			}
+		}
+	}
+	if ( zeros+digitCount+1 > maxStrLen )
+	{
+		return false;
+	}
+	char *dest = output;
+	for (uint32_t i=0; i<zeros; i++)
+	{
+		*dest++ = '1';
+	}
+	while ( digitCount )
+	{
+		*dest++ = digits[--digitCount];
+	}
+	*dest = 0;
+	return true;
+}
+
+uint32_t decodeBase58(const char *string,		// The base58 encoded string
+					   uint8_t *output,			// The output binary buffer
+					   uint32_t maxOutputLength, // The maximum output length of the binary buffer.
+					   bool isBigEndian) // If the output needs to be in big endian format (true for bitcoin addresses)
+{
+	// Each leading '1' is a leading zero byte
+	uint32_t zeros = 0;
+	while ( string[zeros] == '1' )
+	{
+		zeros++;
+	}
+	uint32_t words[BASE58_MAX_WORDS]; // least significant word first
+	uint32_t wordCount = 0;
+	const char *scan = &string[zeros];
+	if ( zeros == 0 && *scan == 0 )
+	{
+		return 0;
+	}
+	while ( *scan )
+	{
+		// Consume up to five digits at a time and fold them into the number with a single multiply-add pass
+		uint32_t acc = 0;
+		uint32_t mul = 1;
+		for (uint32_t k=0; k<5 && *scan; k++)
+		{
+			int8_t d = base58Digits[(uint8_t)*scan++];
+			if ( d < 0 )
+			{
+				return 0;
+			}
+			acc = acc*58 + (uint32_t)d;
+			mul*=58;
+		}
+		uint64_t carry = acc;
+		for (uint32_t i=0; i<wordCount; i++)
+		{
+			uint64_t cur = (uint64_t)words[i]*mul + carry;
+			words[i] = (uint32_t)cur;
+			carry = cur>>32;
+		}
+		if ( carry )
+		{
+			if ( wordCount == BASE58_MAX_WORDS )
+			{
+				return 0;
+			}
+			words[wordCount++] = (uint32_t)carry;
+		}
+	}
+	// Unpack the words into big-endian bytes, skipping leading zero bytes
+	uint8_t bytes[MAX_BIG_NUMBER+BASE58_MAX_WORDS*4];
+	uint32_t byteCount = 0;
+	for (uint32_t i=0; i<zeros; i++)
+	{
+		if ( byteCount == MAX_BIG_NUMBER )
+		{
+			return 0;
+		}
+		bytes[byteCount++] = 0;
+	}
+	bool leading = true;
+	for (int32_t i=(int32_t)wordCount-1; i>=0; i--)
+	{
+		for (int32_t shift=24; shift>=0; shift-=8)
+		{
+			uint8_t b = (uint8_t)(words[i]>>shift);
+			if ( leading && b == 0 )
+			{
+				continue;
+			}
+			leading = false;
+			bytes[byteCount++] = b;
+		}
+	}
+	if ( byteCount > maxOutputLength )
+	{
+		return 0;
+	}
+	if ( isBigEndian )
+	{
+		memcpy(output,bytes,byteCount);
+	}
+	else
+	{
+		for (uint32_t i=0; i<byteCount; i++)
+		{
+			output[i] = bytes[byteCount-1-i];
+		}
+	}
+	return byteCount;
+}
+
+uint32_t encodeBase58Batch(const uint8_t *bigNumbers,uint32_t length,uint32_t count,bool isBigEndian,char *output,uint32_t stride)
+{
+	uint32_t ret = 0;
+	for (uint32_t i=0; i<count; i++)
+	{
+		char *dest = &output[i*stride];
+		if ( encodeBase58(&bigNumbers[i*length],length,isBigEndian,dest,stride) )
+		{
+			ret++;
+		}
+		else
+		{
+			dest[0] = 0;
+		}
+	}
+	return ret;
+}
+
+}; // end of namespace
+
+// ************ Beginning of source to compute bitcoin addresses from public keys, etc.
+namespace BLOCKCHAIN_BITCOIN_ADDRESS
+{
+
+bool bitcoinPublicKeyToAddress(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
+							   uint8_t output[25])		// A bitcoin address (in binary( is always 25 bytes long.
+{
+	bool ret = false;
+
+	if ( input[0] == 0x04)
+	{
+		uint8_t hash1[32]; // holds the intermediate SHA256 hash computations
+		BLOCKCHAIN_SHA256::computeSHA256(input,65,hash1);	// Compute the SHA256 hash of the input public ECSDA signature
+		output[0] = 0;	// Store a network byte of 0 (i.e. 'main' network)
+		BLOCKCHAIN_RIPEMD160::computeRIPEMD160(hash1,32,&output[1]);	// Compute the RIPEMD160 (20 byte) hash of the SHA256 hash
+		BLOCKCHAIN_SHA256::computeSHA256(output,21,hash1);	// Compute the SHA256 hash of the RIPEMD16 hash + the one byte header (for a checksum)
+		BLOCKCHAIN_SHA256::computeSHA256(hash1,32,hash1); // now compute the SHA256 hash of the previously computed SHA256 hash (for a checksum)
+		output[21] = hash1[0];	// Store the checksum in the last 4 bytes of the public key hash
+		output[22] = hash1[1];
+		output[23] = hash1[2];
+		output[24] = hash1[3];
+		ret = true;
+	}
+	return ret;
+}
+
+
+bool bitcoinPublicKeyToHash160(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
+							   uint8_t hash160[20])		// The 20 byte RIPEMD160 hash of the SHA256 hash of the key
+{
+	bool ret = false;
+
+	if ( input[0] == 0x04)
+	{
+		uint8_t hash1[32]; // holds the intermediate SHA256 hash computation
+		BLOCKCHAIN_SHA256::computeSHA256(input,65,hash1);	// Compute the SHA256 hash of the input public ECSDA signature
+		BLOCKCHAIN_RIPEMD160::computeRIPEMD160(hash1,32,hash160);	// Compute the RIPEMD160 (20 byte) hash of the SHA256 hash; no header or checksum is needed
+		ret = true;
+	}
+	return ret;
+}
+
+#define PUBLIC_KEY_BATCH 64 // How many keys are pushed through the multi-buffer hash routines at a time
+
+void bitcoinPublicKeysToHash160(const uint8_t * const *keys,uint32_t count,uint8_t *hash160s)
+{
+	uint8_t hash1[PUBLIC_KEY_BATCH*32]; // holds the intermediate SHA256 hash computations
+	const void *sha[PUBLIC_KEY_BATCH];
+	for (uint32_t i=0; i<PUBLIC_KEY_BATCH; i++)
+	{
+		sha[i] = &hash1[i*32];
+	}
+	for (uint32_t base=0; base<count; base+=PUBLIC_KEY_BATCH)
+	{
+		uint32_t n = count-base;
+		if ( n > PUBLIC_KEY_BATCH )
+		{
+			n = PUBLIC_KEY_BATCH;
+		}
+		BLOCKCHAIN_SHA256::computeSHA256Batch((const void * const *)&keys[base],65,n,hash1);
+		BLOCKCHAIN_RIPEMD160::computeRIPEMD160Batch(sha,32,n,&hash160s[base*20]);
+	}
+}
+
+bool bitcoinPublicKeyToAscii(const uint8_t input[65], // The 65 bytes long ECDSA public key; first byte will always be 0x4 followed by two 32 byte components
+							 char *output,				// The output ascii representation.
+							 uint32_t maxOutputLen) // convert a binary bitcoin address into ASCII
+{
+	bool ret = false;
+
+	output[0] = 0;
+
+	uint8_t hash2[25];
+
+	if ( bitcoinPublicKeyToAddress(input,hash2))
+	{
+		ret = BLOCKCHAIN_BASE58::encodeBase58(hash2,25,true,output,maxOutputLen);
+	}
+	return ret;
+}
+
+bool bitcoinAsciiToAddress(const char *input,uint8_t output[25]) // convert an ASCII bitcoin address into binary.
+{
+	bool ret = false;
+	uint32_t len = BLOCKCHAIN_BASE58::decodeBase58(input,output,25,true);
+	if ( len == 25 ) // the output must be *exactly* 25 bytes!
+	{
+		uint8_t checksum[32];
+		BLOCKCHAIN_SHA256::computeSHA256(output,21,checksum);
+		BLOCKCHAIN_SHA256::computeSHA256(checksum,32,checksum);
+		if ( output[21] == checksum[0] ||
+			 output[22] == checksum[1] ||
+			 output[23] == checksum[2] ||
+			 output[24] == checksum[3] )
+		{
+			ret = true; // the cheksum matches!
+		}
+	}
+	return ret;
+}
+
+
+
+void bitcoinRIPEMD160ToAddress(const uint8_t ripeMD160[20],uint8_t output[25])
+{
+	uint8_t hash1[32]; // holds the intermediate SHA256 hash computations
+	output[0] = 0;	// Store a network byte of 0 (i.e. 'main' network)
+	memcpy(&output[1],ripeMD160,20); // copy the 20 byte of the public key address
+	BLOCKCHAIN_SHA256::computeSHA256(output,21,hash1);	// Compute the SHA256 hash of the RIPEMD16 hash + the one byte header (for a checksum)
+	BLOCKCHAIN_SHA256::computeSHA256(hash1,32,hash1); // now compute the SHA256 hash of the previously computed SHA256 hash (for a checksum)
+	output[21] = hash1[0];	// Store the checksum in the last 4 bytes of the public key hash
+	output[22] = hash1[1];
+	output[23] = hash1[2];
+	output[24] = hash1[3];
+}
+
+bool bitcoinAddressToAscii(const uint8_t address[25],char *output,uint32_t maxOutputLen)
+{
+	bool ret = false;
+
+	ret = BLOCKCHAIN_BASE58::encodeBase58(address,25,true,output,maxOutputLen);
+
+	return ret;
+}
+
+uint32_t bitcoinAddressesToAscii(const uint8_t *addresses,uint32_t count,char *output,uint32_t stride)
+{
+	return BLOCKCHAIN_BASE58::encodeBase58Batch(addresses,25,count,true,output,stride);
+}
+
+}; // end of namespace
+
+
+enum ScriptOpcodes
+{
+	OP_0 			=  0x00,
+	OP_PUSHDATA1 	=  0x4c,
+	OP_PUSHDATA2 	=  0x4d,
+	OP_PUSHDATA4 	=  0x4e,
+	OP_1NEGATE 		=  0x4f,
+	OP_RESERVED 	=  0x50,
+	OP_1 			=  0x51,
+	OP_2 			=  0x52,
+	OP_3 			=  0x53,
+	OP_4 			=  0x54,
+	OP_5 			=  0x55,
+	OP_6 			=  0x56,
+	OP_7 			=  0x57,
+	OP_8 			=  0x58,
+	OP_9 			=  0x59,
+	OP_10 			=  0x5a,
+	OP_11 			=  0x5b,
+	OP_12 			=  0x5c,
+	OP_13 			=  0x5d,
+	OP_14 			=  0x5e,
+	OP_15 			=  0x5f,
+	OP_16 			=  0x60,
+	OP_NOP 			=  0x61,
+	OP_VER 			=  0x62,
+	OP_IF 			=  0x63,
+	OP_NOTIF 		=  0x64,
+	OP_VERIF 		=  0x65,
+	OP_VERNOTIF 	=  0x66,
 	OP_ELSE 		=  0x67,
 	OP_ENDIF 		=  0x68,
 	OP_VERIFY 		=  0x69,
@@ -1980,2974 +5654,7859 @@ enum ScriptOpcodes
 	OP_INVALIDOPCODE =  0xff
 };
 
-#define MAGIC_ID 0xD9B4BEF9
-#define ONE_BTC 100000000
-#define ONE_MBTC (ONE_BTC/1000)
+// Renders a native segwit output script (OP_0 through OP_16 followed by a single 2 to 40 byte push; this covers
+// P2WPKH, P2WSH and P2TR) as its 'bc1...' address.  Returns false if the script is not a witness program.
+static bool segwitScriptToAscii(const uint8_t *script,uint32_t scriptLength,char *output,uint32_t maxOutputLen)
+{
+	bool ret = false;
+	if ( script && scriptLength >= 4 && scriptLength <= 42 &&
+		 (script[0] == OP_0 || (script[0] >= OP_1 && script[0] <= OP_16)) &&
+		 (uint32_t)script[1]+2 == scriptLength )
+	{
+		uint32_t witnessVersion = script[0] == OP_0 ? 0 : (uint32_t)(script[0]-OP_1)+1;
+		ret = encodeSegwitAddress("bc",witnessVersion,&script[2],script[1],output,maxOutputLen);
+	}
+	return ret;
+}
+
+#define MAGIC_ID 0xD9B4BEF9
+#define ONE_BTC 100000000
+#define ONE_MBTC (ONE_BTC/1000)
+
+#define MAX_BLOCK_FILES	512	// As of July 6, 2013 there are only about 70 .dat files; so it will be a long time before this overflows
+
+// These defines set the limits this parser expects to ever encounter on the blockchain data stream.
+// In a debug build there are asserts to make sure these limits are never exceeded.
+// These limits work for the blockchain current as of July 1, 2013.
+// The limits can be revised when and if necessary.
+#define MAX_BLOCK_SIZE (1024*1024)*10	// never expect to have a block larger than 10mb
+#define MAX_BLOCK_TRANSACTION 8192		// never expect more than 8192 transactions per block.
+#define MAX_BLOCK_INPUTS 32768			// never expect more than 32768 total inputs
+#define MAX_BLOCK_OUTPUTS 32768			// never expect more than 32768 total outputs
+
+#define MAX_REASONABLE_SCRIPT_LENGTH (1024*8) // would never expect any script to be more than 8k in size; that would be very unusual!
+#define MAX_REASONABLE_INPUTS 4096				// really can't imagine any transaction ever having more than 4096 inputs
+#define MAX_REASONABLE_OUTPUTS 4096				// really can't imagine any transaction ever having more than 4096 outputs
+
+//********************************************
+//********************************************
+
+class BlockImpl : public BlockChain::Block
+{
+public:
+
+	// Read one byte from the block-chain input stream.
+	inline uint8_t readU8(void)
+	{
+		assert( (mBlockRead+sizeof(uint8_t)) <= mBlockEnd );
+		uint8_t ret = *(uint8_t *)mBlockRead;
+		mBlockRead+=sizeof(uint8_t);
+		return ret;
+	}
+
+	// Read two bytes from the block-chain input stream.
+	inline uint16_t readU16(void)
+	{
+		assert( (mBlockRead+sizeof(uint16_t)) <= mBlockEnd );
+		uint16_t ret = *(uint16_t *)mBlockRead;
+		mBlockRead+=sizeof(uint16_t);
+		return ret;
+	}
+
+	// Read four bytes from the block-chain input stream.
+	inline uint32_t readU32(void)
+	{
+		assert( (mBlockRead+sizeof(uint32_t)) <= mBlockEnd );
+		uint32_t ret = *(uint32_t *)mBlockRead;
+		mBlockRead+=sizeof(uint32_t);
+		return ret;
+	}
+
+	// Read eight bytes from the block-chain input stream.
+	inline uint64_t readU64(void)
+	{
+		assert( (mBlockRead+sizeof(uint64_t)) <= mBlockEnd );
+		uint64_t ret = *(uint64_t *)mBlockRead;
+		mBlockRead+=sizeof(uint64_t);
+		return ret;
+	}
+
+	// Return the current stream pointer representing a 32byte hash and advance the read pointer accordingly
+	inline const uint8_t *readHash(void)
+	{
+		const uint8_t *ret = mBlockRead;
+		assert( (mBlockRead+32) <= mBlockEnd );
+		mBlockRead+=32;
+		return ret;
+	}
+
+	// reads a variable length integer.
+	// See the documentation from here:  https://en.bitcoin.it/wiki/Protocol_specification#Variable_length_integer
+	inline uint32_t readVariableLengthInteger(void)
+	{
+		uint32_t ret = 0;
+
+		uint8_t v = readU8();
+		if ( v < 0xFD ) // If it's less than 0xFD use this value as the unsigned integer
+		{
+			ret = (uint32_t)v;
+		}
+		else
+		{
+			uint16_t v = readU16();
+			if ( v < 0xFFFF )
+			{
+				ret = (uint32_t)v;
+			}
+			else
+			{
+				uint32_t v = readU32();
+				if ( v < 0xFFFFFFFF )
+				{
+					ret = (uint32_t)v;
+				}
+				else
+				{
+					assert(0); // never expect to actually encounter a 64bit integer in the block-chain stream; it's outside of any reasonable expected value
+					uint64_t v = readU64();
+					ret = (uint32_t)v;
+				}
+			}
+		}
+		return ret;
+	}
+
+	// Get the current read buffer address and advance the stream buffer by this length; used to get the address of input/output scripts
+	inline const uint8_t * getReadBufferAdvance(uint32_t readLength)
+	{
+		const uint8_t *ret = mBlockRead;
+		mBlockRead+=readLength;
+		assert( mBlockRead <= mBlockEnd );
+		return ret;
+	}
+	
+	// Read a transaction input
+	bool readInput(BlockChain::BlockInput &input)
+	{
+		bool ret = true;
+
+		input.transactionHash = readHash();	// read the transaction hash
+		input.transactionIndex = readU32();	// read the transaction index
+		input.responseScriptLength = readVariableLengthInteger();	// read the length of the script
+		assert( input.responseScriptLength < MAX_REASONABLE_SCRIPT_LENGTH );
+		if ( input.responseScriptLength < MAX_REASONABLE_SCRIPT_LENGTH )
+		{
+			input.responseScript = input.responseScriptLength ? getReadBufferAdvance(input.responseScriptLength) : NULL;	// get the script buffer pointer; and advance the read location
+			input.sequenceNumber = readU32();
+		}
+		else
+		{
+			ret = false;
+		}
+		return ret;
+	}
+
+	// Read an output block
+	bool readOutput(BlockChain::BlockOutput &output)
+	{
+		bool ret = true;
+
+		output.value = readU64();	// Read the value of the transaction
+		output.publicKey = NULL;
+		blockReward+=output.value;
+		output.challengeScriptLength = readVariableLengthInteger();
+		assert ( output.challengeScriptLength < MAX_REASONABLE_SCRIPT_LENGTH );
+
+		if ( output.challengeScriptLength < MAX_REASONABLE_SCRIPT_LENGTH )
+		{
+			output.challengeScript = output.challengeScriptLength ? getReadBufferAdvance(output.challengeScriptLength) : NULL; // get the script buffer pointer and advance the read location
+			if ( output.challengeScriptLength == 67 && output.challengeScript[0] == 65  && output.challengeScript[66]== OP_CHECKSIG )
+			{
+				output.publicKey = output.challengeScript+1;
+				output.isRipeMD160 = false;
+			}
+			else if ( output.challengeScriptLength == 66 && output.challengeScript[65]== OP_CHECKSIG )
+			{
+				output.publicKey = output.challengeScript;
+				output.isRipeMD160 = false;
+			}
+			else if ( output.challengeScriptLength >= 25 && 
+					  output.challengeScript[0] == OP_DUP &&
+					  output.challengeScript[1] == OP_HASH160 && 
+					  output.challengeScript[2] == 20 )
+			{
+				output.publicKey = output.challengeScript+3;
+				output.isRipeMD160 = true;
+			}
+			else if ( output.challengeScriptLength == 5 && 
+					  output.challengeScript[0] == OP_DUP &&
+					  output.challengeScript[1] == OP_HASH160 &&
+					  output.challengeScript[2] == OP_0 && 
+					  output.challengeScript[3] == OP_EQUALVERIFY &&
+					  output.challengeScript[4] == OP_CHECKSIG )
+			{
+				printf("WARNING: Unusual but expected output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
+				gIsWarning = true;
+			}
+			else
+			{
+				// Ok..we are going to scan for this pattern.. OP_DUP, OP_HASH160, 0x14 then exactly 20 bytes after 0x88,0xAC
+				// 25...
+				if ( output.challengeScriptLength > 25 )
+				{
+					uint32_t endIndex = output.challengeScriptLength-25;
+
+					for (uint32_t i=0; i<endIndex; i++)
+					{
+						const uint8_t *scan = &output.challengeScript[i];
+						if ( scan[0] == OP_DUP &&
+							 scan[1] == OP_HASH160 &&
+							 scan[2] == 20 &&
+							 scan[23] == OP_EQUALVERIFY &&
+							 scan[24] == OP_CHECKSIG )
+						{
+							output.publicKey = &scan[3];
+							output.isRipeMD160 = true;
+							printf("WARNING: Unusual output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
+							gIsWarning = true;
+							break;
+						}
+					}
+				}
+				if ( !output.publicKey )
+				{
+					if ( output.challengeScriptLength >= 66 && output.challengeScript[output.challengeScriptLength-1] == OP_CHECKSIG )
+					{
+						printf("WARNING: Failed to decode public key in output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
+						gIsWarning = true;
+					}
+				}
+			}
+		}
+		else
+		{
+			ret = false;
+		}
+
+		return ret;
+	}
+
+	// Read a single transaction
+	bool readTransation(BlockChain::BlockTransaction &transaction,uint32_t &transactionIndex,uint32_t tindex)
+	{
+		bool ret = false;
+
+		const uint8_t *transactionBegin = mBlockRead;
+
+		transaction.transactionVersionNumber = readU32(); // read the transaction version number; always expect it to be 1
+		if ( transaction.transactionVersionNumber == 1 || transaction.transactionVersionNumber == 2 )
+		{
+		}
+		else
+		{
+			gIsWarning = true;
+			printf("Encountered unusual and unexpected transaction version number of [%d] for transaction #%d\r\n", transaction.transactionVersionNumber, tindex );
+		}
+		transaction.inputCount = readVariableLengthInteger();
+		assert( transaction.inputCount < MAX_REASONABLE_INPUTS );
+		transaction.inputs = &mInputs[totalInputCount];
+		totalInputCount+=transaction.inputCount;
+		assert( totalInputCount < MAX_BLOCK_INPUTS );
+		if ( totalInputCount < MAX_BLOCK_INPUTS )
+		{
+			for (uint32_t i=0; i<transaction.inputCount; i++)
+			{
+				BlockChain::BlockInput &input = transaction.inputs[i];
+				ret = readInput(input);	// read the input 
+				if ( !ret )
+				{
+					break;
+				}
+			}
+		}
+		else
+		{
+			ret = false;
+		}
+		if ( ret )
+		{
+			transaction.outputCount = readVariableLengthInteger();
+			assert( transaction.outputCount < MAX_REASONABLE_OUTPUTS );
+			transaction.outputs = &mOutputs[totalOutputCount];
+			totalOutputCount+=transaction.outputCount;
+			assert( totalOutputCount < MAX_BLOCK_OUTPUTS );
+			if ( totalOutputCount < MAX_BLOCK_OUTPUTS )
+			{
+				for (uint32_t i=0; i<transaction.outputCount; i++)
+				{
+					gOutputIndex = i;
+					BlockChain::BlockOutput &output = transaction.outputs[i];
+					ret = readOutput(output);
+					if ( !ret )
+					{
+						break;
+					}
+				}
+
+				transaction.lockTime = readU32();
+
+				if ( ret )
+				{
+					transaction.transactionLength = (uint32_t)(mBlockRead - transactionBegin);
+					transaction.fileIndex = fileIndex;
+					transaction.fileOffset = fileOffset + (uint32_t)(transactionBegin-mBlockData);
+					transaction.transactionIndex = transactionIndex;
+					transactionIndex++;
+					BLOCKCHAIN_SHA256::computeSHA256(transactionBegin,transaction.transactionLength,transaction.transactionHash);
+					BLOCKCHAIN_SHA256::computeSHA256(transaction.transactionHash,32,transaction.transactionHash);
+				}
+
+			}
+		}
+		return ret;
+	}
+
+	// @see this link for detailed documentation:
+	//
+	// http://james.lab6.com/2012/01/12/bitcoin-285-bytes-that-changed-the-world/
+	//
+	// read a single block from the block chain into memory
+	// Here is how a block is read.
+	//
+	// Step #1 : We read the block format version
+	// Step #2 : We read the hash of the previous block
+	// Step #3 : We read the merkle root hash
+	// Step #4 : We read the block time stamp
+	// Step #5 : We read a 'bits' field; internal use defined by the bitcoin software
+	// Step #6 : We read the 'nonce' value; a randum number generated during the mining process.
+	// Step #7 : We read the transaction count
+	// Step #8 : For/Each Transaction
+	//          : (a) We read the transaction version number.
+	//          : (b) We read the number of inputs.
+	//Step #8a : For/Each input
+	//			: (a) Read the hash of the input transaction
+	//			: (b) Read the input transaction index
+	//			: (c) Read the response script length
+	//			: (d) Read the response script data; parsed using the bitcoin scripting system; a little virtual machine.
+	//			: Read the sequence number.
+	//			: Read the number of outputs
+	//Step #8b : For/Each Output
+	//			: (a) Read the value of the output in BTC fixed decimal; see docs.
+	//			: (b) Read the length of the challenge script.
+	//			: (c) Read the challenge script
+	//Step #9 Read the LockTime; a value currently always hard-coded to zero
+	bool processBlockData(const void *blockData,uint32_t blockLength,uint32_t &transactionIndex)
+	{
+		bool ret = true;
+		mBlockData = (const uint8_t *)blockData;
+		mBlockRead = mBlockData;	// Set the block-read scan pointer.
+		mBlockEnd = &mBlockData[blockLength]; // Mark the end of block pointer
+		blockFormatVersion = readU32();	// Read the format version
+		previousBlockHash = readHash();  // get the address of the hash
+		merkleRoot = readHash();	// Get the address of the merkle root hash
+		timeStamp = readU32();	// Get the timestamp
+		bits = readU32();	// Get the bits field
+		nonce = readU32();	// Get the 'nonce' random number.
+		transactionCount = readVariableLengthInteger();	// Read the number of transactions
+		if ( transactionCount < MAX_BLOCK_TRANSACTION )
+		{
+			transactions = mTransactions;	// Assign the transactions buffer pointer
+			for (uint32_t i=0; i<transactionCount; i++)
+			{
+				gTransactionIndex = i;
+				BlockChain::BlockTransaction &b = transactions[i];
+				if ( !readTransation(b,transactionIndex,i) )	// Read the transaction; if it failed; then abort processing the block chain
+				{
+					ret = false;
+					break;
+				}
+			}
+		}
+		return ret;
+	}
+
+	const BlockChain::BlockTransaction *processTransactionData(const void *transactionData,uint32_t transactionLength)
+	{
+		uint32_t transactionIndex=0;
+		BlockChain::BlockTransaction *ret = &mTransactions[0];
+		mBlockData = (const uint8_t *)transactionData;
+		mBlockRead = mBlockData;	// Set the block-read scan pointer.
+		mBlockEnd = &mBlockData[transactionLength]; // Mark the end of block pointer
+		if ( !readTransation(*ret,transactionIndex,0) )	// Read the transaction; if it failed; then abort processing the block chain
+		{
+			ret = NULL;
+		}
+		return ret;
+	}
+
+
+	const uint8_t					*mBlockRead;				// The current read buffer address in the block
+	const uint8_t					*mBlockEnd;					// The EOF marker for the block
+	const uint8_t					*mBlockData;
+	BlockChain::BlockTransaction	mTransactions[MAX_BLOCK_TRANSACTION];	// Holds the array of transactions
+	BlockChain::BlockInput			mInputs[MAX_BLOCK_INPUTS];	// The input arrays
+	BlockChain::BlockOutput			mOutputs[MAX_BLOCK_OUTPUTS]; // The output arrays
+
+};
+
+class Transaction;
+
+// Contains a hash of just the 20 byte RIPEMD160 key; does not have the header or footer; which can be calculated.
+class BitcoinAddress 
+{
+public:
+	BitcoinAddress(void)
+	{
+		mWord0 = 0;
+		mWord1 = 0;
+		mWord2 = 0;
+		mTransactionCount = 0;
+		mTransactionIndex = 0xFFFFFFFF;
+		mTransactions = NULL;
+		mTotalReceived = 0;
+		mTotalSent = 0;
+		mLastInputTime = 0;
+		mLastOutputTime = 0;
+		mFirstOutputTime = 0;
+		mInputCount = 0;
+		mOutputCount = 0;
+	}
+
+	BitcoinAddress(const uint8_t address[20]) 
+	{
+		mWord0 = *(const uint64_t *)(address);
+		mWord1 = *(const uint64_t *)(address+8);
+		mWord2 = *(const uint32_t *)(address+16);
+		mTransactionCount = 0;
+		mTransactionIndex = 0xFFFFFFFF;
+		mTransactions = NULL;
+		mTotalReceived = 0;
+		mTotalSent = 0;
+		mLastInputTime = 0;
+		mLastOutputTime = 0;
+		mFirstOutputTime = 0;
+		mInputCount = 0;
+		mOutputCount = 0;
+	}
+
+	bool operator==(const BitcoinAddress &a) const
+	{
+		return mWord0 == a.mWord0 && mWord1 == a.mWord1 && mWord2 == a.mWord2;
+	}
+
+	uint32_t getHash(void) const
+	{
+		const uint32_t *h = (const uint32_t *)&mWord0;
+		return h[0] ^ h[1] ^ h[2] ^ h[3] ^ h[4];
+	}
+
+	// The RIPEMD160 hash is already uniformly distributed, so 64 of its bits make a fingerprint for the perfect hash
+	uint64_t getHash64(void) const
+	{
+		return mWord0 ^ ((uint64_t)mWord2 << 32);
+	}
+
+	uint32_t getLastUsedTime(void) const
+	{
+		uint32_t lastUsed = mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+		if ( mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+		{
+			lastUsed = mFirstOutputTime;
+		}
+		return lastUsed;
+	}
+
+	uint32_t getDaysSinceLastUsed(void) const
+	{
+		time_t currentTime;
+		time(&currentTime); // get the current time.
+		uint32_t lastUsed = mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+		if ( mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+		{
+			lastUsed = mFirstOutputTime;
+		}
+		double seconds = difftime(currentTime,time_t(lastUsed));
+		double minutes = seconds/60;
+		double hours = minutes/60;
+		uint32_t days = (uint32_t) (hours/24);
+		return days;
+	}
+
+	uint32_t getInputCount(void) const
+	{
+		return mInputCount;
+	}
+
+	uint32_t getOutputCount(void)
+	{
+		return mOutputCount;
+	}
+
+	uint64_t getBalance(void) const
+	{
+		return mTotalReceived - mTotalSent;
+	}
+
+	uint64_t	mWord0; // 8
+	uint64_t	mWord1; // 16
+	uint32_t	mWord2; // 20
+	uint32_t	mLastInputTime;
+	uint32_t	mLastOutputTime;
+	uint32_t	mFirstOutputTime;
+	uint64_t	mTotalSent;
+	uint64_t	mTotalReceived;
+	uint32_t	mInputCount;
+	uint32_t	mOutputCount;
+	uint32_t	mTransactionIndex;
+	uint32_t	mTransactionCount;
+	uint32_t	*mTransactions;		// The indices of the transactions associated with this bitcoin-address as either inputs or outputs or (sometimes) both.
+};
+
+
+
+#pragma warning(push)
+#pragma warning(disable:4100)
+
+
+// Output values are kept the way the reference client keeps them in its chain state; the trailing decimal zeros are
+// folded into an exponent, so the round amounts most outputs carry become small numbers.
+static inline uint64_t compressAmount(uint64_t n)
+{
+	if ( n == 0 )
+	{
+		return 0;
+	}
+	uint32_t e = 0;
+	while ( (n%10) == 0 && e < 9 )
+	{
+		n/=10;
+		e++;
+	}
+	if ( e < 9 )
+	{
+		uint32_t d = (uint32_t)(n%10);
+		n/=10;
+		return 1 + (n*9 + d - 1)*10 + e;
+	}
+	return 1 + (n-1)*10 + 9;
+}
+
+static inline uint64_t decompressAmount(uint64_t x)
+{
+	static const uint64_t powers[10] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	if ( x == 0 )
+	{
+		return 0;
+	}
+	x--;
+	uint32_t e = (uint32_t)(x%10);
+	x/=10;
+	uint64_t n;
+	if ( e < 9 )
+	{
+		uint32_t d = (uint32_t)(x%9) + 1;
+		x/=9;
+		n = x*10 + d;
+	}
+	else
+	{
+		n = x+1;
+	}
+	return n*powers[e];
+}
+
+// The reference client's VARINT; seven bits a byte, most significant first, with every continued prefix offset by
+// one so each number has exactly one encoding.  Writes at most 10 bytes and returns how many.
+static inline uint32_t writeVarInt(uint8_t *dest,uint64_t n)
+{
+	uint8_t scratch[10];
+	uint32_t len = 0;
+	for (;;)
+	{
+		scratch[len] = (uint8_t)((n & 0x7F) | (len ? 0x80 : 0x00));
+		if ( n <= 0x7F )
+		{
+			break;
+		}
+		n = (n>>7)-1;
+		len++;
+	}
+	for (uint32_t i=0; i<=len; i++)
+	{
+		dest[i] = scratch[len-i];
+	}
+	return len+1;
+}
+
+// Returns false if the number runs past 'end' or does not fit in 64 bits
+static inline bool readVarInt(const uint8_t *&p,const uint8_t *end,uint64_t &n)
+{
+	n = 0;
+	while ( p < end )
+	{
+		uint8_t c = *p++;
+		if ( n > (0xFFFFFFFFFFFFFFFFULL>>7) )
+		{
+			return false;
+		}
+		n = (n<<7) | (c & 0x7F);
+		if ( (c & 0x80) == 0 )
+		{
+			return true;
+		}
+		if ( n == 0xFFFFFFFFFFFFFFFFULL )
+		{
+			return false;
+		}
+		n++;
+	}
+	return false;
+}
+
+#define AMOUNT_OVERFLOW 0xC0000000 // A compressed amount this large or larger is kept in the factory's overflow table
+
+// Eight bytes; nearly every amount compresses to well under 32 bits, the exceptions are large values which are not
+// round, such as the change of a big payment.
+class TransactionOutput
+{
+public:
+	TransactionOutput(void)
+	{
+		mAmount = 0;
+		mAddress = 0;
+	}
+	uint32_t	mAmount;	// compressAmount of the value, or AMOUNT_OVERFLOW plus where the value is in the overflow table
+	uint32_t	mAddress;	// address of the output. 
+};
+
+#define NO_OUTPUT 0xFFFFFFFF // mOutput of a coinbase input, or of one whose output was not found
+#define NO_TRANSACTION 0xFFFFFFFF
+
+// The factory's records refer to each other by index rather than by pointer; at billions of records the pointer
+// width alone would cost tens of gigabytes.
+class TransactionInput
+{
+public:
+	TransactionInput(void)
+	{
+		mOutput = NO_OUTPUT;
+	}
+	uint32_t	mOutput;	// All inputs are the result of a previous output (this is its index) or block-reward mining fee (otherwise known as 'coinbase')
+};
+
+// A transaction's inputs and outputs are stored one after the other, so only where they begin is kept; they run up
+// to where the next transaction's begin.
+class Transaction
+{
+public:
+	Transaction(void)
+	{
+		mBlock = 0;
+		mTime = 0;
+		mFirstInput = 0;
+		mFirstOutput = 0;
+	}
+	uint32_t	mBlock;
+	uint32_t	mTime;
+	uint32_t	mFirstInput;
+	uint32_t	mFirstOutput;
+};
+
+
+// The bucket of a hash in the on-disk indices below is its leading bits; hashes are uniformly distributed so the
+// buckets come out evenly filled and, with the records sorted by hash, in order.
+static inline uint32_t getHashBucket(const uint8_t *hash,uint32_t bits)
+{
+	uint32_t v = ((uint32_t)hash[0]<<24) | ((uint32_t)hash[1]<<16) | ((uint32_t)hash[2]<<8) | (uint32_t)hash[3];
+	return bits ? v>>(32-bits) : 0;
+}
+
+// Returns the block holding this transaction given the index of the first transaction of each block
+static uint32_t getTransactionBlock(const uint32_t *blockStart,uint32_t blockCount,uint32_t transaction)
+{
+	uint32_t low = 0;
+	uint32_t high = blockCount;
+	while ( (high-low) > 1 )
+	{
+		uint32_t mid = (low+high)/2;
+		if ( blockStart[mid] <= transaction )
+		{
+			low = mid;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+
+#define SPENT_BY_UNSPENT 0xFFFFFFFF // mTransaction of an output which has not been spent
+#define SPENT_BY_FILE "SpentBy.bin"
+#define SPENT_BY_MAGIC "SPENTBY"
+#define SPENT_BY_VERSION 2
+
+// The forward link of an output; which transaction spent it and through which of its inputs.  The factory keeps one
+// per output, in the same order as the outputs, so the spender of any output is a single array lookup.
+class SpentBy
+{
+public:
+	SpentBy(void)
+	{
+		mTransaction = SPENT_BY_UNSPENT;
+		mInput = 0;
+	}
+	uint32_t	mTransaction;	// Index of the spending transaction or SPENT_BY_UNSPENT
+	uint32_t	mInput;			// Which input of the spending transaction
+};
+
+// Where a block is stored in the data files.  The on-disk indices which name transactions by their position save one
+// for each block, so a fresh process can read back the block holding a transaction without scanning the headers.
+class BlockLocation
+{
+public:
+	uint32_t	mFileIndex;
+	uint32_t	mFileOffset;
+	uint32_t	mBlockLength;
+};
+
+// 'SpentBy.bin' is this header, then blockCount+1 first transaction indices of each block, the location of each block,
+// transactionCount+1 first output indices of each transaction, and a SpentBy record for every output.
+class SpentByHeader
+{
+public:
+	char		mMagic[8];
+	uint32_t	mVersion;
+	uint32_t	mBlockCount;
+	uint32_t	mTransactionCount;
+	uint32_t	mOutputCount;
+};
+
+// The address directory, 'AddressDirectory.bin', holds the summary of every address sorted by its hash160 so a
+// fresh process can answer an address query without processing the block chain.  It is a header, a table of
+// (1<<bucketBits)+1 record offsets, the first transaction index of each block (plus one past the end), the location
+// of each block and then the records.  The transactions of each address are listed, as transaction indices, in
+// 'AddressPostings.bin'; the block locations let a query read their hashes and times without scanning the headers.
+#define ADDRESS_DIRECTORY_FILE "AddressDirectory.bin"
+#define ADDRESS_POSTINGS_FILE "AddressPostings.bin"
+#define ADDRESS_DIRECTORY_MAGIC "ADRDIR"
+#define ADDRESS_DIRECTORY_VERSION 2
+#define ADDRESS_DIRECTORY_PARTITION_BITS 8		// The addresses are sorted in 256 partitions in parallel
+
+class AddressDirectoryHeader
+{
+public:
+	char		mMagic[8];
+	uint32_t	mVersion;
+	uint32_t	mBucketBits;
+	uint32_t	mAddressCount;
+	uint32_t	mBlockCount;
+	uint32_t	mTransactionCount;
+	uint32_t	mReserved;
+	uint64_t	mPostingCount;			// The number of transaction indices in the postings file
+};
+
+class AddressDirectoryRecord
+{
+public:
+	uint8_t		mHash160[20];
+	uint32_t	mTransactionCount;
+	uint64_t	mTotalReceived;
+	uint64_t	mTotalSent;
+	uint64_t	mPostings;				// The first of this address's transactions in the postings file
+	uint32_t	mFirstOutputTime;
+	uint32_t	mLastOutputTime;
+	uint32_t	mLastInputTime;
+	uint32_t	mInputCount;
+	uint32_t	mOutputCount;
+	uint32_t	mPostingCount;			// How many of its transactions are listed; zero if the history was not kept
+};
+
+typedef ShardedHash< BitcoinAddress > BitcoinAddressHashMap;
+
+enum AgeMarker
+{
+	AM_ONE_DAY,
+	AM_ONE_WEEK,
+	AM_ONE_MONTH,
+	AM_THREE_MONTHS,
+	AM_SIX_MONTHS,
+	AM_ONE_YEAR,
+	AM_TWO_YEARS,
+	AM_THREE_YEARS,
+	AM_FOUR_YEARS,
+	AM_FIVE_YEARS,
+	AM_LAST
+};
+
+const char * getAgeString(AgeMarker m)
+{
+	const char *ret = "UNKNOWN";
+	switch ( m )
+	{
+		case AM_ONE_DAY: ret = "One Day"; break;
+		case AM_ONE_WEEK: ret = "One Week"; break;
+		case AM_ONE_MONTH: ret = "One Month"; break;
+		case AM_THREE_MONTHS: ret = "1-3 Months"; break;
+		case AM_SIX_MONTHS: ret = "3-6 Months"; break;
+		case AM_ONE_YEAR: ret = "Six Months to One Year"; break;
+		case AM_TWO_YEARS: ret = "One to Two Years"; break;
+		case AM_THREE_YEARS: ret = "Two to Three Years"; break;
+		case AM_FOUR_YEARS: ret = "Three to Four Years"; break;
+		case AM_FIVE_YEARS: ret = "Four to Fix Years"; break;
+	}
+	return ret;
+}
+
+// The state image, 'BlockChainState.bin', holds everything processing has built up: the transactions, inputs, outputs
+// and spent-by links, the address map, the statistics, the transaction map, the UTXO set commitment if it is kept and
+// the header chain, so a later run can answer queries or carry on processing without replaying the blocks.  It is a
+// header followed by sections.  Arrays are written as they are in memory except that each pointer is replaced by the
+// index of the element it points to (STATE_NULL for a NULL pointer), so the image does not depend on where anything was
+// allocated.  Loading maps the file, copies each section into place and turns the indices back into pointers in the
+// same pass; the hash tables are restored slot for slot, so nothing is parsed or rehashed.  The structures are stored
+// as compiled, so the header records their sizes and an image only loads in a build with the same layout.
+#define STATE_IMAGE_FILE "BlockChainState.bin"
+#define STATE_IMAGE_SCRATCH "BlockChainState.tmp"
+#define STATE_IMAGE_MAGIC "BCSTATE"
+#define STATE_IMAGE_VERSION 5
+#define STATE_NULL 0xFFFFFFFF	// The index written in place of a NULL pointer
+#define STATE_BATCH 4096		// How many elements are converted at a time while writing
+
+enum StateSection
+{
+	STATE_HEADERS,			// The block headers of the chain, by height
+	STATE_TRANSACTIONS,
+	STATE_INPUTS,
+	STATE_OUTPUTS,
+	STATE_SPENT_BY,
+	STATE_BLOCKS,			// The first transaction of each processed block
+	STATE_REFERENCES,		// The transactions of each address, concatenated
+	STATE_ADDRESSES,		// The address map's keys, by address index
+	STATE_ADDRESS_SLOTS,	// and its probe tables
+	STATE_STATISTICS,		// The statistics rows, each followed by its address arrays
+	STATE_TRANSACTION_MAP,
+	STATE_COMMITMENT,		// The UTXO set commitment and the UTXO set entries holding its digests; empty if it is not kept
+	STATE_SECTION_COUNT
+};
+
+class StateSectionRecord
+{
+public:
+	uint64_t	mOffset;
+	uint64_t	mSize;
+};
+
+class StateImageHeader
+{
+public:
+	char				mMagic[8];
+	uint32_t			mVersion;
+	uint32_t			mLayout;				// The structure sizes folded together; see getStateLayout
+	uint32_t			mProcessedBlocks;		// How many blocks had been processed
+	uint32_t			mStatTime;				// The start of the statistics period in progress
+	uint32_t			mTransactionCount;		// The block reader's running counts
+	uint32_t			mTotalTransactionCount;
+	uint32_t			mTotalInputCount;
+	uint32_t			mTotalOutputCount;
+	StateSectionRecord	mSections[STATE_SECTION_COUNT];
+};
+
+// Writes the sections of a state image one after the other, recording where each starts and how long it is
+class StateImageWriter
+{
+public:
+	StateImageWriter(FILE *fph,StateImageHeader &header) : mFile(fph), mHeader(header)
+	{
+		mPosition = sizeof(StateImageHeader);
+		mOk = true;
+	}
+
+	inline void begin(StateSection section)
+	{
+		mHeader.mSections[section].mOffset = mPosition;
+	}
+
+	inline void end(StateSection section)
+	{
+		mHeader.mSections[section].mSize = mPosition-mHeader.mSections[section].mOffset;
+	}
+
+	void write(const void *data,uint64_t size)
+	{
+		if ( mOk && size )
+		{
+			mOk = fwrite(data,1,(size_t)size,mFile) == size;
+		}
+		mPosition+=size;
+	}
+
+	// For data written straight to the file by someone else
+	inline void wrote(bool ok,uint64_t size)
+	{
+		mOk = mOk && ok;
+		mPosition+=size;
+	}
+
+	inline FILE *getFile(void) const
+	{
+		return mFile;
+	}
+
+	inline bool isOk(void) const
+	{
+		return mOk;
+	}
+
+private:
+	FILE				*mFile;
+	StateImageHeader	&mHeader;
+	uint64_t			mPosition;
+	bool				mOk;
+};
+
+// A pointer into 'base' is stored as the index of the element it points to
+template < class T > static inline T *toStateIndex(const T *p,const T *base)
+{
+	return (T *)(uintptr_t)(p ? (uint32_t)(p-base) : STATE_NULL);
+}
+
+// and turned back into a pointer on load; 'ok' is cleared if the index is out of range
+template < class T > static inline T *fromStateIndex(T *p,T *base,uint32_t count,bool &ok)
+{
+	uint32_t index = (uint32_t)(uintptr_t)p;
+	if ( index == STATE_NULL )
+	{
+		return NULL;
+	}
+	if ( index > count )
+	{
+		ok = false;
+		return NULL;
+	}
+	return base+index;
+}
+
+class AgeStat
+{
+public:
+	AgeStat(void)
+	{
+		mTotalValue = 0;
+		mCount = 0;
+	}
+	void addValue(uint64_t b)
+	{
+		mTotalValue+=b;
+		if ( b >= ONE_BTC )
+		{
+			mCount++;
+		}
+	}
+	uint64_t	mTotalValue;
+	uint32_t	mCount;
+};
+
+enum StatSize
+{
+	SS_ZERO,			// addresses with a balance of exactly zero
+	SS_ONE_MBTC,		// addresses with a balance of one MBTC or less but not zero
+	SS_FIVE_MBTC,
+
+	SS_TEN_MBTC,		// addresses with a balance of ten MBTC
+	SS_FIFTY_MBTC,
+
+	SS_HUNDRED_MBTC,		// addresses with 100 mbtc
+	SS_FIVE_HUNDRED_MBTC,
+
+	SS_ONE_BTC,		// addresses with one BTC
+	SS_FIVE_BTC,		// address with between 2 and 5 btc
+
+	SS_TEN_BTC,	// addresses with ten BTC
+	SS_FIFTY_BTC,
+
+	SS_HUNDRED_BTC,
+	SS_FIVE_HUNDRED_BTC,
+
+	SS_ONE_THOUSAND_BTC,
+	SS_FIVE_THOUSAND_BTC,
+
+	SS_TEN_THOUSAND_BTC,
+	SS_FIFTY_THOUSAND_BTC,
+	SS_HUNDRED_THOUSAND_BTC,
+	SS_MAX_BTC,
+	SS_COUNT,
+};
+
+#define MAX_DAYS 2000
+#define DAYS_PER 7
+#define MAX_DAY_INDEX (MAX_DAYS/DAYS_PER)
+
+class StatValue
+{
+public:
+	StatValue(void)
+	{
+		mCount  = 0;
+		mValue = 0;
+	}
+	uint32_t	mCount;
+	uint64_t	mValue;
+};
+
+class StatAddress
+{
+public:
+	StatAddress(void)
+	{
+		mAddress = 0;
+		mTotalReceived = 0;
+		mTotalSent = 0;
+		mLastTime = 0;
+		mTransactionCount = 0;
+		mInputCount = 0;
+		mOutputCount = 0;
+	}
+
+	bool operator==(const StatAddress &a) const
+	{
+		return mAddress == a.mAddress &&
+			   mTotalSent == a.mTotalSent &&
+			   mTotalReceived == a.mTotalReceived &&
+			   mFirstTime == a.mFirstTime &&
+			   mLastTime == a.mLastTime &&
+			   mTransactionCount == a.mTransactionCount &&
+			   mInputCount == a.mInputCount &&
+			   mOutputCount == a.mOutputCount;
+	}
+
+	uint32_t getBalance(void) const
+	{
+		return mTotalReceived - mTotalSent;
+	}
+
+	uint32_t	mAddress;			// the address index.
+	uint32_t	mTotalSent;			// total number of bitcoins sent
+	uint32_t	mTotalReceived;
+	uint32_t	mFirstTime;			// first time this address was used
+	uint32_t	mLastTime;			// Last time a spend transaction occurred.
+	uint8_t		mTransactionCount;	// total number of transactions
+	uint8_t		mInputCount;		// total number of inputs.
+	uint8_t		mOutputCount;		// total number of outputs
+};
+
+class StatRow
+{
+public:
+	StatRow(void)
+	{
+		mTime = 0;
+		mCount = 0;
+		mValue = 0;
+		mZombieTotal = 0;
+		mZombieCount = 0;
+		mAddressCount = 0;
+		mAddresses = NULL;
+		mNewAddressCount = 0;
+		mDeleteAddressCount = 0;
+		mChangeAddressCount = 0;
+		mSameAddressCount = 0;
+		mRiseFromDeadCount = 0;
+		mRiseFromDeadAmount = 0;
+		mNewAddresses = NULL;
+		mChangedAddresses = NULL;
+		mDeletedAddresses = NULL;
+	}
+
+	~StatRow(void)
+	{
+		delete []mAddresses;
+		delete []mNewAddresses;
+		delete []mChangedAddresses;
+		delete []mDeletedAddresses;
+	}
+
+	// Frees the row's address arrays and zeroes it so it can be gathered again
+	void clear(void)
+	{
+		delete []mAddresses;
+		delete []mNewAddresses;
+		delete []mChangedAddresses;
+		delete []mDeletedAddresses;
+		mTime = 0;
+		mCount = 0;
+		mValue = 0;
+		mZombieTotal = 0;
+		mZombieCount = 0;
+		for (uint32_t i=0; i<SS_COUNT; i++)
+		{
+			mStats[i] = StatValue();
+		}
+		mAddressCount = 0;
+		mAddresses = NULL;
+		mNewAddressCount = 0;
+		mDeleteAddressCount = 0;
+		mChangeAddressCount = 0;
+		mSameAddressCount = 0;
+		mRiseFromDeadCount = 0;
+		mRiseFromDeadAmount = 0;
+		mNewAddresses = NULL;
+		mChangedAddresses = NULL;
+		mDeletedAddresses = NULL;
+	}
+	uint64_t	mZombieTotal;
+	uint32_t	mZombieCount;
+	uint32_t	mTime;
+	uint32_t	mCount;
+	uint64_t	mValue;
+	StatValue	mStats[SS_COUNT];
+
+	uint32_t	mAddressCount;		// number of addreses recorded
+	StatAddress	*mAddresses;
+	
+	uint32_t	mNewAddressCount;
+	uint32_t	mDeleteAddressCount;
+	uint32_t	mChangeAddressCount;
+	uint32_t	mSameAddressCount;
+	uint32_t	mRiseFromDeadCount;
+	uint32_t	mRiseFromDeadAmount;
+
+	StatAddress	*mNewAddresses;
+	StatAddress	*mChangedAddresses;
+	uint32_t	*mDeletedAddresses;
+};
+
+#define MAX_STAT_COUNT (365*6) // reserve room for up to 6 years of 365 days entries...
+
+class QuickSortPointers
+{
+public:
+	void qsort(void **base,int32_t num); // perform the qsort.
+protected:
+	// -1 less, 0 equal, +1 greater.
+	virtual int32_t compare(void **p1,void **p2) = 0;
+private:
+	void inline swap(char **a,char **b);
+};
+
+void QuickSortPointers::swap(char **a,char **b)
+{
+	char *tmp;
+
+	if ( a != b )
+	{
+		tmp = *a;
+		*a++ = *b;
+		*b++ = tmp;
+	}
+}
+
+
+void QuickSortPointers::qsort(void **b,int32_t num)
+{
+	char *lo,*hi;
+	char *mid;
+	char *bottom, *top;
+	int32_t size;
+	char *lostk[30], *histk[30];
+	int32_t stkptr;
+	char **base = (char **)b;
+
+	if (num < 2 ) return;
+
+	stkptr = 0;
+
+	lo = (char *)base;
+	hi = (char *)base + sizeof(char **) * (num-1);
+
+nextone:
+
+	size = (int32_t)(hi - lo) / sizeof(char**) + 1;
+
+	mid = lo + (size / 2) * sizeof(char **);
+	swap((char **)mid,(char **)lo);
+	bottom = lo;
+	top = hi + sizeof(char **);
+
+	for (;;)
+	{
+		do
+		{
+			bottom += sizeof(char **);
+		} while (bottom <= hi && compare((void **)bottom,(void **)lo) <= 0);
+
+		do
+		{
+			top -= sizeof(char **);
+		} while (top > lo && compare((void **)top,(void **)lo) >= 0);
+
+		if (top < bottom) break;
+
+		swap((char **)bottom,(char **)top);
+
+	}
+
+	swap((char **)lo,(char **)top);
+
+	if ( top - 1 - lo >= hi - bottom )
+	{
+		if (lo + sizeof(char **) < top)
+		{
+			lostk[stkptr] = lo;
+			histk[stkptr] = top - sizeof(char **);
+			stkptr++;
+		}
+		if (bottom < hi)
+		{
+			lo = bottom;
+			goto nextone;
+		}
+	}
+	else
+	{
+		if ( bottom < hi )
+		{
+			lostk[stkptr] = bottom;
+			histk[stkptr] = hi;
+			stkptr++;
+		}
+		if (lo + sizeof(char **) < top)
+		{
+			hi = top - sizeof(char **);
+			goto nextone; 					/* do small recursion */
+		}
+	}
+
+	stkptr--;
+
+	if (stkptr >= 0)
+	{
+		lo = lostk[stkptr];
+		hi = histk[stkptr];
+		goto nextone;
+	}
+	return;
+}
+
+class SortByBalance : public QuickSortPointers
+{
+public:
+	SortByBalance(BitcoinAddress **addresses,uint32_t count)
+	{
+		QuickSortPointers::qsort((void **)addresses,(int32_t)count);
+	}
+
+	// -1 less, 0 equal, +1 greater.
+	virtual int32_t compare(void **p1,void **p2) 
+	{
+		BitcoinAddress **ba1 = (BitcoinAddress **)p1;
+		BitcoinAddress **ba2 = (BitcoinAddress **)p2;
+		BitcoinAddress *a1 = *ba1;
+		BitcoinAddress *a2 = *ba2;
+		uint64_t balance1 = a1->mTotalReceived-a1->mTotalSent;
+		uint64_t balance2 = a2->mTotalReceived-a2->mTotalSent;
+		if ( balance1 == balance2 ) return 0;
+		return balance1 > balance2 ? -1 : 1;
+	}
+};
+
+class SortByAge : public QuickSortPointers
+{
+public:
+	SortByAge(BitcoinAddress **addresses,uint32_t count)
+	{
+		QuickSortPointers::qsort((void **)addresses,(int32_t)count);
+	}
+
+	// -1 less, 0 equal, +1 greater.
+	virtual int32_t compare(void **p1,void **p2) 
+	{
+		BitcoinAddress **ba1 = (BitcoinAddress **)p1;
+		BitcoinAddress **ba2 = (BitcoinAddress **)p2;
+		BitcoinAddress *a1 = *ba1;
+		BitcoinAddress *a2 = *ba2;
+		uint32_t age1 = a1->getDaysSinceLastUsed();
+		uint32_t age2 = a2->getDaysSinceLastUsed();
+		if ( age1 == age2 ) return 0;
+		return age1 > age2 ? -1 : 1;
+	}
+
+};
+
+// What one output received or spent in UTXO mode did to its address; enough to take it back if the block is
+// disconnected.  The totals and counts are simply reversed, the times which only ever move forward are restored.
+class AddressUndo
+{
+public:
+	uint64_t	mValue;				// The value received or spent
+	uint32_t	mAddress;
+	uint32_t	mLastTime;			// The address's last output time (or last input time for a spend) before
+	uint32_t	mFirstOutputTime;	// and its first output time
+	uint32_t	mTransactionIndex;	// The last transaction it had been counted in
+	uint32_t	mSpend;				// Non zero for a spend
+};
+
+#define KEY_BATCH 256	// How many address strings are rendered at a time by getKeys
+#define KEY_STRIDE 36	// Enough room for any 25 byte address in ASCII plus the zero terminator
+
+class BitcoinTransactionFactory
+{
+public:
+	BitcoinTransactionFactory(void)
+	{
+		mTransactionReferences = NULL;
+		mTransactionReferenceCount = 0;
+		mOverflow = NULL;
+		mOverflowCount = 0;
+		mOverflowCapacity = 0;
+		mUtxoMode = false;
+		mTransactionCount = 0;
+		mTotalInputCount = 0;
+		mTotalOutputCount = 0;
+		mBlockCount = 0;
+		mStatCount = 0;
+
+		mStatLimits[SS_ZERO] = 0;
+		mStatLimits[SS_ONE_MBTC] = ONE_MBTC;
+		mStatLimits[SS_FIVE_MBTC] = ONE_MBTC*5;
+
+		mStatLimits[SS_TEN_MBTC] = ONE_MBTC*10;
+		mStatLimits[SS_FIFTY_MBTC] = ONE_MBTC*50;
+
+		mStatLimits[SS_HUNDRED_MBTC] = ONE_MBTC*100;
+		mStatLimits[SS_FIVE_HUNDRED_MBTC] = ONE_MBTC*500;
+
+
+		mStatLimits[SS_ONE_BTC] = ONE_BTC;
+		mStatLimits[SS_FIVE_BTC] = ONE_BTC*5;
+
+		mStatLimits[SS_TEN_BTC] = ONE_BTC*10;
+		mStatLimits[SS_FIFTY_BTC] = (uint64_t)ONE_BTC*(uint64_t)50;
+
+		mStatLimits[SS_HUNDRED_BTC] = (uint64_t)ONE_BTC*(uint64_t)100;
+		mStatLimits[SS_FIVE_HUNDRED_BTC] = (uint64_t)ONE_BTC*(uint64_t)500;
+
+		mStatLimits[SS_ONE_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)1000;
+		mStatLimits[SS_FIVE_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)5000;
+
+		mStatLimits[SS_TEN_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)10000;
+		mStatLimits[SS_FIFTY_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)50000;
+		mStatLimits[SS_HUNDRED_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)100000;
+		mStatLimits[SS_MAX_BTC] = (uint64_t)ONE_BTC*(uint64_t)21000000;
+
+
+		mStatLabel[SS_ZERO] = "ZERO";
+		mStatLabel[SS_ONE_MBTC] = "<1MBTC";
+		mStatLabel[SS_FIVE_MBTC] = "<5MBTC";
+		mStatLabel[SS_TEN_MBTC] = "<10MBTC";
+		mStatLabel[SS_FIFTY_MBTC] = "<50MBTC";
+		mStatLabel[SS_HUNDRED_MBTC] = "<100MBTC";
+		mStatLabel[SS_FIVE_HUNDRED_MBTC] = "<500MBTC";
+		mStatLabel[SS_ONE_BTC] = "<1BTC";
+		mStatLabel[SS_FIVE_BTC] = "<5BTC";
+		mStatLabel[SS_TEN_BTC] = "<10BTC";
+		mStatLabel[SS_FIFTY_BTC] = "<50BTC";
+		mStatLabel[SS_HUNDRED_BTC] = "<100BTC";
+		mStatLabel[SS_FIVE_HUNDRED_BTC] = "<500BTC";
+		mStatLabel[SS_ONE_THOUSAND_BTC] = "<1KBTC";
+		mStatLabel[SS_FIVE_THOUSAND_BTC] = "<5KBTC";
+		mStatLabel[SS_TEN_THOUSAND_BTC] = "<10KBTC";
+		mStatLabel[SS_FIFTY_THOUSAND_BTC] = "<50KBTC";
+		mStatLabel[SS_HUNDRED_THOUSAND_BTC] = "<100KBTC";
+		mStatLabel[SS_MAX_BTC] = ">100KBTC";
+
+	}
+
+	~BitcoinTransactionFactory(void)
+	{
+		delete []mOverflow;
+		delete []mTransactionReferences;
+	}
+
+	// Only reserves the address space; the arrays are committed as they fill.  Returns false if it could not be
+	// reserved.
+	bool init(void)
+	{
+		if ( mTransactions == NULL )
+		{
+			bool ok = mTransactions.reserve(MAX_TOTAL_TRANSACTIONS);
+			ok = mInputs.reserve(MAX_TOTAL_INPUTS) && ok;
+			ok = mOutputs.reserve(MAX_TOTAL_OUTPUTS) && ok;
+			ok = mSpentBy.reserve(MAX_TOTAL_OUTPUTS) && ok;
+			ok = mBlocks.reserve(MAX_TOTAL_BLOCKS) && ok;
+			if ( !ok )
+			{
+				printf("Failed to reserve address space for the transaction records.\r\n");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// In UTXO mode no transaction history is kept; the address totals are updated as each output is created and
+	// spent instead of being gathered from the history.
+	void setUtxoMode(bool state)
+	{
+		mUtxoMode = state;
+	}
+
+	inline bool isUtxoMode(void) const
+	{
+		return mUtxoMode;
+	}
+
+	// Numbers the next transaction processed in UTXO mode
+	inline uint32_t addUtxoTransaction(uint32_t inputCount,uint32_t outputCount)
+	{
+		mTotalInputCount+=inputCount;
+		mTotalOutputCount+=outputCount;
+		return mTransactionCount++;
+	}
+
+	// Credits an output of transaction 'transaction' to its address; 'undo', if given, records how to take it back
+	void receiveUtxo(uint32_t adr,uint64_t value,uint32_t time,uint32_t transaction,AddressUndo *undo)
+	{
+		BitcoinAddress *ba = getAddress(adr);
+		if ( ba )
+		{
+			if ( undo )
+			{
+				saveUndo(*undo,adr,ba,value,false);
+			}
+			countUtxoTransaction(ba,transaction);
+			ba->mTotalReceived+=value;
+			ba->mOutputCount++;
+			if ( time > ba->mLastOutputTime )
+			{
+				ba->mLastOutputTime = time;
+				if ( ba->mFirstOutputTime == 0 )
+				{
+					ba->mFirstOutputTime = time;
+				}
+			}
+		}
+	}
+
+	// Debits a spent output from its address
+	void spendUtxo(uint32_t adr,uint64_t value,uint32_t time,uint32_t transaction,AddressUndo *undo)
+	{
+		BitcoinAddress *ba = getAddress(adr);
+		if ( ba )
+		{
+			if ( undo )
+			{
+				saveUndo(*undo,adr,ba,value,true);
+			}
+			countUtxoTransaction(ba,transaction);
+			ba->mTotalSent+=value;
+			ba->mInputCount++;
+			if ( time > ba->mLastInputTime )
+			{
+				ba->mLastInputTime = time;
+			}
+		}
+	}
+
+	static inline void saveUndo(AddressUndo &u,uint32_t adr,const BitcoinAddress *ba,uint64_t value,bool spend)
+	{
+		u.mValue = value;
+		u.mAddress = adr;
+		u.mLastTime = spend ? ba->mLastInputTime : ba->mLastOutputTime;
+		u.mFirstOutputTime = ba->mFirstOutputTime;
+		u.mTransactionIndex = ba->mTransactionIndex;
+		u.mSpend = spend ? 1 : 0;
+	}
+
+	// Takes back one receiveUtxo or spendUtxo; they have to be undone newest first
+	void undoUtxo(const AddressUndo &u)
+	{
+		BitcoinAddress *ba = getAddress(u.mAddress);
+		if ( ba )
+		{
+			if ( ba->mTransactionIndex != u.mTransactionIndex )
+			{
+				ba->mTransactionIndex = u.mTransactionIndex;
+				ba->mTransactionCount--;
+			}
+			if ( u.mSpend )
+			{
+				ba->mTotalSent-=u.mValue;
+				ba->mInputCount--;
+				ba->mLastInputTime = u.mLastTime;
+			}
+			else
+			{
+				ba->mTotalReceived-=u.mValue;
+				ba->mOutputCount--;
+				ba->mLastOutputTime = u.mLastTime;
+				ba->mFirstOutputTime = u.mFirstOutputTime;
+			}
+		}
+	}
+
+	inline void countUtxoTransaction(BitcoinAddress *ba,uint32_t transaction)
+	{
+		if ( ba->mTransactionIndex != transaction )
+		{
+			ba->mTransactionIndex = transaction;
+			ba->mTransactionCount++;
+		}
+	}
+
+	// The transactions added from here on belong to the next block; returns false if there is no room for it
+	bool markBlock(void)
+	{
+		bool ok = init() && mBlocks.ensure(mBlockCount+1);
+		if ( ok )
+		{
+			mBlocks[mBlockCount] = mTransactionCount;
+			mBlockCount++;
+		}
+		return ok;
+	}
+
+	// Returns the index of the first transaction of this block, or NO_TRANSACTION
+	uint32_t getBlock(uint32_t index,uint32_t &tcount) const
+	{
+		uint32_t ret = NO_TRANSACTION;
+		assert( index < mBlockCount );
+		if ( index < mBlockCount )
+		{
+			ret = mBlocks[index];
+			if ( (index+1) == mBlockCount )
+			{
+				tcount = mTransactionCount - ret;
+			}
+			else
+			{
+				tcount = mBlocks[index+1] - ret;
+			}
+		}
+		return ret;
+	}
+
+	inline uint32_t getProcessedBlockCount(void) const
+	{
+		return mBlockCount;
+	}
+
+	inline uint32_t getTotalInputCount(void) const
+	{
+		return mTotalInputCount;
+	}
+
+	inline uint32_t getTotalOutputCount(void) const
+	{
+		return mTotalOutputCount;
+	}
+
+	inline uint32_t getStatCount(void) const
+	{
+		return mStatCount;
+	}
+
+	// Drops everything added since the counts were these, as when the blocks which added it are disconnected.  The
+	// outputs spent by the dropped inputs are marked unspent again.  With the history kept the address totals are
+	// gathered from it, so only the addresses first seen since have to go; in UTXO mode the caller has already taken
+	// back what the blocks did to the addresses.  The dropped transactions come off the end of each address's
+	// transaction list, but the address totals stay as they were until the next gather.
+	void truncate(uint32_t transactionCount,uint32_t inputCount,uint32_t outputCount,uint32_t blockCount,uint32_t addressCount,uint32_t statCount)
+	{
+		if ( !mUtxoMode && mTransactions )
+		{
+			if ( mTransactionReferences )
+			{
+				// Only the addresses the dropped transactions paid or spent from can have them in their lists
+				for (uint32_t t=transactionCount; t<mTransactionCount; t++)
+				{
+					uint32_t outputEnd = getOutputEnd(t);
+					for (uint32_t j=mTransactions[t].mFirstOutput; j<outputEnd; j++)
+					{
+						trimTransactions(mOutputs[j].mAddress,addressCount,transactionCount);
+					}
+					uint32_t inputEnd = getInputEnd(t);
+					for (uint32_t j=mTransactions[t].mFirstInput; j<inputEnd; j++)
+					{
+						if ( mInputs[j].mOutput != NO_OUTPUT )
+						{
+							trimTransactions(mOutputs[mInputs[j].mOutput].mAddress,addressCount,transactionCount);
+						}
+					}
+				}
+			}
+			for (uint32_t i=inputCount; i<mTotalInputCount; i++)
+			{
+				uint32_t o = mInputs[i].mOutput;
+				if ( o < outputCount )
+				{
+					setSpentBy(o,SPENT_BY_UNSPENT,0);
+				}
+				mInputs[i].mOutput = NO_OUTPUT;
+			}
+			for (uint32_t i=outputCount; i<mTotalOutputCount; i++)
+			{
+				mSpentBy[i] = SpentBy();
+			}
+			// The overflow values are added in output order, so the first dropped output which has one marks the end
+			for (uint32_t i=outputCount; i<mTotalOutputCount; i++)
+			{
+				if ( mOutputs[i].mAmount >= AMOUNT_OVERFLOW )
+				{
+					mOverflowCount = mOutputs[i].mAmount-AMOUNT_OVERFLOW;
+					break;
+				}
+			}
+		}
+		mTransactionCount = transactionCount;
+		mTotalInputCount = inputCount;
+		mTotalOutputCount = outputCount;
+		if ( blockCount < mBlockCount )
+		{
+			mBlockCount = blockCount;
+		}
+		mAddresses.truncate(addressCount);
+		truncateStatistics(statCount);
+	}
+
+	// Drops the transactions from 'transactionCount' on off address 'a', unless the address is going too.  Each list
+	// is in transaction order, so they are the ones at the end.
+	void trimTransactions(uint32_t a,uint32_t addressCount,uint32_t transactionCount)
+	{
+		if ( a && a <= addressCount )
+		{
+			BitcoinAddress *ba = mAddresses.getKey(a-1);
+			if ( ba->mTransactions )
+			{
+				while ( ba->mTransactionCount && ba->mTransactions[ba->mTransactionCount-1] >= transactionCount )
+				{
+					ba->mTransactionCount--;
+				}
+			}
+		}
+	}
+
+	void truncateStatistics(uint32_t statCount)
+	{
+		while ( mStatCount > statCount )
+		{
+			mStatCount--;
+			mStatistics[mStatCount].clear();
+		}
+	}
+
+	// Writes the factory's sections of the state image
+	void writeState(StateImageWriter &w)
+	{
+		init();
+		// The transactions, inputs and block starts only hold indices, so they are written as they are
+		w.begin(STATE_TRANSACTIONS);
+		w.write(mTransactions,(uint64_t)mTransactionCount*sizeof(Transaction));
+		w.end(STATE_TRANSACTIONS);
+
+		w.begin(STATE_INPUTS);
+		w.write(mInputs,(uint64_t)mTotalInputCount*sizeof(TransactionInput));
+		w.end(STATE_INPUTS);
+
+		// The outputs are written as a compressed amount and an address, both as VARINTs
+		w.begin(STATE_OUTPUTS);
+		{
+			uint8_t *buffer = new uint8_t[STATE_BATCH*20];
+			for (uint32_t i=0; i<mTotalOutputCount; i+=STATE_BATCH)
+			{
+				uint32_t n = (mTotalOutputCount-i) < STATE_BATCH ? (mTotalOutputCount-i) : STATE_BATCH;
+				uint32_t len = 0;
+				for (uint32_t j=0; j<n; j++)
+				{
+					const TransactionOutput &o = mOutputs[i+j];
+					len+=writeVarInt(&buffer[len],compressAmount(getValue(o)));
+					len+=writeVarInt(&buffer[len],o.mAddress);
+				}
+				w.write(buffer,len);
+			}
+			delete []buffer;
+		}
+		w.end(STATE_OUTPUTS);
+
+		w.begin(STATE_SPENT_BY);
+		w.write(mSpentBy,(uint64_t)mTotalOutputCount*sizeof(SpentBy));
+		w.end(STATE_SPENT_BY);
+
+		w.begin(STATE_BLOCKS);
+		w.write(mBlocks,(uint64_t)mBlockCount*sizeof(uint32_t));
+		w.end(STATE_BLOCKS);
+
+		w.begin(STATE_REFERENCES);
+		w.write(mTransactionReferences,(uint64_t)mTransactionReferenceCount*sizeof(uint32_t));
+		w.end(STATE_REFERENCES);
+
+		w.begin(STATE_ADDRESSES);
+		{
+			BitcoinAddress *buffer = new BitcoinAddress[STATE_BATCH];
+			uint32_t addressCount = mAddresses.size();
+			for (uint32_t i=0; i<addressCount; i+=STATE_BATCH)
+			{
+				uint32_t n = (addressCount-i) < STATE_BATCH ? (addressCount-i) : STATE_BATCH;
+				for (uint32_t j=0; j<n; j++)
+				{
+					buffer[j] = *mAddresses.getKey(i+j);
+					buffer[j].mTransactions = toStateIndex(buffer[j].mTransactions,mTransactionReferences);
+				}
+				w.write(buffer,sizeof(BitcoinAddress)*n);
+			}
+			delete []buffer;
+		}
+		w.end(STATE_ADDRESSES);
+
+		w.begin(STATE_ADDRESS_SLOTS);
+		{
+			uint64_t size;
+			bool ok = mAddresses.writeSlots(w.getFile(),size);
+			w.wrote(ok,size);
+		}
+		w.end(STATE_ADDRESS_SLOTS);
+
+		// Each row is followed by its address arrays; the row's pointers only record which arrays are present
+		w.begin(STATE_STATISTICS);
+		for (uint32_t i=0; i<mStatCount; i++)
+		{
+			const StatRow &row = mStatistics[i];
+			uint8_t raw[sizeof(StatRow)];
+			memcpy(raw,&row,sizeof(StatRow));
+			StatRow *r = (StatRow *)raw;
+			r->mAddresses = toStateIndex(row.mAddresses,row.mAddresses);
+			r->mNewAddresses = toStateIndex(row.mNewAddresses,row.mNewAddresses);
+			r->mChangedAddresses = toStateIndex(row.mChangedAddresses,row.mChangedAddresses);
+			r->mDeletedAddresses = toStateIndex(row.mDeletedAddresses,row.mDeletedAddresses);
+			w.write(raw,sizeof(StatRow));
+			if ( row.mAddresses )
+			{
+				w.write(row.mAddresses,(uint64_t)row.mAddressCount*sizeof(StatAddress));
+			}
+			if ( row.mNewAddresses )
+			{
+				w.write(row.mNewAddresses,(uint64_t)row.mNewAddressCount*sizeof(StatAddress));
+			}
+			if ( row.mChangedAddresses )
+			{
+				w.write(row.mChangedAddresses,(uint64_t)row.mChangeAddressCount*sizeof(StatAddress));
+			}
+			if ( row.mDeletedAddresses )
+			{
+				w.write(row.mDeletedAddresses,(uint64_t)row.mDeleteAddressCount*sizeof(uint32_t));
+			}
+		}
+		w.end(STATE_STATISTICS);
+	}
+
+	// Restores the factory from the sections of a state image; it must not have processed anything yet
+	bool readState(const StateImageHeader &h,const uint8_t *data)
+	{
+		if ( !init() )
+		{
+			return false;
+		}
+		const StateSectionRecord *sections = h.mSections;
+		uint32_t transactionCount = (uint32_t)(sections[STATE_TRANSACTIONS].mSize/sizeof(Transaction));
+		uint32_t inputCount = (uint32_t)(sections[STATE_INPUTS].mSize/sizeof(TransactionInput));
+		uint32_t outputCount = (uint32_t)(sections[STATE_SPENT_BY].mSize/sizeof(SpentBy)); // the outputs are variable length
+		uint32_t blockCount = (uint32_t)(sections[STATE_BLOCKS].mSize/sizeof(uint32_t));
+		uint32_t referenceCount = (uint32_t)(sections[STATE_REFERENCES].mSize/sizeof(uint32_t));
+		uint32_t addressCount = (uint32_t)(sections[STATE_ADDRESSES].mSize/sizeof(BitcoinAddress));
+		if ( !mTransactions.ensure(transactionCount) || !mInputs.ensure(inputCount) || !mOutputs.ensure(outputCount) ||
+			 !mSpentBy.ensure(outputCount) || !mBlocks.ensure(blockCount) || sections[STATE_SPENT_BY].mSize != (uint64_t)outputCount*sizeof(SpentBy) )
+		{
+			printf("The state image holds more than this build has room for.\r\n");
+			return false;
+		}
+		bool ok = true;
+
+		// The indices are checked so a damaged image cannot send a later lookup out of bounds
+		memcpy(mTransactions,&data[sections[STATE_TRANSACTIONS].mOffset],sizeof(Transaction)*transactionCount);
+		uint32_t firstInput = 0;
+		uint32_t firstOutput = 0;
+		for (uint32_t i=0; i<transactionCount; i++)
+		{
+			const Transaction &t = mTransactions[i];
+			ok = ok && t.mFirstInput >= firstInput && t.mFirstInput <= inputCount && t.mFirstOutput >= firstOutput && t.mFirstOutput <= outputCount;
+			firstInput = t.mFirstInput;
+			firstOutput = t.mFirstOutput;
+		}
+		memcpy(mInputs,&data[sections[STATE_INPUTS].mOffset],sizeof(TransactionInput)*inputCount);
+		for (uint32_t i=0; i<inputCount; i++)
+		{
+			ok = ok && (mInputs[i].mOutput < outputCount || mInputs[i].mOutput == NO_OUTPUT);
+		}
+		{
+			const uint8_t *scan = &data[sections[STATE_OUTPUTS].mOffset];
+			const uint8_t *end = scan+sections[STATE_OUTPUTS].mSize;
+			mOverflowCount = 0;
+			for (uint32_t i=0; i<outputCount && ok; i++)
+			{
+				uint64_t amount = 0;
+				uint64_t address = 0;
+				ok = readVarInt(scan,end,amount) && readVarInt(scan,end,address) && address <= 0xFFFFFFFF;
+				mOutputs[i].mAddress = (uint32_t)address;
+				setValue(mOutputs[i],decompressAmount(amount));
+			}
+			ok = ok && scan == end;
+		}
+		memcpy(mSpentBy,&data[sections[STATE_SPENT_BY].mOffset],sizeof(SpentBy)*outputCount);
+
+		memcpy(mBlocks,&data[sections[STATE_BLOCKS].mOffset],sizeof(uint32_t)*blockCount);
+		for (uint32_t i=0; i<blockCount; i++)
+		{
+			ok = ok && mBlocks[i] <= transactionCount;
+		}
+
+		delete []mTransactionReferences;
+		mTransactionReferences = referenceCount ? new uint32_t[referenceCount] : NULL;
+		memcpy(mTransactionReferences,&data[sections[STATE_REFERENCES].mOffset],sizeof(uint32_t)*referenceCount);
+		for (uint32_t i=0; i<referenceCount; i++)
+		{
+			ok = ok && mTransactionReferences[i] < transactionCount;
+		}
+
+		const uint8_t *addresses = &data[sections[STATE_ADDRESSES].mOffset];
+		for (uint32_t i=0; i<addressCount; i++)
+		{
+			BitcoinAddress *ba = mAddresses.restoreKey(i);
+			memcpy(ba,&addresses[(uint64_t)i*sizeof(BitcoinAddress)],sizeof(BitcoinAddress));
+			ba->mTransactions = fromStateIndex(ba->mTransactions,mTransactionReferences,referenceCount,ok);
+		}
+		ok = ok && mAddresses.readSlots(&data[sections[STATE_ADDRESS_SLOTS].mOffset],sections[STATE_ADDRESS_SLOTS].mSize);
+
+		uint64_t offset = sections[STATE_STATISTICS].mOffset;
+		uint64_t end = offset+sections[STATE_STATISTICS].mSize;
+		uint32_t statCount = 0;
+		while ( ok && offset < end )
+		{
+			if ( statCount == MAX_STAT_COUNT || offset+sizeof(StatRow) > end )
+			{
+				ok = false;
+				break;
+			}
+			StatRow &row = mStatistics[statCount++];
+			memcpy((void *)&row,&data[offset],sizeof(StatRow));
+			offset+=sizeof(StatRow);
+			row.mAddresses = (StatAddress *)readStatArray(row.mAddresses,row.mAddressCount,sizeof(StatAddress),data,offset,end,ok);
+			row.mNewAddresses = (StatAddress *)readStatArray(row.mNewAddresses,row.mNewAddressCount,sizeof(StatAddress),data,offset,end,ok);
+			row.mChangedAddresses = (StatAddress *)readStatArray(row.mChangedAddresses,row.mChangeAddressCount,sizeof(StatAddress),data,offset,end,ok);
+			row.mDeletedAddresses = (uint32_t *)readStatArray(row.mDeletedAddresses,row.mDeleteAddressCount,sizeof(uint32_t),data,offset,end,ok);
+		}
+
+		mTransactionCount = transactionCount;
+		mTotalInputCount = inputCount;
+		mTotalOutputCount = outputCount;
+		mBlockCount = blockCount;
+		mTransactionReferenceCount = referenceCount;
+		mStatCount = statCount;
+		return ok;
+	}
+
+	// Copies one of a statistics row's address arrays out of the image, if the row had it
+	static void *readStatArray(const void *saved,uint32_t count,uint32_t elementSize,const uint8_t *data,uint64_t &offset,uint64_t end,bool &ok)
+	{
+		if ( (uint32_t)(uintptr_t)saved == STATE_NULL || !ok )
+		{
+			return NULL;
+		}
+		uint64_t size = (uint64_t)count*elementSize;
+		if ( offset+size > end )
+		{
+			ok = false;
+			return NULL;
+		}
+		uint8_t *ret = NULL;
+		if ( elementSize == sizeof(StatAddress) )
+		{
+			ret = (uint8_t *)new StatAddress[count];
+		}
+		else
+		{
+			ret = (uint8_t *)new uint32_t[count];
+		}
+		memcpy(ret,&data[offset],(size_t)size);
+		offset+=size;
+		return ret;
+	}
+
+	BitcoinAddress * getAddress(const uint8_t from[20],uint32_t &adr)
+	{
+		BitcoinAddress *ret = NULL;
+
+		BitcoinAddress h(from);
+		uint32_t index;
+		ret = mAddresses.insert(h,index); // returns the existing entry if this address has been seen before
+		if ( ret )
+		{
+			adr = index + 1;
+		}
+		return ret;
+	}
+
+	uint32_t getAddressCount(void) const
+	{
+		return (uint32_t)mAddresses.size();
+	}
+
+	bool hasAddress(const uint8_t hash160[20]) const
+	{
+		BitcoinAddress h(hash160);
+		return mAddresses.find(h) ? true : false;
+	}
+
+	Transaction * getSingleTransaction(uint32_t index)
+	{
+		Transaction *ret = NULL;
+		assert( index < mTransactionCount );
+		if ( index < mTransactionCount )
+		{
+			ret = &mTransactions[index];
+		}
+		return ret;
+	}
+
+
+	// Adds a transaction with room for its inputs and outputs after those of the transaction before it; returns
+	// its index, or NO_TRANSACTION if there is no room left.  The records are linked by 32-bit indices, so once the
+	// chain has more of them than that can address nothing which follows could be linked correctly; processing
+	// stops rather than let the counts wrap around.
+	uint32_t addTransaction(uint32_t block,uint32_t time,uint32_t inputCount,uint32_t outputCount)
+	{
+		if ( !init() )
+		{
+			return NO_TRANSACTION;
+		}
+		if ( (uint64_t)mTransactionCount+1 > MAX_TOTAL_TRANSACTIONS ||
+			 (uint64_t)mTotalInputCount+inputCount > MAX_TOTAL_INPUTS ||
+			 (uint64_t)mTotalOutputCount+outputCount > MAX_TOTAL_OUTPUTS )
+		{
+			printf("Block #%u has more transactions, inputs or outputs than the 32-bit record indices can hold (at most %u, %u and %u).\r\n",
+				block, (uint32_t)MAX_TOTAL_TRANSACTIONS, (uint32_t)MAX_TOTAL_INPUTS, (uint32_t)MAX_TOTAL_OUTPUTS );
+			printf("Use UTXO mode, which keeps no per-record indices, to process a chain this long.\r\n");
+			return NO_TRANSACTION;
+		}
+		uint32_t ret = NO_TRANSACTION;
+		bool ok = mTransactions.ensure(mTransactionCount+1) && mInputs.ensure(mTotalInputCount+inputCount) &&
+				  mOutputs.ensure(mTotalOutputCount+outputCount) && mSpentBy.ensure(mTotalOutputCount+outputCount);
+		if ( !ok )
+		{
+			printf("Failed to commit memory for the transaction records of block #%u.\r\n", block );
+		}
+		else
+		{
+			Transaction &t = mTransactions[mTransactionCount];
+			t.mBlock = block;
+			t.mTime = time;
+			t.mFirstInput = mTotalInputCount;
+			t.mFirstOutput = mTotalOutputCount;
+			ret = mTransactionCount++;
+			mTotalInputCount+=inputCount;
+			mTotalOutputCount+=outputCount;
+		}
+		return ret;
+	}
+
+	inline uint64_t getValue(const TransactionOutput &o) const
+	{
+		return o.mAmount < AMOUNT_OVERFLOW ? decompressAmount(o.mAmount) : mOverflow[o.mAmount-AMOUNT_OVERFLOW];
+	}
+
+	void setValue(TransactionOutput &o,uint64_t value)
+	{
+		uint64_t amount = compressAmount(value);
+		if ( amount < AMOUNT_OVERFLOW )
+		{
+			o.mAmount = (uint32_t)amount;
+		}
+		else
+		{
+			if ( mOverflowCount == mOverflowCapacity )
+			{
+				uint32_t capacity = mOverflowCapacity ? mOverflowCapacity*2 : 4096;
+				uint64_t *overflow = new uint64_t[capacity];
+				if ( mOverflowCount )
+				{
+					memcpy(overflow,mOverflow,sizeof(uint64_t)*mOverflowCount);
+				}
+				delete []mOverflow;
+				mOverflow = overflow;
+				mOverflowCapacity = capacity;
+			}
+			assert( mOverflowCount < (0xFFFFFFFF-AMOUNT_OVERFLOW) );
+			o.mAmount = AMOUNT_OVERFLOW+mOverflowCount;
+			mOverflow[mOverflowCount++] = value;
+		}
+	}
+
+	// One past the last input and output of transaction 't'
+	inline uint32_t getInputEnd(uint32_t t) const
+	{
+		return (t+1) < mTransactionCount ? mTransactions[t+1].mFirstInput : mTotalInputCount;
+	}
+
+	inline uint32_t getOutputEnd(uint32_t t) const
+	{
+		return (t+1) < mTransactionCount ? mTransactions[t+1].mFirstOutput : mTotalOutputCount;
+	}
+
+	inline uint32_t getInputCount(uint32_t t) const
+	{
+		return getInputEnd(t)-mTransactions[t].mFirstInput;
+	}
+
+	inline uint32_t getOutputCount(uint32_t t) const
+	{
+		return getOutputEnd(t)-mTransactions[t].mFirstOutput;
+	}
+
+	inline TransactionInput &getInput(uint32_t index)
+	{
+		return mInputs[index];
+	}
+
+	// Records that this output was spent by input 'input' of transaction 'transaction'
+	void setSpentBy(uint32_t output,uint32_t transaction,uint32_t input)
+	{
+		SpentBy &sb = mSpentBy[output];
+		sb.mTransaction = transaction;
+		sb.mInput = input;
+	}
+
+	uint32_t getProcessedTransactionCount(void) const
+	{
+		return mTransactionCount;
+	}
+
+	// Writes the spent-by array out along with the offsets needed to find the outputs of a transaction and the
+	// transactions of a block, so it can be memory mapped and walked without processing the block chain again.
+	// 'locations' gives where each processed block is stored.
+	bool saveSpentBy(const char *fname,const BlockLocation *locations) const
+	{
+		FILE *fph = fopen(fname,"wb");
+		if ( fph == NULL )
+		{
+			printf("Failed to open '%s' for write access.\r\n", fname );
+			return false;
+		}
+		SpentByHeader h;
+		memset(&h,0,sizeof(h));
+		memcpy(h.mMagic,SPENT_BY_MAGIC,sizeof(SPENT_BY_MAGIC));
+		h.mVersion = SPENT_BY_VERSION;
+		h.mBlockCount = mBlockCount;
+		h.mTransactionCount = mTransactionCount;
+		h.mOutputCount = mTotalOutputCount;
+		fwrite(&h,sizeof(h),1,fph);
+		if ( mBlockCount )
+		{
+			fwrite(mBlocks,sizeof(uint32_t)*mBlockCount,1,fph);
+		}
+		fwrite(&mTransactionCount,sizeof(uint32_t),1,fph);
+		if ( mBlockCount )
+		{
+			fwrite(locations,sizeof(BlockLocation)*mBlockCount,1,fph);
+		}
+		for (uint32_t i=0; i<mTransactionCount; i++)
+		{
+			fwrite(&mTransactions[i].mFirstOutput,sizeof(uint32_t),1,fph);
+		}
+		fwrite(&mTotalOutputCount,sizeof(uint32_t),1,fph);
+		if ( mTotalOutputCount )
+		{
+			fwrite(mSpentBy,sizeof(SpentBy)*mTotalOutputCount,1,fph);
+		}
+		bool ok = ferror(fph) == 0;
+		fclose(fph);
+		if ( ok )
+		{
+			printf("Saved the spent-by index for %s outputs of %s transactions to '%s'.\r\n", formatNumber(mTotalOutputCount), formatNumber(mTransactionCount), fname );
+		}
+		else
+		{
+			printf("Failed to write '%s'.\r\n", fname );
+		}
+		return ok;
+	}
+
+	class AddressSortContext
+	{
+	public:
+		BitcoinAddress	**mAddresses;
+		uint32_t		*mPartitionStart;
+	};
+
+	static int compareAddresses(const void *a,const void *b)
+	{
+		return memcmp(*(BitcoinAddress * const *)a,*(BitcoinAddress * const *)b,20);
+	}
+
+	// Each thread sorts every threadCount'th partition
+	static void sortAddressPartitions(void *context,uint32_t thread,uint32_t threadCount)
+	{
+		AddressSortContext &c = *(AddressSortContext *)context;
+		for (uint32_t p=thread; p<(1<<ADDRESS_DIRECTORY_PARTITION_BITS); p+=threadCount)
+		{
+			uint32_t start = c.mPartitionStart[p];
+			uint32_t count = c.mPartitionStart[p+1]-start;
+			if ( count > 1 )
+			{
+				qsort(&c.mAddresses[start],count,sizeof(BitcoinAddress *),compareAddresses);
+			}
+		}
+	}
+
+	// Gathers the per address totals and transaction lists and writes them out as the address directory and
+	// postings file, with the addresses sorted by hash160.
+	bool saveAddressDirectory(const char *directoryName,const char *postingsName,const BlockLocation *locations,uint32_t threadCount)
+	{
+		gatherAddresses();
+		uint32_t addressCount = (uint32_t)mAddresses.size();
+
+		// Scatter the addresses into partitions by their leading bits, then sort the partitions in parallel
+		uint32_t partitionStart[(1<<ADDRESS_DIRECTORY_PARTITION_BITS)+1];
+		memset(partitionStart,0,sizeof(partitionStart));
+		for (uint32_t i=0; i<addressCount; i++)
+		{
+			partitionStart[getHashBucket((const uint8_t *)mAddresses.getKey(i),ADDRESS_DIRECTORY_PARTITION_BITS)+1]++;
+		}
+		for (uint32_t p=0; p<(1<<ADDRESS_DIRECTORY_PARTITION_BITS); p++)
+		{
+			partitionStart[p+1]+=partitionStart[p];
+		}
+		uint32_t next[1<<ADDRESS_DIRECTORY_PARTITION_BITS];
+		memcpy(next,partitionStart,sizeof(next));
+		BitcoinAddress **sorted = new BitcoinAddress *[addressCount ? addressCount : 1];
+		for (uint32_t i=0; i<addressCount; i++)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			sorted[next[getHashBucket((const uint8_t *)ba,ADDRESS_DIRECTORY_PARTITION_BITS)]++] = ba;
+		}
+		AddressSortContext c;
+		c.mAddresses = sorted;
+		c.mPartitionStart = partitionStart;
+		runThreads(sortAddressPartitions,&c,addressCount < 65536 ? 1 : threadCount);
+
+		FILE *fph = fopen(directoryName,"wb");
+		FILE *postings = fopen(postingsName,"wb");
+		if ( fph == NULL || postings == NULL )
+		{
+			printf("Failed to open '%s' and '%s' for write access.\r\n", directoryName, postingsName );
+			if ( fph ) fclose(fph);
+			if ( postings ) fclose(postings);
+			delete []sorted;
+			return false;
+		}
+
+		uint32_t bits = 0;
+		while ( bits < 24 && ((uint32_t)256<<bits) < addressCount ) // about 128 to 256 addresses per bucket
+		{
+			bits++;
+		}
+		uint32_t bucketCount = 1<<bits;
+		uint32_t *buckets = new uint32_t[bucketCount+1];
+		memset(buckets,0,sizeof(uint32_t)*(bucketCount+1));
+		for (uint32_t i=0; i<addressCount; i++)
+		{
+			buckets[getHashBucket((const uint8_t *)sorted[i],bits)+1]++;
+		}
+		for (uint32_t b=0; b<bucketCount; b++)
+		{
+			buckets[b+1]+=buckets[b];
+		}
+
+		AddressDirectoryHeader h;
+		memset(&h,0,sizeof(h));
+		memcpy(h.mMagic,ADDRESS_DIRECTORY_MAGIC,sizeof(ADDRESS_DIRECTORY_MAGIC));
+		h.mVersion = ADDRESS_DIRECTORY_VERSION;
+		h.mBucketBits = bits;
+		h.mAddressCount = addressCount;
+		h.mBlockCount = mBlockCount;
+		h.mTransactionCount = mTransactionCount;
+		fwrite(&h,sizeof(h),1,fph); // rewritten once the postings have been counted
+		fwrite(buckets,sizeof(uint32_t)*(bucketCount+1),1,fph);
+		if ( mBlockCount )
+		{
+			fwrite(mBlocks,sizeof(uint32_t)*mBlockCount,1,fph);
+		}
+		fwrite(&mTransactionCount,sizeof(uint32_t),1,fph);
+		if ( mBlockCount )
+		{
+			fwrite(locations,sizeof(BlockLocation)*mBlockCount,1,fph);
+		}
+
+		uint64_t postingCount = 0;
+		for (uint32_t i=0; i<addressCount; i++)
+		{
+			BitcoinAddress *ba = sorted[i];
+			AddressDirectoryRecord r;
+			memset(&r,0,sizeof(r));
+			memcpy(r.mHash160,ba,20);
+			r.mTransactionCount = ba->mTransactionCount;
+			r.mTotalReceived = ba->mTotalReceived;
+			r.mTotalSent = ba->mTotalSent;
+			r.mPostings = postingCount;
+			r.mFirstOutputTime = ba->mFirstOutputTime;
+			r.mLastOutputTime = ba->mLastOutputTime;
+			r.mLastInputTime = ba->mLastInputTime;
+			r.mInputCount = ba->mInputCount;
+			r.mOutputCount = ba->mOutputCount;
+			r.mPostingCount = ba->mTransactions ? ba->mTransactionCount : 0;
+			fwrite(&r,sizeof(r),1,fph);
+			if ( r.mPostingCount )
+			{
+				fwrite(ba->mTransactions,sizeof(uint32_t)*r.mPostingCount,1,postings);
+			}
+			postingCount+=r.mPostingCount;
+		}
+		h.mPostingCount = postingCount;
+		fseek(fph,0L,SEEK_SET);
+		fwrite(&h,sizeof(h),1,fph);
+		bool ok = ferror(fph) == 0 && ferror(postings) == 0;
+		fclose(fph);
+		fclose(postings);
+		delete []buckets;
+		delete []sorted;
+		if ( ok )
+		{
+			printf("Saved %s addresses and %s address transactions to '%s' and '%s'.\r\n", formatNumber(addressCount), formatNumber((uint32_t)postingCount), directoryName, postingsName );
+		}
+		else
+		{
+			printf("Failed to write the address directory '%s'.\r\n", directoryName );
+		}
+		return ok;
+	}
+
+	TransactionOutput * getOutput(uint32_t index)
+	{
+		TransactionOutput *ret = NULL;
+		assert( index < mTotalOutputCount );
+		if ( index < mTotalOutputCount )
+		{
+			ret = &mOutputs[index];
+		}
+		return ret;
+	}
+
+	const char *getKey(uint32_t a) const
+	{
+		static char scratch[256];
+		const char *ret = "UNKNOWN ADDRESS";
+		if ( a )
+		{
+			BitcoinAddress *ba = mAddresses.getKey(a-1);
+			uint8_t address1[25];
+			BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress((const uint8_t *)ba,address1);
+			BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(address1,scratch,256);
+			ret = scratch;
+		}
+		return ret;
+	}
+
+	// Renders the ASCII form of many addresses at once into 'output'; KEY_STRIDE bytes per address.
+	// The checksums and the base58 encoding are computed in batches rather than one address at a time.
+	// A NULL address, an output script without a recognized address, comes out as getKey shows it.
+	void getKeys(BitcoinAddress * const *addresses,uint32_t count,char *output) const
+	{
+		uint8_t binary[KEY_BATCH*25];
+		uint8_t checksum[KEY_BATCH*32];
+		const void *inputs[KEY_BATCH];
+		for (uint32_t base=0; base<count; base+=KEY_BATCH)
+		{
+			uint32_t n = count-base;
+			if ( n > KEY_BATCH )
+			{
+				n = KEY_BATCH;
+			}
+			for (uint32_t i=0; i<n; i++)
+			{
+				uint8_t *address = &binary[i*25];
+				address[0] = 0; // main network
+				if ( addresses[base+i] )
+				{
+					memcpy(&address[1],addresses[base+i],20);
+				}
+				else
+				{
+					memset(&address[1],0,20);
+				}
+				inputs[i] = address;
+			}
+			BLOCKCHAIN_SHA256::computeSHA256Batch(inputs,21,n,checksum);
+			for (uint32_t i=0; i<n; i++)
+			{
+				inputs[i] = &checksum[i*32];
+			}
+			BLOCKCHAIN_SHA256::computeSHA256Batch(inputs,32,n,checksum);
+			for (uint32_t i=0; i<n; i++)
+			{
+				memcpy(&binary[i*25+21],&checksum[i*32],4);
+			}
+			BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressesToAscii(binary,n,&output[base*KEY_STRIDE],KEY_STRIDE);
+			for (uint32_t i=0; i<n; i++)
+			{
+				if ( addresses[base+i] == NULL )
+				{
+					strcpy(&output[(base+i)*KEY_STRIDE],"UNKNOWN ADDRESS");
+				}
+			}
+		}
+	}
+
+	void printTransaction(uint32_t index,uint32_t tindex,uint32_t address)
+	{
+
+		uint64_t totalInput=0;
+		uint64_t totalOutput=0;
+		uint64_t coinBase=0;
+
+		const Transaction *t = &mTransactions[tindex];
+		TransactionInput *inputs = &mInputs[t->mFirstInput];
+		TransactionOutput *outputs = &mOutputs[t->mFirstOutput];
+		uint32_t inputCount = getInputCount(tindex);
+		uint32_t outputCount = getOutputCount(tindex);
+
+		for (uint32_t i=0; i<outputCount; i++)
+		{
+			TransactionOutput &o = outputs[i];
+			totalOutput+=getValue(o);
+		}
+		for (uint32_t i=0; i<inputCount; i++)
+		{
+			TransactionInput &input = inputs[i];
+			if ( input.mOutput != NO_OUTPUT )
+			{
+				TransactionOutput &o = mOutputs[input.mOutput];
+				totalInput+=getValue(o);
+			}
+		}
+
+		printf("    Transaction #%s From Block: %s has %s inputs and %s outputs time: %s.\r\n", formatNumber(index), formatNumber(t->mBlock), formatNumber(inputCount), formatNumber(outputCount), getTimeString(t->mTime) );
+
+		printf("    Total Input: %0.4f Total Output: %0.4f : Fees: %0.4f\r\n", 
+			(float)totalInput / ONE_BTC, 
+			(float) totalOutput / ONE_BTC, 
+			(float)((totalOutput-totalInput)-coinBase) / ONE_BTC );
+
+		// The addresses of the inputs followed by those of the outputs, rendered in one batch
+		BitcoinAddress **addresses = new BitcoinAddress*[inputCount+outputCount];
+		for (uint32_t i=0; i<inputCount; i++)
+		{
+			addresses[i] = inputs[i].mOutput != NO_OUTPUT ? getAddress(mOutputs[inputs[i].mOutput].mAddress) : NULL;
+		}
+		for (uint32_t i=0; i<outputCount; i++)
+		{
+			addresses[inputCount+i] = getAddress(outputs[i].mAddress);
+		}
+		char *keys = new char[(inputCount+outputCount)*KEY_STRIDE];
+		getKeys(addresses,inputCount+outputCount,keys);
+
+		for (uint32_t i=0; i<inputCount; i++)
+		{
+			TransactionInput &input = inputs[i];
+			if ( input.mOutput != NO_OUTPUT )
+			{
+				TransactionOutput &o = mOutputs[input.mOutput];
+				if ( o.mAddress == address )
+				{
+					printf("        [Input] "); 
+				}
+				else
+				{
+					printf("         Input  "); 
+				}
+				printf("%d : %s[%d] : Value %0.4f\r\n", i, &keys[i*KEY_STRIDE],o.mAddress, (float)getValue(o) / ONE_BTC );
+			}
+			else
+			{
+				printf("        [Input] %d : COINBASE\r\n", i );
+			}
+		}
+
+		for (uint32_t i=0; i<outputCount; i++)
+		{
+			TransactionOutput &o = outputs[i];
+			if ( o.mAddress == address )
+			{
+				printf("        [Output] ");
+			}
+			else
+			{
+				printf("         Output  ");
+			}
+			printf("%d : %s[%d] : Value %0.4f\r\n", i, &keys[(inputCount+i)*KEY_STRIDE],o.mAddress, (float)getValue(o) / ONE_BTC );
+		}
+		delete []keys;
+		delete []addresses;
+	}
+
+	void printTransactions(uint32_t blockIndex)
+	{
+		if ( blockIndex >= mBlockCount ) // nothing is kept for blocks processed in UTXO mode
+		{
+			return;
+		}
+		uint32_t tcount;
+		uint32_t t = getBlock(blockIndex,tcount);
+		if ( t != NO_TRANSACTION )
+		{
+			printf("===================================================\r\n");
+			printf("Block #%s has %s transactions.\r\n", formatNumber(blockIndex), formatNumber(tcount) );
+			for (uint32_t j=0; j<tcount; j++)
+			{
+				printTransaction(j,t+j,0);
+			}
+			printf("===================================================\r\n");
+			printf("\r\n");
+		}
+	}
+
+	// Addresses stop being added once processing is done; freezing the address map makes it much smaller for the queries which follow
+	void freeze(uint32_t threadCount)
+	{
+		mAddresses.freeze(threadCount);
+	}
+
+	void reportAddressMap(void) const
+	{
+		mAddresses.report("Address");
+	}
+
+	void reportCounts(void)
+	{
+		if ( mTransactionCount )
+		{
+			printf("%s transactions.\r\n", formatNumber(mTransactionCount) );
+			printf("%s inputs.\r\n", formatNumber(mTotalInputCount) );
+			printf("%s outputs.\r\n", formatNumber(mTotalOutputCount) );
+			printf("%s addresses.\r\n", formatNumber(mAddresses.size()) );
+			reportAddressMap();
+
+			enum StatType
+			{
+				ST_ZERO,
+				ST_DUST,
+				ST_LESSONE,
+				ST_LESSTEN,
+				ST_LESS_HUNDRED,
+				ST_LESS_THOUSAND,
+				ST_LESS_TEN_THOUSAND,
+				ST_LESS_HUNDRED_THOUSAND,
+				ST_GREATER_HUNDRED_THOUSAND,
+				ST_LAST
+			};
+			uint32_t counts[ST_LAST];
+			uint64_t balances[ST_LAST];
+			for (uint32_t i=0; i<ST_LAST; i++)
+			{
+				counts[i] = 0;
+				balances[i] = 0;
+			}
+
+			for (uint32_t i=0; i<mAddresses.size(); i++)
+			{
+				BitcoinAddress *ba = mAddresses.getKey(i);
+				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+				uint32_t btc = (uint32_t)(balance/ONE_BTC);
+				if ( balance == 0 )
+				{
+					counts[ST_ZERO]++;
+				}
+				else if ( balance < ONE_MBTC )
+				{
+					counts[ST_DUST]++;
+					balances[ST_DUST]+=balance;
+				}
+				else if ( balance < ONE_BTC )
+				{
+					counts[ST_LESSONE]++;
+					balances[ST_LESSONE]+=balance;
+				}
+				else if ( btc < 10 )
+				{
+					counts[ST_LESSTEN]++;
+					balances[ST_LESSTEN]+=btc;
+				}
+				else if ( btc < 100 )
+				{
+					counts[ST_LESS_HUNDRED]++;
+					balances[ST_LESS_HUNDRED]+=btc;
+				}
+				else if ( btc < 1000 )
+				{
+					counts[ST_LESS_THOUSAND]++;
+					balances[ST_LESS_THOUSAND]+=btc;
+				}
+				else if ( btc < 10000 )
+				{
+					counts[ST_LESS_TEN_THOUSAND]++;
+					balances[ST_LESS_TEN_THOUSAND]+=btc;
+				}
+				else if ( btc < 100000 )
+				{
+					counts[ST_LESS_HUNDRED_THOUSAND]++;
+					balances[ST_LESS_HUNDRED_THOUSAND]+=btc;
+				}
+				else
+				{
+					counts[ST_GREATER_HUNDRED_THOUSAND]++;
+					balances[ST_GREATER_HUNDRED_THOUSAND]+=btc;
+				}
+			}
+			printf("Found %s addresses which have ever been used.\r\n", formatNumber(mAddresses.size()) );
+
+			printf("Found %s addresses with a zero balance.\r\n", formatNumber( counts[ST_ZERO]) );
+
+			printf("Found %s 'dust' addresses (less than 1mbtc) with a total balance of %0.5f BTC\r\n", 
+				formatNumber( counts[ST_DUST] ), 
+				(float)balances[ST_DUST] / ONE_BTC );
+
+			printf("Found %s addresses with a balance greater than 1mbtc but less than 1btc, total balance %0.5f\r\n",
+				formatNumber(counts[ST_LESSONE]),
+				(float)balances[ST_LESSONE]/ONE_BTC );
+
+			printf("Found %s addresses with a balance greater than 1btc but less than 10btc, total btc: %s\r\n",
+				formatNumber(counts[ST_LESSTEN]),
+				formatNumber((uint32_t)balances[ST_LESSTEN]));
+
+			printf("Found %s addresses with a balance greater than 10btc but less than 100btc, total: %s\r\n",
+				formatNumber(counts[ST_LESS_HUNDRED]),
+				formatNumber((uint32_t)balances[ST_LESS_HUNDRED]));
+
+			printf("Found %s addresses with a balance greater than 100btc but less than 1,000btc, total: %s\r\n",
+				formatNumber(counts[ST_LESS_THOUSAND]),
+				formatNumber((uint32_t)balances[ST_LESS_THOUSAND]));
+
+			printf("Found %s addresses with a balance greater than 1,000btc but less than 10,000btc, total: %s\r\n",
+				formatNumber(counts[ST_LESS_TEN_THOUSAND]),
+				formatNumber((uint32_t)balances[ST_LESS_TEN_THOUSAND]));
+
+			printf("Found %s addresses with a balance greater than 10,000btc but less than 100,000btc, total: %s\r\n",
+				formatNumber(counts[ST_LESS_HUNDRED_THOUSAND]),
+				formatNumber((uint32_t)balances[ST_LESS_HUNDRED_THOUSAND]));
+
+			printf("Found %s addresses with a balance greater than 100,000btc, total: %s\r\n",
+				formatNumber(counts[ST_GREATER_HUNDRED_THOUSAND]),
+				formatNumber((uint32_t)balances[ST_GREATER_HUNDRED_THOUSAND]));
+
+
+		}
+	}
+
+
+	void gatherTransaction(BitcoinAddress *ba,uint32_t tindex)
+	{
+		if ( ba && ba->mTransactionIndex != tindex )
+		{
+			ba->mTransactionIndex = tindex;
+			ba->mTransactions[ba->mTransactionCount] = tindex;
+			ba->mTransactionCount++;
+		}
+	}
+
+	void countTransaction(BitcoinAddress *ba,
+						  uint32_t tindex,
+						  uint32_t &transactionReferenceCount)
+	{
+		if ( ba && ba->mTransactionIndex != tindex )
+		{
+			ba->mTransactionIndex = tindex;
+			ba->mTransactionCount++;
+			transactionReferenceCount++;
+		}
+	}
+
+	BitcoinAddress *getAddress(uint32_t a)
+	{
+		BitcoinAddress *ret = NULL;
+		if ( a )
+		{
+			ret = mAddresses.getKey(a-1);
+		}
+		return ret;
+	}
+
+
+	void gatherAddresses(void)
+	{
+		if ( mUtxoMode ) // the totals are kept up to date as blocks are processed and there is no history to gather
+		{
+			return;
+		}
+		delete []mTransactionReferences;
+		mTransactionReferences = NULL;
+		mTransactionReferenceCount = 0;
+
+		for (uint32_t i=0; i<mAddresses.size(); i++)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			ba->mTransactionCount = 0;
+			ba->mTransactionIndex = 0xFFFFFFFF;
+			ba->mTransactions = NULL;
+			ba->mLastInputTime = 0;
+			ba->mLastOutputTime = 0;
+			ba->mFirstOutputTime = 0;
+			ba->mTotalReceived = 0;
+			ba->mTotalSent = 0;
+			ba->mInputCount = 0;
+			ba->mOutputCount = 0;
+		}
+
+		uint32_t transactionReferenceCount=0;
+
+		// ok..we.now it's time to add all transactions to all addresses...
+		for (uint32_t i=0; i<mTransactionCount; i++)
+		{
+			Transaction &t = mTransactions[i];
+			uint32_t outputEnd = getOutputEnd(i);
+			for (uint32_t j=t.mFirstOutput; j<outputEnd; j++)
+			{
+				TransactionOutput &o = mOutputs[j];
+				BitcoinAddress *ba = getAddress(o.mAddress);
+				countTransaction(ba,i,transactionReferenceCount);
+			}
+			uint32_t inputEnd = getInputEnd(i);
+			for (uint32_t j=t.mFirstInput; j<inputEnd; j++)
+			{
+				TransactionInput &input = mInputs[j];
+				if ( input.mOutput != NO_OUTPUT )
+				{
+					TransactionOutput &o = mOutputs[input.mOutput];
+					BitcoinAddress *ba = getAddress(o.mAddress);
+					countTransaction(ba,i,transactionReferenceCount);
+				}
+			}
+		}
+
+		mTransactionReferences = new uint32_t[transactionReferenceCount];
+		mTransactionReferenceCount = transactionReferenceCount;
+		transactionReferenceCount=0;
+		for (uint32_t i=0; i<mAddresses.size(); i++)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			ba->mTransactions = &mTransactionReferences[transactionReferenceCount];
+			transactionReferenceCount+=ba->mTransactionCount;
+			ba->mTransactionIndex = 0xFFFFFFFF; // which transaction we have stored yet so far...
+			ba->mTransactionCount = 0;
+		}
+
+		// ok..we.now it's time to add all transactions to all addresses...
+		for (uint32_t i=0; i<mTransactionCount; i++)
+		{
+			Transaction &t = mTransactions[i];
+
+			uint32_t outputEnd = getOutputEnd(i);
+			for (uint32_t j=t.mFirstOutput; j<outputEnd; j++)
+			{
+				TransactionOutput &o = mOutputs[j];
+				BitcoinAddress *ba = getAddress(o.mAddress);
+				if ( ba )
+				{
+					gatherTransaction(ba,i);
+					ba->mTotalReceived+=getValue(o);
+					ba->mOutputCount++;
+					if ( t.mTime > ba->mLastOutputTime ) // if the transaction time is more recnet than the last output time..
+					{
+						ba->mLastOutputTime = t.mTime;
+						if ( ba->mFirstOutputTime == 0 ) // if this is the first output encountered, then mark it as the first output time.
+						{
+							ba->mFirstOutputTime = t.mTime;
+						}
+					}
+
+				}
+			}
+
+			uint32_t inputEnd = getInputEnd(i);
+			for (uint32_t j=t.mFirstInput; j<inputEnd; j++)
+			{
+				TransactionInput &input = mInputs[j];
+
+				if ( input.mOutput != NO_OUTPUT )
+				{
+					TransactionOutput &o = mOutputs[input.mOutput];
+					BitcoinAddress *ba = getAddress(o.mAddress);
+					if ( ba )
+					{
+						gatherTransaction(ba,i);
+						ba->mTotalSent+=getValue(o);
+						ba->mInputCount++;
+						if ( t.mTime > ba->mLastInputTime ) // if the transaction time is newer than the last input/spent time..
+						{
+							ba->mLastInputTime = t.mTime;
+						}
+					}
+				}
+
+			}
+		}
+	}
+
+	void printTopBalances(uint32_t tcount,uint32_t minBalance)
+	{
+		uint32_t plotCount = 0;
+		uint64_t mbtc = minBalance*ONE_BTC;
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->getBalance();
+			if ( balance >= mbtc )
+			{
+				plotCount++;
+			}
+		}
+
+		if ( !plotCount )
+		{
+			printf("No addresses found with a balance more than %d bitcoins\r\n", minBalance );
+			return;
+		}
+
+		BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
+		plotCount = 0;
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->getBalance();
+			if ( balance >= mbtc )
+			{
+				sortPointers[plotCount] = ba;
+				plotCount++;
+			}
+		}
+		SortByBalance sb(sortPointers,plotCount);
+		time_t currentTime;
+		time(&currentTime); // get the current time.
+
+		if ( plotCount < tcount )
+		{
+			tcount = plotCount;
+		}
+		printf("Displaying the top %d addresses by balance.\r\n", tcount );
+		printf("==============================================\r\n");
+		printf(" Address           : Balance  : Days Since Last Use\r\n");
+		printf("==============================================\r\n");
+		char *keys = new char[tcount*KEY_STRIDE];
+		getKeys(sortPointers,tcount,keys);
+		for (uint32_t i=0; i<tcount; i++)
+		{
+			BitcoinAddress *ba = sortPointers[i];
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+			{
+				lastUsed = ba->mFirstOutputTime;
+			}
+			double seconds = difftime(currentTime,time_t(lastUsed));
+			double minutes = seconds/60;
+			double hours = minutes/60;
+			uint32_t days = (uint32_t) (hours/24);
+			printf("%40s,  %8d,  %4d\r\n", &keys[i*KEY_STRIDE], (uint32_t)( balance / ONE_BTC ), days );
+		}
+		delete []keys;
+		delete []sortPointers;
+	}
+
+	void zombieReport(uint32_t zdays,uint32_t minBalance)
+	{
+		uint32_t zombie_count=0;
+		uint32_t alive_count=0;
+		uint32_t zombie_balance=0;
+		uint32_t alive_balance=0;
+		uint64_t mbtc = minBalance*ONE_BTC;
+		time_t currentTime;
+		time(&currentTime); // get the current time.
+		printf("Scanning %s bitcoin addresses and looking for zombies.\r\n", formatNumber(mAddresses.size()));
+
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			if ( balance > mbtc )
+			{
+				uint32_t btc = (uint32_t)((balance)/ONE_BTC);
+				uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+				if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+				{
+					lastUsed = ba->mFirstOutputTime;
+				}
+				double seconds = difftime(currentTime,time_t(lastUsed));
+				double minutes = seconds/60;
+				double hours = minutes/60;
+				uint32_t days = (uint32_t) (hours/24);
+				if ( days > zdays )
+				{
+					zombie_count++;
+					zombie_balance+=btc;
+				}
+				else
+				{
+					alive_count++;
+					alive_balance+=btc;
+				}
+			}
+		}
+		printf("Zombie Report:\r\n");
+		printf("Found %s zombie addresses older than %s days with a total balance of %s, excluding balances less than %s\r\n",formatNumber(zombie_count),formatNumber(zdays),formatNumber(zombie_balance), formatNumber(minBalance) );
+		printf("Found %s living addresses newer than %s days with a total balance of %s, excluding balances less than %s\r\n",formatNumber(alive_count),formatNumber(zdays),formatNumber(alive_balance), formatNumber(minBalance) );
+	}
+
+	void printOldest(uint32_t tcount,uint32_t minBalance)
+	{
+		uint32_t plotCount = 0;
+		uint64_t mbtc = minBalance*ONE_BTC;
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			if ( balance >= mbtc )
+			{
+				plotCount++;
+			}
+		}
+
+		if ( !plotCount )
+		{
+			printf("No addresses found with a balance more than %d bitcoins\r\n", minBalance );
+			return;
+		}
+
+		BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
+		plotCount = 0;
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			if ( balance >= mbtc )
+			{
+				sortPointers[plotCount] = ba;
+				plotCount++;
+			}
+		}
+		SortByAge sb(sortPointers,plotCount);
+		time_t currentTime;
+		time(&currentTime); // get the current time.
+
+		if ( plotCount < tcount )
+		{
+			tcount = plotCount;
+		}
+		printf("Displaying the top %d addresses by age.\r\n", tcount );
+		printf("==============================================\r\n");
+		printf(" Address           : Balance  : Days Since Last Use\r\n");
+		printf("==============================================\r\n");
+		char *keys = new char[tcount*KEY_STRIDE];
+		getKeys(sortPointers,tcount,keys);
+		for (uint32_t i=0; i<tcount; i++)
+		{
+			BitcoinAddress *ba = sortPointers[i];
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+			{
+				lastUsed = ba->mFirstOutputTime;
+			}
+			double seconds = difftime(currentTime,time_t(lastUsed));
+			double minutes = seconds/60;
+			double hours = minutes/60;
+			uint32_t days = (uint32_t) (hours/24);
+			printf("%40s,  %8d,  %4d\r\n", &keys[i*KEY_STRIDE], (uint32_t)( balance / ONE_BTC ), days );
+		}
+		delete []keys;
+		delete []sortPointers;
+	}
+
+
+	void printAddress(const char *adr)
+	{
+		BitcoinAddress ba;
+		uint8_t output[25];
+		if ( BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAsciiToAddress(adr,output) )
+		{
+			memcpy(&ba.mWord0,&output[1],20);
+			BitcoinAddress *found = mAddresses.find(ba);
+			if ( found )
+			{
+				printAddress(found);
+			}
+			else
+			{
+				printf("Failed to locate address: %s\r\n", adr );
+			}
+		}
+		else
+		{
+			printf("Failed to decode address: %s\r\n", adr );
+		}
+	}
+
+	void printAddresses(void)
+	{
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			printAddress(ba);
+		}
+	}
+
+	void printAddress(BitcoinAddress *ba)
+	{
+		uint32_t i = mAddresses.getIndex(ba);
+		printf("========================================\r\n");
+		printf("PublicKey: %s[%d] has %s transactions associated with it.\r\n", getKey(i+1),i+1, formatNumber(ba->mTransactionCount) );
+		printf("Balance: %0.4f : TotalReceived: %0.4f TotalSpent: %0.4f\r\n", (float) (ba->mTotalReceived-ba->mTotalSent)/ONE_BTC, (float)ba->mTotalReceived / ONE_BTC, (float) ba->mTotalSent / ONE_BTC );
+		if ( ba->mLastInputTime )
+		{
+			printf("Last Input Time: %s\r\n", getTimeString(ba->mLastInputTime) );
+		}
+		if ( ba->mLastOutputTime )
+		{
+			printf("Last Output Time: %s\r\n", getTimeString(ba->mLastOutputTime) );
+		}
+		if ( ba->mTransactions )
+		{
+			for (uint32_t j=0; j<ba->mTransactionCount; j++)
+			{
+				printTransaction(j,ba->mTransactions[j],i+1);
+			}
+		}
+		printf("========================================\r\n");
+		printf("\r\n");
+	}
+
+	inline StatSize getStatSize(uint64_t v)
+	{
+		if ( v == 0 ) return SS_ZERO;
+		for (uint32_t i=1; i<(SS_COUNT-1); i++)
+		{
+			if ( v < mStatLimits[i] )
+			{
+				return (StatSize)i;
+			}
+		}
+		return SS_MAX_BTC;
+	}
+
+	void gatherStatistics(uint32_t stime,uint32_t zombieDate,bool recordAddresses)
+	{
+		gatherAddresses();
+
+		assert( mStatCount < MAX_STAT_COUNT );
+		StatRow &row = mStatistics[mStatCount];
+		row.mTime = stime;
+
+		time_t currentTime;
+		time(&currentTime); // get the current time.
+
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+			StatSize s = getStatSize(balance);
+			row.mCount++;
+			row.mValue+=balance;
+
+			row.mStats[s].mCount++;
+			row.mStats[s].mValue+=balance;
+
+			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+			{
+				lastUsed = ba->mFirstOutputTime;
+			}
+
+			if ( lastUsed < zombieDate )
+			{
+				row.mZombieTotal+=balance;
+				row.mZombieCount++;
+			}
+
+		}
+
+		if ( recordAddresses )
+		{
+			// First compute how many bitcoin addresses have a balance over a minimum bitcoin size (we will start with just one)
+			uint32_t plotCount = 0;
+
+			for (uint32_t i=0; i<mAddresses.size(); i++) 
+			{
+				BitcoinAddress *ba = mAddresses.getKey(i);
+				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+				if ( balance >= ONE_BTC )
+				{
+					plotCount++;
+				}
+			}
+
+			printf("Gathering Address Delta's for %s addresses containing more than one bitcoin\r\n", formatNumber(plotCount) );
+
+			if ( plotCount )
+			{
+				BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
+				uint32_t plotCount = 0;
+				for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+				{
+					BitcoinAddress *ba = mAddresses.getKey(i);
+					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+					if ( balance >= ONE_BTC )
+					{
+						sortPointers[plotCount] = ba;
+						plotCount++;
+					}
+				}
+
+				uint32_t reportCount = plotCount;
+
+				row.mAddresses = new StatAddress[reportCount];
+				row.mAddressCount = reportCount;
+
+				SortByBalance sb(sortPointers,plotCount);
+
+				for (uint32_t i=0; i<reportCount; i++)
+				{
+					BitcoinAddress *ba = sortPointers[i];
+					StatAddress &sa = row.mAddresses[i];
+					sa.mAddress = mAddresses.getIndex(ba)+1;
+					sa.mLastTime = ba->getLastUsedTime();
+					sa.mFirstTime = ba->mFirstOutputTime;
+					sa.mTotalReceived = (uint32_t)(ba->mTotalReceived/ONE_MBTC);
+					sa.mTotalSent = (uint32_t)(ba->mTotalSent/ONE_MBTC);
+					sa.mTransactionCount = (uint8_t) (ba->mTransactionCount > 255 ? 255 : ba->mTransactionCount);
+					uint32_t inputCount = ba->getInputCount();
+					uint32_t outputCount = ba->getOutputCount();
+					sa.mInputCount = (uint8_t) (inputCount > 255 ? 255 : inputCount);
+					sa.mOutputCount = (uint8_t) (outputCount > 255 ? 255 : outputCount);
+				}
+
+				if ( mStatCount >= 1 )
+				{
+					// build the delta!
+					StatRow &previousRow = mStatistics[mStatCount-1];
+					//
+					uint32_t *addressIndex = new uint32_t[mAddresses.size()];	// convert from master address list to used by statistics address list table
+
+					memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
+
+					for (uint32_t i=0; i<previousRow.mAddressCount; i++)
+					{
+						StatAddress &sa = previousRow.mAddresses[i];
+						addressIndex[sa.mAddress-1] = i+1; // make this address as being used by the previous row
+					}
+
+					uint32_t changeCount=0;
+					uint32_t newCount=0;
+					uint32_t deleteCount=0;
+					uint32_t sameCount=0;
+					uint32_t riseFromTheDeadCount=0;
+					uint32_t riseFromTheDeadAmount=0;
+
+					for (uint32_t i=0; i<row.mAddressCount; i++)
+					{
+						StatAddress &na = row.mAddresses[i];	// get the current row address
+						uint32_t aindex = na.mAddress-1; // get the array index for this address
+
+						if ( addressIndex[aindex] ) // did the previous row use this address?
+						{
+							uint32_t pindex = addressIndex[aindex]-1; // get the array index in the previous row so we can do a compare.
+
+							addressIndex[aindex] = 0xFFFFFFFF; // make it as processed.
+
+							StatAddress &oa = previousRow.mAddresses[pindex];
+
+							if ( na == oa )
+							{
+								sameCount++; // no changes...
+							}
+							else
+							{
+								// ok.. if it previously existed but there has been a change, was it a zombie change?
+								if ( oa.mLastTime < zombieDate && na.mLastTime >= zombieDate )
+								{
+									riseFromTheDeadCount++;
+									riseFromTheDeadAmount+=oa.getBalance(); // how much bitcoin rose from the dead.
+								}
+								changeCount++;
+							}
+						}
+						else
+						{
+							newCount++;
+						}
+					}
+
+					for (uint32_t i=0; i<mAddresses.size(); i++)
+					{
+						if ( addressIndex[i] && addressIndex[i] != 0xFFFFFFFF )
+						{
+							deleteCount++;
+						}
+					}
+
+					row.mNewAddressCount = newCount;
+					row.mDeleteAddressCount = deleteCount;
+					row.mChangeAddressCount = changeCount;
+					row.mSameAddressCount = sameCount;
+					row.mRiseFromDeadAmount = riseFromTheDeadAmount;
+					row.mRiseFromDeadCount = riseFromTheDeadCount;
+
+
+					if ( newCount )
+					{
+						row.mNewAddresses = new StatAddress[newCount];
+					}
+
+					if ( changeCount )
+					{
+						row.mChangedAddresses = new StatAddress[changeCount];
+					}
+					// Assign an array index to each address used by the previous row
+					memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
+					for (uint32_t i=0; i<previousRow.mAddressCount; i++)
+					{
+						StatAddress &sa = previousRow.mAddresses[i];
+						addressIndex[sa.mAddress-1] = i+1;
+					}
+
+					newCount = 0;
+					changeCount = 0;
+					sameCount = 0;
+
+					for (uint32_t i=0; i<row.mAddressCount; i++)
+					{
+						StatAddress &na = row.mAddresses[i];
+						uint32_t aindex = na.mAddress-1;
+
+						if ( addressIndex[aindex] ) // did the previous row have this address.
+						{
+							uint32_t pindex = addressIndex[aindex]-1;
+							addressIndex[aindex] = 0xFFFFFFFF; // make it as processed.
+							StatAddress &oa = previousRow.mAddresses[pindex];
+							if ( na == oa )
+							{
+								sameCount++;
+							}
+							else
+							{
+								row.mChangedAddresses[changeCount] = na;
+								changeCount++;
+							}
+						}
+						else
+						{
+							row.mNewAddresses[newCount] = na;
+							newCount++;
+						}
+					}
+
+					if ( deleteCount ) 
+					{
+						row.mDeletedAddresses = new uint32_t[deleteCount];
+						deleteCount = 0;
+						for (uint32_t i=0; i<mAddresses.size(); i++)
+						{
+							if ( addressIndex[i] && addressIndex[i] != 0xFFFFFFFF )
+							{
+								row.mDeletedAddresses[deleteCount] = i+1;
+								deleteCount++;
+							}
+						}
+					}
+
+					delete []addressIndex;
+
+					printf("Found %s new addresses, %s changed addresses, and %s deleted addresses\r\n",
+						formatNumber(newCount),
+						formatNumber(changeCount),
+						formatNumber(deleteCount));
+
+					if ( mStatCount >= 2 )
+					{
+						StatRow &oldRow = mStatistics[mStatCount-2];
+						delete []oldRow.mAddresses;
+						oldRow.mAddresses = NULL;
+						oldRow.mAddressCount = 0;
+					}
+				}
+				delete []sortPointers;
+			}
+		}
+		mStatCount++;
+	}
+
+	void saveAddressesOverTime(void)
+	{
+		FILE *fph = fopen("BlockChainAddresses.bin", "wb");
+		if ( fph )
+		{
+			const char *header = "BLOCK_CHAIN_ADDRESSES";
+			fwrite(header,strlen(header)+1,1,fph);
+			uint32_t version = 1;
+			fwrite(&version, sizeof(version), 1, fph );
+
+			// first..we need to count how many addresses are being used for this report.
+			uint32_t *addressIndex = new uint32_t[mAddresses.size()];	// convert from master address list to used by statistics address list table
+			uint32_t *inverseAddress = new uint32_t[mAddresses.size()]; // convert from remapped list back to master address.
+
+			memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
+			memset(inverseAddress,0,sizeof(uint32_t)*mAddresses.size());
+
+			uint32_t fcount = 0; // number of unique addresses found
+
+			for (uint32_t i=0; i<mStatCount; i++)
+			{
+				StatRow &row = mStatistics[i];
+				for (uint32_t i=0; i<row.mAddressCount; i++)
+				{
+					StatAddress &sa = row.mAddresses[i];
+					assert( sa.mAddress	 );
+					uint32_t a = sa.mAddress-1;
+					assert( a < mAddresses.size() );
+					if ( addressIndex[a] == 0 ) // if this is the first time we have encountered this address, then we add it to the forward and inverse lookup tables.
+					{
+						addressIndex[a] = fcount+1;
+						inverseAddress[fcount] = a;
+						fcount++;
+					}
+				}
+			}
+			// ok..now ready to write out the address headers.
+			fwrite(&fcount,sizeof(fcount),1,fph);	// save how many unique addresses were found.
+			// now write out the 20 byte public key address for each.
+			for (uint32_t i=0; i<fcount; i++)
+			{
+				uint32_t a = inverseAddress[i]; // get the original address.
+				BitcoinAddress *ba = mAddresses.getKey(a);
+				fwrite(ba,20,1,fph);// write out the bitcoin address 160 bit public key (20 bytes long)
+			}
+
+			fwrite(&mStatCount, sizeof(mStatCount), 1, fph );
+
+			for (uint32_t i=0; i<mStatCount; i++)
+			{
+				StatRow &row = mStatistics[i];
+				fwrite(&row.mTime,sizeof(row.mTime),1, fph); // write out the time that this row was recorded...
+				if ( i == 0 ) 
+				{
+					fwrite(&row.mAddressCount,sizeof(row.mAddressCount),1,fph);
+				}
+				else
+				{
+					fwrite(&row.mNewAddressCount,sizeof(row.mNewAddressCount),1,fph);
+				}
+				fwrite(&row.mChangeAddressCount,sizeof(row.mChangeAddressCount),1,fph);
+				fwrite(&row.mDeleteAddressCount,sizeof(row.mDeleteAddressCount),1,fph);
+			}
+
+			for (uint32_t i=0; i<mStatCount; i++)
+			{
+				StatRow &row = mStatistics[i];
+				if ( i == 0 )
+				{
+					for (uint32_t i=0; i<row.mAddressCount; i++)
+					{
+						StatAddress sa = row.mAddresses[i];
+						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
+						fwrite(&sa,sizeof(sa),1,fph); // write it out...
+					}
+				}
+				else
+				{
+					for (uint32_t i=0; i<row.mNewAddressCount; i++)
+					{
+						StatAddress sa = row.mNewAddresses[i];
+						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
+						fwrite(&sa,sizeof(sa),1,fph); // write it out...
+					}
+					for (uint32_t i=0; i<row.mChangeAddressCount; i++)
+					{
+						StatAddress sa = row.mChangedAddresses[i];
+						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
+						fwrite(&sa,sizeof(sa),1,fph); // write it out...
+					}
+					for (uint32_t i=0; i<row.mDeleteAddressCount; i++)
+					{
+						uint32_t da = row.mDeletedAddresses[i];
+						uint32_t a = addressIndex[da-1];
+						fwrite(&a,sizeof(uint32_t),1,fph);
+					}
+				}
+			}
+			delete []addressIndex;
+			delete []inverseAddress;
+			fclose(fph);
+		}
+	}
+
+	void saveStatistics(bool record_addresses)
+	{
+		if ( record_addresses )
+		{
+			saveAddressesOverTime();
+		}
+		FILE *fph = fopen("stats.csv", "wb");
+		if ( !fph ) 
+		{
+			printf("Failed to open statistics output file 'stats.csv' for write access.\r\n");
+			return;
+		}
+
+// BitcoinAddress Summary Results first
 
-#define MAX_BLOCK_FILES	512	// As of July 6, 2013 there are only about 70 .dat files; so it will be a long time before this overflows
+		AgeStat ageStats[AM_LAST];
 
-// These defines set the limits this parser expects to ever encounter on the blockchain data stream.
-// In a debug build there are asserts to make sure these limits are never exceeded.
-// These limits work for the blockchain current as of July 1, 2013.
-// The limits can be revised when and if necessary.
-#define MAX_BLOCK_SIZE (1024*1024)*10	// never expect to have a block larger than 10mb
-#define MAX_BLOCK_TRANSACTION 8192		// never expect more than 8192 transactions per block.
-#define MAX_BLOCK_INPUTS 32768			// never expect more than 32768 total inputs
-#define MAX_BLOCK_OUTPUTS 32768			// never expect more than 32768 total outputs
+		// First compute how many bitcoin addresses have a balance over a minimum bitcoin size (we will start with just one)
+		uint32_t plotCount = 0;
+		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		{
+			BitcoinAddress *ba = mAddresses.getKey(i);
+			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
 
-#define MAX_REASONABLE_SCRIPT_LENGTH (1024*8) // would never expect any script to be more than 8k in size; that would be very unusual!
-#define MAX_REASONABLE_INPUTS 4096				// really can't imagine any transaction ever having more than 4096 inputs
-#define MAX_REASONABLE_OUTPUTS 4096				// really can't imagine any transaction ever having more than 4096 outputs
+			uint32_t days = ba->getDaysSinceLastUsed();
+			if ( days <= 1 )
+			{
+				ageStats[AM_ONE_DAY].addValue(balance);
+			}
+			else if ( days <= 7 )
+			{
+				ageStats[AM_ONE_WEEK].addValue(balance);
+			}
+			else if ( days <= 30 )
+			{
+				ageStats[AM_ONE_MONTH].addValue(balance);
+			}
+			else if ( days <= (30*3) )
+			{
+				ageStats[AM_THREE_MONTHS].addValue(balance);
+			}
+			else if ( days <= (30*6) )
+			{
+				ageStats[AM_SIX_MONTHS].addValue(balance);
+			}
+			else if ( days <= 365 )
+			{
+				ageStats[AM_ONE_YEAR].addValue(balance);
+			}
+			else if ( days <= 365*2 )
+			{
+				ageStats[AM_TWO_YEARS].addValue(balance);
+			}
+			else if ( days <= 365*3 )
+			{
+				ageStats[AM_THREE_YEARS].addValue(balance);
+			}
+			else if ( days <= 365*4 )
+			{
+				ageStats[AM_FOUR_YEARS].addValue(balance);
+			}
+			else
+			{
+				ageStats[AM_FIVE_YEARS].addValue(balance);
+			}
+			if ( balance >= ONE_BTC )
+			{
+				plotCount++;
+			}
+		}
 
-//********************************************
-//********************************************
 
-class BlockImpl : public BlockChain::Block
-{
-public:
 
-	// Read one byte from the block-chain input stream.
-	inline uint8_t readU8(void)
-	{
-		assert( (mBlockRead+sizeof(uint8_t)) <= mBlockEnd );
-		uint8_t ret = *(uint8_t *)mBlockRead;
-		mBlockRead+=sizeof(uint8_t);
-		return ret;
-	}
+		if ( plotCount )
+		{
+#define MAX_PLOT_COUNT 150000
+			BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
+			uint32_t plotCount = 0;
+			for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+			{
+				BitcoinAddress *ba = mAddresses.getKey(i);
+				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+				if ( balance >= ONE_BTC )
+				{
+					sortPointers[plotCount] = ba;
+					plotCount++;
+				}
+			}
+			uint32_t reportCount = plotCount;
+			fprintf(fph,"\r\n");
+			fprintf(fph,"\"BlockChain Statistics Report generated by: https://code.google.com/p/blockchain/ \"\r\n" );
+			fprintf(fph,"\r\n");
+			fprintf(fph,"\"Written by John W. Ratcliff mailto:jratcliffscarab@gmail.com\"\r\n" );
+			fprintf(fph,"\"Website: http://codesuppository.blogspot.com/\"\r\n" );
+			fprintf(fph,"\"TipJar Address: 1BT66EoaGySkbY9J6MugvQRhMMXDwPxPya\"\r\n" );
 
-	// Read two bytes from the block-chain input stream.
-	inline uint16_t readU16(void)
-	{
-		assert( (mBlockRead+sizeof(uint16_t)) <= mBlockEnd );
-		uint16_t ret = *(uint16_t *)mBlockRead;
-		mBlockRead+=sizeof(uint16_t);
-		return ret;
-	}
+			fprintf(fph,"\r\n");
+			fprintf(fph,"Bitcoin value distribution based on age.\r\n");
+			fprintf(fph,"Age,Value,Count\r\n");
+			for (uint32_t i=0; i<AM_LAST; i++)
+			{
+				AgeStat &as = ageStats[i];
+				fprintf(fph,"%s,%d,%d\r\n", getAgeString((AgeMarker)i), (uint32_t)(as.mTotalValue/ONE_BTC), as.mCount );
+			}
+			fprintf(fph,"\r\n");
 
-	// Read four bytes from the block-chain input stream.
-	inline uint32_t readU32(void)
-	{
-		assert( (mBlockRead+sizeof(uint32_t)) <= mBlockEnd );
-		uint32_t ret = *(uint32_t *)mBlockRead;
-		mBlockRead+=sizeof(uint32_t);
-		return ret;
-	}
 
-	// Read eight bytes from the block-chain input stream.
-	inline uint64_t readU64(void)
-	{
-		assert( (mBlockRead+sizeof(uint64_t)) <= mBlockEnd );
-		uint64_t ret = *(uint64_t *)mBlockRead;
-		mBlockRead+=sizeof(uint64_t);
-		return ret;
-	}
+			fprintf(fph,"\"Found %s addreses with a bitcoin balance of 1btc or more.\"\r\n", formatNumber(plotCount));
+			if ( plotCount > MAX_PLOT_COUNT )
+			{
+				reportCount = MAX_PLOT_COUNT;
+				fprintf(fph,"\"Exceeded maximum plot count, so only reporting the first %s addresses.\"\r\n", formatNumber(reportCount));
+			}
+			{
+				fprintf(fph,"\"Scatter Plot Data values of %s bitcoin address balances with over 1btc and number of days since last transaction. Sorted by Balance\"\r\n", formatNumber(plotCount));
+				fprintf(fph,"Days,Value,FirstUsed,LastReceived,LastSpent,TotalSent,TotalReceived,TransactionCount,PublicKeyAddress\r\n");
+				SortByBalance sb(sortPointers,plotCount);
+				char *keys = new char[reportCount*KEY_STRIDE];
+				getKeys(sortPointers,reportCount,keys);
+				time_t currentTime;
+				time(&currentTime); // get the current time.
+				for (uint32_t i=0; i<reportCount; i++)
+				{
+					BitcoinAddress *ba = sortPointers[i];
+					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+					uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
+					if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+					{
+						lastUsed = ba->mFirstOutputTime;
+					}
+					double seconds = difftime(currentTime,time_t(lastUsed));
+					double minutes = seconds/60;
+					double hours = minutes/60;
+					uint32_t days = (uint32_t) (hours/24);
+
+					fprintf(fph,"%d,", days );
+					fprintf(fph,"%d,", (uint32_t)( balance / ONE_BTC ));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mFirstOutputTime));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mLastOutputTime));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mLastInputTime));
+					fprintf(fph,"%0.2f,", (float)ba->mTotalSent / ONE_BTC );
+					fprintf(fph,"%0.2f,", (float) ba->mTotalReceived / ONE_BTC );
+					fprintf(fph,"%d,", ba->mTransactionCount );
+					fprintf(fph,"%s\r\n", &keys[i*KEY_STRIDE] );
+
+				}
+				delete []keys;
+				fprintf(fph,"\r\n");
+			}
+			{
+				fprintf(fph,"\"Scatter Plot Data values of %s bitcoin address balances with over 1btc and number of days since last transaction. Sorted by Age\"\r\n", formatNumber(plotCount));
+				fprintf(fph,"Days,Value,FirstUsed,LastReceived,LastSpent,TotalSent,TotalReceived,TransactionCount,PublicKeyAddress\r\n");
+
+				SortByAge sb(sortPointers,plotCount);
+				char *keys = new char[reportCount*KEY_STRIDE];
+				getKeys(sortPointers,reportCount,keys);
+				time_t currentTime;
+				time(&currentTime); // get the current time.
+				for (uint32_t i=0; i<reportCount; i++)
+				{
+					BitcoinAddress *ba = sortPointers[i];
+					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
+					uint32_t days = ba->getDaysSinceLastUsed();
+					fprintf(fph,"%d,", days );
+					fprintf(fph,"%d,", (uint32_t)( balance / ONE_BTC ));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mFirstOutputTime));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mLastOutputTime));
+					fprintf(fph,"\"%s\",", getTimeString(ba->mLastInputTime));
+					fprintf(fph,"%0.2f,", (float)ba->mTotalSent / ONE_BTC );
+					fprintf(fph,"%0.2f,", (float) ba->mTotalReceived / ONE_BTC );
+					fprintf(fph,"%d,", ba->mTransactionCount );
+					fprintf(fph,"%s\r\n", &keys[i*KEY_STRIDE] );
+
+				}
+				delete []keys;
+				fprintf(fph,"\r\n");
+			}
+			delete []sortPointers;
+		}
+//
+
+
+		const char *months[12] = { "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
+		{
+			fprintf(fph,"\r\n");
+			fprintf(fph,"Summary statistics for %d months.\r\n", mStatCount );
+			fprintf(fph,"\r\n");
+
+
+			fprintf(fph,"Date,");					// Date of this row
+			fprintf(fph,"ZombieValue,");			// The total value of all zombie addresses
+			fprintf(fph,"ZombieCount,");			// The number of zombie addresses
+			fprintf(fph,"TotalBTC,");				// Total BTC in circulation
+			fprintf(fph,"TotalActiveBTC,");			// Total non-zombie BTC
+			fprintf(fph,"AddressesUsed,");			// Total addresses used.
+			fprintf(fph,"AddressesWithBalance,");	// Total non-zero addresses.
+			fprintf(fph,"ZeroBalanceCount,");		// Number of zero balance addresses.
+			fprintf(fph,"DustCount,");				// The number of dust addresses < 1mbtc
+			fprintf(fph,"DustAmount,");				// The total amount in all dust addresses.
+			fprintf(fph,"AddressOneBTCCount,");		// The number of addresses with at least 1btc or more.
+			fprintf(fph,"AddressOneBTCValue,");		// The total value of all addresses with at least 1btc or more.
+			fprintf(fph,"Address1KCount,");			// The number of addresses with more than 1,000 btc in them.
+			fprintf(fph,"Address1KValue,");		// The total value of all addresses with more than 1,000 btc
+			fprintf(fph,"NewAddressCount,");		// Number of new addresses with a non-zero balance created
+			fprintf(fph,"ZeroAddressCount,");		// number of addresses who's balance went down to zero.
+			fprintf(fph,"ChangeAddressCount,");		// number of addresses who had changes against them.
+			fprintf(fph,"SameAddressCount,");		// The number of addresses with no change.
+			fprintf(fph,"RiseFromDeadCount,");		// number of addresses which rose from the dead.
+			fprintf(fph,"RiseFromDeadAmount\r\n");	// 
+
+			for (uint32_t i=0; i<mStatCount; i++)
+			{
+				StatRow &row = mStatistics[i];
+				time_t tnow(row.mTime);
+				struct tm beg;
+				beg = *localtime(&tnow);
+
+				uint32_t addressUsed = row.mCount;
+				uint32_t zeroCount = row.mStats[SS_ZERO].mCount;
+				uint32_t addressWithBalance = addressUsed - zeroCount;
+
+				uint32_t dustCount = row.mStats[SS_ONE_MBTC].mCount;
+				uint64_t dustAmount = row.mStats[SS_ONE_MBTC].mValue;
+
+				uint32_t addressOneBTCCount = 0;
+				uint64_t addressOneBTCTotal = 0;
+				uint32_t addressOneKCount = 0;
+				uint64_t addressOneKTotal = 0;
+
+				for (uint32_t i=SS_FIVE_BTC; i<SS_MAX_BTC; i++)
+				{
+					addressOneBTCCount+=row.mStats[i].mCount;
+					addressOneBTCTotal+=row.mStats[i].mValue;
+					if ( i > SS_ONE_THOUSAND_BTC )
+					{
+						addressOneKCount+=row.mStats[i].mCount;
+						addressOneKTotal+=row.mStats[i].mValue;
+					}
+				}
+
+				
+				// Date
+				fprintf(fph,"\"%s %d %d\",",months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900); 
+				fprintf(fph,"%d,", (uint32_t)(row.mZombieTotal/ONE_BTC) );
+				fprintf(fph,"%d,", row.mZombieCount );
 
-	// Return the current stream pointer representing a 32byte hash and advance the read pointer accordingly
-	inline const uint8_t *readHash(void)
-	{
-		const uint8_t *ret = mBlockRead;
-		assert( (mBlockRead+32) <= mBlockEnd );
-		mBlockRead+=32;
-		return ret;
-	}
+				fprintf(fph,"%d,", (uint32_t)(row.mValue / ONE_BTC) );
+				fprintf(fph,"%d,", (uint32_t)((row.mValue-row.mZombieTotal)/ ONE_BTC) );
 
-	// reads a variable length integer.
-	// See the documentation from here:  https://en.bitcoin.it/wiki/Protocol_specification#Variable_length_integer
-	inline uint32_t readVariableLengthInteger(void)
-	{
-		uint32_t ret = 0;
+				fprintf(fph,"%d,", addressUsed );
+				fprintf(fph,"%d,", addressWithBalance );
+				fprintf(fph,"%d,", zeroCount );
+				fprintf(fph,"%d,", dustCount );
+				fprintf(fph,"%d,", (uint32_t)(dustAmount / ONE_BTC) );
+				fprintf(fph,"%d,", addressOneBTCCount );
+				fprintf(fph,"%d,", (uint32_t) (addressOneBTCTotal / ONE_BTC) );
+				fprintf(fph,"%d,", addressOneKCount );
+				fprintf(fph,"%d,", (uint32_t) (addressOneKTotal / ONE_BTC) );
 
-		uint8_t v = readU8();
-		if ( v < 0xFD ) // If it's less than 0xFD use this value as the unsigned integer
-		{
-			ret = (uint32_t)v;
+				fprintf(fph,"%d,", row.mNewAddressCount );
+				fprintf(fph,"%d,", row.mDeleteAddressCount );
+				fprintf(fph,"%d,", row.mChangeAddressCount );
+				fprintf(fph,"%d,", row.mSameAddressCount );
+				fprintf(fph,"%d,", row.mRiseFromDeadCount );
+				fprintf(fph,"%d,", row.mRiseFromDeadAmount );
+
+				fprintf(fph,"\r\n");
+			}
+
+			fprintf(fph,"\r\n");
 		}
-		else
+	
 		{
-			uint16_t v = readU16();
-			if ( v < 0xFFFF )
+			fprintf(fph,"\r\n");
+			fprintf(fph,"Bitcoin Public Key Address Distribution Count by balance.\r\n");
+			fprintf(fph,"\r\n");
+			fprintf(fph,",");
+			for (uint32_t i=0; i<SS_COUNT; i++)
 			{
-				ret = (uint32_t)v;
+				fprintf(fph,"\"%s\",", mStatLabel[i]);
 			}
-			else
+			fprintf(fph,"\r\n");
+			for (uint32_t i=0; i<mStatCount; i++)
 			{
-				uint32_t v = readU32();
-				if ( v < 0xFFFFFFFF )
-				{
-					ret = (uint32_t)v;
-				}
-				else
+				StatRow &row = mStatistics[i];
+				time_t tnow(row.mTime);
+				struct tm beg;
+				beg = *localtime(&tnow);
+				fprintf(fph,"\"%s %d %d\",", months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
+				for (uint32_t j=0; j<SS_COUNT; j++)
 				{
-					assert(0); // never expect to actually encounter a 64bit integer in the block-chain stream; it's outside of any reasonable expected value
-					uint64_t v = readU64();
-					ret = (uint32_t)v;
+					StatValue &v = row.mStats[j];
+					fprintf(fph,"%d,",v.mCount);
 				}
+				fprintf(fph,"\r\n");
 			}
+			fprintf(fph,"\r\n");
 		}
-		return ret;
-	}
-
-	// Get the current read buffer address and advance the stream buffer by this length; used to get the address of input/output scripts
-	inline const uint8_t * getReadBufferAdvance(uint32_t readLength)
-	{
-		const uint8_t *ret = mBlockRead;
-		mBlockRead+=readLength;
-		assert( mBlockRead <= mBlockEnd );
-		return ret;
-	}
-	
-	// Read a transaction input
-	bool readInput(BlockChain::BlockInput &input)
-	{
-		bool ret = true;
 
-		input.transactionHash = readHash();	// read the transaction hash
-		input.transactionIndex = readU32();	// read the transaction index
-		input.responseScriptLength = readVariableLengthInteger();	// read the length of the script
-		assert( input.responseScriptLength < MAX_REASONABLE_SCRIPT_LENGTH );
-		if ( input.responseScriptLength < MAX_REASONABLE_SCRIPT_LENGTH )
-		{
-			input.responseScript = input.responseScriptLength ? getReadBufferAdvance(input.responseScriptLength) : NULL;	// get the script buffer pointer; and advance the read location
-			input.sequenceNumber = readU32();
-		}
-		else
 		{
-			ret = false;
+			fprintf(fph,"\r\n");
+			fprintf(fph,"Bitcoin Public Key Address Distribution Total Value by balance.\r\n");
+			fprintf(fph,"\r\n");
+			fprintf(fph,",");
+			for (uint32_t i=0; i<SS_COUNT; i++)
+			{
+				fprintf(fph,"\"%s\",", mStatLabel[i]);
+			}
+			fprintf(fph,"\r\n");
+			for (uint32_t i=0; i<mStatCount; i++)
+			{
+				StatRow &row = mStatistics[i];
+				time_t tnow(row.mTime);
+				struct tm beg;
+				beg = *localtime(&tnow);
+				fprintf(fph,"\"%s %d %d\",", months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
+				for (uint32_t j=0; j<SS_COUNT; j++)
+				{
+					StatValue &v = row.mStats[j];
+					fprintf(fph,"%0.4f,",(float)v.mValue/ONE_BTC);
+				}
+				fprintf(fph,"\r\n");
+			}
+			fprintf(fph,"\r\n");
 		}
-		return ret;
-	}
-
-	// Read an output block
-	bool readOutput(BlockChain::BlockOutput &output)
-	{
-		bool ret = true;
 
-		output.value = readU64();	// Read the value of the transaction
-		output.publicKey = NULL;
-		blockReward+=output.value;
-		output.challengeScriptLength = readVariableLengthInteger();
-		assert ( output.challengeScriptLength < MAX_REASONABLE_SCRIPT_LENGTH );
 
-		if ( output.challengeScriptLength < MAX_REASONABLE_SCRIPT_LENGTH )
 		{
-			output.challengeScript = output.challengeScriptLength ? getReadBufferAdvance(output.challengeScriptLength) : NULL; // get the script buffer pointer and advance the read location
-			if ( output.challengeScriptLength == 67 && output.challengeScript[0] == 65  && output.challengeScript[66]== OP_CHECKSIG )
-			{
-				output.publicKey = output.challengeScript+1;
-				output.isRipeMD160 = false;
-			}
-			else if ( output.challengeScriptLength == 66 && output.challengeScript[65]== OP_CHECKSIG )
+			fprintf(fph,"\r\n");
+			fprintf(fph,"NORMALIZED : Bitcoin Public Key Address Distribution Count by balance.\r\n");
+			fprintf(fph,"\r\n");
+			fprintf(fph,",");
+			for (uint32_t i=1; i<SS_COUNT; i++)
 			{
-				output.publicKey = output.challengeScript;
-				output.isRipeMD160 = false;
+				fprintf(fph,"\"%s\",", mStatLabel[i]);
 			}
-			else if ( output.challengeScriptLength >= 25 && 
-					  output.challengeScript[0] == OP_DUP &&
-					  output.challengeScript[1] == OP_HASH160 && 
-					  output.challengeScript[2] == 20 )
+			fprintf(fph,"\r\n");
+			for (uint32_t i=0; i<mStatCount; i++)
 			{
-				output.publicKey = output.challengeScript+3;
-				output.isRipeMD160 = true;
+				StatRow &row = mStatistics[i];
+				time_t tnow(row.mTime);
+				struct tm beg;
+				beg = *localtime(&tnow);
+				fprintf(fph,"\"%s %d\",", months[beg.tm_mon], beg.tm_year+1900);
+				for (uint32_t j=1; j<SS_COUNT; j++)
+				{
+					StatValue &v = row.mStats[j];
+					float value = (float)v.mCount*100.0f / (float)(row.mCount-row.mStats[0].mCount);
+					fprintf(fph,"%0.4f,", value );
+				}
+				fprintf(fph,"\r\n");
 			}
-			else if ( output.challengeScriptLength == 5 && 
-					  output.challengeScript[0] == OP_DUP &&
-					  output.challengeScript[1] == OP_HASH160 &&
-					  output.challengeScript[2] == OP_0 && 
-					  output.challengeScript[3] == OP_EQUALVERIFY &&
-					  output.challengeScript[4] == OP_CHECKSIG )
+			fprintf(fph,"\r\n");
+		}
+
+		{
+			fprintf(fph,"\r\n");
+			fprintf(fph,"NORMALIZED: Bitcoin Public Key Address Distribution Total Value by balance.\r\n");
+			fprintf(fph,"\r\n");
+			fprintf(fph,",");
+			for (uint32_t i=1; i<SS_COUNT; i++)
 			{
-				printf("WARNING: Unusual but expected output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
-				gIsWarning = true;
+				fprintf(fph,"\"%s\",", mStatLabel[i]);
 			}
-			else
+			fprintf(fph,"\r\n");
+			for (uint32_t i=0; i<mStatCount; i++)
 			{
-				// Ok..we are going to scan for this pattern.. OP_DUP, OP_HASH160, 0x14 then exactly 20 bytes after 0x88,0xAC
-				// 25...
-				if ( output.challengeScriptLength > 25 )
-				{
-					uint32_t endIndex = output.challengeScriptLength-25;
-
-					for (uint32_t i=0; i<endIndex; i++)
-					{
-						const uint8_t *scan = &output.challengeScript[i];
-						if ( scan[0] == OP_DUP &&
-							 scan[1] == OP_HASH160 &&
-							 scan[2] == 20 &&
-							 scan[23] == OP_EQUALVERIFY &&
-							 scan[24] == OP_CHECKSIG )
-						{
-							output.publicKey = &scan[3];
-							output.isRipeMD160 = true;
-							printf("WARNING: Unusual output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
-							gIsWarning = true;
-							break;
-						}
-					}
-				}
-				if ( !output.publicKey )
+				StatRow &row = mStatistics[i];
+				time_t tnow(row.mTime);
+				struct tm beg;
+				beg = *localtime(&tnow);
+				fprintf(fph,"\"%s %d\",", months[beg.tm_mon], beg.tm_year+1900);
+				for (uint32_t j=1; j<SS_COUNT; j++)
 				{
-					if ( output.challengeScriptLength >= 66 && output.challengeScript[output.challengeScriptLength-1] == OP_CHECKSIG )
-					{
-						printf("WARNING: Failed to decode public key in output script. Block %s : Transaction: %s : OutputIndex: %s\r\n", formatNumber(gBlockIndex), formatNumber(gTransactionIndex), formatNumber(gOutputIndex) );
-						gIsWarning = true;
-					}
+					StatValue &v = row.mStats[j];
+					float value = (float)(v.mValue)*100.0f / (float)row.mValue;
+					fprintf(fph,"%0.4f,",value);
 				}
+				fprintf(fph,"\r\n");
 			}
+			fprintf(fph,"\r\n");
 		}
-		else
-		{
-			ret = false;
-		}
 
-		return ret;
-	}
 
-	// Read a single transaction
-	bool readTransation(BlockChain::BlockTransaction &transaction,uint32_t &transactionIndex,uint32_t tindex)
-	{
-		bool ret = false;
+		fclose(fph);
+	}
+
+protected:
+	BitcoinAddressHashMap		mAddresses;				// A hash map of every single bitcoin address ever referenced to a much shorter integer to save memory
+
+	uint32_t					mTransactionCount;
+	uint32_t					mTotalInputCount;
+	uint32_t					mTotalOutputCount;
+	ArenaArray< Transaction >		mTransactions;
+	ArenaArray< TransactionInput >	mInputs;
+	ArenaArray< TransactionOutput >	mOutputs;
+	ArenaArray< SpentBy >			mSpentBy;				// Which transaction input spent each output, in the same order as mOutputs
+	uint64_t					*mOverflow;				// The values of the outputs whose compressed amount does not fit in 32 bits
+	uint32_t					mOverflowCount;
+	uint32_t					mOverflowCapacity;
+	bool						mUtxoMode;				// True if only the unspent outputs are kept, not the transaction history
+	uint32_t					mBlockCount;
+	ArenaArray< uint32_t >		mBlocks;				// The index of the first transaction of each block
+	uint32_t					*mTransactionReferences;	// The transactions of each address, concatenated
+	uint32_t					mTransactionReferenceCount;
+	uint32_t					mStatCount;
+	StatRow						mStatistics[MAX_STAT_COUNT];
+	const char					*mStatLabel[SS_COUNT];
+	uint64_t					mStatLimits[SS_COUNT];
+};
+
+#pragma warning(pop)
 
-		const uint8_t *transactionBegin = mBlockRead;
+#define PUBLIC_KEY_CACHE_WAYS 4 // Each set holds four entries; 288 bytes, so a lookup touches at most five cache lines
 
-		transaction.transactionVersionNumber = readU32(); // read the transaction version number; always expect it to be 1
-		if ( transaction.transactionVersionNumber == 1 || transaction.transactionVersionNumber == 2 )
-		{
-		}
-		else
+// A small set associative cache which maps a 65 byte public key directly to its address index.
+// The same public keys are paid to over and over again (especially by the early miners) so a hit
+// skips both the SHA256/RIPEMD160 hashing and the lookup in the address hash map.
+// Each entry keeps the whole 64 byte X||Y point so a hit is always exact, even for malformed keys
+// which are not on the curve; the start of the X coordinate is only used to pick the set.
+class PublicKeyCache
+{
+public:
+	PublicKeyCache(void)
+	{
+		memset(mEntries,0,sizeof(mEntries));
+		mClock = 0;
+		mLookups = 0;
+		mHits = 0;
+		mEvictions = 0;
+	}
+
+	// Returns the address index for this public key or zero if it is not in the cache
+	uint32_t find(const uint8_t publicKey[65])
+	{
+		uint32_t ret = 0;
+		Entry *set = getSet(publicKey);
+		mLookups++;
+		for (uint32_t i=0; i<PUBLIC_KEY_CACHE_WAYS; i++)
 		{
-			gIsWarning = true;
-			printf("Encountered unusual and unexpected transaction version number of [%d] for transaction #%d\r\n", transaction.transactionVersionNumber, tindex );
+			Entry &e = set[i];
+			if ( e.mAddress && memcmp(e.mKey,&publicKey[1],sizeof(e.mKey)) == 0 )
+			{
+				e.mStamp = ++mClock;
+				mHits++;
+				ret = e.mAddress;
+				break;
+			}
 		}
-		transaction.inputCount = readVariableLengthInteger();
-		assert( transaction.inputCount < MAX_REASONABLE_INPUTS );
-		transaction.inputs = &mInputs[totalInputCount];
-		totalInputCount+=transaction.inputCount;
-		assert( totalInputCount < MAX_BLOCK_INPUTS );
-		if ( totalInputCount < MAX_BLOCK_INPUTS )
+		return ret;
+	}
+
+	// Records the address index for this public key; replaces the least recently used entry in the set
+	void insert(const uint8_t publicKey[65],uint32_t adr)
+	{
+		Entry *set = getSet(publicKey);
+		Entry *replace = &set[0];
+		for (uint32_t i=0; i<PUBLIC_KEY_CACHE_WAYS; i++)
 		{
-			for (uint32_t i=0; i<transaction.inputCount; i++)
+			Entry &e = set[i];
+			if ( e.mAddress && memcmp(e.mKey,&publicKey[1],sizeof(e.mKey)) == 0 )
 			{
-				BlockChain::BlockInput &input = transaction.inputs[i];
-				ret = readInput(input);	// read the input 
-				if ( !ret )
-				{
-					break;
-				}
+				replace = &e;
+				break;
+			}
+			if ( e.mAddress == 0 || e.mStamp < replace->mStamp )
+			{
+				replace = &e;
+				if ( e.mAddress == 0 ) break;
 			}
 		}
-		else
+		if ( replace->mAddress && memcmp(replace->mKey,&publicKey[1],sizeof(replace->mKey)) != 0 )
 		{
-			ret = false;
+			mEvictions++;
 		}
-		if ( ret )
+		memcpy(replace->mKey,&publicKey[1],sizeof(replace->mKey));
+		replace->mAddress = adr;
+		replace->mStamp = ++mClock;
+	}
+
+	// Empties the entries for addresses past 'addressCount', which have been dropped from the address map
+	void forget(uint32_t addressCount)
+	{
+		for (uint32_t i=0; i<MAX_PUBLIC_KEY_CACHE_SETS*PUBLIC_KEY_CACHE_WAYS; i++)
 		{
-			transaction.outputCount = readVariableLengthInteger();
-			assert( transaction.outputCount < MAX_REASONABLE_OUTPUTS );
-			transaction.outputs = &mOutputs[totalOutputCount];
-			totalOutputCount+=transaction.outputCount;
-			assert( totalOutputCount < MAX_BLOCK_OUTPUTS );
-			if ( totalOutputCount < MAX_BLOCK_OUTPUTS )
+			if ( mEntries[i].mAddress > addressCount )
 			{
-				for (uint32_t i=0; i<transaction.outputCount; i++)
-				{
-					gOutputIndex = i;
-					BlockChain::BlockOutput &output = transaction.outputs[i];
-					ret = readOutput(output);
-					if ( !ret )
-					{
-						break;
-					}
-				}
+				mEntries[i].mAddress = 0;
+			}
+		}
+	}
 
-				transaction.lockTime = readU32();
+	void report(void)
+	{
+		printf("Public key cache: %s lookups, %s hits (%0.2f%%), %s evictions.\r\n",
+			formatNumber((int32_t)mLookups),
+			formatNumber((int32_t)mHits),
+			mLookups ? (double)mHits*100.0/(double)mLookups : 0.0,
+			formatNumber((int32_t)mEvictions));
+	}
 
-				if ( ret )
-				{
-					transaction.transactionLength = (uint32_t)(mBlockRead - transactionBegin);
-					transaction.fileIndex = fileIndex;
-					transaction.fileOffset = fileOffset + (uint32_t)(transactionBegin-mBlockData);
-					transaction.transactionIndex = transactionIndex;
-					transactionIndex++;
-					BLOCKCHAIN_SHA256::computeSHA256(transactionBegin,transaction.transactionLength,transaction.transactionHash);
-					BLOCKCHAIN_SHA256::computeSHA256(transaction.transactionHash,32,transaction.transactionHash);
-				}
+private:
+	struct Entry
+	{
+		uint8_t		mKey[64];	// The public key's X and Y coordinates, without the 0x04 prefix
+		uint32_t	mAddress;	// The address index (one based; zero means the entry is empty)
+		uint32_t	mStamp;		// When this entry was last used; for least recently used replacement
+	};
 
-			}
-		}
-		return ret;
+	Entry *getSet(const uint8_t publicKey[65])
+	{
+		// The X coordinate is effectively random so its first eight bytes select the set directly
+		uint64_t fingerprint;
+		memcpy(&fingerprint,&publicKey[1],sizeof(fingerprint));
+		uint32_t index = (uint32_t)(fingerprint ^ (fingerprint>>32)) & (MAX_PUBLIC_KEY_CACHE_SETS-1);
+		return &mEntries[index*PUBLIC_KEY_CACHE_WAYS];
 	}
 
-	// @see this link for detailed documentation:
-	//
-	// http://james.lab6.com/2012/01/12/bitcoin-285-bytes-that-changed-the-world/
-	//
-	// read a single block from the block chain into memory
-	// Here is how a block is read.
-	//
-	// Step #1 : We read the block format version
-	// Step #2 : We read the hash of the previous block
-	// Step #3 : We read the merkle root hash
-	// Step #4 : We read the block time stamp
-	// Step #5 : We read a 'bits' field; internal use defined by the bitcoin software
-	// Step #6 : We read the 'nonce' value; a randum number generated during the mining process.
-	// Step #7 : We read the transaction count
-	// Step #8 : For/Each Transaction
-	//          : (a) We read the transaction version number.
-	//          : (b) We read the number of inputs.
-	//Step #8a : For/Each input
-	//			: (a) Read the hash of the input transaction
-	//			: (b) Read the input transaction index
-	//			: (c) Read the response script length
-	//			: (d) Read the response script data; parsed using the bitcoin scripting system; a little virtual machine.
-	//			: Read the sequence number.
-	//			: Read the number of outputs
-	//Step #8b : For/Each Output
-	//			: (a) Read the value of the output in BTC fixed decimal; see docs.
-	//			: (b) Read the length of the challenge script.
-	//			: (c) Read the challenge script
-	//Step #9 Read the LockTime; a value currently always hard-coded to zero
-	bool processBlockData(const void *blockData,uint32_t blockLength,uint32_t &transactionIndex)
+	Entry		mEntries[MAX_PUBLIC_KEY_CACHE_SETS*PUBLIC_KEY_CACHE_WAYS];
+	uint32_t	mClock;
+	uint32_t	mLookups;
+	uint32_t	mHits;
+	uint32_t	mEvictions;
+};
+
+// A read only memory mapping of a whole file; the operating system pages it in on demand, so opening even a
+// multi-gigabyte index is immediate and a lookup only touches the pages it needs.
+class MappedFile
+{
+public:
+	MappedFile(void)
 	{
-		bool ret = true;
-		mBlockData = (const uint8_t *)blockData;
-		mBlockRead = mBlockData;	// Set the block-read scan pointer.
-		mBlockEnd = &mBlockData[blockLength]; // Mark the end of block pointer
-		blockFormatVersion = readU32();	// Read the format version
-		previousBlockHash = readHash();  // get the address of the hash
-		merkleRoot = readHash();	// Get the address of the merkle root hash
-		timeStamp = readU32();	// Get the timestamp
-		bits = readU32();	// Get the bits field
-		nonce = readU32();	// Get the 'nonce' random number.
-		transactionCount = readVariableLengthInteger();	// Read the number of transactions
-		if ( transactionCount < MAX_BLOCK_TRANSACTION )
+		mData = NULL;
+		mSize = 0;
+#ifdef _MSC_VER
+		mFile = INVALID_HANDLE_VALUE;
+		mMapping = NULL;
+#else
+		mFile = -1;
+#endif
+	}
+
+	~MappedFile(void)
+	{
+		close();
+	}
+
+	bool open(const char *fname)
+	{
+		close();
+#ifdef _MSC_VER
+		mFile = CreateFileA(fname,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+		if ( mFile != INVALID_HANDLE_VALUE )
 		{
-			transactions = mTransactions;	// Assign the transactions buffer pointer
-			for (uint32_t i=0; i<transactionCount; i++)
+			LARGE_INTEGER size;
+			if ( GetFileSizeEx(mFile,&size) && size.QuadPart > 0 )
 			{
-				gTransactionIndex = i;
-				BlockChain::BlockTransaction &b = transactions[i];
-				if ( !readTransation(b,transactionIndex,i) )	// Read the transaction; if it failed; then abort processing the block chain
+				mMapping = CreateFileMappingA(mFile,NULL,PAGE_READONLY,0,0,NULL);
+				if ( mMapping )
 				{
-					ret = false;
-					break;
+					mData = (const uint8_t *)MapViewOfFile(mMapping,FILE_MAP_READ,0,0,0);
+					mSize = (uint64_t)size.QuadPart;
 				}
 			}
 		}
-		return ret;
+#else
+		mFile = ::open(fname,O_RDONLY);
+		if ( mFile >= 0 )
+		{
+			struct stat st;
+			if ( fstat(mFile,&st) == 0 && st.st_size > 0 )
+			{
+				void *data = mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_SHARED,mFile,0);
+				if ( data != MAP_FAILED )
+				{
+					mData = (const uint8_t *)data;
+					mSize = (uint64_t)st.st_size;
+				}
+			}
+		}
+#endif
+		if ( mData == NULL )
+		{
+			close();
+		}
+		return mData ? true : false;
 	}
 
-	const BlockChain::BlockTransaction *processTransactionData(const void *transactionData,uint32_t transactionLength)
+	void close(void)
 	{
-		uint32_t transactionIndex=0;
-		BlockChain::BlockTransaction *ret = &mTransactions[0];
-		mBlockData = (const uint8_t *)transactionData;
-		mBlockRead = mBlockData;	// Set the block-read scan pointer.
-		mBlockEnd = &mBlockData[transactionLength]; // Mark the end of block pointer
-		if ( !readTransation(*ret,transactionIndex,0) )	// Read the transaction; if it failed; then abort processing the block chain
+#ifdef _MSC_VER
+		if ( mData )
 		{
-			ret = NULL;
+			UnmapViewOfFile(mData);
 		}
-		return ret;
+		if ( mMapping )
+		{
+			CloseHandle(mMapping);
+		}
+		if ( mFile != INVALID_HANDLE_VALUE )
+		{
+			CloseHandle(mFile);
+		}
+		mFile = INVALID_HANDLE_VALUE;
+		mMapping = NULL;
+#else
+		if ( mData )
+		{
+			munmap((void *)mData,(size_t)mSize);
+		}
+		if ( mFile >= 0 )
+		{
+			::close(mFile);
+		}
+		mFile = -1;
+#endif
+		mData = NULL;
+		mSize = 0;
 	}
 
+	inline const uint8_t *getData(void) const
+	{
+		return mData;
+	}
 
-	const uint8_t					*mBlockRead;				// The current read buffer address in the block
-	const uint8_t					*mBlockEnd;					// The EOF marker for the block
-	const uint8_t					*mBlockData;
-	BlockChain::BlockTransaction	mTransactions[MAX_BLOCK_TRANSACTION];	// Holds the array of transactions
-	BlockChain::BlockInput			mInputs[MAX_BLOCK_INPUTS];	// The input arrays
-	BlockChain::BlockOutput			mOutputs[MAX_BLOCK_OUTPUTS]; // The output arrays
+	inline uint64_t getSize(void) const
+	{
+		return mSize;
+	}
+
+private:
+	const uint8_t	*mData;
+	uint64_t		mSize;
+#ifdef _MSC_VER
+	HANDLE			mFile;
+	HANDLE			mMapping;
+#else
+	int				mFile;
+#endif
+};
+
+// Replaces 'dest' with 'source'; rename will not overwrite an existing file on Windows
+static bool replaceFile(const char *source,const char *dest)
+{
+	remove(dest);
+	return rename(source,dest) == 0;
+}
+
+// Seeks to a 64 bit file offset; the index files and the spill log can grow well past what a 'long' holds on Windows
+static bool seekFile(FILE *fph,uint64_t offset)
+{
+#ifdef _MSC_VER
+	return _fseeki64(fph,(__int64)offset,SEEK_SET) == 0;
+#else
+	return fseeko(fph,(off_t)offset,SEEK_SET) == 0;
+#endif
+}
+
+// The persistent transaction index, 'TransactionIndex.bin', maps a transaction hash to the block file, offset and
+// length of the transaction and the height of its block, so a transaction can be found in a fresh process without
+// reprocessing the block chain first.
+//
+// The file is a header, a table of (1<<bucketBits)+1 record offsets, then fixed size records sorted by hash.  The
+// bucket of a hash is its leading bits, so a lookup reads the bucket table and then binary searches a few hundred
+// records at most.  It is used straight out of a memory mapping.
+//
+// Records for new blocks are collected in memory and, every TX_INDEX_RUN records and at the end, sorted (in parallel,
+// one bucket range per thread) and appended to the end of the file as a sorted run; the records already in the file
+// are not touched.  A lookup binary searches each run after the bucketed table.  Once there are TX_INDEX_MAX_RUNS
+// runs, or they hold more records than the table, everything is compacted into a new bucketed table.  The header
+// remembers how many blocks are indexed and the hash of the last one, so an update only reads the blocks added since,
+// and the index is rebuilt from scratch if the chain it was built from no longer matches.
+//
+// Two early coinbase transactions were repeated in later blocks (BIP-30), so a hash can have more than one record.
+// Both are kept, ordered by height; 'find' returns the latest, which is the one whose outputs are spendable.
+#define TX_INDEX_FILE "TransactionIndex.bin"
+#define TX_INDEX_MAGIC "TXINDEX"
+#define TX_INDEX_VERSION 2
+#define TX_INDEX_PARTITION_BITS 8						// The pending records are split into 256 partitions to be sorted in parallel
+#if SMALL_MEMORY_PROFILE
+#define TX_INDEX_RUN (1<<20)							// About 48mb of pending records before they are merged into the file
+#else
+#define TX_INDEX_RUN (1<<22)							// About 192mb of pending records before they are merged into the file
+#endif
+#define TX_INDEX_WRITE_BATCH 4096						// Records written to the new index per fwrite
+#define TX_INDEX_MAX_RUNS 8								// Sorted runs appended after the bucketed table before it is compacted
+#define TX_INDEX_MAX_MATCHES 4							// The most records returned for one hash
+
+class TransactionIndexRecord
+{
+public:
+	uint8_t		mHash[32];
+	uint32_t	mFileIndex;
+	uint32_t	mFileOffset;
+	uint32_t	mFileLength;
+	uint32_t	mHeight;
+};
+
+class TransactionIndexHeader
+{
+public:
+	char		mMagic[8];
+	uint32_t	mVersion;
+	uint32_t	mBucketBits;
+	uint32_t	mRecordCount;			// Records in the bucketed table
+	uint32_t	mBlockCount;			// Blocks 0..mBlockCount-1 are indexed
+	uint8_t		mLastBlockHash[32];		// The hash of block mBlockCount-1 when the index was written
+	uint32_t	mRunCount;				// Sorted runs appended after the table since it was last compacted
+	uint32_t	mRunLength[TX_INDEX_MAX_RUNS];	// The number of records in each run
+};
+
+static int compareTransactionIndexRecords(const void *a,const void *b)
+{
+	const TransactionIndexRecord *ra = (const TransactionIndexRecord *)a;
+	const TransactionIndexRecord *rb = (const TransactionIndexRecord *)b;
+	int ret = memcmp(ra->mHash,rb->mHash,32);
+	if ( ret == 0 ) // the same hash twice (BIP-30 duplicate coinbases); order by height so the newest comes last
+	{
+		ret = ra->mHeight < rb->mHeight ? -1 : (ra->mHeight > rb->mHeight ? 1 : 0);
+	}
+	return ret;
+}
+
+class TransactionIndexFile
+{
+public:
+	TransactionIndexFile(void)
+	{
+		mHeader = NULL;
+		mBuckets = NULL;
+		mRecords = NULL;
+		mRunRecordCount = 0;
+		mPending = NULL;
+		mPendingCount = 0;
+	}
+
+	~TransactionIndexFile(void)
+	{
+		delete []mPending;
+	}
+
+	// Maps an existing index; returns false if there is none or it is not valid
+	bool open(const char *fname)
+	{
+		close();
+		if ( !mFile.open(fname) )
+		{
+			return false;
+		}
+		const TransactionIndexHeader *h = (const TransactionIndexHeader *)mFile.getData();
+		uint64_t size = mFile.getSize();
+		bool ok = size >= sizeof(TransactionIndexHeader) &&
+				  memcmp(h->mMagic,TX_INDEX_MAGIC,sizeof(TX_INDEX_MAGIC)) == 0 &&
+				  h->mVersion == TX_INDEX_VERSION &&
+				  h->mBucketBits <= 24 &&
+				  h->mRunCount <= TX_INDEX_MAX_RUNS;
+		// Anything past the records the header describes is left over from an append which did not complete
+		ok = ok && size >= getFileSize(*h);
+		if ( !ok )
+		{
+			printf("Ignoring '%s'; it is not a valid transaction index.\r\n", fname );
+			close();
+			return false;
+		}
+		mHeader = h;
+		mBuckets = (const uint32_t *)(h+1);
+		mRecords = (const TransactionIndexRecord *)(mBuckets + ((1<<h->mBucketBits)+1));
+		mRunRecordCount = 0;
+		for (uint32_t i=0; i<h->mRunCount; i++)
+		{
+			mRunRecordCount+=h->mRunLength[i];
+		}
+		return true;
+	}
 
-};
+	void close(void)
+	{
+		mFile.close();
+		mHeader = NULL;
+		mBuckets = NULL;
+		mRecords = NULL;
+		mRunRecordCount = 0;
+	}
 
-class Transaction;
+	inline bool isOpen(void) const
+	{
+		return mHeader ? true : false;
+	}
 
-// Contains a hash of just the 20 byte RIPEMD160 key; does not have the header or footer; which can be calculated.
-class BitcoinAddress 
-{
-public:
-	BitcoinAddress(void)
+	inline uint32_t getBlockCount(void) const
 	{
-		mWord0 = 0;
-		mWord1 = 0;
-		mWord2 = 0;
-		mTransactionCount = 0;
-		mTransactionIndex = 0xFFFFFFFF;
-		mTransactions = NULL;
-		mTotalReceived = 0;
-		mTotalSent = 0;
-		mLastInputTime = 0;
-		mLastOutputTime = 0;
-		mFirstOutputTime = 0;
-		mInputCount = 0;
-		mOutputCount = 0;
+		return mHeader ? mHeader->mBlockCount : 0;
 	}
 
-	BitcoinAddress(const uint8_t address[20]) 
+	inline uint32_t getRecordCount(void) const
 	{
-		mWord0 = *(const uint64_t *)(address);
-		mWord1 = *(const uint64_t *)(address+8);
-		mWord2 = *(const uint32_t *)(address+16);
-		mTransactionCount = 0;
-		mTransactionIndex = 0xFFFFFFFF;
-		mTransactions = NULL;
-		mTotalReceived = 0;
-		mTotalSent = 0;
-		mLastInputTime = 0;
-		mLastOutputTime = 0;
-		mFirstOutputTime = 0;
-		mInputCount = 0;
-		mOutputCount = 0;
+		return mHeader ? mHeader->mRecordCount+mRunRecordCount : 0;
 	}
 
-	bool operator==(const BitcoinAddress &a) const
+	inline const uint8_t *getLastBlockHash(void) const
 	{
-		return mWord0 == a.mWord0 && mWord1 == a.mWord1 && mWord2 == a.mWord2;
+		return mHeader ? mHeader->mLastBlockHash : NULL;
 	}
 
-	uint32_t getHash(void) const
+	// Returns the latest record for this hash, or NULL if it is not indexed
+	const TransactionIndexRecord *find(const uint8_t *hash) const
 	{
-		const uint32_t *h = (const uint32_t *)&mWord0;
-		return h[0] ^ h[1] ^ h[2] ^ h[3] ^ h[4];
+		const TransactionIndexRecord *found[TX_INDEX_MAX_MATCHES];
+		uint32_t count = findAll(hash,found,TX_INDEX_MAX_MATCHES);
+		return count ? found[count-1] : NULL;
 	}
 
-	uint32_t getLastUsedTime(void) const
+	// Returns every record for this hash, oldest first.  The runs hold later blocks than the table, and each one
+	// later blocks than the run before it, so collecting them in file order keeps the records in height order.
+	uint32_t findAll(const uint8_t *hash,const TransactionIndexRecord **found,uint32_t maxFound) const
 	{
-		uint32_t lastUsed = mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-		if ( mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+		uint32_t count = 0;
+		if ( mHeader )
 		{
-			lastUsed = mFirstOutputTime;
+			uint32_t bucket = getHashBucket(hash,mHeader->mBucketBits);
+			count = collect(mRecords,mBuckets[bucket],mBuckets[bucket+1],hash,found,count,maxFound);
+			const TransactionIndexRecord *run = mRecords+mHeader->mRecordCount;
+			for (uint32_t i=0; i<mHeader->mRunCount; i++)
+			{
+				count = collect(run,0,mHeader->mRunLength[i],hash,found,count,maxFound);
+				run+=mHeader->mRunLength[i];
+			}
 		}
-		return lastUsed;
+		return count;
 	}
 
-	uint32_t getDaysSinceLastUsed(void) const
+	// Queues up a record to be merged into the file
+	void add(const uint8_t *hash,uint32_t fileIndex,uint32_t fileOffset,uint32_t fileLength,uint32_t height)
 	{
-		time_t currentTime;
-		time(&currentTime); // get the current time.
-		uint32_t lastUsed = mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-		if ( mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+		if ( mPending == NULL )
 		{
-			lastUsed = mFirstOutputTime;
+			mPending = new TransactionIndexRecord[TX_INDEX_RUN];
 		}
-		double seconds = difftime(currentTime,time_t(lastUsed));
-		double minutes = seconds/60;
-		double hours = minutes/60;
-		uint32_t days = (uint32_t) (hours/24);
-		return days;
+		assert( mPendingCount < TX_INDEX_RUN );
+		TransactionIndexRecord &r = mPending[mPendingCount++];
+		memcpy(r.mHash,hash,32);
+		r.mFileIndex = fileIndex;
+		r.mFileOffset = fileOffset;
+		r.mFileLength = fileLength;
+		r.mHeight = height;
 	}
 
-	uint32_t getInputCount(void) const
+	inline uint32_t getPendingCount(void) const
 	{
-		return mInputCount;
+		return mPendingCount;
 	}
 
-	uint32_t getOutputCount(void)
+	// Throws away the existing index; the next merge starts a new one
+	void discard(void)
 	{
-		return mOutputCount;
+		close();
+		mPendingCount = 0;
 	}
 
-	uint64_t getBalance(void) const
+	// Sorts the pending records and adds them to the index, which is then mapped again.  Usually they are appended
+	// as a new run; when the runs have grown too many or too large the whole index is rewritten as one table.
+	// 'blockCount' and 'lastBlockHash' describe the chain the index now covers.
+	bool merge(const char *fname,uint32_t blockCount,const uint8_t *lastBlockHash,uint32_t threadCount)
 	{
-		return mTotalReceived - mTotalSent;
+		sortPending(threadCount);
+		if ( mHeader && mHeader->mRunCount < TX_INDEX_MAX_RUNS && (uint64_t)mRunRecordCount+mPendingCount <= mHeader->mRecordCount )
+		{
+			return append(fname,blockCount,lastBlockHash);
+		}
+		return compact(fname,blockCount,lastBlockHash);
 	}
 
-	uint64_t	mWord0; // 8
-	uint64_t	mWord1; // 16
-	uint32_t	mWord2; // 20
-	uint32_t	mLastInputTime;
-	uint32_t	mLastOutputTime;
-	uint32_t	mFirstOutputTime;
-	uint64_t	mTotalSent;
-	uint64_t	mTotalReceived;
-	uint32_t	mInputCount;
-	uint32_t	mOutputCount;
-	uint32_t	mTransactionIndex;
-	uint32_t	mTransactionCount;
-	Transaction	**mTransactions;	// The array of transactions associated with this bitcoin-address as either inputs or outputs or (sometimes) both.
-};
-
+private:
+	// The size of the index this header describes
+	static uint64_t getFileSize(const TransactionIndexHeader &h)
+	{
+		uint64_t recordCount = h.mRecordCount;
+		for (uint32_t i=0; i<h.mRunCount && i<TX_INDEX_MAX_RUNS; i++)
+		{
+			recordCount+=h.mRunLength[i];
+		}
+		return sizeof(TransactionIndexHeader) + (((uint64_t)1<<h.mBucketBits)+1)*sizeof(uint32_t) + recordCount*sizeof(TransactionIndexRecord);
+	}
 
+	// Adds the records in [low,high) matching this hash to 'found'
+	static uint32_t collect(const TransactionIndexRecord *records,uint32_t low,uint32_t high,const uint8_t *hash,const TransactionIndexRecord **found,uint32_t count,uint32_t maxFound)
+	{
+		uint32_t end = high;
+		while ( low < high ) // the first record not below the hash
+		{
+			uint32_t mid = (low+high)/2;
+			if ( memcmp(records[mid].mHash,hash,32) < 0 )
+			{
+				low = mid+1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		for (; low < end && count < maxFound && memcmp(records[low].mHash,hash,32) == 0; low++)
+		{
+			found[count++] = &records[low];
+		}
+		return count;
+	}
 
-#pragma warning(push)
-#pragma warning(disable:4100)
+	// Writes the pending records after the existing ones as a new run and then points the header at it.  If the
+	// header is never rewritten the appended records are simply ignored the next time the index is opened.
+	bool append(const char *fname,uint32_t blockCount,const uint8_t *lastBlockHash)
+	{
+		TransactionIndexHeader h = *mHeader;
+		close(); // the mapping has to go before the file can be written
+		bool ok = false;
+		FILE *fph = fopen(fname,"r+b");
+		if ( fph )
+		{
+			ok = seekFile(fph,getFileSize(h)) &&
+				 (mPendingCount == 0 || fwrite(mPending,sizeof(TransactionIndexRecord)*mPendingCount,1,fph) == 1) &&
+				 fflush(fph) == 0;
+			if ( ok )
+			{
+				if ( mPendingCount )
+				{
+					h.mRunLength[h.mRunCount++] = mPendingCount;
+				}
+				h.mBlockCount = blockCount;
+				memcpy(h.mLastBlockHash,lastBlockHash,32);
+				ok = seekFile(fph,0) && fwrite(&h,sizeof(h),1,fph) == 1;
+			}
+			ok = fclose(fph) == 0 && ok;
+		}
+		mPendingCount = 0;
+		if ( !ok )
+		{
+			printf("Failed to append to the transaction index '%s'.\r\n", fname );
+			return false;
+		}
+		return open(fname);
+	}
 
+	class MergeSource
+	{
+	public:
+		const TransactionIndexRecord	*mRecords;
+		uint32_t						mCount;
+		uint32_t						mNext;
+	};
 
-class TransactionOutput
-{
-public:
-	TransactionOutput(void)
+	// Merges the table, every run and the pending records into a new file with a single bucketed table
+	bool compact(const char *fname,uint32_t blockCount,const uint8_t *lastBlockHash)
 	{
-		mValue = 0;
-		mAddress = 0;
+		MergeSource sources[TX_INDEX_MAX_RUNS+2];
+		uint32_t sourceCount = 0;
+		if ( mHeader )
+		{
+			sources[sourceCount].mRecords = mRecords;
+			sources[sourceCount].mCount = mHeader->mRecordCount;
+			sourceCount++;
+			const TransactionIndexRecord *run = mRecords+mHeader->mRecordCount;
+			for (uint32_t i=0; i<mHeader->mRunCount; i++)
+			{
+				sources[sourceCount].mRecords = run;
+				sources[sourceCount].mCount = mHeader->mRunLength[i];
+				sourceCount++;
+				run+=mHeader->mRunLength[i];
+			}
+		}
+		sources[sourceCount].mRecords = mPending;
+		sources[sourceCount].mCount = mPendingCount;
+		sourceCount++;
+		uint64_t total = 0;
+		for (uint32_t i=0; i<sourceCount; i++)
+		{
+			sources[i].mNext = 0;
+			total+=sources[i].mCount;
+		}
+
+		uint32_t bits = 0;
+		while ( bits < 24 && ((uint64_t)256<<bits) < total ) // about 128 to 256 records per bucket
+		{
+			bits++;
+		}
+		uint32_t bucketCount = 1<<bits;
+
+		char scratch[512];
+		sprintf(scratch,"%s.tmp", fname );
+		FILE *fph = fopen(scratch,"wb");
+		if ( fph == NULL )
+		{
+			printf("Failed to open '%s' for write access.\r\n", scratch );
+			return false;
+		}
+		TransactionIndexHeader h;
+		memset(&h,0,sizeof(h));
+		memcpy(h.mMagic,TX_INDEX_MAGIC,sizeof(TX_INDEX_MAGIC));
+		h.mVersion = TX_INDEX_VERSION;
+		h.mBucketBits = bits;
+		h.mBlockCount = blockCount;
+		memcpy(h.mLastBlockHash,lastBlockHash,32);
+		uint32_t *buckets = new uint32_t[bucketCount+1];
+		memset(buckets,0,sizeof(uint32_t)*(bucketCount+1));
+		fwrite(&h,sizeof(h),1,fph);
+		fwrite(buckets,sizeof(uint32_t)*(bucketCount+1),1,fph); // filled in once the records have been counted
+
+		// Merge the sorted sources; there are only a handful, so the smallest head is found by looking at each
+		TransactionIndexRecord *buffer = new TransactionIndexRecord[TX_INDEX_WRITE_BATCH];
+		uint32_t bufferCount = 0;
+		uint32_t count = 0;
+		for (;;)
+		{
+			MergeSource *best = NULL;
+			for (uint32_t i=0; i<sourceCount; i++)
+			{
+				MergeSource &s = sources[i];
+				if ( s.mNext < s.mCount && (best == NULL || compareTransactionIndexRecords(&s.mRecords[s.mNext],&best->mRecords[best->mNext]) < 0) )
+				{
+					best = &s;
+				}
+			}
+			if ( best == NULL )
+			{
+				break;
+			}
+			const TransactionIndexRecord *r = &best->mRecords[best->mNext++];
+			buckets[getHashBucket(r->mHash,bits)+1]++;
+			buffer[bufferCount++] = *r;
+			count++;
+			if ( bufferCount == TX_INDEX_WRITE_BATCH )
+			{
+				fwrite(buffer,sizeof(TransactionIndexRecord)*bufferCount,1,fph);
+				bufferCount = 0;
+			}
+		}
+		if ( bufferCount )
+		{
+			fwrite(buffer,sizeof(TransactionIndexRecord)*bufferCount,1,fph);
+		}
+		for (uint32_t b=0; b<bucketCount; b++)
+		{
+			buckets[b+1]+=buckets[b];
+		}
+		h.mRecordCount = count;
+		fseek(fph,0L,SEEK_SET);
+		fwrite(&h,sizeof(h),1,fph);
+		fwrite(buckets,sizeof(uint32_t)*(bucketCount+1),1,fph);
+		bool ok = ferror(fph) == 0;
+		fclose(fph);
+		delete []buffer;
+		delete []buckets;
+		mPendingCount = 0;
+
+		close(); // the old mapping has to go before the file can be replaced
+		if ( !ok || !replaceFile(scratch,fname) )
+		{
+			printf("Failed to write the transaction index '%s'.\r\n", fname );
+			return false;
+		}
+		return open(fname);
 	}
-	uint64_t	mValue;		// value of the output.
-	uint32_t	mAddress;	// address of the output. 
-};
 
-class TransactionInput
-{
-public:
-	TransactionInput(void)
+	class SortContext
 	{
-		mOutput = NULL;
-	}
-	TransactionOutput	*mOutput;	// All inputs are the result of a previous output or block-reward mining fee (otherwise known as 'coinbase')
-};
+	public:
+		TransactionIndexRecord	*mRecords;
+		uint32_t				*mPartitionStart;
+	};
 
-class Transaction
-{
-public:
-	Transaction(void)
+	// Each thread sorts every threadCount'th partition
+	static void sortPartitions(void *context,uint32_t thread,uint32_t threadCount)
 	{
-		mInputCount = 0;
-		mOutputCount = 0;
-		mInputs = 0;
-		mOutputCount = 0;
+		SortContext &c = *(SortContext *)context;
+		for (uint32_t p=thread; p<(1<<TX_INDEX_PARTITION_BITS); p+=threadCount)
+		{
+			uint32_t start = c.mPartitionStart[p];
+			uint32_t count = c.mPartitionStart[p+1]-start;
+			if ( count > 1 )
+			{
+				qsort(&c.mRecords[start],count,sizeof(TransactionIndexRecord),compareTransactionIndexRecords);
+			}
+		}
 	}
-	uint32_t			mBlock;
-	uint32_t			mTime;
-	uint32_t			mInputCount;
-	uint32_t			mOutputCount;
-	TransactionInput	*mInputs;
-	TransactionOutput	*mOutputs;
-};
 
+	// Sorts the pending records by hash, and by height for the same hash
+	void sortPending(uint32_t threadCount)
+	{
+		if ( mPendingCount == 0 )
+		{
+			return;
+		}
+		// Scatter the records into partitions by their leading bits, then sort the partitions in parallel
+		uint32_t partitionStart[(1<<TX_INDEX_PARTITION_BITS)+1];
+		memset(partitionStart,0,sizeof(partitionStart));
+		for (uint32_t i=0; i<mPendingCount; i++)
+		{
+			partitionStart[getHashBucket(mPending[i].mHash,TX_INDEX_PARTITION_BITS)+1]++;
+		}
+		for (uint32_t p=0; p<(1<<TX_INDEX_PARTITION_BITS); p++)
+		{
+			partitionStart[p+1]+=partitionStart[p];
+		}
+		uint32_t next[1<<TX_INDEX_PARTITION_BITS];
+		memcpy(next,partitionStart,sizeof(next));
+		TransactionIndexRecord *sorted = new TransactionIndexRecord[TX_INDEX_RUN];
+		for (uint32_t i=0; i<mPendingCount; i++)
+		{
+			sorted[next[getHashBucket(mPending[i].mHash,TX_INDEX_PARTITION_BITS)]++] = mPending[i];
+		}
+		delete []mPending;
+		mPending = sorted;
 
-typedef SimpleHash< BitcoinAddress, 4194304, MAX_BITCOIN_ADDRESSES > BitcoinAddressHashMap;
+		SortContext c;
+		c.mRecords = mPending;
+		c.mPartitionStart = partitionStart;
+		runThreads(sortPartitions,&c,mPendingCount < 65536 ? 1 : threadCount);
+	}
 
-enum AgeMarker
-{
-	AM_ONE_DAY,
-	AM_ONE_WEEK,
-	AM_ONE_MONTH,
-	AM_THREE_MONTHS,
-	AM_SIX_MONTHS,
-	AM_ONE_YEAR,
-	AM_TWO_YEARS,
-	AM_THREE_YEARS,
-	AM_FOUR_YEARS,
-	AM_FIVE_YEARS,
-	AM_LAST
+	MappedFile						mFile;
+	const TransactionIndexHeader	*mHeader;
+	const uint32_t					*mBuckets;		// The first record of each bucket, plus one past the end
+	const TransactionIndexRecord	*mRecords;		// The bucketed table, followed by the runs
+	uint32_t						mRunRecordCount;	// The number of records in all of the runs
+	TransactionIndexRecord			*mPending;		// Records waiting to be merged into the file
+	uint32_t						mPendingCount;
 };
 
-const char * getAgeString(AgeMarker m)
-{
-	const char *ret = "UNKNOWN";
-	switch ( m )
-	{
-		case AM_ONE_DAY: ret = "One Day"; break;
-		case AM_ONE_WEEK: ret = "One Week"; break;
-		case AM_ONE_MONTH: ret = "One Month"; break;
-		case AM_THREE_MONTHS: ret = "1-3 Months"; break;
-		case AM_SIX_MONTHS: ret = "3-6 Months"; break;
-		case AM_ONE_YEAR: ret = "Six Months to One Year"; break;
-		case AM_TWO_YEARS: ret = "One to Two Years"; break;
-		case AM_THREE_YEARS: ret = "Two to Three Years"; break;
-		case AM_FOUR_YEARS: ret = "Three to Four Years"; break;
-		case AM_FIVE_YEARS: ret = "Four to Fix Years"; break;
-	}
-	return ret;
-}
-
-class AgeStat
+// The memory mapped form of 'SpentBy.bin'; following an output forward to the transaction which spent it, and then
+// to the outputs of that transaction, is nothing more than array lookups.
+class SpentByFile
 {
 public:
-	AgeStat(void)
+	SpentByFile(void)
 	{
-		mTotalValue = 0;
-		mCount = 0;
+		mHeader = NULL;
+		mBlockStart = NULL;
+		mBlockLocations = NULL;
+		mOutputStart = NULL;
+		mSpentBy = NULL;
 	}
-	void addValue(uint64_t b)
+
+	bool open(const char *fname)
 	{
-		mTotalValue+=b;
-		if ( b >= ONE_BTC )
+		close();
+		if ( !mFile.open(fname) )
 		{
-			mCount++;
+			return false;
 		}
+		const SpentByHeader *h = (const SpentByHeader *)mFile.getData();
+		uint64_t size = mFile.getSize();
+		bool ok = size >= sizeof(SpentByHeader) &&
+				  memcmp(h->mMagic,SPENT_BY_MAGIC,sizeof(SPENT_BY_MAGIC)) == 0 &&
+				  h->mVersion == SPENT_BY_VERSION &&
+				  size == sizeof(SpentByHeader) + ((uint64_t)h->mBlockCount+1+h->mTransactionCount+1)*sizeof(uint32_t) +
+						  (uint64_t)h->mBlockCount*sizeof(BlockLocation) + (uint64_t)h->mOutputCount*sizeof(SpentBy);
+		if ( !ok )
+		{
+			printf("Ignoring '%s'; it is not a valid spent-by index.\r\n", fname );
+			close();
+			return false;
+		}
+		mHeader = h;
+		mBlockStart = (const uint32_t *)(h+1);
+		mBlockLocations = (const BlockLocation *)(mBlockStart + h->mBlockCount + 1);
+		mOutputStart = (const uint32_t *)(mBlockLocations + h->mBlockCount);
+		mSpentBy = (const SpentBy *)(mOutputStart + h->mTransactionCount + 1);
+		return true;
 	}
-	uint64_t	mTotalValue;
-	uint32_t	mCount;
-};
-
-enum StatSize
-{
-	SS_ZERO,			// addresses with a balance of exactly zero
-	SS_ONE_MBTC,		// addresses with a balance of one MBTC or less but not zero
-	SS_FIVE_MBTC,
 
-	SS_TEN_MBTC,		// addresses with a balance of ten MBTC
-	SS_FIFTY_MBTC,
+	void close(void)
+	{
+		mFile.close();
+		mHeader = NULL;
+		mBlockStart = NULL;
+		mBlockLocations = NULL;
+		mOutputStart = NULL;
+		mSpentBy = NULL;
+	}
 
-	SS_HUNDRED_MBTC,		// addresses with 100 mbtc
-	SS_FIVE_HUNDRED_MBTC,
+	inline bool isOpen(void) const
+	{
+		return mHeader ? true : false;
+	}
 
-	SS_ONE_BTC,		// addresses with one BTC
-	SS_FIVE_BTC,		// address with between 2 and 5 btc
+	inline uint32_t getBlockCount(void) const
+	{
+		return mHeader ? mHeader->mBlockCount : 0;
+	}
 
-	SS_TEN_BTC,	// addresses with ten BTC
-	SS_FIFTY_BTC,
+	inline uint32_t getTransactionCount(void) const
+	{
+		return mHeader ? mHeader->mTransactionCount : 0;
+	}
 
-	SS_HUNDRED_BTC,
-	SS_FIVE_HUNDRED_BTC,
+	// The index of the first transaction in this block
+	inline uint32_t getBlockStart(uint32_t block) const
+	{
+		return mBlockStart[block];
+	}
 
-	SS_ONE_THOUSAND_BTC,
-	SS_FIVE_THOUSAND_BTC,
+	inline const BlockLocation &getBlockLocation(uint32_t block) const
+	{
+		return mBlockLocations[block];
+	}
 
-	SS_TEN_THOUSAND_BTC,
-	SS_FIFTY_THOUSAND_BTC,
-	SS_HUNDRED_THOUSAND_BTC,
-	SS_MAX_BTC,
-	SS_COUNT,
-};
+	inline uint32_t getOutputCount(uint32_t transaction) const
+	{
+		return mOutputStart[transaction+1] - mOutputStart[transaction];
+	}
 
-#define MAX_DAYS 2000
-#define DAYS_PER 7
-#define MAX_DAY_INDEX (MAX_DAYS/DAYS_PER)
+	inline const SpentBy &getSpentBy(uint32_t transaction,uint32_t output) const
+	{
+		return mSpentBy[mOutputStart[transaction]+output];
+	}
 
-class StatValue
-{
-public:
-	StatValue(void)
+	// The block which holds this transaction
+	inline uint32_t getBlock(uint32_t transaction) const
 	{
-		mCount  = 0;
-		mValue = 0;
+		return getTransactionBlock(mBlockStart,mHeader->mBlockCount,transaction);
 	}
-	uint32_t	mCount;
-	uint64_t	mValue;
+
+private:
+	MappedFile			mFile;
+	const SpentByHeader	*mHeader;
+	const uint32_t		*mBlockStart;		// First transaction of each block, plus one past the end
+	const BlockLocation	*mBlockLocations;	// Where each block is stored in the data files
+	const uint32_t		*mOutputStart;		// First output of each transaction, plus one past the end
+	const SpentBy		*mSpentBy;
 };
 
-class StatAddress
+// The memory mapped address directory and its postings file
+class AddressDirectoryFile
 {
 public:
-	StatAddress(void)
+	AddressDirectoryFile(void)
 	{
-		mAddress = 0;
-		mTotalReceived = 0;
-		mTotalSent = 0;
-		mLastTime = 0;
-		mTransactionCount = 0;
-		mInputCount = 0;
-		mOutputCount = 0;
+		mHeader = NULL;
+		mBuckets = NULL;
+		mBlockStart = NULL;
+		mBlockLocations = NULL;
+		mRecords = NULL;
+		mPostings = NULL;
 	}
 
-	bool operator==(const StatAddress &a) const
+	bool open(const char *directoryName,const char *postingsName)
 	{
-		return mAddress == a.mAddress &&
-			   mTotalSent == a.mTotalSent &&
-			   mTotalReceived == a.mTotalReceived &&
-			   mFirstTime == a.mFirstTime &&
-			   mLastTime == a.mLastTime &&
-			   mTransactionCount == a.mTransactionCount &&
-			   mInputCount == a.mInputCount &&
-			   mOutputCount == a.mOutputCount;
+		close();
+		if ( !mDirectory.open(directoryName) )
+		{
+			return false;
+		}
+		const AddressDirectoryHeader *h = (const AddressDirectoryHeader *)mDirectory.getData();
+		uint64_t size = mDirectory.getSize();
+		bool ok = size >= sizeof(AddressDirectoryHeader) &&
+				  memcmp(h->mMagic,ADDRESS_DIRECTORY_MAGIC,sizeof(ADDRESS_DIRECTORY_MAGIC)) == 0 &&
+				  h->mVersion == ADDRESS_DIRECTORY_VERSION &&
+				  h->mBucketBits <= 24 &&
+				  size == sizeof(AddressDirectoryHeader) + (((uint64_t)1<<h->mBucketBits)+1+h->mBlockCount+1)*sizeof(uint32_t) +
+						  (uint64_t)h->mBlockCount*sizeof(BlockLocation) + (uint64_t)h->mAddressCount*sizeof(AddressDirectoryRecord);
+		// An address with no transactions leaves the postings file empty, which cannot be mapped
+		if ( ok && h->mPostingCount )
+		{
+			ok = mPostingsFile.open(postingsName) && mPostingsFile.getSize() == h->mPostingCount*sizeof(uint32_t);
+		}
+		if ( !ok )
+		{
+			printf("Ignoring '%s'; it is not a valid address directory.\r\n", directoryName );
+			close();
+			return false;
+		}
+		mHeader = h;
+		mBuckets = (const uint32_t *)(h+1);
+		mBlockStart = mBuckets + (1<<h->mBucketBits) + 1;
+		mBlockLocations = (const BlockLocation *)(mBlockStart + h->mBlockCount + 1);
+		mRecords = (const AddressDirectoryRecord *)(mBlockLocations + h->mBlockCount);
+		mPostings = (const uint32_t *)mPostingsFile.getData();
+		return true;
 	}
 
-	uint32_t getBalance(void) const
+	void close(void)
 	{
-		return mTotalReceived - mTotalSent;
+		mDirectory.close();
+		mPostingsFile.close();
+		mHeader = NULL;
+		mBuckets = NULL;
+		mBlockStart = NULL;
+		mBlockLocations = NULL;
+		mRecords = NULL;
+		mPostings = NULL;
 	}
 
-	uint32_t	mAddress;			// the address index.
-	uint32_t	mTotalSent;			// total number of bitcoins sent
-	uint32_t	mTotalReceived;
-	uint32_t	mFirstTime;			// first time this address was used
-	uint32_t	mLastTime;			// Last time a spend transaction occurred.
-	uint8_t		mTransactionCount;	// total number of transactions
-	uint8_t		mInputCount;		// total number of inputs.
-	uint8_t		mOutputCount;		// total number of outputs
-};
+	const AddressDirectoryRecord *find(const uint8_t hash160[20]) const
+	{
+		const AddressDirectoryRecord *ret = NULL;
+		if ( mHeader )
+		{
+			uint32_t bucket = getHashBucket(hash160,mHeader->mBucketBits);
+			uint32_t low = mBuckets[bucket];
+			uint32_t high = mBuckets[bucket+1];
+			while ( low < high )
+			{
+				uint32_t mid = (low+high)/2;
+				int c = memcmp(mRecords[mid].mHash160,hash160,20);
+				if ( c == 0 )
+				{
+					ret = &mRecords[mid];
+					break;
+				}
+				if ( c < 0 )
+				{
+					low = mid+1;
+				}
+				else
+				{
+					high = mid;
+				}
+			}
+		}
+		return ret;
+	}
 
-class StatRow
-{
-public:
-	StatRow(void)
+	// The transaction indices of this address
+	inline const uint32_t *getPostings(const AddressDirectoryRecord *r) const
 	{
-		mTime = 0;
-		mCount = 0;
-		mValue = 0;
-		mZombieTotal = 0;
-		mZombieCount = 0;
-		mAddressCount = 0;
-		mAddresses = NULL;
-		mNewAddressCount = 0;
-		mDeleteAddressCount = 0;
-		mChangeAddressCount = 0;
-		mSameAddressCount = 0;
-		mRiseFromDeadCount = 0;
-		mRiseFromDeadAmount = 0;
-		mNewAddresses = NULL;
-		mChangedAddresses = NULL;
-		mDeletedAddresses = NULL;
+		return &mPostings[r->mPostings];
 	}
 
-	~StatRow(void)
+	inline uint32_t getBlock(uint32_t transaction) const
 	{
-		delete []mAddresses;
-		delete []mNewAddresses;
-		delete []mChangedAddresses;
-		delete []mDeletedAddresses;
+		return getTransactionBlock(mBlockStart,mHeader->mBlockCount,transaction);
 	}
-	uint64_t	mZombieTotal;
-	uint32_t	mZombieCount;
-	uint32_t	mTime;
-	uint32_t	mCount;
-	uint64_t	mValue;
-	StatValue	mStats[SS_COUNT];
 
-	uint32_t	mAddressCount;		// number of addreses recorded
-	StatAddress	*mAddresses;
-	
-	uint32_t	mNewAddressCount;
-	uint32_t	mDeleteAddressCount;
-	uint32_t	mChangeAddressCount;
-	uint32_t	mSameAddressCount;
-	uint32_t	mRiseFromDeadCount;
-	uint32_t	mRiseFromDeadAmount;
+	inline uint32_t getBlockStart(uint32_t block) const
+	{
+		return mBlockStart[block];
+	}
 
-	StatAddress	*mNewAddresses;
-	StatAddress	*mChangedAddresses;
-	uint32_t	*mDeletedAddresses;
+	inline const BlockLocation &getBlockLocation(uint32_t block) const
+	{
+		return mBlockLocations[block];
+	}
+
+private:
+	MappedFile						mDirectory;
+	MappedFile						mPostingsFile;
+	const AddressDirectoryHeader	*mHeader;
+	const uint32_t					*mBuckets;
+	const uint32_t					*mBlockStart;
+	const BlockLocation				*mBlockLocations;	// Where each block is stored in the data files
+	const AddressDirectoryRecord	*mRecords;
+	const uint32_t					*mPostings;
 };
 
-#define MAX_STAT_COUNT (365*6) // reserve room for up to 6 years of 365 days entries...
+#define SPENT_BY_TRACE_LIMIT 256 // The most spends a trace will print
 
-class QuickSortPointers
+// The unspent transaction outputs, keyed by outpoint (transaction hash and output number).  Used in place of the full
+// transaction history when processing in UTXO mode: an output is added when it is created and removed again when it
+// is spent, so memory follows the size of the live UTXO set rather than every output ever created.
+//
+// Each entry is 64 bytes; the first 12 bytes of the transaction hash (collisions among 96 bit prefixes of a few
+// billion random hashes are vanishingly unlikely), the output number, the value, the address index, the height of
+// the block which created it and the output's digest in the UTXO set commitment, so that the digest is kept under
+// the memory budget and spilled along with the rest of the entry.  The table is open addressed with linear probing and removal shifts the following
+// entries back, so there are no tombstones and lookups never slow down as the set churns.
+#define UTXO_INITIAL_SLOTS (1<<16)
+#define UTXO_EMPTY 0xFFFFFFFF
+
+class UtxoEntry
 {
 public:
-	void qsort(void **base,int32_t num); // perform the qsort.
-protected:
-	// -1 less, 0 equal, +1 greater.
-	virtual int32_t compare(void **p1,void **p2) = 0;
-private:
-	void inline swap(char **a,char **b);
-};
+	uint64_t	mHash0;			// Bytes 0-7 of the transaction hash
+	uint32_t	mHash1;			// Bytes 8-11 of the transaction hash
+	uint32_t	mOutput;		// The output number; UTXO_EMPTY marks an empty slot
+	uint64_t	mValue;
+	uint32_t	mAddress;		// The address index; zero if the output script did not have a recognized address
+	uint32_t	mHeight;		// The height of the block which created this output
+	uint8_t		mDigest[32];	// The SHA256 the UTXO set commitment holds for this output; all zeros if it is not part of it
 
-void QuickSortPointers::swap(char **a,char **b)
-{
-	char *tmp;
+	// Fills in the entry for output 'output' of this transaction, without a digest
+	void set(const uint8_t *transactionHash,uint32_t output,uint64_t value,uint32_t address,uint32_t height)
+	{
+		memcpy(&mHash0,transactionHash,sizeof(mHash0));
+		memcpy(&mHash1,transactionHash+8,sizeof(mHash1));
+		mOutput = output;
+		mValue = value;
+		mAddress = address;
+		mHeight = height;
+		memset(mDigest,0,sizeof(mDigest));
+	}
 
-	if ( a != b )
+	inline bool hasDigest(void) const
 	{
-		tmp = *a;
-		*a++ = *b;
-		*b++ = tmp;
+		static const uint8_t zero[32] = { 0 };
+		return memcmp(mDigest,zero,sizeof(mDigest)) != 0;
 	}
+};
+
+// The outpoint part of a UtxoEntry; the entries are sorted by it in the spill log
+class UtxoKey
+{
+public:
+	uint64_t	mHash0;
+	uint32_t	mHash1;
+	uint32_t	mOutput;
+};
+
+static inline int compareOutpoints(uint64_t a0,uint32_t a1,uint32_t aOutput,uint64_t b0,uint32_t b1,uint32_t bOutput)
+{
+	if ( a0 != b0 ) return a0 < b0 ? -1 : 1;
+	if ( a1 != b1 ) return a1 < b1 ? -1 : 1;
+	if ( aOutput != bOutput ) return aOutput < bOutput ? -1 : 1;
+	return 0;
 }
 
+static int compareUtxoEntries(const void *a,const void *b)
+{
+	const UtxoEntry *ea = (const UtxoEntry *)a;
+	const UtxoEntry *eb = (const UtxoEntry *)b;
+	return compareOutpoints(ea->mHash0,ea->mHash1,ea->mOutput,eb->mHash0,eb->mHash1,eb->mOutput);
+}
 
-void QuickSortPointers::qsort(void **b,int32_t num)
+static int compareUtxoKeys(const void *a,const void *b)
 {
-	char *lo,*hi;
-	char *mid;
-	char *bottom, *top;
-	int32_t size;
-	char *lostk[30], *histk[30];
-	int32_t stkptr;
-	char **base = (char **)b;
+	const UtxoKey *ka = (const UtxoKey *)a;
+	const UtxoKey *kb = (const UtxoKey *)b;
+	return compareOutpoints(ka->mHash0,ka->mHash1,ka->mOutput,kb->mHash0,kb->mHash1,kb->mOutput);
+}
 
-	if (num < 2 ) return;
+// When the UTXO set is given a memory budget the oldest outputs are moved out to 'UtxoSpill.bin', an append-only log
+// of runs.  Each run is a batch of entries sorted by outpoint; in memory we keep only the first outpoint of each 4KB
+// page, a bloom filter and one bit per entry marking it as taken back out, which is less than 2 bytes per spilled
+// output instead of 64.  The outputs a block spends are looked up as one sorted batch, so each run is read forward a
+// page at a time and a page holding several of them is read once.  When there are too many runs, or most of the log
+// has been taken back out, the live entries are merged into a single run in a new log which replaces the old one.
+#define UTXO_SPILL_FILE "UtxoSpill.bin"
+#define UTXO_SPILL_SCRATCH "UtxoSpill.tmp"
+#define UTXO_SPILL_PAGE 64			// Entries per page of a run (4KB)
+#define UTXO_SPILL_MAX_RUNS 8		// More runs than this are merged into one
+#define UTXO_SPILL_BLOOM_BITS 8		// Bloom filter bits per spilled entry (rounded up to a power of two)
+#define UTXO_SPILL_MERGE_PAGES 64	// Pages read at a time from each run while merging
+#define UTXO_MIN_BUDGET 16			// The smallest memory budget accepted, in megabytes
+#define UTXO_HEIGHT_BUCKETS 4096	// Resolution of the histogram used to pick the oldest outputs to spill
+
+class UtxoRun
+{
+public:
+	uint64_t	mOffset;		// Where the run's entries start in the log
+	uint32_t	mCount;			// The number of entries in the run
+	uint32_t	mLiveCount;		// How many of them have not been taken back out
+	UtxoKey		*mFences;		// The first outpoint of each page
+	uint32_t	*mTaken;		// One bit per entry, set once it has been taken back out
+	uint32_t	*mBloom;
+	uint32_t	mBloomMask;		// The number of bloom filter bits less one
+};
 
-	stkptr = 0;
+class UtxoSpill
+{
+public:
+	UtxoSpill(void)
+	{
+		mFile = NULL;
+		mRunCount = 0;
+		mEnd = 0;
+		mLiveCount = 0;
+		mWriteCount = 0;
+		mTakeCount = 0;
+		mPageReads = 0;
+		mMergeCount = 0;
+		mPageIndex = 0xFFFFFFFF;
+		mPageRun = NULL;
+	}
 
-	lo = (char *)base;
-	hi = (char *)base + sizeof(char **) * (num-1);
+	~UtxoSpill(void)
+	{
+		close();
+	}
 
-nextone:
+	// Sorts these entries and appends them to the log as a new run; returns false, with nothing written, if it cannot
+	bool write(UtxoEntry *entries,uint32_t count)
+	{
+		if ( count == 0 )
+		{
+			return true;
+		}
+		if ( mRunCount > UTXO_SPILL_MAX_RUNS ) // a previous merge failed
+		{
+			return false;
+		}
+		if ( mFile == NULL )
+		{
+			mFile = fopen(UTXO_SPILL_FILE,"w+b");
+			if ( mFile == NULL )
+			{
+				printf("Failed to create the UTXO spill log '%s'\r\n", UTXO_SPILL_FILE );
+				return false;
+			}
+		}
+		qsort(entries,count,sizeof(UtxoEntry),compareUtxoEntries);
+		if ( !seekFile(mFile,mEnd) || fwrite(entries,sizeof(UtxoEntry),count,mFile) != count )
+		{
+			printf("Failed to write %s entries to the UTXO spill log.\r\n", formatNumber(count) );
+			return false;
+		}
+		UtxoRun &r = mRuns[mRunCount++];
+		initRun(r,mEnd,count);
+		for (uint32_t i=0; i<count; i++)
+		{
+			addEntry(r,i,entries[i]);
+		}
+		mEnd+=(uint64_t)count*sizeof(UtxoEntry);
+		mLiveCount+=count;
+		mWriteCount+=count;
+		mPageIndex = 0xFFFFFFFF;
+		if ( mRunCount > UTXO_SPILL_MAX_RUNS )
+		{
+			merge(); // if this fails the entries are still in the log, but nothing more can be written to it
+		}
+		return true;
+	}
 
-	size = (int32_t)(hi - lo) / sizeof(char**) + 1;
+	// Takes every one of these outpoints (sorted, as 'count' keys) which is in the log back out of it.  'done' has a
+	// flag per key which is set for the ones found, and the entries found are returned in 'found'.
+	uint32_t take(const UtxoKey *keys,uint32_t count,uint8_t *done,UtxoEntry *found)
+	{
+		uint32_t foundCount = 0;
+		for (uint32_t i=mRunCount; i>0 && foundCount<count; i--)
+		{
+			UtxoRun &r = mRuns[i-1];
+			for (uint32_t j=0; j<count; j++)
+			{
+				const UtxoKey &k = keys[j];
+				if ( done[j] || !inBloom(r,k) )
+				{
+					continue;
+				}
+				uint32_t page = findPage(r,k);
+				if ( page == 0xFFFFFFFF || !readPage(r,page) )
+				{
+					continue;
+				}
+				uint32_t base = page*UTXO_SPILL_PAGE;
+				uint32_t lo = 0;
+				uint32_t hi = r.mCount-base < UTXO_SPILL_PAGE ? r.mCount-base : UTXO_SPILL_PAGE;
+				while ( lo < hi )
+				{
+					uint32_t mid = (lo+hi)/2;
+					const UtxoEntry &e = mPage[mid];
+					int c = compareOutpoints(e.mHash0,e.mHash1,e.mOutput,k.mHash0,k.mHash1,k.mOutput);
+					if ( c == 0 )
+					{
+						uint32_t index = base+mid;
+						if ( !(r.mTaken[index>>5] & (1<<(index&31))) )
+						{
+							r.mTaken[index>>5]|=1<<(index&31);
+							r.mLiveCount--;
+							mLiveCount--;
+							mTakeCount++;
+							found[foundCount++] = e;
+							done[j] = 1;
+						}
+						break;
+					}
+					if ( c < 0 )
+					{
+						lo = mid+1;
+					}
+					else
+					{
+						hi = mid;
+					}
+				}
+			}
+		}
+		if ( foundCount )
+		{
+			dropEmptyRuns();
+			// Rewrite the log once most of it is dead space
+			if ( mRunCount && (uint64_t)mLiveCount*2*sizeof(UtxoEntry) < mEnd && mEnd > (64<<20) )
+			{
+				merge();
+			}
+		}
+		return foundCount;
+	}
 
-	mid = lo + (size / 2) * sizeof(char **);
-	swap((char **)mid,(char **)lo);
-	bottom = lo;
-	top = hi + sizeof(char **);
+	inline uint32_t getLiveCount(void) const
+	{
+		return mLiveCount;
+	}
+
+	inline bool isEmpty(void) const
+	{
+		return mLiveCount == 0;
+	}
+
+	inline uint32_t getMergeCount(void) const
+	{
+		return mMergeCount;
+	}
+
+	// The memory used for the spilled entries; the fences, bloom filters and taken flags
+	uint64_t getMemoryUsed(void) const
+	{
+		uint64_t ret = 0;
+		for (uint32_t i=0; i<mRunCount; i++)
+		{
+			const UtxoRun &r = mRuns[i];
+			ret+=(uint64_t)getPageCount(r.mCount)*sizeof(UtxoKey);
+			ret+=(uint64_t)((r.mCount+31)/32)*sizeof(uint32_t);
+			ret+=(uint64_t)(r.mBloomMask+1)/8;
+		}
+		return ret;
+	}
 
-	for (;;)
+	void report(void) const
 	{
-		do
-		{
-			bottom += sizeof(char **);
-		} while (bottom <= hi && compare((void **)bottom,(void **)lo) <= 0);
+		printf("UTXO spill log: %s outputs in %s runs, %s MB on disk, %s MB in memory; %s written, %s brought back, %s pages read, %s merges.\r\n",
+			formatNumber(mLiveCount),
+			formatNumber(mRunCount),
+			formatNumber((int32_t)(mEnd>>20)),
+			formatNumber((int32_t)(getMemoryUsed()>>20)),
+			formatNumber((int32_t)mWriteCount),
+			formatNumber((int32_t)mTakeCount),
+			formatNumber((int32_t)mPageReads),
+			formatNumber(mMergeCount));
+	}
 
-		do
+	void close(void)
+	{
+		for (uint32_t i=0; i<mRunCount; i++)
 		{
-			top -= sizeof(char **);
-		} while (top > lo && compare((void **)top,(void **)lo) >= 0);
+			releaseRun(mRuns[i]);
+		}
+		mRunCount = 0;
+		if ( mFile )
+		{
+			fclose(mFile);
+			mFile = NULL;
+			remove(UTXO_SPILL_FILE);
+		}
+		mEnd = 0;
+		mLiveCount = 0;
+		mPageIndex = 0xFFFFFFFF;
+	}
 
-		if (top < bottom) break;
+private:
+	static inline uint32_t getPageCount(uint32_t count)
+	{
+		return (count+UTXO_SPILL_PAGE-1)/UTXO_SPILL_PAGE;
+	}
 
-		swap((char **)bottom,(char **)top);
+	void initRun(UtxoRun &r,uint64_t offset,uint32_t count)
+	{
+		r.mOffset = offset;
+		r.mCount = count;
+		r.mLiveCount = count;
+		r.mFences = new UtxoKey[getPageCount(count)];
+		uint32_t words = (count+31)/32;
+		r.mTaken = new uint32_t[words];
+		memset(r.mTaken,0,sizeof(uint32_t)*words);
+		uint32_t bits = 64;
+		while ( bits < count*UTXO_SPILL_BLOOM_BITS && bits < 0x80000000 )
+		{
+			bits*=2;
+		}
+		r.mBloomMask = bits-1;
+		r.mBloom = new uint32_t[bits/32];
+		memset(r.mBloom,0,bits/8);
+	}
 
+	void releaseRun(UtxoRun &r)
+	{
+		delete []r.mFences;
+		delete []r.mTaken;
+		delete []r.mBloom;
 	}
 
-	swap((char **)lo,(char **)top);
+	// Two independent bit positions come out of one 64 bit mix of the outpoint; four probes are made from them
+	static inline uint64_t mixKey(uint64_t hash0,uint32_t hash1,uint32_t output)
+	{
+		return (hash0 ^ ((uint64_t)hash1<<29) ^ ((uint64_t)output*0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+	}
 
-	if ( top - 1 - lo >= hi - bottom )
+	void addEntry(UtxoRun &r,uint32_t index,const UtxoEntry &e)
 	{
-		if (lo + sizeof(char **) < top)
+		if ( (index%UTXO_SPILL_PAGE) == 0 )
 		{
-			lostk[stkptr] = lo;
-			histk[stkptr] = top - sizeof(char **);
-			stkptr++;
+			UtxoKey &f = r.mFences[index/UTXO_SPILL_PAGE];
+			f.mHash0 = e.mHash0;
+			f.mHash1 = e.mHash1;
+			f.mOutput = e.mOutput;
 		}
-		if (bottom < hi)
+		uint64_t m = mixKey(e.mHash0,e.mHash1,e.mOutput);
+		uint32_t a = (uint32_t)m;
+		uint32_t b = (uint32_t)(m>>32)|1;
+		for (uint32_t i=0; i<4; i++)
 		{
-			lo = bottom;
-			goto nextone;
+			uint32_t bit = (a+i*b) & r.mBloomMask;
+			r.mBloom[bit>>5]|=1<<(bit&31);
 		}
 	}
-	else
+
+	inline bool inBloom(const UtxoRun &r,const UtxoKey &k) const
 	{
-		if ( bottom < hi )
+		uint64_t m = mixKey(k.mHash0,k.mHash1,k.mOutput);
+		uint32_t a = (uint32_t)m;
+		uint32_t b = (uint32_t)(m>>32)|1;
+		for (uint32_t i=0; i<4; i++)
 		{
-			lostk[stkptr] = bottom;
-			histk[stkptr] = hi;
-			stkptr++;
+			uint32_t bit = (a+i*b) & r.mBloomMask;
+			if ( !(r.mBloom[bit>>5] & (1<<(bit&31))) )
+			{
+				return false;
+			}
 		}
-		if (lo + sizeof(char **) < top)
+		return true;
+	}
+
+	// Returns the page which would hold this outpoint; the last page whose first outpoint is not greater than it
+	uint32_t findPage(const UtxoRun &r,const UtxoKey &k) const
+	{
+		uint32_t lo = 0;
+		uint32_t hi = getPageCount(r.mCount);
+		while ( lo < hi )
 		{
-			hi = top - sizeof(char **);
-			goto nextone; 					/* do small recursion */
+			uint32_t mid = (lo+hi)/2;
+			const UtxoKey &f = r.mFences[mid];
+			if ( compareOutpoints(f.mHash0,f.mHash1,f.mOutput,k.mHash0,k.mHash1,k.mOutput) <= 0 )
+			{
+				lo = mid+1;
+			}
+			else
+			{
+				hi = mid;
+			}
 		}
+		return lo ? lo-1 : 0xFFFFFFFF;
 	}
 
-	stkptr--;
-
-	if (stkptr >= 0)
+	bool readPage(const UtxoRun &r,uint32_t page)
 	{
-		lo = lostk[stkptr];
-		hi = histk[stkptr];
-		goto nextone;
+		if ( mPageRun == &r && mPageIndex == page )
+		{
+			return true;
+		}
+		uint32_t base = page*UTXO_SPILL_PAGE;
+		uint32_t count = r.mCount-base < UTXO_SPILL_PAGE ? r.mCount-base : UTXO_SPILL_PAGE;
+		mPageIndex = 0xFFFFFFFF;
+		if ( !seekFile(mFile,r.mOffset+(uint64_t)base*sizeof(UtxoEntry)) || fread(mPage,sizeof(UtxoEntry),count,mFile) != count )
+		{
+			printf("Failed to read page %d of the UTXO spill log.\r\n", page );
+			return false;
+		}
+		mPageRun = &r;
+		mPageIndex = page;
+		mPageReads++;
+		return true;
 	}
-	return;
-}
 
-class SortByBalance : public QuickSortPointers
-{
-public:
-	SortByBalance(BitcoinAddress **addresses,uint32_t count)
+	void dropEmptyRuns(void)
 	{
-		QuickSortPointers::qsort((void **)addresses,(int32_t)count);
+		uint32_t n = 0;
+		for (uint32_t i=0; i<mRunCount; i++)
+		{
+			if ( mRuns[i].mLiveCount )
+			{
+				mRuns[n++] = mRuns[i];
+			}
+			else
+			{
+				releaseRun(mRuns[i]);
+			}
+		}
+		mRunCount = n;
+		mPageIndex = 0xFFFFFFFF;
 	}
 
-	// -1 less, 0 equal, +1 greater.
-	virtual int32_t compare(void **p1,void **p2) 
+	// Where a run is up to while merging; a window of its entries is read at a time
+	class MergeCursor
 	{
-		BitcoinAddress **ba1 = (BitcoinAddress **)p1;
-		BitcoinAddress **ba2 = (BitcoinAddress **)p2;
-		BitcoinAddress *a1 = *ba1;
-		BitcoinAddress *a2 = *ba2;
-		uint64_t balance1 = a1->mTotalReceived-a1->mTotalSent;
-		uint64_t balance2 = a2->mTotalReceived-a2->mTotalSent;
-		if ( balance1 == balance2 ) return 0;
-		return balance1 > balance2 ? -1 : 1;
-	}
-};
+	public:
+		UtxoRun		*mRun;
+		uint32_t	mIndex;			// The next entry of the run
+		uint32_t	mWindowStart;	// The run index of the first entry in the window
+		uint32_t	mWindowCount;
+		UtxoEntry	*mWindow;
+	};
 
-class SortByAge : public QuickSortPointers
-{
-public:
-	SortByAge(BitcoinAddress **addresses,uint32_t count)
+	// Advances the cursor to the next entry which has not been taken out; returns false at the end of the run
+	bool nextLive(FILE *fph,MergeCursor &c)
 	{
-		QuickSortPointers::qsort((void **)addresses,(int32_t)count);
+		while ( c.mIndex < c.mRun->mCount )
+		{
+			if ( !(c.mRun->mTaken[c.mIndex>>5] & (1<<(c.mIndex&31))) )
+			{
+				if ( c.mIndex >= c.mWindowStart+c.mWindowCount )
+				{
+					uint32_t count = c.mRun->mCount-c.mIndex;
+					if ( count > UTXO_SPILL_MERGE_PAGES*UTXO_SPILL_PAGE )
+					{
+						count = UTXO_SPILL_MERGE_PAGES*UTXO_SPILL_PAGE;
+					}
+					if ( !seekFile(fph,c.mRun->mOffset+(uint64_t)c.mIndex*sizeof(UtxoEntry)) || fread(c.mWindow,sizeof(UtxoEntry),count,fph) != count )
+					{
+						return false;
+					}
+					c.mWindowStart = c.mIndex;
+					c.mWindowCount = count;
+				}
+				return true;
+			}
+			c.mIndex++;
+		}
+		return false;
 	}
 
-	// -1 less, 0 equal, +1 greater.
-	virtual int32_t compare(void **p1,void **p2) 
+	// Merges the live entries of every run into a single run at the start of a new log
+	bool merge(void)
 	{
-		BitcoinAddress **ba1 = (BitcoinAddress **)p1;
-		BitcoinAddress **ba2 = (BitcoinAddress **)p2;
-		BitcoinAddress *a1 = *ba1;
-		BitcoinAddress *a2 = *ba2;
-		uint32_t age1 = a1->getDaysSinceLastUsed();
-		uint32_t age2 = a2->getDaysSinceLastUsed();
-		if ( age1 == age2 ) return 0;
-		return age1 > age2 ? -1 : 1;
+		FILE *fph = fopen(UTXO_SPILL_SCRATCH,"wb");
+		if ( fph == NULL )
+		{
+			printf("Failed to create '%s' to merge the UTXO spill log.\r\n", UTXO_SPILL_SCRATCH );
+			return false;
+		}
+		uint32_t window = UTXO_SPILL_MERGE_PAGES*UTXO_SPILL_PAGE;
+		MergeCursor cursors[UTXO_SPILL_MAX_RUNS+1];
+		UtxoEntry *windows = new UtxoEntry[window*(mRunCount+1)];
+		UtxoEntry *out = &windows[window*mRunCount];
+		bool ok = true;
+		for (uint32_t i=0; i<mRunCount; i++)
+		{
+			MergeCursor &c = cursors[i];
+			c.mRun = &mRuns[i];
+			c.mIndex = 0;
+			c.mWindowStart = 0;
+			c.mWindowCount = 0;
+			c.mWindow = &windows[window*i];
+		}
+		UtxoRun merged;
+		initRun(merged,0,mLiveCount);
+		uint32_t written = 0;
+		uint32_t outCount = 0;
+		for (;;)
+		{
+			MergeCursor *best = NULL;
+			for (uint32_t i=0; i<mRunCount; i++)
+			{
+				MergeCursor &c = cursors[i];
+				if ( c.mIndex < c.mRun->mCount && nextLive(mFile,c) )
+				{
+					const UtxoEntry &e = c.mWindow[c.mIndex-c.mWindowStart];
+					if ( best == NULL )
+					{
+						best = &c;
+					}
+					else
+					{
+						const UtxoEntry &b = best->mWindow[best->mIndex-best->mWindowStart];
+						if ( compareOutpoints(e.mHash0,e.mHash1,e.mOutput,b.mHash0,b.mHash1,b.mOutput) < 0 )
+						{
+							best = &c;
+						}
+					}
+				}
+			}
+			if ( best == NULL || written+outCount == merged.mCount )
+			{
+				break;
+			}
+			out[outCount] = best->mWindow[best->mIndex-best->mWindowStart];
+			addEntry(merged,written+outCount,out[outCount]);
+			outCount++;
+			best->mIndex++;
+			if ( outCount == window )
+			{
+				ok = ok && fwrite(out,sizeof(UtxoEntry),outCount,fph) == outCount;
+				written+=outCount;
+				outCount = 0;
+			}
+		}
+		ok = ok && fwrite(out,sizeof(UtxoEntry),outCount,fph) == outCount;
+		written+=outCount;
+		delete []windows;
+		fclose(fph);
+		if ( ok && written == merged.mCount )
+		{
+			fclose(mFile);
+			mFile = NULL;
+			if ( replaceFile(UTXO_SPILL_SCRATCH,UTXO_SPILL_FILE) )
+			{
+				mFile = fopen(UTXO_SPILL_FILE,"r+b");
+			}
+			ok = mFile != NULL;
+		}
+		else
+		{
+			ok = false;
+			remove(UTXO_SPILL_SCRATCH);
+		}
+		if ( !ok )
+		{
+			printf("Failed to merge the UTXO spill log.\r\n");
+			releaseRun(merged);
+			return false;
+		}
+		for (uint32_t i=0; i<mRunCount; i++)
+		{
+			releaseRun(mRuns[i]);
+		}
+		mRuns[0] = merged;
+		mRunCount = merged.mCount ? 1 : 0;
+		if ( mRunCount == 0 )
+		{
+			releaseRun(merged);
+		}
+		mEnd = (uint64_t)merged.mCount*sizeof(UtxoEntry);
+		mPageIndex = 0xFFFFFFFF;
+		mMergeCount++;
+		return true;
 	}
 
+	FILE			*mFile;
+	UtxoRun			mRuns[UTXO_SPILL_MAX_RUNS+1];
+	uint32_t		mRunCount;
+	uint64_t		mEnd;				// The end of the log; new runs are appended here
+	uint32_t		mLiveCount;			// Entries in the log which have not been taken back out
+	uint64_t		mWriteCount;
+	uint64_t		mTakeCount;
+	uint64_t		mPageReads;
+	uint32_t		mMergeCount;
+	const UtxoRun	*mPageRun;			// The run and page currently held in 'mPage'
+	uint32_t		mPageIndex;
+	UtxoEntry		mPage[UTXO_SPILL_PAGE];
 };
 
-class BitcoinTransactionFactory
+class UtxoMap
 {
 public:
-	BitcoinTransactionFactory(void)
+	UtxoMap(void)
 	{
-		mTransactionReferences = NULL;
-		mTransactions = NULL;
-		mInputs = NULL;
-		mOutputs = NULL;
-		mBlocks = NULL;
-		mTransactionCount = 0;
-		mTotalInputCount = 0;
-		mTotalOutputCount = 0;
-		mBlockCount = 0;
-		mStatCount = 0;
-
-		mStatLimits[SS_ZERO] = 0;
-		mStatLimits[SS_ONE_MBTC] = ONE_MBTC;
-		mStatLimits[SS_FIVE_MBTC] = ONE_MBTC*5;
-
-		mStatLimits[SS_TEN_MBTC] = ONE_MBTC*10;
-		mStatLimits[SS_FIFTY_MBTC] = ONE_MBTC*50;
-
-		mStatLimits[SS_HUNDRED_MBTC] = ONE_MBTC*100;
-		mStatLimits[SS_FIVE_HUNDRED_MBTC] = ONE_MBTC*500;
-
-
-		mStatLimits[SS_ONE_BTC] = ONE_BTC;
-		mStatLimits[SS_FIVE_BTC] = ONE_BTC*5;
-
-		mStatLimits[SS_TEN_BTC] = ONE_BTC*10;
-		mStatLimits[SS_FIFTY_BTC] = (uint64_t)ONE_BTC*(uint64_t)50;
-
-		mStatLimits[SS_HUNDRED_BTC] = (uint64_t)ONE_BTC*(uint64_t)100;
-		mStatLimits[SS_FIVE_HUNDRED_BTC] = (uint64_t)ONE_BTC*(uint64_t)500;
-
-		mStatLimits[SS_ONE_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)1000;
-		mStatLimits[SS_FIVE_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)5000;
-
-		mStatLimits[SS_TEN_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)10000;
-		mStatLimits[SS_FIFTY_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)50000;
-		mStatLimits[SS_HUNDRED_THOUSAND_BTC] = (uint64_t)ONE_BTC*(uint64_t)100000;
-		mStatLimits[SS_MAX_BTC] = (uint64_t)ONE_BTC*(uint64_t)21000000;
-
-
-		mStatLabel[SS_ZERO] = "ZERO";
-		mStatLabel[SS_ONE_MBTC] = "<1MBTC";
-		mStatLabel[SS_FIVE_MBTC] = "<5MBTC";
-		mStatLabel[SS_TEN_MBTC] = "<10MBTC";
-		mStatLabel[SS_FIFTY_MBTC] = "<50MBTC";
-		mStatLabel[SS_HUNDRED_MBTC] = "<100MBTC";
-		mStatLabel[SS_FIVE_HUNDRED_MBTC] = "<500MBTC";
-		mStatLabel[SS_ONE_BTC] = "<1BTC";
-		mStatLabel[SS_FIVE_BTC] = "<5BTC";
-		mStatLabel[SS_TEN_BTC] = "<10BTC";
-		mStatLabel[SS_FIFTY_BTC] = "<50BTC";
-		mStatLabel[SS_HUNDRED_BTC] = "<100BTC";
-		mStatLabel[SS_FIVE_HUNDRED_BTC] = "<500BTC";
-		mStatLabel[SS_ONE_THOUSAND_BTC] = "<1KBTC";
-		mStatLabel[SS_FIVE_THOUSAND_BTC] = "<5KBTC";
-		mStatLabel[SS_TEN_THOUSAND_BTC] = "<10KBTC";
-		mStatLabel[SS_FIFTY_THOUSAND_BTC] = "<50KBTC";
-		mStatLabel[SS_HUNDRED_THOUSAND_BTC] = "<100KBTC";
-		mStatLabel[SS_MAX_BTC] = ">100KBTC";
-
+		mSlots = NULL;
+		mSlotCount = 0;
+		mMaxSlots = 0;
+		mCount = 0;
+		mPeakCount = 0;
+		mMaxHeight = 0;
+		mAddCount = 0;
+		mSpendCount = 0;
+		mMissingCount = 0;
+		mEvicted = NULL;
+		mEvictCapacity = 0;
+		mFound = NULL;
+		mKeyDone = NULL;
+		mFailed = false;
 	}
 
-	~BitcoinTransactionFactory(void)
+	~UtxoMap(void)
 	{
-		delete []mBlocks;
-		delete []mTransactions;
-		delete []mInputs;
-		delete []mOutputs;
-		delete []mTransactionReferences;
+		freePages(mSlots,sizeof(UtxoEntry)*(uint64_t)mSlotCount);
+		delete []mEvicted;
+		delete []mFound;
+		delete []mKeyDone;
 	}
 
-	void init(void)
+	// Limits the UTXO set to about this many megabytes of memory; the in-memory table takes up to half of it, the
+	// buffer the oldest outputs are spilled from an eighth, and the spill log's in-memory part most of the rest.  The
+	// address table is not part of the budget.
+	bool setBudget(uint32_t megabytes)
 	{
-		if ( mTransactions == NULL )
+		if ( megabytes < UTXO_MIN_BUDGET )
+		{
+			printf("The UTXO memory budget must be at least %d MB.\r\n", UTXO_MIN_BUDGET );
+			return false;
+		}
+		uint64_t bytes = (uint64_t)megabytes<<20;
+		uint32_t slots = UTXO_INITIAL_SLOTS;
+		while ( (uint64_t)slots*2*sizeof(UtxoEntry) <= bytes/2 && slots < 0x80000000 )
 		{
-			mTransactions = new Transaction[MAX_TOTAL_TRANSACTIONS];
-			mInputs = new TransactionInput[MAX_TOTAL_INPUTS];
-			mOutputs = new TransactionOutput[MAX_TOTAL_OUTPUTS];
-			mBlocks = new Transaction *[MAX_TOTAL_BLOCKS];
+			slots*=2;
 		}
-	}
-
-	void markBlock(Transaction *t)
-	{
-		assert( mBlockCount < MAX_TOTAL_BLOCKS );
-		if ( mBlockCount < MAX_TOTAL_BLOCKS )
+		if ( mSlotCount > slots )
 		{
-			mBlocks[mBlockCount] = t;
-			mBlockCount++;
+			printf("The UTXO set already uses more than this budget.\r\n");
+			return false;
+		}
+		mMaxSlots = slots;
+		delete []mEvicted;
+		mEvictCapacity = (uint32_t)((bytes/8)/sizeof(UtxoEntry));
+		mEvicted = new UtxoEntry[mEvictCapacity];
+		if ( mFound == NULL )
+		{
+			mFound = new UtxoEntry[MAX_BLOCK_INPUTS];
+			mKeyDone = new uint8_t[MAX_BLOCK_INPUTS];
 		}
+		return true;
 	}
 
-	Transaction * getBlock(uint32_t index,uint32_t &tcount) const
+	// With a memory budget, first makes room for 'additions' more entries without growing past it, then brings back
+	// from the spill log any of these outpoints (the inputs of the next block) which were moved out to it, so that
+	// every spend of the block finds its output in memory.  The keys are reordered.
+	void prefetch(UtxoKey *keys,uint32_t count,uint32_t additions)
 	{
-		Transaction *ret = NULL;
-		assert( index < mBlockCount );
-		if ( index < mBlockCount )
+		if ( mMaxSlots == 0 )
 		{
-			ret = mBlocks[index];
-			if ( (index+1) == mBlockCount )
+			return;
+		}
+		uint32_t limit = mMaxSlots/4*3;
+		if ( mCount+additions >= limit && !mFailed )
+		{
+			uint32_t target = mCount/2;
+			if ( mCount+additions-target >= limit )
 			{
-				tcount = (uint32_t)(&mTransactions[mTransactionCount] - ret);
+				target = mCount+additions-limit+1;
 			}
-			else
+			spillOldest(target);
+		}
+		if ( mSpill.isEmpty() )
+		{
+			return;
+		}
+		uint32_t missing = 0;
+		for (uint32_t i=0; i<count; i++)
+		{
+			const UtxoKey &k = keys[i];
+			if ( mSlots == NULL || mSlots[findSlot(k.mHash0,k.mHash1,k.mOutput)].mOutput == UTXO_EMPTY )
 			{
-				tcount = (uint32_t)(mBlocks[index+1] - ret);
+				keys[missing] = k;
+				mKeyDone[missing] = 0;
+				missing++;
 			}
 		}
+		if ( missing )
+		{
+			qsort(keys,missing,sizeof(UtxoKey),compareUtxoKeys);
+			uint32_t found = mSpill.take(keys,missing,mKeyDone,mFound);
+			for (uint32_t i=0; i<found; i++)
+			{
+				insert(mFound[i],NULL);
+			}
+		}
+	}
+
+	// Adds an unspent output; an outpoint which already exists (the duplicate coinbase transactions before BIP-30)
+	// is overwritten, as it is in the reference client, and true is returned with the entry it replaced.
+	bool add(const UtxoEntry &e,UtxoEntry &replaced)
+	{
+		bool ret = insert(e,&replaced);
+		mAddCount++;
+		if ( e.mHeight > mMaxHeight )
+		{
+			mMaxHeight = e.mHeight;
+		}
 		return ret;
 	}
 
-	BitcoinAddress * getAddress(const uint8_t from[20],uint32_t &adr)
+	// Removes the output this input spends, returning its value, address and height; returns false if it is not there
+	bool spend(const uint8_t *transactionHash,uint32_t output,UtxoEntry &entry)
 	{
-		BitcoinAddress *ret = NULL;
-
-		BitcoinAddress h(from);
-		ret = mAddresses.find(h);
-
-		if ( ret == NULL )
+		bool ret = false;
+		if ( mSlots )
 		{
-			ret = mAddresses.insert(h);
+			uint32_t i = findSlot(*(const uint64_t *)transactionHash,*(const uint32_t *)(transactionHash+8),output);
+			if ( mSlots[i].mOutput != UTXO_EMPTY )
+			{
+				entry = mSlots[i];
+				remove(i);
+				mSpendCount++;
+				ret = true;
+			}
 		}
-		if ( ret )
+		if ( !ret )
 		{
-			adr = mAddresses.getIndex(ret) + 1;
+			mMissingCount++;
 		}
 		return ret;
 	}
 
-	uint32_t getAddressCount(void) const
+	// Puts back an output spent by a block which has been disconnected
+	inline void restore(const UtxoEntry &e)
 	{
-		return (uint32_t)mAddresses.size();
+		insert(e,NULL);
 	}
 
-	Transaction * getSingleTransaction(uint32_t index)
+	// Removes an output added by a block which has been disconnected, returning it; under a memory budget it has to
+	// have been brought back in with prefetch first.
+	bool discard(const UtxoKey &k,UtxoEntry &entry)
 	{
-		Transaction *ret = NULL;
-		assert( index < MAX_TOTAL_TRANSACTIONS );
-		assert( index < mTransactionCount );
-		if ( index < mTransactionCount )
+		if ( mSlots )
 		{
-			ret = &mTransactions[index];
+			uint32_t i = findSlot(k.mHash0,k.mHash1,k.mOutput);
+			if ( mSlots[i].mOutput != UTXO_EMPTY )
+			{
+				entry = mSlots[i];
+				remove(i);
+				return true;
+			}
 		}
-		return ret;
+		return false;
 	}
 
-
-	Transaction *getTransactions(uint32_t count)
+	// Writes every entry held in memory; without a budget that is all of them
+	void writeEntries(StateImageWriter &w) const
 	{
-		init();
-		Transaction *ret = NULL;
-		assert( (mTransactionCount+count) < MAX_TOTAL_TRANSACTIONS );
-		if ( (mTransactionCount+count) < MAX_TOTAL_TRANSACTIONS ) 
+		for (uint32_t i=0; i<mSlotCount; i++)
 		{
-			ret = &mTransactions[mTransactionCount];
-			mTransactionCount+=count;
+			if ( mSlots[i].mOutput != UTXO_EMPTY )
+			{
+				w.write(&mSlots[i],sizeof(UtxoEntry));
+			}
 		}
-		return ret;
 	}
 
-	TransactionInput * getInputs(uint32_t count)
+	inline uint32_t size(void) const
 	{
-		TransactionInput *ret = NULL;
-		assert( (mTotalInputCount+count) < MAX_TOTAL_INPUTS );
-		if ( (mTotalInputCount+count) < MAX_TOTAL_INPUTS ) 
-		{
-			ret = &mInputs[mTotalInputCount];
-			mTotalInputCount+=count;
-		}
-		return ret;
+		return mCount+mSpill.getLiveCount();
 	}
 
-	TransactionOutput *getOutputs(uint32_t count)
+	inline bool hasBudget(void) const
 	{
-		TransactionOutput *ret = NULL;
-		assert( (mTotalOutputCount+count) < MAX_TOTAL_OUTPUTS );
-		if ( (mTotalOutputCount+count) < MAX_TOTAL_OUTPUTS )
-		{
-			ret = &mOutputs[mTotalOutputCount];
-			mTotalOutputCount+=count;
-		}
-		return ret;
+		return mMaxSlots != 0;
 	}
 
-	TransactionOutput * getOutput(uint32_t index)
+	// True once an output could not be kept, or the set could not be kept under its budget; processing has to stop
+	inline bool hasFailed(void) const
 	{
-		TransactionOutput *ret = NULL;
-		assert( index < mTotalOutputCount );
-		if ( index < mTotalOutputCount )
+		return mFailed;
+	}
+
+	inline uint32_t getMergeCount(void) const
+	{
+		return mSpill.getMergeCount();
+	}
+
+	void report(void) const
+	{
+		printf("UTXO set: %s unspent outputs (peak %s in memory) in %s slots, %s MB; %s outputs added, %s spent, %s spends not found.\r\n",
+			formatNumber(size()),
+			formatNumber(mPeakCount),
+			formatNumber(mSlotCount),
+			formatNumber((int32_t)(((uint64_t)mSlotCount*sizeof(UtxoEntry))>>20)),
+			formatNumber((int32_t)mAddCount),
+			formatNumber((int32_t)mSpendCount),
+			formatNumber((int32_t)mMissingCount));
+		if ( mMaxSlots )
 		{
-			ret = &mOutputs[index];
+			printf("UTXO memory budget: at most %s slots in memory.\r\n", formatNumber(mMaxSlots) );
+			mSpill.report();
 		}
-		return ret;
 	}
 
-	const char *getKey(uint32_t a) const
+private:
+	// Returns true, with the entry it replaced in 'replaced' if that is given, if the outpoint was already there
+	bool insert(const UtxoEntry &e,UtxoEntry *replaced)
 	{
-		static char scratch[256];
-		const char *ret = "UNKNOWN ADDRESS";
-		if ( a )
+		if ( (mCount+1)*4 > mSlotCount*3 )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(a-1);
-			uint8_t address1[25];
-			BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress((const uint8_t *)ba,address1);
-			BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(address1,scratch,256);
-			ret = scratch;
+			if ( mMaxSlots && mSlotCount >= mMaxSlots && !mFailed )
+			{
+				// prefetch should always have left room; spilling here could move out an output the block still spends
+				spillOldest(mCount/2);
+			}
+			else
+			{
+				grow();
+			}
+		}
+		if ( mSlots == NULL || mCount+1 >= mSlotCount )
+		{
+			mFailed = true; // no room at all; processing stops at the end of the block
+			return false;
+		}
+		uint32_t i = findSlot(e.mHash0,e.mHash1,e.mOutput);
+		bool ret = mSlots[i].mOutput != UTXO_EMPTY;
+		if ( ret )
+		{
+			if ( replaced )
+			{
+				*replaced = mSlots[i];
+			}
+		}
+		else
+		{
+			mCount++;
+			if ( mCount > mPeakCount )
+			{
+				mPeakCount = mCount;
+			}
 		}
+		mSlots[i] = e;
 		return ret;
 	}
 
-	void printTransaction(uint32_t index,Transaction *t,uint32_t address)
+	// Moves at least 'target' of the oldest outputs out to the spill log.  A histogram of the creation heights gives
+	// the height below which they are taken, and they are written out a buffer full at a time.
+	void spillOldest(uint32_t target)
 	{
-
-		uint64_t totalInput=0;
-		uint64_t totalOutput=0;
-		uint64_t coinBase=0;
-
-		for (uint32_t i=0; i<t->mOutputCount; i++)
+		if ( target > mCount )
 		{
-			TransactionOutput &o = t->mOutputs[i];
-			totalOutput+=o.mValue;
+			target = mCount;
 		}
-		for (uint32_t i=0; i<t->mInputCount; i++)
+		uint32_t histogram[UTXO_HEIGHT_BUCKETS];
+		memset(histogram,0,sizeof(histogram));
+		uint64_t scale = (uint64_t)mMaxHeight+1;
+		for (uint32_t i=0; i<mSlotCount; i++)
 		{
-			TransactionInput &input = t->mInputs[i];
-			if ( input.mOutput )
+			if ( mSlots[i].mOutput != UTXO_EMPTY )
 			{
-				TransactionOutput &o = *input.mOutput;
-				totalInput+=o.mValue;
+				histogram[(uint64_t)mSlots[i].mHeight*UTXO_HEIGHT_BUCKETS/scale]++;
 			}
 		}
-
-		printf("    Transaction #%s From Block: %s has %s inputs and %s outputs time: %s.\r\n", formatNumber(index), formatNumber(t->mBlock), formatNumber(t->mInputCount), formatNumber(t->mOutputCount), getTimeString(t->mTime) );
-
-		printf("    Total Input: %0.4f Total Output: %0.4f : Fees: %0.4f\r\n", 
-			(float)totalInput / ONE_BTC, 
-			(float) totalOutput / ONE_BTC, 
-			(float)((totalOutput-totalInput)-coinBase) / ONE_BTC );
-
-		for (uint32_t i=0; i<t->mInputCount; i++)
+		uint32_t threshold = 0;
+		uint32_t total = 0;
+		while ( threshold < UTXO_HEIGHT_BUCKETS-1 && total+histogram[threshold] < target )
+		{
+			total+=histogram[threshold];
+			threshold++;
+		}
+		// Entries removed from slot i are replaced by later entries of the same run, so slot i is looked at again
+		uint32_t evicted = 0;
+		uint32_t spilled = 0;
+		uint32_t i = 0;
+		while ( i < mSlotCount && spilled+evicted < target )
 		{
-			TransactionInput &input = t->mInputs[i];
-			if ( input.mOutput )
+			const UtxoEntry &e = mSlots[i];
+			if ( e.mOutput != UTXO_EMPTY && (uint64_t)e.mHeight*UTXO_HEIGHT_BUCKETS/scale <= threshold )
 			{
-				TransactionOutput &o = *input.mOutput;
-				if ( o.mAddress == address )
-				{
-					printf("        [Input] "); 
-				}
-				else
+				mEvicted[evicted++] = e;
+				remove(i);
+				if ( evicted == mEvictCapacity )
 				{
-					printf("         Input  "); 
+					if ( !writeEvicted(evicted) )
+					{
+						return;
+					}
+					spilled+=evicted;
+					evicted = 0;
 				}
-				printf("%d : %s[%d] : Value %0.4f\r\n", i, getKey(o.mAddress),o.mAddress, (float)o.mValue / ONE_BTC );
 			}
 			else
 			{
-				printf("        [Input] %d : COINBASE\r\n", i );
+				i++;
 			}
 		}
+		writeEvicted(evicted);
+	}
 
-		for (uint32_t i=0; i<t->mOutputCount; i++)
+	// Writes the evicted outputs to the spill log.  If the log cannot be written they go back into the slots they
+	// were just taken from, and the set stops spilling and grows past its budget until processing stops at the end of
+	// the block.
+	bool writeEvicted(uint32_t count)
+	{
+		if ( mSpill.write(mEvicted,count) )
 		{
-			TransactionOutput &o = t->mOutputs[i];
-			if ( o.mAddress == address )
-			{
-				printf("        [Output] ");
-			}
-			else
+			return true;
+		}
+		printf("The UTXO set cannot be kept under its memory budget without the spill log '%s'.\r\n", UTXO_SPILL_FILE );
+		for (uint32_t i=0; i<count; i++)
+		{
+			const UtxoEntry &e = mEvicted[i];
+			mSlots[findSlot(e.mHash0,e.mHash1,e.mOutput)] = e;
+			mCount++;
+		}
+		mFailed = true;
+		return false;
+	}
+
+	inline uint32_t getHome(uint64_t hash0,uint32_t output) const
+	{
+		uint64_t h = (hash0 ^ ((uint64_t)output*0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+		return (uint32_t)(h>>32) & (mSlotCount-1);
+	}
+
+	// Returns the slot holding this outpoint, or the empty slot where it would go
+	inline uint32_t findSlot(uint64_t hash0,uint32_t hash1,uint32_t output) const
+	{
+		uint32_t i = getHome(hash0,output);
+		for (;;)
+		{
+			const UtxoEntry &e = mSlots[i];
+			if ( e.mOutput == UTXO_EMPTY || (e.mHash0 == hash0 && e.mHash1 == hash1 && e.mOutput == output) )
 			{
-				printf("         Output  ");
+				return i;
 			}
-			printf("%d : %s[%d] : Value %0.4f\r\n", i, getKey(o.mAddress),o.mAddress, (float)o.mValue / ONE_BTC );
+			i = (i+1) & (mSlotCount-1);
 		}
 	}
 
-	void printTransactions(uint32_t blockIndex)
+	// Empties slot 'i' and moves back any later entry of the same run which would otherwise become unreachable
+	void remove(uint32_t i)
 	{
-		uint32_t tcount;
-		Transaction *t = getBlock(blockIndex,tcount);
-		if ( t )
+		uint32_t j = i;
+		for (;;)
 		{
-			printf("===================================================\r\n");
-			printf("Block #%s has %s transactions.\r\n", formatNumber(blockIndex), formatNumber(tcount) );
-			for (uint32_t j=0; j<tcount; j++)
+			j = (j+1) & (mSlotCount-1);
+			if ( mSlots[j].mOutput == UTXO_EMPTY )
 			{
-				printTransaction(j,t,0);
-				t++;
+				break;
+			}
+			uint32_t home = getHome(mSlots[j].mHash0,mSlots[j].mOutput);
+			// The entry at j may move to i only if its home is not cyclically within (i,j]
+			bool between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+			if ( !between )
+			{
+				mSlots[i] = mSlots[j];
+				i = j;
 			}
-			printf("===================================================\r\n");
-			printf("\r\n");
 		}
+		mSlots[i].mOutput = UTXO_EMPTY;
+		mCount--;
 	}
 
-	void reportCounts(void)
+	// Doubles the table; if that cannot be allocated the current one is kept
+	void grow(void)
 	{
-		if ( mTransactionCount )
+		UtxoEntry *old = mSlots;
+		uint32_t oldCount = mSlotCount;
+		uint32_t slotCount = mSlotCount ? mSlotCount*2 : UTXO_INITIAL_SLOTS;
+		UtxoEntry *slots = (UtxoEntry *)allocPages(sizeof(UtxoEntry)*(uint64_t)slotCount);
+		if ( slots == NULL )
 		{
-			printf("%s transactions.\r\n", formatNumber(mTransactionCount) );
-			printf("%s inputs.\r\n", formatNumber(mTotalInputCount) );
-			printf("%s outputs.\r\n", formatNumber(mTotalOutputCount) );
-			printf("%s addresses.\r\n", formatNumber(mAddresses.size()) );
-
-			enum StatType
-			{
-				ST_ZERO,
-				ST_DUST,
-				ST_LESSONE,
-				ST_LESSTEN,
-				ST_LESS_HUNDRED,
-				ST_LESS_THOUSAND,
-				ST_LESS_TEN_THOUSAND,
-				ST_LESS_HUNDRED_THOUSAND,
-				ST_GREATER_HUNDRED_THOUSAND,
-				ST_LAST
-			};
-			uint32_t counts[ST_LAST];
-			uint64_t balances[ST_LAST];
-			for (uint32_t i=0; i<ST_LAST; i++)
+			return;
+		}
+		mSlots = slots;
+		mSlotCount = slotCount;
+		for (uint32_t i=0; i<mSlotCount; i++)
+		{
+			mSlots[i].mOutput = UTXO_EMPTY;
+		}
+		for (uint32_t i=0; i<oldCount; i++)
+		{
+			if ( old[i].mOutput != UTXO_EMPTY )
 			{
-				counts[i] = 0;
-				balances[i] = 0;
+				mSlots[findSlot(old[i].mHash0,old[i].mHash1,old[i].mOutput)] = old[i];
 			}
+		}
+		freePages(old,sizeof(UtxoEntry)*(uint64_t)oldCount);
+	}
 
-			for (uint32_t i=0; i<mAddresses.size(); i++)
+	UtxoEntry	*mSlots;
+	uint32_t	mSlotCount;
+	uint32_t	mMaxSlots;			// The most slots allowed under the memory budget; zero if there is no budget
+	uint32_t	mCount;
+	uint32_t	mPeakCount;
+	uint32_t	mMaxHeight;
+	uint64_t	mAddCount;
+	uint64_t	mSpendCount;
+	uint64_t	mMissingCount;
+	UtxoSpill	mSpill;
+	UtxoEntry	*mEvicted;			// The oldest outputs collected here before they are written to the spill log
+	uint32_t	mEvictCapacity;
+	UtxoEntry	*mFound;			// The outputs a block spends brought back from the spill log
+	uint8_t		*mKeyDone;
+	bool		mFailed;
+};
+
+#define UTXO_TEST_BLOCK_OUTPUTS 2000	// Outputs added by each block of the self test
+#define UTXO_TEST_BLOCK_SPENDS 1500		// Spends tried by each block of the self test
+
+// The outpoint of the self test's output 'index'
+static void getTestOutpoint(uint32_t index,uint8_t *hash,uint32_t &output)
+{
+	uint64_t h = (uint64_t)index*0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+	for (uint32_t i=0; i<4; i++)
+	{
+		h ^= h >> 31;
+		h *= 0xBF58476D1CE4E5B9ULL;
+		h ^= h >> 29;
+		memcpy(&hash[i*8],&h,sizeof(h));
+	}
+	output = index & 3;
+}
+
+// Runs the same blocks of made up outputs and spends through a UTXO map under the smallest memory budget and through
+// one with no budget, and checks that every spend finds the same output in both.  Enough outputs stay unspent to
+// write several runs to the spill log and merge them.  Finally every remaining output is spent from both, so the
+// spill log must give back exactly what went into it.
+static bool testUtxoSpill(uint32_t outputCount)
+{
+	UtxoMap *budget = new UtxoMap;
+	UtxoMap *reference = new UtxoMap;
+	budget->setBudget(UTXO_MIN_BUDGET);
+	uint32_t *spent = new uint32_t[(outputCount+31)/32];
+	memset(spent,0,sizeof(uint32_t)*((outputCount+31)/32));
+	UtxoKey *keys = new UtxoKey[MAX_BLOCK_INPUTS];
+	uint32_t *spends = new uint32_t[MAX_BLOCK_INPUTS];
+	uint32_t created = 0;
+	uint32_t height = 0;
+	uint32_t mismatches = 0;
+	uint64_t spendCount = 0;
+	uint32_t seed = 1;
+	uint8_t hash[32];
+	uint32_t output;
+	while ( created < outputCount || spendCount < created )
+	{
+		// The spends of this block, picked at random from every output made so far; then, once every output has been
+		// made, all the ones still unspent
+		uint32_t count = 0;
+		if ( created < outputCount )
+		{
+			for (uint32_t i=0; i<UTXO_TEST_BLOCK_SPENDS && created; i++)
 			{
-				BitcoinAddress *ba = mAddresses.getKey(i);
-				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-				uint32_t btc = (uint32_t)(balance/ONE_BTC);
-				if ( balance == 0 )
-				{
-					counts[ST_ZERO]++;
-				}
-				else if ( balance < ONE_MBTC )
-				{
-					counts[ST_DUST]++;
-					balances[ST_DUST]+=balance;
-				}
-				else if ( balance < ONE_BTC )
-				{
-					counts[ST_LESSONE]++;
-					balances[ST_LESSONE]+=balance;
-				}
-				else if ( btc < 10 )
-				{
-					counts[ST_LESSTEN]++;
-					balances[ST_LESSTEN]+=btc;
-				}
-				else if ( btc < 100 )
-				{
-					counts[ST_LESS_HUNDRED]++;
-					balances[ST_LESS_HUNDRED]+=btc;
-				}
-				else if ( btc < 1000 )
-				{
-					counts[ST_LESS_THOUSAND]++;
-					balances[ST_LESS_THOUSAND]+=btc;
-				}
-				else if ( btc < 10000 )
+				seed = seed*1664525+1013904223;
+				uint32_t index = (uint32_t)(((uint64_t)seed*created)>>32);
+				if ( !(spent[index>>5] & (1<<(index&31))) )
 				{
-					counts[ST_LESS_TEN_THOUSAND]++;
-					balances[ST_LESS_TEN_THOUSAND]+=btc;
+					spent[index>>5]|=1<<(index&31);
+					spends[count++] = index;
 				}
-				else if ( btc < 100000 )
+			}
+		}
+		else
+		{
+			for (uint32_t index=0; index<created && count<MAX_BLOCK_INPUTS; index++)
+			{
+				if ( !(spent[index>>5] & (1<<(index&31))) )
 				{
-					counts[ST_LESS_HUNDRED_THOUSAND]++;
-					balances[ST_LESS_HUNDRED_THOUSAND]+=btc;
+					spent[index>>5]|=1<<(index&31);
+					spends[count++] = index;
 				}
-				else
+			}
+		}
+		uint32_t additions = created < outputCount ? outputCount-created : 0;
+		if ( additions > UTXO_TEST_BLOCK_OUTPUTS )
+		{
+			additions = UTXO_TEST_BLOCK_OUTPUTS;
+		}
+		for (uint32_t i=0; i<count; i++)
+		{
+			getTestOutpoint(spends[i],hash,output);
+			memcpy(&keys[i].mHash0,hash,sizeof(uint64_t));
+			memcpy(&keys[i].mHash1,&hash[8],sizeof(uint32_t));
+			keys[i].mOutput = output;
+		}
+		budget->prefetch(keys,count,additions+count);
+		for (uint32_t i=0; i<count; i++)
+		{
+			getTestOutpoint(spends[i],hash,output);
+			UtxoEntry a;
+			UtxoEntry b;
+			bool foundA = budget->spend(hash,output,a);
+			bool foundB = reference->spend(hash,output,b);
+			if ( !foundA || !foundB || a.mValue != b.mValue || a.mAddress != b.mAddress || a.mHeight != b.mHeight ||
+				 memcmp(a.mDigest,b.mDigest,sizeof(a.mDigest)) != 0 )
+			{
+				if ( mismatches < 10 )
 				{
-					counts[ST_GREATER_HUNDRED_THOUSAND]++;
-					balances[ST_GREATER_HUNDRED_THOUSAND]+=btc;
+					printf("Output #%d differs: %s under the budget, %s without it.\r\n", spends[i], foundA ? "found" : "missing", foundB ? "found" : "missing" );
 				}
+				mismatches++;
 			}
-			printf("Found %s addresses which have ever been used.\r\n", formatNumber(mAddresses.size()) );
-
-			printf("Found %s addresses with a zero balance.\r\n", formatNumber( counts[ST_ZERO]) );
-
-			printf("Found %s 'dust' addresses (less than 1mbtc) with a total balance of %0.5f BTC\r\n", 
-				formatNumber( counts[ST_DUST] ), 
-				(float)balances[ST_DUST] / ONE_BTC );
-
-			printf("Found %s addresses with a balance greater than 1mbtc but less than 1btc, total balance %0.5f\r\n",
-				formatNumber(counts[ST_LESSONE]),
-				(float)balances[ST_LESSONE]/ONE_BTC );
-
-			printf("Found %s addresses with a balance greater than 1btc but less than 10btc, total btc: %s\r\n",
-				formatNumber(counts[ST_LESSTEN]),
-				formatNumber((uint32_t)balances[ST_LESSTEN]));
-
-			printf("Found %s addresses with a balance greater than 10btc but less than 100btc, total: %s\r\n",
-				formatNumber(counts[ST_LESS_HUNDRED]),
-				formatNumber((uint32_t)balances[ST_LESS_HUNDRED]));
+			spendCount++;
+		}
+		for (uint32_t i=0; i<additions; i++)
+		{
+			getTestOutpoint(created,hash,output);
+			UtxoEntry e;
+			UtxoEntry replaced;
+			e.set(hash,output,(uint64_t)created*1000+7,created*7+1,height);
+			memcpy(e.mDigest,hash,sizeof(e.mDigest)); // made up, but it has to come back from the spill log intact
+			budget->add(e,replaced);
+			reference->add(e,replaced);
+			created++;
+		}
+		height++;
+	}
+	bool ok = mismatches == 0 && budget->size() == 0 && reference->size() == 0 && budget->getMergeCount() != 0;
+	budget->report();
+	printf("UTXO spill self test %s: %s outputs over %s blocks, %s spends, %s mismatches, %s merges of the spill log.\r\n",
+		ok ? "passed" : "FAILED",
+		formatNumber(outputCount),
+		formatNumber(height),
+		formatNumber((int32_t)spendCount),
+		formatNumber(mismatches),
+		formatNumber(budget->getMergeCount()));
+	delete budget;
+	delete reference;
+	delete []spent;
+	delete []keys;
+	delete []spends;
+	return ok;
+}
 
-			printf("Found %s addresses with a balance greater than 100btc but less than 1,000btc, total: %s\r\n",
-				formatNumber(counts[ST_LESS_THOUSAND]),
-				formatNumber((uint32_t)balances[ST_LESS_THOUSAND]));
+#define TX_TEST_DUPLICATE_RATE 8		// Every eighth record of the transaction index self test reuses an earlier hash
 
-			printf("Found %s addresses with a balance greater than 1,000btc but less than 10,000btc, total: %s\r\n",
-				formatNumber(counts[ST_LESS_TEN_THOUSAND]),
-				formatNumber((uint32_t)balances[ST_LESS_TEN_THOUSAND]));
+// Fills a transaction index with made up hashes where every eighth record reuses the hash of an earlier one, the way
+// the two BIP-30 coinbase transactions do, and checks that 'find' always gives the most recent record for a hash.
+// The shards resize many times along the way, so plenty of the duplicates land while a shard is still migrating.
+// The same check is made again once the index is frozen.
+static bool testTransactionIndex(uint32_t recordCount)
+{
+	TransactionHashMap *map = new TransactionHashMap;
+	uint32_t *latest = new uint32_t[recordCount];	// The most recent record for each distinct hash
+	uint32_t distinct = 0;
+	uint32_t duplicates = 0;
+	uint32_t mismatches = 0;
+	uint32_t seed = 1;
+	uint8_t hash[32];
+	uint32_t output;
+	for (uint32_t index=0; index<recordCount; index++)
+	{
+		uint32_t key = distinct;
+		if ( distinct && (index % TX_TEST_DUPLICATE_RATE) == TX_TEST_DUPLICATE_RATE-1 )
+		{
+			seed = seed*1664525+1013904223;
+			key = (uint32_t)(((uint64_t)seed*distinct)>>32);
+			duplicates++;
+		}
+		else
+		{
+			distinct++;
+		}
+		getTestOutpoint(key,hash,output);
+		Hash256 h(hash);
+		map->insert(h,index,0,0,0);
+		latest[key] = index;
+		uint32_t found;
+		if ( !map->find(h,found) || found != index )
+		{
+			mismatches++;
+		}
+	}
+	for (uint32_t pass=0; pass<2; pass++)
+	{
+		if ( pass )
+		{
+			map->freeze(1);
+		}
+		for (uint32_t key=0; key<distinct; key++)
+		{
+			getTestOutpoint(key,hash,output);
+			uint32_t found;
+			if ( !map->find(Hash256(hash),found) || found != latest[key] )
+			{
+				if ( mismatches < 10 )
+				{
+					printf("Hash #%d finds record %d instead of %d%s.\r\n", key, (int32_t)found, latest[key], pass ? " once frozen" : "" );
+				}
+				mismatches++;
+			}
+		}
+	}
+	bool ok = mismatches == 0 && map->size() == distinct;
+	map->report("Transaction index self test");
+	printf("Transaction index self test %s: %s records, %s distinct hashes, %s duplicates, %s mismatches.\r\n",
+		ok ? "passed" : "FAILED",
+		formatNumber(recordCount),
+		formatNumber(distinct),
+		formatNumber(duplicates),
+		formatNumber(mismatches));
+	delete map;
+	delete []latest;
+	return ok;
+}
 
-			printf("Found %s addresses with a balance greater than 10,000btc but less than 100,000btc, total: %s\r\n",
-				formatNumber(counts[ST_LESS_HUNDRED_THOUSAND]),
-				formatNumber((uint32_t)balances[ST_LESS_HUNDRED_THOUSAND]));
+// The UTXO set commitment: the MuHash3072 of the unspent outputs, the same value as the reference client's
+// 'gettxoutsetinfo muhash', kept up to date as the blocks are processed so it is ready at every height.  Each output
+// is hashed the way the reference client serializes it (outpoint, height and coinbase flag, value and script); the
+// scripts are not kept, so the SHA256 of each unspent output is, to take it back out of the set when it is spent.
+// The digests live in the UTXO set's own entries, so they come under its memory budget and spill with them; in
+// history mode the UTXO set is kept just for them.  The outputs the reference client never puts in its UTXO set are
+// left out: the genesis coinbase, unspendable scripts, and the two coinbases which were overwritten by duplicates
+// before BIP-30.
+#define MAX_SCRIPT_SIZE 10000		// A longer output script can never be spent
+#define BIP30_UNSPENDABLE_1 91722	// The heights of the overwritten coinbases
+#define BIP30_UNSPENDABLE_2 91812
+
+class UtxoCommitment
+{
+public:
+	UtxoCommitment(void)
+	{
+		mEnabled = false;
+		mCount = 0;
+		mTotalValue = 0;
+	}
 
-			printf("Found %s addresses with a balance greater than 100,000btc, total: %s\r\n",
-				formatNumber(counts[ST_GREATER_HUNDRED_THOUSAND]),
-				formatNumber((uint32_t)balances[ST_GREATER_HUNDRED_THOUSAND]));
+	inline void setEnabled(bool state)
+	{
+		mEnabled = state;
+	}
 
+	inline bool isEnabled(void) const
+	{
+		return mEnabled;
+	}
 
+	// Fills in the digest of an output created at 'height'; returns false, leaving it all zeros, if the output is not
+	// part of the UTXO set.
+	bool computeDigest(const uint8_t *transactionHash,uint32_t output,uint32_t height,bool coinbase,const BlockChain::BlockOutput &o,uint8_t digest[32]) const
+	{
+		memset(digest,0,32);
+		if ( height == 0 ||
+			 (o.challengeScriptLength && o.challengeScript[0] == OP_RETURN) ||
+			 o.challengeScriptLength > MAX_SCRIPT_SIZE ||
+			 (coinbase && (height == BIP30_UNSPENDABLE_1 || height == BIP30_UNSPENDABLE_2)) )
+		{
+			return false;
 		}
+		hashOutput(transactionHash,output,height*2+(coinbase ? 1 : 0),o,digest);
+		return true;
 	}
 
-
-	void gatherTransaction(BitcoinAddress *ba,Transaction *t,uint32_t tindex)
+	// Puts an unspent output into the commitment; one without a digest is not part of it
+	inline void add(const UtxoEntry &e)
 	{
-		if ( ba && ba->mTransactionIndex != tindex )
+		if ( e.hasDigest() )
 		{
-			ba->mTransactionIndex = tindex;
-			ba->mTransactions[ba->mTransactionCount] = t;
-			ba->mTransactionCount++;
+			mHash.insert(e.mDigest);
+			mCount++;
+			mTotalValue+=e.mValue;
 		}
 	}
 
-	void countTransaction(BitcoinAddress *ba,
-						  uint32_t tindex,
-						  uint32_t &transactionReferenceCount)
+	// Takes an output which has been spent, or replaced by a duplicate, back out
+	inline void remove(const UtxoEntry &e)
 	{
-		if ( ba && ba->mTransactionIndex != tindex )
+		if ( e.hasDigest() )
 		{
-			ba->mTransactionIndex = tindex;
-			ba->mTransactionCount++;
-			transactionReferenceCount++;
+			mHash.remove(e.mDigest);
+			mCount--;
+			mTotalValue-=e.mValue;
 		}
 	}
 
-	BitcoinAddress *getAddress(uint32_t a)
+	void report(void) const
 	{
-		BitcoinAddress *ret = NULL;
-		if ( a )
+		uint8_t hash[32];
+		mHash.finalize(hash);
+		printf("UTXO set commitment (MuHash3072): ");
+		for (uint32_t i=0; i<32; i++)
 		{
-			ret = mAddresses.getKey(a-1);
+			printf("%02x", hash[31-i] );
 		}
-		return ret;
+		printf("\r\n");
+		printf("UTXO set commitment covers %s unspent outputs holding %0.8f BTC.\r\n",
+			formatNumber(mCount),
+			(double)mTotalValue / ONE_BTC);
 	}
 
+	// The state image section: the set hash, the totals, then the entries of the UTXO set holding the digests.  It is
+	// only written in history mode, where the UTXO set has no budget and is all in memory.
+	void writeState(StateImageWriter &w,const UtxoMap &utxo) const
+	{
+		w.write(&mHash,sizeof(mHash));
+		w.write(&mCount,sizeof(mCount));
+		w.write(&mTotalValue,sizeof(mTotalValue));
+		utxo.writeEntries(w);
+	}
 
-	void gatherAddresses(void)
+	bool readState(const uint8_t *data,uint64_t size,UtxoMap &utxo)
 	{
-		delete []mTransactionReferences;
-		mTransactionReferences = NULL;
+		uint32_t count;
+		uint64_t totalValue;
+		uint64_t head = sizeof(mHash)+sizeof(count)+sizeof(totalValue);
+		if ( size < head )
+		{
+			return false;
+		}
+		memcpy(&count,data+sizeof(mHash),sizeof(count));
+		if ( size != head+(uint64_t)count*sizeof(UtxoEntry) )
+		{
+			return false;
+		}
+		memcpy(&mHash,data,sizeof(mHash));
+		memcpy(&totalValue,data+sizeof(mHash)+sizeof(count),sizeof(totalValue));
+		for (uint32_t i=0; i<count; i++)
+		{
+			UtxoEntry e;
+			memcpy(&e,data+head+(uint64_t)i*sizeof(UtxoEntry),sizeof(UtxoEntry));
+			utxo.restore(e);
+		}
+		mCount = count;
+		mTotalValue = totalValue;
+		mEnabled = true;
+		return utxo.size() == count;
+	}
 
-		for (uint32_t i=0; i<mAddresses.size(); i++)
+private:
+	// The element the reference client hashes: the transaction hash, the output number, the height times two plus
+	// the coinbase flag, the value, and the script with its compact size length.
+	static void hashOutput(const uint8_t *transactionHash,uint32_t output,uint32_t code,const BlockChain::BlockOutput &o,uint8_t digest[32])
+	{
+		uint8_t buffer[32+4+4+8+3+MAX_SCRIPT_SIZE];
+		uint32_t len = 0;
+		memcpy(buffer,transactionHash,32);
+		len+=32;
+		writeLE32(&buffer[len],output);
+		len+=4;
+		writeLE32(&buffer[len],code);
+		len+=4;
+		writeLE32(&buffer[len],(uint32_t)o.value);
+		writeLE32(&buffer[len+4],(uint32_t)(o.value>>32));
+		len+=8;
+		uint32_t scriptLength = o.challengeScriptLength;
+		if ( scriptLength < 253 )
+		{
+			buffer[len++] = (uint8_t)scriptLength;
+		}
+		else
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			ba->mTransactionCount = 0;
-			ba->mTransactionIndex = 0xFFFFFFFF;
-			ba->mTransactions = NULL;
-			ba->mLastInputTime = 0;
-			ba->mLastOutputTime = 0;
-			ba->mFirstOutputTime = 0;
-			ba->mTotalReceived = 0;
-			ba->mTotalSent = 0;
-			ba->mInputCount = 0;
-			ba->mOutputCount = 0;
+			buffer[len++] = 253;
+			buffer[len++] = (uint8_t)scriptLength;
+			buffer[len++] = (uint8_t)(scriptLength>>8);
+		}
+		if ( scriptLength )
+		{
+			memcpy(&buffer[len],o.challengeScript,scriptLength);
+			len+=scriptLength;
 		}
+		BLOCKCHAIN_SHA256::computeSHA256(buffer,len,digest);
+	}
 
-		uint32_t transactionReferenceCount=0;
+	static inline void writeLE32(uint8_t *dest,uint32_t v)
+	{
+		dest[0] = (uint8_t)v;
+		dest[1] = (uint8_t)(v>>8);
+		dest[2] = (uint8_t)(v>>16);
+		dest[3] = (uint8_t)(v>>24);
+	}
 
-		// ok..we.now it's time to add all transactions to all addresses...
-		for (uint32_t i=0; i<mTransactionCount; i++)
+	bool							mEnabled;
+	BLOCKCHAIN_MUHASH::MuHash3072	mHash;
+	uint32_t						mCount;
+	uint64_t						mTotalValue;
+};
+
+// Undo records for the most recently processed blocks, so that when the best chain changes near the tip only the
+// blocks no longer on it have to be disconnected and the new branch processed, instead of the whole chain again.
+// With the transaction history kept, a disconnected block's own transactions say which outputs to mark unspent and
+// everything past it is simply dropped, so its record only needs the counts from before it.  In UTXO mode the record
+// also locates the outputs the block spent, the outputs it added and what it did to each address, in logs shared
+// by all of the records.  When the UTXO set commitment is kept in history mode, the same spent and added logs record
+// the outputs the block took out of the commitment's UTXO set and put in.  Blocks processed without statistics get a
+// record too, of which only the transaction map count and the running totals are used.
+#define UNDO_DEFAULT_DEPTH 100	// Blocks kept; the same as coinbase maturity, far deeper than any reorg to be expected
+#define UNDO_NO_FORK 0xFFFFFFFF	// The best chain left the processed blocks further back than the records reach
+
+class BlockUndo
+{
+public:
+	Hash256		mBlockHash;
+	Hash256		mPreviousBlockHash;
+	uint32_t	mHeight;
+	uint32_t	mReadCount;				// The parser's transaction count, which numbers the transaction map, before the block was read
+	uint32_t	mTransactionCount;		// The factory's counts before the block
+	uint32_t	mInputCount;
+	uint32_t	mOutputCount;
+	uint32_t	mAddressCount;
+	uint32_t	mStatCount;				// Statistics rows gathered by the end of the previous block
+	uint32_t	mTotalTransactionCount;	// The parser's running totals before the block
+	uint32_t	mTotalInputCount;
+	uint32_t	mTotalOutputCount;
+	uint64_t	mSpentStart;			// Where the block's entries begin in each of the UTXO mode logs
+	uint64_t	mAddedStart;
+	uint64_t	mAddressStart;
+};
+
+// One of the logs; it grows at the end and is dropped from the front as the oldest record goes.  Entries are
+// numbered from when the log began, so the positions held by the records stay valid as the front is dropped.
+template < class T > class UndoArray
+{
+public:
+	UndoArray(void)
+	{
+		mData = NULL;
+		mBase = 0;
+		mSkip = 0;
+		mCount = 0;
+		mCapacity = 0;
+	}
+
+	~UndoArray(void)
+	{
+		delete []mData;
+	}
+
+	inline uint64_t end(void) const
+	{
+		return mBase+mCount;
+	}
+
+	inline T *add(void)
+	{
+		if ( mCount == mCapacity )
 		{
-			Transaction &t = mTransactions[i];
-			for (uint32_t j=0; j<t.mOutputCount; j++)
-			{
-				TransactionOutput &o = t.mOutputs[j];
-				BitcoinAddress *ba = getAddress(o.mAddress);
-				countTransaction(ba,i,transactionReferenceCount);
-			}
-			for (uint32_t j=0; j<t.mInputCount; j++)
+			mCapacity = mCapacity ? mCapacity*2 : 4096;
+			T *data = new T[mCapacity];
+			if ( mCount )
 			{
-				TransactionInput &input = t.mInputs[j];
-				if ( input.mOutput )
-				{
-					TransactionOutput &o = *input.mOutput;
-					BitcoinAddress *ba = getAddress(o.mAddress);
-					countTransaction(ba,i,transactionReferenceCount);
-				}
+				memcpy(data,mData,sizeof(T)*mCount);
 			}
+			delete []mData;
+			mData = data;
 		}
+		return &mData[mCount++];
+	}
 
-		mTransactionReferences = new Transaction*[transactionReferenceCount];
-		transactionReferenceCount=0;
-		for (uint32_t i=0; i<mAddresses.size(); i++)
+	// Returns the entries from 'position' on; they are contiguous
+	inline T *get(uint64_t position) const
+	{
+		assert( position >= mBase+mSkip && position <= end() );
+		return &mData[position-mBase];
+	}
+
+	// Drops the entries before 'position'.  Their room is only reclaimed once it is at least half of the log, so
+	// dropping the oldest record each block does not copy the whole log each time.
+	void dropFront(uint64_t position)
+	{
+		mSkip = (uint32_t)(position-mBase);
+		if ( mSkip && mSkip*2 >= mCount )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			ba->mTransactions = &mTransactionReferences[transactionReferenceCount];
-			transactionReferenceCount+=ba->mTransactionCount;
-			ba->mTransactionIndex = 0xFFFFFFFF; // which transaction we have stored yet so far...
-			ba->mTransactionCount = 0;
+			memmove(mData,&mData[mSkip],sizeof(T)*(mCount-mSkip));
+			mCount-=mSkip;
+			mBase+=mSkip;
+			mSkip = 0;
 		}
+	}
 
-		// ok..we.now it's time to add all transactions to all addresses...
-		for (uint32_t i=0; i<mTransactionCount; i++)
-		{
-			Transaction &t = mTransactions[i];
+	// Drops the entries from 'position' on
+	inline void truncate(uint64_t position)
+	{
+		mCount = (uint32_t)(position-mBase);
+	}
 
-			for (uint32_t j=0; j<t.mOutputCount; j++)
-			{
-				TransactionOutput &o = t.mOutputs[j];
-				BitcoinAddress *ba = getAddress(o.mAddress);
-				if ( ba )
-				{
-					gatherTransaction(ba,&t,i);
-					ba->mTotalReceived+=o.mValue;
-					ba->mOutputCount++;
-					if ( t.mTime > ba->mLastOutputTime ) // if the transaction time is more recnet than the last output time..
-					{
-						ba->mLastOutputTime = t.mTime;
-						if ( ba->mFirstOutputTime == 0 ) // if this is the first output encountered, then mark it as the first output time.
-						{
-							ba->mFirstOutputTime = t.mTime;
-						}
-					}
+	inline void clear(void)
+	{
+		mBase+=mCount;
+		mSkip = 0;
+		mCount = 0;
+	}
 
-				}
-			}
+private:
+	T			*mData;
+	uint64_t	mBase;		// The position of mData[0]
+	uint32_t	mSkip;		// Entries at the front which have been dropped but not reclaimed yet
+	uint32_t	mCount;
+	uint32_t	mCapacity;
+};
 
-			for (uint32_t j=0; j<t.mInputCount; j++)
-			{
-				TransactionInput &input = t.mInputs[j];
+class BlockUndoLog
+{
+public:
+	BlockUndoLog(void)
+	{
+		mRecords = NULL;
+		mDepth = UNDO_DEFAULT_DEPTH;
+		mFirst = 0;
+		mCount = 0;
+		mRecording = false;
+	}
 
-				if ( input.mOutput )
-				{
-					TransactionOutput &o = *input.mOutput;
-					BitcoinAddress *ba = getAddress(o.mAddress);
-					if ( ba )
-					{
-						gatherTransaction(ba,&t,i);
-						ba->mTotalSent+=o.mValue;
-						ba->mInputCount++;
-						if ( t.mTime > ba->mLastInputTime ) // if the transaction time is newer than the last input/spent time..
-						{
-							ba->mLastInputTime = t.mTime;
-						}
-					}
-				}
+	~BlockUndoLog(void)
+	{
+		delete []mRecords;
+	}
 
-			}
-		}
+	// Keeps records for this many blocks; any records kept so far are dropped
+	void setDepth(uint32_t depth)
+	{
+		clear();
+		delete []mRecords;
+		mRecords = NULL;
+		mDepth = depth;
 	}
 
-	void printTopBalances(uint32_t tcount,uint32_t minBalance)
+	inline uint32_t getDepth(void) const
 	{
-		uint32_t plotCount = 0;
-		uint64_t mbtc = minBalance*ONE_BTC;
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		return mDepth;
+	}
+
+	// Starts the record of the block about to be processed at 'height', dropping the oldest if all are in use.
+	// Returns NULL if no records are kept.
+	BlockUndo *begin(uint32_t height)
+	{
+		mRecording = false;
+		if ( mDepth == 0 )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->getBalance();
-			if ( balance >= mbtc )
-			{
-				plotCount++;
-			}
+			return NULL;
 		}
-
-		if ( !plotCount )
+		if ( mRecords == NULL )
 		{
-			printf("No addresses found with a balance more than %d bitcoins\r\n", minBalance );
-			return;
+			mRecords = new BlockUndo[mDepth];
 		}
+		if ( mCount && get(mCount-1).mHeight+1 != height ) // processing did not carry on from the last block
+		{
+			clear();
+		}
+		if ( mCount == mDepth )
+		{
+			mFirst = (mFirst+1)%mDepth;
+			mCount--;
+			mSpent.dropFront(mCount ? get(0).mSpentStart : mSpent.end());
+			mAdded.dropFront(mCount ? get(0).mAddedStart : mAdded.end());
+			mAddresses.dropFront(mCount ? get(0).mAddressStart : mAddresses.end());
+		}
+		BlockUndo &u = mRecords[(mFirst+mCount)%mDepth];
+		mCount++;
+		u.mHeight = height;
+		u.mSpentStart = mSpent.end();
+		u.mAddedStart = mAdded.end();
+		u.mAddressStart = mAddresses.end();
+		mRecording = true;
+		return &u;
+	}
 
-		BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
-		plotCount = 0;
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+	// Room in the logs for the block being recorded; NULL if it is not being recorded
+	inline UtxoEntry *addSpent(void)
+	{
+		return mRecording ? mSpent.add() : NULL;
+	}
+
+	inline UtxoKey *addAdded(void)
+	{
+		return mRecording ? mAdded.add() : NULL;
+	}
+
+	inline AddressUndo *addAddress(void)
+	{
+		return mRecording ? mAddresses.add() : NULL;
+	}
+
+	inline uint32_t size(void) const
+	{
+		return mCount;
+	}
+
+	// Record 'i', oldest first
+	inline BlockUndo &get(uint32_t i) const
+	{
+		assert( i < mCount );
+		return mRecords[(mFirst+i)%mDepth];
+	}
+
+	// The log entries of record 'i'
+	inline uint32_t getSpent(uint32_t i,UtxoEntry *&entries) const
+	{
+		return getEntries(mSpent,get(i).mSpentStart,i+1 < mCount ? get(i+1).mSpentStart : mSpent.end(),entries);
+	}
+
+	inline uint32_t getAdded(uint32_t i,UtxoKey *&keys) const
+	{
+		return getEntries(mAdded,get(i).mAddedStart,i+1 < mCount ? get(i+1).mAddedStart : mAdded.end(),keys);
+	}
+
+	inline uint32_t getAddresses(uint32_t i,AddressUndo *&entries) const
+	{
+		return getEntries(mAddresses,get(i).mAddressStart,i+1 < mCount ? get(i+1).mAddressStart : mAddresses.end(),entries);
+	}
+
+	// Drops the records from 'i' on, once their blocks have been disconnected
+	void truncate(uint32_t i)
+	{
+		if ( i < mCount )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->getBalance();
-			if ( balance >= mbtc )
-			{
-				sortPointers[plotCount] = ba;
-				plotCount++;
-			}
+			const BlockUndo &u = get(i);
+			mSpent.truncate(u.mSpentStart);
+			mAdded.truncate(u.mAddedStart);
+			mAddresses.truncate(u.mAddressStart);
+			mCount = i;
 		}
-		SortByBalance sb(sortPointers,plotCount);
-		time_t currentTime;
-		time(&currentTime); // get the current time.
+		mRecording = false;
+	}
+
+	void clear(void)
+	{
+		mSpent.clear();
+		mAdded.clear();
+		mAddresses.clear();
+		mFirst = 0;
+		mCount = 0;
+		mRecording = false;
+	}
+
+private:
+	template < class T > static inline uint32_t getEntries(const UndoArray< T > &log,uint64_t start,uint64_t end,T *&entries)
+	{
+		entries = log.get(start);
+		return (uint32_t)(end-start);
+	}
+
+	BlockUndo				*mRecords;		// A ring of mDepth records
+	uint32_t				mDepth;
+	uint32_t				mFirst;			// The oldest record
+	uint32_t				mCount;
+	bool					mRecording;		// True while the newest record is for the block being processed
+	UndoArray< UtxoEntry >	mSpent;			// The outputs each block spent
+	UndoArray< UtxoKey >	mAdded;			// The outputs each block added
+	UndoArray< AddressUndo >	mAddresses;	// What each output received or spent did to its address
+};
+
+#define BLOCK_HEADERS_FILE "BlockHeaders.csv"	// The header time series written by saveBlockHeaders
 
-		if ( plotCount < tcount )
+#define PREVOUT_BATCH 256 // How many inputs are queued up before their spent outputs are looked up together
+
+// This is the implementation of the BlockChain parser interface
+class BlockChainImpl : public BlockChain
+{
+public:
+	BlockChainImpl(const char *rootPath)
+	{
+		sprintf(mRootDir,"%s",rootPath);
+		mCurrentBlockData = mBlockDataBuffer;	// scratch buffers to read in up to 3 block.
+		mTransactionCount = 0;
+		mBlockIndex = 0;
+		mBlockBase = 0;
+		mReadCount = 0;
+		for (uint32_t i=0; i<MAX_BLOCK_FILES; i++)
 		{
-			tcount = plotCount;
+			mBlockChain[i] = NULL;
 		}
-		printf("Displaying the top %d addresses by balance.\r\n", tcount );
-		printf("==============================================\r\n");
-		printf(" Address           : Balance  : Days Since Last Use\r\n");
-		printf("==============================================\r\n");
-		for (uint32_t i=0; i<tcount; i++)
+		mBlockCount = 0;
+		mScanCount = 0;
+		mScanOffset = 0;
+		mBlockHeaders.reserve(MAX_TOTAL_BLOCKS);
+		mBlockTimes = NULL;
+		mMaxBlockTimes = NULL;
+		mLastBlockHeaderCount = 0;
+		mLinkedHeaders = 0;
+		mUnlinked = NULL;
+		mUnlinkedCount = 0;
+		mUnlinkedCapacity = 0;
+		mLinkStack = NULL;
+		mLinkStackCapacity = 0;
+		mBestHeader = HEADER_NO_PARENT;
+		mWorkBits = 0;
+		mTotalInputCount = 0;
+		mTotalOutputCount = 0;
+		mTotalTransactionCount = 0;
+		mPrevoutCount = 0;
+		mPublicKeyCount = 0;
+		mPublicKeyIndex = 0;
+		mMissIndex = 0;
+		mTransactionIndexOpened = false;
+		mLookupBlock = 0xFFFFFFFF;
+		mAddressDirectoryOpened = false;
+		mProcessedStatCount = 0;
+		mProcessingFailed = false;
+		mPartlyProcessed = false;
+		openBlock();	// open the input file
+	}
+
+	// Close all blockchain files which have been opended so far
+	virtual ~BlockChainImpl(void)
+	{
+		for (uint32_t i=0; i<MAX_BLOCK_FILES; i++) // files past mBlockIndex may have been opened by a lookup
 		{
-			BitcoinAddress *ba = sortPointers[i];
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+			if ( mBlockChain[i] )
 			{
-				lastUsed = ba->mFirstOutputTime;
+				fclose(mBlockChain[i]);	// close the block-chain file pointer
 			}
-			double seconds = difftime(currentTime,time_t(lastUsed));
-			double minutes = seconds/60;
-			double hours = minutes/60;
-			uint32_t days = (uint32_t) (hours/24);
-			uint32_t adr = mAddresses.getIndex(ba)+1;
-			printf("%40s,  %8d,  %4d\r\n", getKey(adr), (uint32_t)( balance / ONE_BTC ), days );
 		}
-		delete []sortPointers;
+		delete []mBlockTimes;
+		delete []mMaxBlockTimes;
+		delete []mUnlinked;
+		delete []mLinkStack;
 	}
 
-	void zombieReport(uint32_t zdays,uint32_t minBalance)
+	void getBlockFileName(uint32_t fileIndex,char *scratch)
 	{
-		uint32_t zombie_count=0;
-		uint32_t alive_count=0;
-		uint32_t zombie_balance=0;
-		uint32_t alive_balance=0;
-		uint64_t mbtc = minBalance*ONE_BTC;
-		time_t currentTime;
-		time(&currentTime); // get the current time.
-		printf("Scanning %s bitcoin addresses and looking for zombies.\r\n", formatNumber(mAddresses.size()));
+#ifdef _MSC_VER
+		sprintf(scratch,"%s\\blk%05d.dat", mRootDir, fileIndex );	// get the filename
+#else
+		sprintf(scratch,"%s/blk%05d.dat", mRootDir, fileIndex );	// get the filename
+#endif
+	}
 
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+	// Returns the handle for this data file, opening it if the scan has not reached it yet.  A transaction found
+	// through one of the saved indices can be in any file, even before a scan in this run has opened any.
+	FILE *getBlockFile(uint32_t fileIndex)
+	{
+		FILE *ret = NULL;
+		if ( fileIndex < MAX_BLOCK_FILES )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			if ( balance > mbtc )
+			ret = mBlockChain[fileIndex];
+			if ( ret == NULL )
 			{
-				uint32_t btc = (uint32_t)((balance)/ONE_BTC);
-				uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-				if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
-				{
-					lastUsed = ba->mFirstOutputTime;
-				}
-				double seconds = difftime(currentTime,time_t(lastUsed));
-				double minutes = seconds/60;
-				double hours = minutes/60;
-				uint32_t days = (uint32_t) (hours/24);
-				if ( days > zdays )
-				{
-					zombie_count++;
-					zombie_balance+=btc;
-				}
-				else
+				char scratch[512];
+				getBlockFileName(fileIndex,scratch);
+				ret = fopen(scratch,"rb");
+				if ( ret == NULL )
 				{
-					alive_count++;
-					alive_balance+=btc;
+					printf("Failed to open block-chain input file '%s'\r\n", scratch );
 				}
+				mBlockChain[fileIndex] = ret;
 			}
 		}
-		printf("Zombie Report:\r\n");
-		printf("Found %s zombie addresses older than %s days with a total balance of %s, excluding balances less than %s\r\n",formatNumber(zombie_count),formatNumber(zdays),formatNumber(zombie_balance), formatNumber(minBalance) );
-		printf("Found %s living addresses newer than %s days with a total balance of %s, excluding balances less than %s\r\n",formatNumber(alive_count),formatNumber(zdays),formatNumber(alive_balance), formatNumber(minBalance) );
+		return ret;
 	}
 
-	void printOldest(uint32_t tcount,uint32_t minBalance)
+	// Open the next data file in the block-chain sequence
+	bool openBlock(void)
 	{
-		uint32_t plotCount = 0;
-		uint64_t mbtc = minBalance*ONE_BTC;
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		bool ret = false;
+
+		char scratch[512];
+		getBlockFileName(mBlockIndex,scratch);
+		FILE *fph = mBlockChain[mBlockIndex] ? mBlockChain[mBlockIndex] : fopen(scratch,"rb"); // a lookup may have opened it already
+		if ( fph )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			if ( balance >= mbtc )
-			{
-				plotCount++;
-			}
+			fseek(fph,0L,SEEK_END);
+			mFileLength = ftell(fph);
+			fseek(fph,0L,SEEK_SET);
+			mBlockChain[mBlockIndex] = fph;
+			mScanOffset = 0;
+			ret = true;
+			printf("Successfully opened block-chain input file '%s'\r\n", scratch );
 		}
-
-		if ( !plotCount )
+		else
 		{
-			printf("No addresses found with a balance more than %d bitcoins\r\n", minBalance );
-			return;
+			printf("Failed to open block-chain input file '%s'\r\n", scratch );
+		}
+		if ( mBlockHeaderMap.size() )
+		{
+			printf("Scanned %s block headers so far, %s since last time.\r\n", formatNumber(mBlockHeaderMap.size()), formatNumber(mBlockHeaderMap.size()-mLastBlockHeaderCount));
 		}
 
-		BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
-		plotCount = 0;
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		mLastBlockHeaderCount = mBlockHeaderMap.size();
+
+		return ret;
+	}
+
+	virtual void release(void) 
+	{
+		delete this;
+	}
+
+	// Returns true if we successfully opened the block-chain input file
+	bool isValid(void)
+	{
+		return mBlockChain[0] ? true : false;
+	}
+
+	void processTransactions(Block &block)
+	{
+		mTotalTransactionCount+=block.transactionCount;
+		if ( mTransactionFactory.isUtxoMode() ) // spends are resolved through the UTXO set; the transaction map would only grow with history
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			if ( balance >= mbtc )
+			for (uint32_t i=0; i<block.transactionCount; i++)
 			{
-				sortPointers[plotCount] = ba;
-				plotCount++;
+				mTotalInputCount+=block.transactions[i].inputCount;
+				mTotalOutputCount+=block.transactions[i].outputCount;
 			}
+			return;
 		}
-		SortByAge sb(sortPointers,plotCount);
-		time_t currentTime;
-		time(&currentTime); // get the current time.
-
-		if ( plotCount < tcount )
+		for (uint32_t i=0; i<block.transactionCount; i++)
 		{
-			tcount = plotCount;
+			BlockTransaction &t = block.transactions[i];
+			Hash256 hash(t.transactionHash);
+			mTransactionMap.insert(hash,t.transactionIndex,t.fileIndex,t.fileOffset,t.transactionLength);
 		}
-		printf("Displaying the top %d addresses by age.\r\n", tcount );
-		printf("==============================================\r\n");
-		printf(" Address           : Balance  : Days Since Last Use\r\n");
-		printf("==============================================\r\n");
-		for (uint32_t i=0; i<tcount; i++)
+		// ok.. now make sure we can locate every input transaction!
+		for (uint32_t i=0; i<block.transactionCount; i++)
 		{
-			BitcoinAddress *ba = sortPointers[i];
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
+			BlockTransaction &t = block.transactions[i];
+			mTotalInputCount+=t.inputCount;
+			mTotalOutputCount+=t.outputCount;
+			for (uint32_t j=0; j<t.inputCount; j++)
 			{
-				lastUsed = ba->mFirstOutputTime;
+				BlockInput &input = t.inputs[j];
+				if ( input.transactionIndex != 0xFFFFFFFF )
+				{
+					Hash256 thash(input.transactionHash);
+					uint32_t transactionIndex;
+					if ( !mTransactionMap.find(thash,transactionIndex) )
+					{
+						block.warning = true;
+					}
+				}
 			}
-			double seconds = difftime(currentTime,time_t(lastUsed));
-			double minutes = seconds/60;
-			double hours = minutes/60;
-			uint32_t days = (uint32_t) (hours/24);
-			uint32_t adr = mAddresses.getIndex(ba)+1;
-			printf("%40s,  %8d,  %4d\r\n", getKey(adr), (uint32_t)( balance / ONE_BTC ), days );
 		}
-		delete []sortPointers;
 	}
 
 
-	void printAddress(const char *adr)
+	virtual const Block *readBlock(uint32_t blockIndex)
 	{
-		BitcoinAddress ba;
-		uint8_t output[25];
-		if ( BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAsciiToAddress(adr,output) )
-		{
-			memcpy(&ba.mWord0,&output[1],20);
-			BitcoinAddress *found = mAddresses.find(ba);
-			if ( found )
-			{
-				printAddress(found);
-			}
-			else
-			{
-				printf("Failed to locate address: %s\r\n", adr );
-			}
-		}
-		else
+		Block *ret = NULL;
+
+		if ( readBlock(mSingleBlock,blockIndex) )
 		{
-			printf("Failed to decode address: %s\r\n", adr );
+			ret = &mSingleBlock;
 		}
+
+		return ret;
 	}
 
-	void printAddresses(void)
+	virtual bool readBlock(BlockImpl &block,uint32_t blockIndex)
 	{
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+		bool ret = loadBlock(block,blockIndex,mTransactionCount);
+		if ( ret )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			printAddress(ba);
+			processTransactions(block);
 		}
+		return ret;
 	}
 
-	void printAddress(BitcoinAddress *ba)
+	// Reads and parses a block without adding its transactions to the transaction map
+	bool loadBlock(BlockImpl &block,uint32_t blockIndex,uint32_t &transactionCount)
 	{
-		uint32_t i = mAddresses.getIndex(ba);
-		printf("========================================\r\n");
-		printf("PublicKey: %s[%d] has %s transactions associated with it.\r\n", getKey(i+1),i+1, formatNumber(ba->mTransactionCount) );
-		printf("Balance: %0.4f : TotalReceived: %0.4f TotalSpent: %0.4f\r\n", (float) (ba->mTotalReceived-ba->mTotalSent)/ONE_BTC, (float)ba->mTotalReceived / ONE_BTC, (float) ba->mTotalSent / ONE_BTC );
-		if ( ba->mLastInputTime )
-		{
-			printf("Last Input Time: %s\r\n", getTimeString(ba->mLastInputTime) );
-		}
-		if ( ba->mLastOutputTime )
+		if ( blockIndex >= mBlockCount ) return false;
+		const BlockHeader &header = mBlockHeaders[blockIndex];
+		if ( blockIndex < (mBlockCount-2) )
 		{
-			printf("Last Output Time: %s\r\n", getTimeString(ba->mLastOutputTime) );
+			const BlockHeader &nextNext = mBlockHeaders[blockIndex+2];
+			block.nextBlockHash =  nextNext.mPreviousBlockHash;
 		}
-		for (uint32_t j=0; j<ba->mTransactionCount; j++)
+		return loadBlockAt(block,blockIndex,header.mFileIndex,header.mFileOffset,header.mBlockLength,transactionCount);
+	}
+
+	// Reads and parses the block stored at this location; needs no block headers, so it also serves the on-disk
+	// indices in a process which has not scanned the block chain
+	bool loadBlockAt(BlockImpl &block,uint32_t blockIndex,uint32_t fileIndex,uint32_t fileOffset,uint32_t blockLength,uint32_t &transactionCount)
+	{
+		bool ret = false;
+
+		FILE *fph = blockLength <= MAX_BLOCK_SIZE ? getBlockFile(fileIndex) : NULL;
+		if ( fph )
 		{
-			printTransaction(j,ba->mTransactions[j],i+1);
+			block.blockIndex = blockIndex;
+			block.warning = false;
+			fseek(fph,fileOffset,SEEK_SET);
+			gBlockIndex = blockIndex;
+			block.blockReward = 0;
+			block.totalInputCount = 0;
+			block.totalOutputCount = 0;
+			block.fileIndex = fileIndex;
+			block.fileOffset = fileOffset;
+			block.blockLength = blockLength;
+
+			uint8_t *blockData = mBlockDataBuffer;
+			size_t r = fread(blockData,block.blockLength,1,fph); // read the rest of the block (less the 8 byte header we have already consumed)
+			if ( r == 1 )
+			{
+				BLOCKCHAIN_SHA256::computeSHA256(blockData,4+32+32+4+4+4,block.computedBlockHash);
+				BLOCKCHAIN_SHA256::computeSHA256(block.computedBlockHash,32,block.computedBlockHash);
+				ret = block.processBlockData(blockData,block.blockLength,transactionCount);
+			}
+			else
+			{
+				printf("Failed to read input block.  BlockChain corrupted.\r\n");
+			}
 		}
-		printf("========================================\r\n");
-		printf("\r\n");
+		block.warning = gIsWarning;
+		gIsWarning = false;
+		return ret;
 	}
 
-	inline StatSize getStatSize(uint64_t v)
+	void printReverseHash(const uint8_t *hash)
 	{
-		if ( v == 0 ) return SS_ZERO;
-		for (uint32_t i=1; i<(SS_COUNT-1); i++)
+		if ( hash )
 		{
-			if ( v < mStatLimits[i] )
+			for (uint32_t i=0; i<32; i++)
 			{
-				return (StatSize)i;
+				printf("%02x", hash[31-i] );
 			}
 		}
-		return SS_MAX_BTC;
+		else
+		{
+			printf("NULL HASH");
+		}
 	}
 
-	void gatherStatistics(uint32_t stime,uint32_t zombieDate,bool recordAddresses)
-	{
-		gatherAddresses();
-
-		assert( mStatCount < MAX_STAT_COUNT );
-		StatRow &row = mStatistics[mStatCount];
-		row.mTime = stime;
-
-		time_t currentTime;
-		time(&currentTime); // get the current time.
-
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
-		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-			StatSize s = getStatSize(balance);
-			row.mCount++;
-			row.mValue+=balance;
 
-			row.mStats[s].mCount++;
-			row.mStats[s].mValue+=balance;
 
-			uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-			if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
-			{
-				lastUsed = ba->mFirstOutputTime;
-			}
+	virtual void printBlock(const Block *block) // prints the contents of the block to the console for debugging purposes
+	{
+		printf("==========================================================================================\r\n");
+		printf("Block #%s\r\n", formatNumber(block->blockIndex) );
 
-			if ( lastUsed < zombieDate )
-			{
-				row.mZombieTotal+=balance;
-				row.mZombieCount++;
-			}
+		printf("ComputedBlockHash: ");
+		printReverseHash(block->computedBlockHash);
+		printf("\r\n");
 
+		if ( block->previousBlockHash )
+		{
+			printf("PreviousBlockHash:");
+			printReverseHash(block->previousBlockHash);
+			printf("\r\n");
 		}
-
-		if ( recordAddresses )
+		if ( block->nextBlockHash )
 		{
-			// First compute how many bitcoin addresses have a balance over a minimum bitcoin size (we will start with just one)
-			uint32_t plotCount = 0;
+			printf("NextBlockHash:");
+			printReverseHash(block->nextBlockHash);
+			printf("\r\n");
+		}
 
-			for (uint32_t i=0; i<mAddresses.size(); i++) 
-			{
-				BitcoinAddress *ba = mAddresses.getKey(i);
-				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-				if ( balance >= ONE_BTC )
-				{
-					plotCount++;
-				}
-			}
 
-			printf("Gathering Address Delta's for %s addresses containing more than one bitcoin\r\n", formatNumber(plotCount) );
+		printf("Merkle root: ");
+		printReverseHash(block->merkleRoot);
+		printf("\r\n");
 
-			if ( plotCount )
-			{
-				BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
-				uint32_t plotCount = 0;
-				for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
-				{
-					BitcoinAddress *ba = mAddresses.getKey(i);
-					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-					if ( balance >= ONE_BTC )
-					{
-						sortPointers[plotCount] = ba;
-						plotCount++;
-					}
-				}
+		printf("Number of Transactions: %s\r\n", formatNumber(block->transactionCount) );
+		printf("Timestamp : %s\r\n", getTimeString(block->timeStamp ) );
+		printf("Bits: %d Hex: %08X\r\n", block->bits, block->bits );
+		printf("Size: %0.10f KB or %s bytes.\r\n", (float)block->blockLength / 1024.0f, formatNumber(block->blockLength) );
+		printf("Version: %d\r\n", block->blockFormatVersion );
+		printf("Nonce: %u\r\n", block->nonce );
+		printf("BlockReward: %f\r\n", (float)block->blockReward / ONE_BTC );
 
-				uint32_t reportCount = plotCount;
+		printf("%s transactions\r\n", formatNumber(block->transactionCount) );
+		for (uint32_t i=0; i<block->transactionCount; i++)
+		{
+			const BlockTransaction &t = block->transactions[i];
+			printf("Transaction %s : %s inputs %s outputs. VersionNumber: %d\r\n", formatNumber(i), formatNumber(t.inputCount), formatNumber(t.outputCount), t.transactionVersionNumber );
+			printf("TransactionHash: ");
+			printReverseHash(t.transactionHash);
+			printf("\r\n");
+			for (uint32_t i=0; i<t.inputCount; i++)
+			{
+				const BlockInput &input = t.inputs[i];
+				printf("    Input %s : ResponsScriptLength: %s TransactionIndex: %s : TransactionHash: ", formatNumber(i), formatNumber(input.responseScriptLength), formatNumber(input.transactionIndex) );
 
-				row.mAddresses = new StatAddress[reportCount];
-				row.mAddressCount = reportCount;
+				printReverseHash(input.transactionHash);
 
-				SortByBalance sb(sortPointers,plotCount);
+				printf("\r\n");
 
-				for (uint32_t i=0; i<reportCount; i++)
+				if ( input.transactionIndex != 0xFFFFFFFF && mTransactionFactory.isUtxoMode() && findIndexedTransaction(input.transactionHash) == NULL )
 				{
-					BitcoinAddress *ba = sortPointers[i];
-					StatAddress &sa = row.mAddresses[i];
-					sa.mAddress = mAddresses.getIndex(ba)+1;
-					sa.mLastTime = ba->getLastUsedTime();
-					sa.mFirstTime = ba->mFirstOutputTime;
-					sa.mTotalReceived = (uint32_t)(ba->mTotalReceived/ONE_MBTC);
-					sa.mTotalSent = (uint32_t)(ba->mTotalSent/ONE_MBTC);
-					sa.mTransactionCount = (uint8_t) (ba->mTransactionCount > 255 ? 255 : ba->mTransactionCount);
-					uint32_t inputCount = ba->getInputCount();
-					uint32_t outputCount = ba->getOutputCount();
-					sa.mInputCount = (uint8_t) (inputCount > 255 ? 255 : inputCount);
-					sa.mOutputCount = (uint8_t) (outputCount > 255 ? 255 : outputCount);
+					printf("        Spent output not kept in UTXO mode; build the 'txindex' to resolve it.\r\n");
 				}
-
-				if ( mStatCount >= 1 )
+				else if ( input.transactionIndex != 0xFFFFFFFF )
 				{
-					// build the delta!
-					StatRow &previousRow = mStatistics[mStatCount-1];
-					//
-					uint32_t *addressIndex = new uint32_t[mAddresses.size()];	// convert from master address list to used by statistics address list table
-
-					memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
-
-					for (uint32_t i=0; i<previousRow.mAddressCount; i++)
+					const BlockTransaction *t = readSingleTransaction(input.transactionHash);
+					if ( t == NULL )
 					{
-						StatAddress &sa = previousRow.mAddresses[i];
-						addressIndex[sa.mAddress-1] = i+1; // make this address as being used by the previous row
+						printf("ERROR: TransactionIndex[%d] FAILED TO LOCATE TRANSACTION FOR HASH: ", input.transactionIndex );
+						printReverseHash(input.transactionHash);
+						printf("\r\n");
 					}
-
-					uint32_t changeCount=0;
-					uint32_t newCount=0;
-					uint32_t deleteCount=0;
-					uint32_t sameCount=0;
-					uint32_t riseFromTheDeadCount=0;
-					uint32_t riseFromTheDeadAmount=0;
-
-					for (uint32_t i=0; i<row.mAddressCount; i++)
+					else
 					{
-						StatAddress &na = row.mAddresses[i];	// get the current row address
-						uint32_t aindex = na.mAddress-1; // get the array index for this address
-
-						if ( addressIndex[aindex] ) // did the previous row use this address?
+						if ( input.transactionIndex < t->outputCount )
 						{
-							uint32_t pindex = addressIndex[aindex]-1; // get the array index in the previous row so we can do a compare.
-
-							addressIndex[aindex] = 0xFFFFFFFF; // make it as processed.
-
-							StatAddress &oa = previousRow.mAddresses[pindex];
-
-							if ( na == oa )
+							const BlockOutput &o = t->outputs[input.transactionIndex];
+							if ( o.publicKey )
 							{
-								sameCount++; // no changes...
+								char scratch[256];
+								bool ok=true;
+								if ( o.isRipeMD160 )
+								{
+									uint8_t temp[25];
+									BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress(o.publicKey,temp);
+									BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(temp,scratch,256);
+								}
+								else
+								{
+									ok = BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeyToAscii(o.publicKey,scratch,256);
+								}
+								if ( ok )
+								{
+									printf("     Spending From Public Key: %s in the amount of: %0.4f\r\n", scratch, (float)o.value / ONE_BTC );
+								}
+								else
+								{
+									printf("ERROR: Unable to decode public key!\r\n");
+								}
 							}
 							else
 							{
-								// ok.. if it previously existed but there has been a change, was it a zombie change?
-								if ( oa.mLastTime < zombieDate && na.mLastTime >= zombieDate )
+								char scratch[BECH32_MAX_LENGTH+1];
+								if ( segwitScriptToAscii(o.challengeScript,o.challengeScriptLength,scratch,sizeof(scratch)) )
 								{
-									riseFromTheDeadCount++;
-									riseFromTheDeadAmount+=oa.getBalance(); // how much bitcoin rose from the dead.
+									printf("     Spending From Segwit Address: %s in the amount of: %0.4f\r\n", scratch, (float)o.value / ONE_BTC );
+								}
+								else
+								{
+									printf("ERROR: No public key found for this previous output.\r\n");
 								}
-								changeCount++;
 							}
 						}
 						else
 						{
-							newCount++;
-						}
-					}
-
-					for (uint32_t i=0; i<mAddresses.size(); i++)
-					{
-						if ( addressIndex[i] && addressIndex[i] != 0xFFFFFFFF )
-						{
-							deleteCount++;
+							printf("ERROR: Invalid transaction index!\r\n");
 						}
 					}
-
-					row.mNewAddressCount = newCount;
-					row.mDeleteAddressCount = deleteCount;
-					row.mChangeAddressCount = changeCount;
-					row.mSameAddressCount = sameCount;
-					row.mRiseFromDeadAmount = riseFromTheDeadAmount;
-					row.mRiseFromDeadCount = riseFromTheDeadCount;
-
-
-					if ( newCount )
+				}
+			}
+			for (uint32_t i=0; i<t.outputCount; i++)
+			{
+				const BlockOutput &output = t.outputs[i];
+				printf("    Output: %s : %f BTC : ChallengeScriptLength: %s\r\n", formatNumber(i), (float)output.value / ONE_BTC, formatNumber(output.challengeScriptLength) );
+				if ( output.publicKey )
+				{
+					char scratch[256];
+					bool ok=true;
+					if ( output.isRipeMD160 )
 					{
-						row.mNewAddresses = new StatAddress[newCount];
+						uint8_t temp[25];
+						BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress(output.publicKey,temp);
+						BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(temp,scratch,256);
 					}
-
-					if ( changeCount )
+					else
 					{
-						row.mChangedAddresses = new StatAddress[changeCount];
+						ok = BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeyToAscii(output.publicKey,scratch,256);
 					}
-					// Assign an array index to each address used by the previous row
-					memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
-					for (uint32_t i=0; i<previousRow.mAddressCount; i++)
+					if ( ok )
 					{
-						StatAddress &sa = previousRow.mAddresses[i];
-						addressIndex[sa.mAddress-1] = i+1;
+						printf("PublicKey: %s : %s\r\n", scratch, output.isRipeMD160 ? "RIPEMD160" : "ECDSA" );
 					}
-
-					newCount = 0;
-					changeCount = 0;
-					sameCount = 0;
-
-					for (uint32_t i=0; i<row.mAddressCount; i++)
+					else
 					{
-						StatAddress &na = row.mAddresses[i];
-						uint32_t aindex = na.mAddress-1;
-
-						if ( addressIndex[aindex] ) // did the previous row have this address.
-						{
-							uint32_t pindex = addressIndex[aindex]-1;
-							addressIndex[aindex] = 0xFFFFFFFF; // make it as processed.
-							StatAddress &oa = previousRow.mAddresses[pindex];
-							if ( na == oa )
-							{
-								sameCount++;
-							}
-							else
-							{
-								row.mChangedAddresses[changeCount] = na;
-								changeCount++;
-							}
-						}
-						else
-						{
-							row.mNewAddresses[newCount] = na;
-							newCount++;
-						}
+						printf("Failed to encode the public key.\r\n");
 					}
-
-					if ( deleteCount ) 
+				}
+				else
+				{
+					char scratch[BECH32_MAX_LENGTH+1];
+					if ( segwitScriptToAscii(output.challengeScript,output.challengeScriptLength,scratch,sizeof(scratch)) )
 					{
-						row.mDeletedAddresses = new uint32_t[deleteCount];
-						deleteCount = 0;
-						for (uint32_t i=0; i<mAddresses.size(); i++)
-						{
-							if ( addressIndex[i] && addressIndex[i] != 0xFFFFFFFF )
-							{
-								row.mDeletedAddresses[deleteCount] = i+1;
-								deleteCount++;
-							}
-						}
+						printf("SegwitAddress: %s : %s\r\n", scratch, output.challengeScript[0] == OP_0 ? "BECH32" : "BECH32M" );
 					}
-
-					delete []addressIndex;
-
-					printf("Found %s new addresses, %s changed addresses, and %s deleted addresses\r\n",
-						formatNumber(newCount),
-						formatNumber(changeCount),
-						formatNumber(deleteCount));
-
-					if ( mStatCount >= 2 )
+					else
 					{
-						StatRow &oldRow = mStatistics[mStatCount-2];
-						delete []oldRow.mAddresses;
-						oldRow.mAddresses = NULL;
-						oldRow.mAddressCount = 0;
+						printf("ERROR: Unable to derive a public key for this output!\r\n");
 					}
 				}
-				delete []sortPointers;
 			}
 		}
-		mStatCount++;
+
+		printf("==========================================================================================\r\n");
 	}
 
-	void saveAddressesOverTime(void)
+	virtual const Block * processSingleBlock(const void *blockData,uint32_t blockLength) 
 	{
-		FILE *fph = fopen("BlockChainAddresses.bin", "wb");
-		if ( fph )
+		const Block *ret = NULL;
+		if ( blockLength < MAX_BLOCK_SIZE )
 		{
-			const char *header = "BLOCK_CHAIN_ADDRESSES";
-			fwrite(header,strlen(header)+1,1,fph);
-			uint32_t version = 1;
-			fwrite(&version, sizeof(version), 1, fph );
-
-			// first..we need to count how many addresses are being used for this report.
-			uint32_t *addressIndex = new uint32_t[mAddresses.size()];	// convert from master address list to used by statistics address list table
-			uint32_t *inverseAddress = new uint32_t[mAddresses.size()]; // convert from remapped list back to master address.
-
-			memset(addressIndex,0,sizeof(uint32_t)*mAddresses.size());
-			memset(inverseAddress,0,sizeof(uint32_t)*mAddresses.size());
-
-			uint32_t fcount = 0; // number of unique addresses found
+			mSingleBlock.blockIndex = 0;
+			mSingleBlock.blockReward = 0;
+			mSingleBlock.totalInputCount = 0;
+			mSingleBlock.totalOutputCount = 0;
+			mSingleBlock.fileIndex = 0;
+			mSingleBlock.fileOffset =  0;
+			uint32_t transactionIndex=0;
+			mSingleBlock.processBlockData(blockData,blockLength,transactionIndex);
+			ret = static_cast< Block *>(&mSingleBlock);
+		}
+		return ret;
+	}
 
-			for (uint32_t i=0; i<mStatCount; i++)
-			{
-				StatRow &row = mStatistics[i];
-				for (uint32_t i=0; i<row.mAddressCount; i++)
-				{
-					StatAddress &sa = row.mAddresses[i];
-					assert( sa.mAddress	 );
-					uint32_t a = sa.mAddress-1;
-					assert( a < mAddresses.size() );
-					if ( addressIndex[a] == 0 ) // if this is the first time we have encountered this address, then we add it to the forward and inverse lookup tables.
-					{
-						addressIndex[a] = fcount+1;
-						inverseAddress[fcount] = a;
-						fcount++;
-					}
-				}
-			}
-			// ok..now ready to write out the address headers.
-			fwrite(&fcount,sizeof(fcount),1,fph);	// save how many unique addresses were found.
-			// now write out the 20 byte public key address for each.
-			for (uint32_t i=0; i<fcount; i++)
-			{
-				uint32_t a = inverseAddress[i]; // get the original address.
-				BitcoinAddress *ba = mAddresses.getKey(a);
-				fwrite(ba,20,1,fph);// write out the bitcoin address 160 bit public key (20 bytes long)
-			}
+	virtual const BlockTransaction *processSingleTransaction(const void *transactionData,uint32_t transactionLength)
+	{
+		const BlockTransaction *ret = NULL;
+		if ( transactionLength < MAX_BLOCK_SIZE )
+		{
+			mSingleBlock.blockIndex = 0;
+			mSingleBlock.blockReward = 0;
+			mSingleBlock.totalInputCount = 0;
+			mSingleBlock.totalOutputCount = 0;
+			mSingleBlock.fileIndex = 0;
+			mSingleBlock.fileOffset =  0;
+			ret = mSingleBlock.processTransactionData(transactionData,transactionLength);
+		}
+		return ret;
 
-			fwrite(&mStatCount, sizeof(mStatCount), 1, fph );
+	}
 
-			for (uint32_t i=0; i<mStatCount; i++)
+	virtual const BlockTransaction *readSingleTransaction(const uint8_t *transactionHash) 
+	{
+		Hash256 h(transactionHash);
+		uint32_t transactionIndex;
+		uint32_t fileIndex;
+		uint32_t fileOffset;
+		uint32_t transactionLength;
+		if ( !mTransactionMap.find(h,transactionIndex,fileIndex,fileOffset,transactionLength) )
+		{
+			// Not processed in this run; fall back to the persistent index if there is one
+			const TransactionIndexRecord *r = findIndexedTransaction(transactionHash);
+			if ( r == NULL )
 			{
-				StatRow &row = mStatistics[i];
-				fwrite(&row.mTime,sizeof(row.mTime),1, fph); // write out the time that this row was recorded...
-				if ( i == 0 ) 
-				{
-					fwrite(&row.mAddressCount,sizeof(row.mAddressCount),1,fph);
-				}
-				else
-				{
-					fwrite(&row.mNewAddressCount,sizeof(row.mNewAddressCount),1,fph);
-				}
-				fwrite(&row.mChangeAddressCount,sizeof(row.mChangeAddressCount),1,fph);
-				fwrite(&row.mDeleteAddressCount,sizeof(row.mDeleteAddressCount),1,fph);
+				printf("ERROR: Unable to locate this transaction hash:");
+				printReverseHash(transactionHash);
+				printf("\r\n");
+				return NULL; 
 			}
+			transactionIndex = 0xFFFFFFFF;
+			fileIndex = r->mFileIndex;
+			fileOffset = r->mFileOffset;
+			transactionLength = r->mFileLength;
+		}
+		return readTransaction(transactionIndex,fileIndex,fileOffset,transactionLength);
+	}
 
-			for (uint32_t i=0; i<mStatCount; i++)
+	// Reads and parses the transaction stored at this location in the block files
+	const BlockTransaction *readTransaction(uint32_t transactionIndex,uint32_t fileIndex,uint32_t fileOffset,uint32_t transactionLength)
+	{
+		const BlockTransaction *ret = NULL;
+		FILE *fph = transactionLength < MAX_BLOCK_SIZE ? getBlockFile(fileIndex) : NULL;
+		if ( fph )
+		{
+			uint32_t saveLocation = (uint32_t)ftell(fph);
+			fseek(fph,fileOffset,SEEK_SET);
+			uint32_t s = (uint32_t)ftell(fph);
+			if ( s == fileOffset )
 			{
-				StatRow &row = mStatistics[i];
-				if ( i == 0 )
+				uint8_t *blockData = mTransactionBlockBuffer;
+				size_t r = fread(blockData,transactionLength,1,fph);
+				if ( r == 1 ) // if we successfully read in the entire transaction
 				{
-					for (uint32_t i=0; i<row.mAddressCount; i++)
+					ret = processSingleTransaction(blockData,transactionLength);
+					if ( ret )
 					{
-						StatAddress sa = row.mAddresses[i];
-						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
-						fwrite(&sa,sizeof(sa),1,fph); // write it out...
+						BlockTransaction *t = (BlockTransaction *)ret;
+						t->transactionIndex = transactionIndex;
+						t->fileIndex = fileIndex;
+						t->fileOffset = fileOffset;
 					}
 				}
 				else
 				{
-					for (uint32_t i=0; i<row.mNewAddressCount; i++)
-					{
-						StatAddress sa = row.mNewAddresses[i];
-						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
-						fwrite(&sa,sizeof(sa),1,fph); // write it out...
-					}
-					for (uint32_t i=0; i<row.mChangeAddressCount; i++)
-					{
-						StatAddress sa = row.mChangedAddresses[i];
-						sa.mAddress = addressIndex[sa.mAddress-1]; // convert to the new sequentially ordered hash
-						fwrite(&sa,sizeof(sa),1,fph); // write it out...
-					}
-					for (uint32_t i=0; i<row.mDeleteAddressCount; i++)
-					{
-						uint32_t da = row.mDeletedAddresses[i];
-						uint32_t a = addressIndex[da-1];
-						fwrite(&a,sizeof(uint32_t),1,fph);
-					}
+					assert(0);
 				}
 			}
-			delete []addressIndex;
-			delete []inverseAddress;
-			fclose(fph);
+			else
+			{
+				assert(0);
+			}
+			fseek(fph,saveLocation,SEEK_SET); // restore the file position back to it's previous location.
+		}
+		else
+		{
+			printf("ERROR: Unable to read the transaction at offset %s of block file %d.\r\n", formatNumber(fileOffset), fileIndex );
 		}
+		return ret;
 	}
 
-	void saveStatistics(bool record_addresses)
+	// Maps the persistent transaction index the first time it is needed
+	const TransactionIndexRecord *findIndexedTransaction(const uint8_t *transactionHash)
 	{
-		if ( record_addresses )
+		if ( !mTransactionIndexOpened )
 		{
-			saveAddressesOverTime();
+			mTransactionIndexOpened = true;
+			mTransactionIndex.open(TX_INDEX_FILE);
 		}
-		FILE *fph = fopen("stats.csv", "wb");
-		if ( !fph ) 
+		return mTransactionIndex.find(transactionHash);
+	}
+
+	// Returns true if the index was built from the same chain we have the headers for, up to the block count it records
+	bool isTransactionIndexCurrent(void) const
+	{
+		uint32_t blockCount = mTransactionIndex.getBlockCount();
+		if ( blockCount == 0 || blockCount > mBlockCount )
 		{
-			printf("Failed to open statistics output file 'stats.csv' for write access.\r\n");
-			return;
+			return false;
 		}
+		Hash256 h(mTransactionIndex.getLastBlockHash());
+		return h == mBlockHeaders[blockCount-1];
+	}
 
-// BitcoinAddress Summary Results first
-
-		AgeStat ageStats[AM_LAST];
-
-		// First compute how many bitcoin addresses have a balance over a minimum bitcoin size (we will start with just one)
-		uint32_t plotCount = 0;
-		for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+	virtual void buildTransactionIndex(void)
+	{
+		mTransactionIndexOpened = true;
+		mTransactionIndex.open(TX_INDEX_FILE);
+		uint32_t startBlock = 0;
+		if ( mTransactionIndex.isOpen() )
 		{
-			BitcoinAddress *ba = mAddresses.getKey(i);
-			uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-
-			uint32_t days = ba->getDaysSinceLastUsed();
-			if ( days <= 1 )
-			{
-				ageStats[AM_ONE_DAY].addValue(balance);
-			}
-			else if ( days <= 7 )
-			{
-				ageStats[AM_ONE_WEEK].addValue(balance);
-			}
-			else if ( days <= 30 )
-			{
-				ageStats[AM_ONE_MONTH].addValue(balance);
-			}
-			else if ( days <= (30*3) )
+			if ( isTransactionIndexCurrent() )
 			{
-				ageStats[AM_THREE_MONTHS].addValue(balance);
-			}
-			else if ( days <= (30*6) )
-			{
-				ageStats[AM_SIX_MONTHS].addValue(balance);
+				startBlock = mTransactionIndex.getBlockCount();
 			}
-			else if ( days <= 365 )
+			else
 			{
-				ageStats[AM_ONE_YEAR].addValue(balance);
+				printf("The transaction index does not match the current block chain; rebuilding it.\r\n");
+				mTransactionIndex.discard();
 			}
-			else if ( days <= 365*2 )
+		}
+		if ( startBlock == mBlockCount )
+		{
+			printf("The transaction index is up to date; %s transactions in %s blocks.\r\n", formatNumber(mTransactionIndex.getRecordCount()), formatNumber(mBlockCount) );
+			return;
+		}
+		uint32_t threadCount = getProcessorCount();
+		printf("Indexing the transactions in blocks %s to %s.\r\n", formatNumber(startBlock), formatNumber(mBlockCount-1) );
+		uint32_t transactionCount = 0;
+		for (uint32_t i=startBlock; i<mBlockCount; i++)
+		{
+			if ( !loadBlock(mSingleBlock,i,transactionCount) )
 			{
-				ageStats[AM_TWO_YEARS].addValue(balance);
+				printf("Failed to read block %d; the transaction index stops at the block before it.\r\n", i );
+				break;
 			}
-			else if ( days <= 365*3 )
+			for (uint32_t j=0; j<mSingleBlock.transactionCount; j++)
 			{
-				ageStats[AM_THREE_YEARS].addValue(balance);
+				const BlockTransaction &t = mSingleBlock.transactions[j];
+				mTransactionIndex.add(t.transactionHash,t.fileIndex,t.fileOffset,t.transactionLength,i);
 			}
-			else if ( days <= 365*4 )
+			// Merge while there is still room for the largest possible next block
+			if ( mTransactionIndex.getPendingCount() > (TX_INDEX_RUN-MAX_BLOCK_TRANSACTION) || (i+1) == mBlockCount )
 			{
-				ageStats[AM_FOUR_YEARS].addValue(balance);
+				if ( !mTransactionIndex.merge(TX_INDEX_FILE,i+1,(const uint8_t *)&mBlockHeaders[i].mWord0,threadCount) )
+				{
+					break;
+				}
+				printf("Indexed %s transactions through block %s.\r\n", formatNumber(mTransactionIndex.getRecordCount()), formatNumber(i) );
 			}
-			else
+		}
+	}
+
+	// Makes sure the spent-by file is mapped and covers every transaction processed in this run
+	bool openSpentBy(void)
+	{
+		// No spent-by array is kept in UTXO mode; only a file saved by an earlier run can be used
+		uint32_t processed = mTransactionFactory.isUtxoMode() ? 0 : mTransactionFactory.getProcessedTransactionCount();
+		if ( !mSpentByFile.isOpen() || mSpentByFile.getTransactionCount() < processed )
+		{
+			if ( processed > mSpentByFile.getTransactionCount() )
 			{
-				ageStats[AM_FIVE_YEARS].addValue(balance);
+				mSpentByFile.close();
+				BlockLocation *locations = getBlockLocations(mTransactionFactory.getProcessedBlockCount());
+				mTransactionFactory.saveSpentBy(SPENT_BY_FILE,locations);
+				delete []locations;
 			}
-			if ( balance >= ONE_BTC )
+			if ( !mSpentByFile.open(SPENT_BY_FILE) )
 			{
-				plotCount++;
+				printf("There is no spent-by index; process the block chain first.\r\n");
+				return false;
 			}
 		}
+		return true;
+	}
+
+	// The location of each of the first 'count' blocks, for the on-disk indices to save; delete[] it when done
+	BlockLocation *getBlockLocations(uint32_t count) const
+	{
+		BlockLocation *ret = new BlockLocation[count ? count : 1];
+		for (uint32_t i=0; i<count; i++)
+		{
+			const BlockHeader &header = mBlockHeaders[i];
+			ret[i].mFileIndex = header.mFileIndex;
+			ret[i].mFileOffset = header.mFileOffset;
+			ret[i].mBlockLength = header.mBlockLength;
+		}
+		return ret;
+	}
 
+	// Returns transaction 'index' of this block, reading the block from the location an on-disk index saved for it
+	// unless it was the one read last.  Used by the queries against those indices, which know a transaction only by
+	// its position.
+	const BlockTransaction *getBlockTransaction(uint32_t block,uint32_t index,const BlockLocation &location)
+	{
+		if ( block != mLookupBlock )
+		{
+			uint32_t transactionCount = 0;
+			mLookupBlock = loadBlockAt(mSingleBlock,block,location.mFileIndex,location.mFileOffset,location.mBlockLength,transactionCount) ? block : 0xFFFFFFFF;
+		}
+		return ( mLookupBlock == block && index < mSingleBlock.transactionCount ) ? &mSingleBlock.transactions[index] : NULL;
+	}
 
+	const uint8_t *getSpentByTransactionHash(uint32_t transaction)
+	{
+		uint32_t block = mSpentByFile.getBlock(transaction);
+		const BlockTransaction *t = getBlockTransaction(block,transaction-mSpentByFile.getBlockStart(block),mSpentByFile.getBlockLocation(block));
+		return t ? t->transactionHash : NULL;
+	}
 
-		if ( plotCount )
+	// Finds the index of a transaction in the spent-by file; through the transaction index if there is one, otherwise
+	// through the transactions processed in this run
+	bool findSpentByTransaction(const uint8_t *transactionHash,uint32_t &transaction)
+	{
+		const TransactionIndexRecord *r = findIndexedTransaction(transactionHash);
+		if ( r && r->mHeight < mSpentByFile.getBlockCount() )
 		{
-#define MAX_PLOT_COUNT 150000
-			BitcoinAddress **sortPointers = new BitcoinAddress*[plotCount];
-			uint32_t plotCount = 0;
-			for (uint32_t i=0; i<mAddresses.size(); i++) // print one in every 10,000 addresses (just for testing right now)
+			uint32_t first = mSpentByFile.getBlockStart(r->mHeight);
+			uint32_t last = r->mHeight+1 < mSpentByFile.getBlockCount() ? mSpentByFile.getBlockStart(r->mHeight+1) : mSpentByFile.getTransactionCount();
+			for (uint32_t i=first; i<last; i++)
 			{
-				BitcoinAddress *ba = mAddresses.getKey(i);
-				uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-				if ( balance >= ONE_BTC )
+				const uint8_t *h = getSpentByTransactionHash(i);
+				if ( h && memcmp(h,transactionHash,32) == 0 )
 				{
-					sortPointers[plotCount] = ba;
-					plotCount++;
+					transaction = i;
+					return true;
 				}
 			}
-			uint32_t reportCount = plotCount;
-			fprintf(fph,"\r\n");
-			fprintf(fph,"\"BlockChain Statistics Report generated by: https://code.google.com/p/blockchain/ \"\r\n" );
-			fprintf(fph,"\r\n");
-			fprintf(fph,"\"Written by John W. Ratcliff mailto:jratcliffscarab@gmail.com\"\r\n" );
-			fprintf(fph,"\"Website: http://codesuppository.blogspot.com/\"\r\n" );
-			fprintf(fph,"\"TipJar Address: 1BT66EoaGySkbY9J6MugvQRhMMXDwPxPya\"\r\n" );
-
-			fprintf(fph,"\r\n");
-			fprintf(fph,"Bitcoin value distribution based on age.\r\n");
-			fprintf(fph,"Age,Value,Count\r\n");
-			for (uint32_t i=0; i<AM_LAST; i++)
-			{
-				AgeStat &as = ageStats[i];
-				fprintf(fph,"%s,%d,%d\r\n", getAgeString((AgeMarker)i), (uint32_t)(as.mTotalValue/ONE_BTC), as.mCount );
-			}
-			fprintf(fph,"\r\n");
+		}
+		// The transaction map also indexes blocks which were only read, not processed, so check that it agrees
+		Hash256 h(transactionHash);
+		if ( mTransactionMap.find(h,transaction) && transaction < mSpentByFile.getTransactionCount() )
+		{
+			const uint8_t *check = getSpentByTransactionHash(transaction);
+			return check && memcmp(check,transactionHash,32) == 0;
+		}
+		return false;
+	}
 
+	void printSpentByTransaction(uint32_t transaction)
+	{
+		printReverseHash(getSpentByTransactionHash(transaction));
+		printf(" (block %d)", mSpentByFile.getBlock(transaction) );
+	}
 
-			fprintf(fph,"\"Found %s addreses with a bitcoin balance of 1btc or more.\"\r\n", formatNumber(plotCount));
-			if ( plotCount > MAX_PLOT_COUNT )
-			{
-				reportCount = MAX_PLOT_COUNT;
-				fprintf(fph,"\"Exceeded maximum plot count, so only reporting the first %s addresses.\"\r\n", formatNumber(reportCount));
-			}
+	// Prints where each output of this transaction went, then does the same for the spending transactions
+	void traceOutputs(uint32_t transaction,uint32_t depth,uint32_t hops,uint32_t &printCount)
+	{
+		uint32_t outputCount = mSpentByFile.getOutputCount(transaction);
+		for (uint32_t i=0; i<outputCount && printCount < SPENT_BY_TRACE_LIMIT; i++)
+		{
+			const SpentBy &sb = mSpentByFile.getSpentBy(transaction,i);
+			printCount++;
+			printf("%*sOutput %d of ", depth*4, "", i );
+			printSpentByTransaction(transaction);
+			if ( sb.mTransaction == SPENT_BY_UNSPENT )
 			{
-				fprintf(fph,"\"Scatter Plot Data values of %s bitcoin address balances with over 1btc and number of days since last transaction. Sorted by Balance\"\r\n", formatNumber(plotCount));
-				fprintf(fph,"Days,Value,FirstUsed,LastReceived,LastSpent,TotalSent,TotalReceived,TransactionCount,PublicKeyAddress\r\n");
-				SortByBalance sb(sortPointers,plotCount);
-				time_t currentTime;
-				time(&currentTime); // get the current time.
-				for (uint32_t i=0; i<reportCount; i++)
-				{
-					BitcoinAddress *ba = sortPointers[i];
-					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-					uint32_t lastUsed = ba->mLastInputTime; // the last time we sent money (not received because anyone can send us money).
-					if ( ba->mLastInputTime == 0 ) // if it has never had a spend.. then we use the time of first receive..
-					{
-						lastUsed = ba->mFirstOutputTime;
-					}
-					double seconds = difftime(currentTime,time_t(lastUsed));
-					double minutes = seconds/60;
-					double hours = minutes/60;
-					uint32_t days = (uint32_t) (hours/24);
-					uint32_t adr = mAddresses.getIndex(ba)+1;
-
-					fprintf(fph,"%d,", days );
-					fprintf(fph,"%d,", (uint32_t)( balance / ONE_BTC ));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mFirstOutputTime));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mLastOutputTime));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mLastInputTime));
-					fprintf(fph,"%0.2f,", (float)ba->mTotalSent / ONE_BTC );
-					fprintf(fph,"%0.2f,", (float) ba->mTotalReceived / ONE_BTC );
-					fprintf(fph,"%d,", ba->mTransactionCount );
-					fprintf(fph,"%s\r\n", getKey(adr) );
-
-				}
-				fprintf(fph,"\r\n");
+				printf(" is unspent.\r\n");
 			}
+			else
 			{
-				fprintf(fph,"\"Scatter Plot Data values of %s bitcoin address balances with over 1btc and number of days since last transaction. Sorted by Age\"\r\n", formatNumber(plotCount));
-				fprintf(fph,"Days,Value,FirstUsed,LastReceived,LastSpent,TotalSent,TotalReceived,TransactionCount,PublicKeyAddress\r\n");
-
-				SortByAge sb(sortPointers,plotCount);
-				time_t currentTime;
-				time(&currentTime); // get the current time.
-				for (uint32_t i=0; i<reportCount; i++)
+				printf(" was spent by input %d of ", sb.mInput );
+				printSpentByTransaction(sb.mTransaction);
+				printf("\r\n");
+				if ( (depth+1) < hops )
 				{
-					BitcoinAddress *ba = sortPointers[i];
-					uint64_t balance = ba->mTotalReceived-ba->mTotalSent;
-					uint32_t days = ba->getDaysSinceLastUsed();
-					uint32_t adr = mAddresses.getIndex(ba)+1;
-					fprintf(fph,"%d,", days );
-					fprintf(fph,"%d,", (uint32_t)( balance / ONE_BTC ));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mFirstOutputTime));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mLastOutputTime));
-					fprintf(fph,"\"%s\",", getTimeString(ba->mLastInputTime));
-					fprintf(fph,"%0.2f,", (float)ba->mTotalSent / ONE_BTC );
-					fprintf(fph,"%0.2f,", (float) ba->mTotalReceived / ONE_BTC );
-					fprintf(fph,"%d,", ba->mTransactionCount );
-					fprintf(fph,"%s\r\n", getKey(adr) );
-
+					traceOutputs(sb.mTransaction,depth+1,hops,printCount);
 				}
-				fprintf(fph,"\r\n");
 			}
-			delete []sortPointers;
 		}
-//
-
+	}
 
-		const char *months[12] = { "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
+	virtual void traceSpends(const char *hash,uint32_t hops)
+	{
+		uint8_t transactionHash[32];
+		if ( !parseTransactionHash(hash,transactionHash) || !openSpentBy() )
 		{
-			fprintf(fph,"\r\n");
-			fprintf(fph,"Summary statistics for %d months.\r\n", mStatCount );
-			fprintf(fph,"\r\n");
-
+			return;
+		}
+		mLookupBlock = 0xFFFFFFFF;
+		uint32_t transaction;
+		if ( !findSpentByTransaction(transactionHash,transaction) )
+		{
+			printf("Transaction %s is not in the spent-by index; the 'txindex' command may help locate it.\r\n", hash );
+			return;
+		}
+		uint32_t printCount = 0;
+		traceOutputs(transaction,0,hops,printCount);
+		if ( printCount == SPENT_BY_TRACE_LIMIT )
+		{
+			printf("Stopped after %d spends.\r\n", SPENT_BY_TRACE_LIMIT );
+		}
+	}
 
-			fprintf(fph,"Date,");					// Date of this row
-			fprintf(fph,"ZombieValue,");			// The total value of all zombie addresses
-			fprintf(fph,"ZombieCount,");			// The number of zombie addresses
-			fprintf(fph,"TotalBTC,");				// Total BTC in circulation
-			fprintf(fph,"TotalActiveBTC,");			// Total non-zombie BTC
-			fprintf(fph,"AddressesUsed,");			// Total addresses used.
-			fprintf(fph,"AddressesWithBalance,");	// Total non-zero addresses.
-			fprintf(fph,"ZeroBalanceCount,");		// Number of zero balance addresses.
-			fprintf(fph,"DustCount,");				// The number of dust addresses < 1mbtc
-			fprintf(fph,"DustAmount,");				// The total amount in all dust addresses.
-			fprintf(fph,"AddressOneBTCCount,");		// The number of addresses with at least 1btc or more.
-			fprintf(fph,"AddressOneBTCValue,");		// The total value of all addresses with at least 1btc or more.
-			fprintf(fph,"Address1KCount,");			// The number of addresses with more than 1,000 btc in them.
-			fprintf(fph,"Address1KValue,");		// The total value of all addresses with more than 1,000 btc
-			fprintf(fph,"NewAddressCount,");		// Number of new addresses with a non-zero balance created
-			fprintf(fph,"ZeroAddressCount,");		// number of addresses who's balance went down to zero.
-			fprintf(fph,"ChangeAddressCount,");		// number of addresses who had changes against them.
-			fprintf(fph,"SameAddressCount,");		// The number of addresses with no change.
-			fprintf(fph,"RiseFromDeadCount,");		// number of addresses which rose from the dead.
-			fprintf(fph,"RiseFromDeadAmount\r\n");	// 
+	// Transaction hashes are displayed byte reversed
+	bool parseTransactionHash(const char *hash,uint8_t transactionHash[32])
+	{
+		uint32_t len = (uint32_t)strlen(hash);
+		bool ok = len == 64;
+		for (uint32_t i=0; ok && i<32; i++)
+		{
+			char scratch[3] = { hash[i*2], hash[i*2+1], 0 };
+			char *end;
+			transactionHash[31-i] = (uint8_t)strtoul(scratch,&end,16);
+			ok = *end == 0;
+		}
+		if ( !ok )
+		{
+			printf("'%s' is not a transaction hash; expected 64 hex digits.\r\n", hash );
+		}
+		return ok;
+	}
 
-			for (uint32_t i=0; i<mStatCount; i++)
+	virtual void lookupTransaction(const char *hash)
+	{
+		uint8_t transactionHash[32];
+		if ( !parseTransactionHash(hash,transactionHash) )
+		{
+			return;
+		}
+		findIndexedTransaction(transactionHash); // maps the index
+		const TransactionIndexRecord *found[TX_INDEX_MAX_MATCHES];
+		uint32_t count = mTransactionIndex.findAll(transactionHash,found,TX_INDEX_MAX_MATCHES);
+		if ( count == 0 )
+		{
+			printf("Transaction %s is not in the transaction index.\r\n", hash );
+			return;
+		}
+		if ( count > 1 )
+		{
+			printf("Transaction %s appears in %d blocks (a BIP-30 duplicate); only the outputs of the last one can be spent.\r\n", hash, count );
+		}
+		for (uint32_t j=0; j<count; j++)
+		{
+			const TransactionIndexRecord *r = found[j];
+			printf("Transaction %s : block %d, file blk%05d.dat, offset %d, length %d\r\n", hash, r->mHeight, r->mFileIndex, r->mFileOffset, r->mFileLength );
+			const BlockTransaction *t = readTransaction(0xFFFFFFFF,r->mFileIndex,r->mFileOffset,r->mFileLength);
+			if ( t )
 			{
-				StatRow &row = mStatistics[i];
-				time_t tnow(row.mTime);
-				struct tm beg;
-				beg = *localtime(&tnow);
-
-				uint32_t addressUsed = row.mCount;
-				uint32_t zeroCount = row.mStats[SS_ZERO].mCount;
-				uint32_t addressWithBalance = addressUsed - zeroCount;
-
-				uint32_t dustCount = row.mStats[SS_ONE_MBTC].mCount;
-				uint64_t dustAmount = row.mStats[SS_ONE_MBTC].mValue;
-
-				uint32_t addressOneBTCCount = 0;
-				uint64_t addressOneBTCTotal = 0;
-				uint32_t addressOneKCount = 0;
-				uint64_t addressOneKTotal = 0;
-
-				for (uint32_t i=SS_FIVE_BTC; i<SS_MAX_BTC; i++)
+				printf("    %d inputs, %d outputs\r\n", t->inputCount, t->outputCount );
+				for (uint32_t i=0; i<t->outputCount; i++)
 				{
-					addressOneBTCCount+=row.mStats[i].mCount;
-					addressOneBTCTotal+=row.mStats[i].mValue;
-					if ( i > SS_ONE_THOUSAND_BTC )
-					{
-						addressOneKCount+=row.mStats[i].mCount;
-						addressOneKTotal+=row.mStats[i].mValue;
-					}
+					printf("    Output %d : %0.8f BTC\r\n", i, (double)t->outputs[i].value / ONE_BTC );
 				}
+			}
+		}
+	}
 
-				
-				// Date
-				fprintf(fph,"\"%s %d %d\",",months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900); 
-				fprintf(fph,"%d,", (uint32_t)(row.mZombieTotal/ONE_BTC) );
-				fprintf(fph,"%d,", row.mZombieCount );
+	virtual bool processTransactions(const Block *block) // process the transactions in this block and assign them to individual wallets
+	{
+		if ( !block ) return true;
+		if ( mProcessingFailed ) return false;
 
-				fprintf(fph,"%d,", (uint32_t)(row.mValue / ONE_BTC) );
-				fprintf(fph,"%d,", (uint32_t)((row.mValue-row.mZombieTotal)/ ONE_BTC) );
+		beginUndo(block);
+		bool ok = true;
+		if ( mTransactionFactory.isUtxoMode() )
+		{
+			processUtxoTransactions(block);
+		}
+		else
+		{
+			if ( mCommitment.isEnabled() )
+			{
+				prefetchUtxo(block); // the commitment's UTXO set is under the memory budget if one was set
+			}
+			ok = processHistoryTransactions(block);
+		}
+		mProcessedStatCount = mTransactionFactory.getStatCount();
+		return finishBlock(block,ok && !mUtxo.hasFailed());
+	}
 
-				fprintf(fph,"%d,", addressUsed );
-				fprintf(fph,"%d,", addressWithBalance );
-				fprintf(fph,"%d,", zeroCount );
-				fprintf(fph,"%d,", dustCount );
-				fprintf(fph,"%d,", (uint32_t)(dustAmount / ONE_BTC) );
-				fprintf(fph,"%d,", addressOneBTCCount );
-				fprintf(fph,"%d,", (uint32_t) (addressOneBTCTotal / ONE_BTC) );
-				fprintf(fph,"%d,", addressOneKCount );
-				fprintf(fph,"%d,", (uint32_t) (addressOneKTotal / ONE_BTC) );
+	// Without statistics reading the block has already added its transactions to the transaction map; disconnecting
+	// it only needs the counts from before that, so the undo record is all there is to do
+	virtual bool skipTransactions(const Block *block)
+	{
+		if ( !block ) return true;
+		if ( mProcessingFailed ) return false;
+		beginUndo(block);
+		return finishBlock(block,true);
+	}
 
-				fprintf(fph,"%d,", row.mNewAddressCount );
-				fprintf(fph,"%d,", row.mDeleteAddressCount );
-				fprintf(fph,"%d,", row.mChangeAddressCount );
-				fprintf(fph,"%d,", row.mSameAddressCount );
-				fprintf(fph,"%d,", row.mRiseFromDeadCount );
-				fprintf(fph,"%d,", row.mRiseFromDeadAmount );
+	// Once a table could not grow or a block could not be recorded in full, processing stops for good.  The block is
+	// taken back with its undo record if it has one, leaving the blocks before it as they were.
+	bool finishBlock(const Block *block,bool ok)
+	{
+		if ( ok && !gAllocFailed )
+		{
+			return true;
+		}
+		mProcessingFailed = true;
+		uint32_t count = mUndo.size();
+		if ( count && mUndo.get(count-1).mHeight == block->blockIndex )
+		{
+			disconnect(block->blockIndex);
+			printf("Took back the partly processed block #%s; the blocks before it are intact.\r\n", formatNumber(block->blockIndex) );
+		}
+		else
+		{
+			printf("Block #%s was only partly processed and there is no undo record to take it back with.\r\n", formatNumber(block->blockIndex) );
+			mPartlyProcessed = true;
+		}
+		return false;
+	}
 
-				fprintf(fph,"\r\n");
-			}
+	// Starts the undo record of the block about to be processed with the counts from before it
+	void beginUndo(const Block *block)
+	{
+		mProcessedTip = Hash256(block->computedBlockHash);
+		BlockUndo *u = mUndo.begin(block->blockIndex);
+		if ( u )
+		{
+			u->mBlockHash = mProcessedTip;
+			u->mPreviousBlockHash = Hash256(block->previousBlockHash);
+			u->mReadCount = mTransactionCount-block->transactionCount;
+			u->mTransactionCount = mTransactionFactory.getProcessedTransactionCount();
+			u->mInputCount = mTransactionFactory.getTotalInputCount();
+			u->mOutputCount = mTransactionFactory.getTotalOutputCount();
+			u->mAddressCount = mTransactionFactory.getAddressCount();
+			u->mStatCount = mProcessedStatCount;
+			u->mTotalTransactionCount = mTotalTransactionCount-block->transactionCount;
+			u->mTotalInputCount = mTotalInputCount-block->totalInputCount;
+			u->mTotalOutputCount = mTotalOutputCount-block->totalOutputCount;
+		}
+	}
 
-			fprintf(fph,"\r\n");
+	// Returns false if the block's transactions could not all be recorded
+	bool processHistoryTransactions(const Block *block)
+	{
+		if ( !mTransactionFactory.markBlock() )
+		{
+			return false;
 		}
-	
+		preparePublicKeys(block);
+		mPrevoutCount = 0;
+
+		bool ret = true;
+		for (uint32_t i=0; i<block->transactionCount; i++)
 		{
-			fprintf(fph,"\r\n");
-			fprintf(fph,"Bitcoin Public Key Address Distribution Count by balance.\r\n");
-			fprintf(fph,"\r\n");
-			fprintf(fph,",");
-			for (uint32_t i=0; i<SS_COUNT; i++)
+
+			const BlockTransaction &t = block->transactions[i];
+			uint32_t tindex = mTransactionFactory.addTransaction(block->blockIndex,block->timeStamp,t.inputCount,t.outputCount);
+			if ( tindex == NO_TRANSACTION )
 			{
-				fprintf(fph,"\"%s\",", mStatLabel[i]);
+				ret = false;
+				break;
 			}
-			fprintf(fph,"\r\n");
-			for (uint32_t i=0; i<mStatCount; i++)
+			const Transaction &trans = *mTransactionFactory.getSingleTransaction(tindex);
+			if ( mCommitment.isEnabled() )
 			{
-				StatRow &row = mStatistics[i];
-				time_t tnow(row.mTime);
-				struct tm beg;
-				beg = *localtime(&tnow);
-				fprintf(fph,"\"%s %d %d\",", months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
-				for (uint32_t j=0; j<SS_COUNT; j++)
-				{
-					StatValue &v = row.mStats[j];
-					fprintf(fph,"%d,",v.mCount);
-				}
-				fprintf(fph,"\r\n");
+				commitTransaction(block,i);
 			}
-			fprintf(fph,"\r\n");
-		}
 
-		{
-			fprintf(fph,"\r\n");
-			fprintf(fph,"Bitcoin Public Key Address Distribution Total Value by balance.\r\n");
-			fprintf(fph,"\r\n");
-			fprintf(fph,",");
-			for (uint32_t i=0; i<SS_COUNT; i++)
+			for (uint32_t i=0; i<t.outputCount; i++)
 			{
-				fprintf(fph,"\"%s\",", mStatLabel[i]);
+				const BlockOutput &output = t.outputs[i];
+				TransactionOutput &to = *mTransactionFactory.getOutput(trans.mFirstOutput+i);
+				to.mAddress = getOutputAddress(output);
+				mTransactionFactory.setValue(to,output.value);
 			}
-			fprintf(fph,"\r\n");
-			for (uint32_t i=0; i<mStatCount; i++)
+
+			// The inputs are queued up and resolved in batches; an input can only spend an output of an earlier
+			// transaction, so every output it could refer to has already been filled in by the time its batch runs.
+			for (uint32_t i=0; i<t.inputCount; i++)
 			{
-				StatRow &row = mStatistics[i];
-				time_t tnow(row.mTime);
-				struct tm beg;
-				beg = *localtime(&tnow);
-				fprintf(fph,"\"%s %d %d\",", months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
-				for (uint32_t j=0; j<SS_COUNT; j++)
+				const BlockInput &input = t.inputs[i];
+				mTransactionFactory.getInput(trans.mFirstInput+i).mOutput = NO_OUTPUT;
+
+				if ( input.transactionIndex != 0xFFFFFFFF )
 				{
-					StatValue &v = row.mStats[j];
-					fprintf(fph,"%0.4f,",(float)v.mValue/ONE_BTC);
+					mPrevoutHashes[mPrevoutCount] = Hash256(input.transactionHash);
+					mPrevoutInputs[mPrevoutCount] = trans.mFirstInput+i;
+					mPrevoutSpender[mPrevoutCount] = tindex;
+					mPrevoutSpenderInput[mPrevoutCount] = i;
+					mPrevoutOutputIndex[mPrevoutCount] = input.transactionIndex;
+					mPrevoutCount++;
+					if ( mPrevoutCount == PREVOUT_BATCH )
+					{
+						resolvePrevouts();
+					}
 				}
-				fprintf(fph,"\r\n");
 			}
-			fprintf(fph,"\r\n");
 		}
+		resolvePrevouts();
+		return ret;
+	}
 
-
+	// In UTXO mode each input removes the output it spends from the UTXO set and each output is added to it; the
+	// address totals are updated as we go rather than gathered from the history later.
+	void processUtxoTransactions(const Block *block)
+	{
+		prefetchUtxo(block);
+		preparePublicKeys(block);
+		bool commit = mCommitment.isEnabled();
+		for (uint32_t i=0; i<block->transactionCount; i++)
 		{
-			fprintf(fph,"\r\n");
-			fprintf(fph,"NORMALIZED : Bitcoin Public Key Address Distribution Count by balance.\r\n");
-			fprintf(fph,"\r\n");
-			fprintf(fph,",");
-			for (uint32_t i=1; i<SS_COUNT; i++)
+			const BlockTransaction &t = block->transactions[i];
+			uint32_t transaction = mTransactionFactory.addUtxoTransaction(t.inputCount,t.outputCount);
+			for (uint32_t j=0; j<t.inputCount; j++)
 			{
-				fprintf(fph,"\"%s\",", mStatLabel[i]);
+				const BlockInput &input = t.inputs[j];
+				if ( input.transactionIndex != 0xFFFFFFFF )
+				{
+					UtxoEntry spent;
+					if ( mUtxo.spend(input.transactionHash,input.transactionIndex,spent) )
+					{
+						UtxoEntry *undo = mUndo.addSpent();
+						if ( undo )
+						{
+							*undo = spent;
+						}
+						if ( commit )
+						{
+							mCommitment.remove(spent);
+						}
+						mTransactionFactory.spendUtxo(spent.mAddress,spent.mValue,block->timeStamp,transaction,spent.mAddress ? mUndo.addAddress() : NULL);
+					}
+				}
 			}
-			fprintf(fph,"\r\n");
-			for (uint32_t i=0; i<mStatCount; i++)
+			for (uint32_t j=0; j<t.outputCount; j++)
 			{
-				StatRow &row = mStatistics[i];
-				time_t tnow(row.mTime);
-				struct tm beg;
-				beg = *localtime(&tnow);
-				fprintf(fph,"\"%s %d\",", months[beg.tm_mon], beg.tm_year+1900);
-				for (uint32_t j=1; j<SS_COUNT; j++)
+				const BlockOutput &output = t.outputs[j];
+				uint32_t adr = getOutputAddress(output);
+				mTransactionFactory.receiveUtxo(adr,output.value,block->timeStamp,transaction,adr ? mUndo.addAddress() : NULL);
+				// An OP_RETURN output can never be spent so it is not worth keeping
+				if ( !(output.challengeScriptLength && output.challengeScript[0] == OP_RETURN) )
 				{
-					StatValue &v = row.mStats[j];
-					float value = (float)v.mCount*100.0f / (float)(row.mCount-row.mStats[0].mCount);
-					fprintf(fph,"%0.4f,", value );
+					UtxoEntry e;
+					UtxoEntry replaced;
+					e.set(t.transactionHash,j,output.value,adr,block->blockIndex);
+					if ( commit )
+					{
+						mCommitment.computeDigest(t.transactionHash,j,block->blockIndex,i == 0,output,e.mDigest);
+					}
+					if ( mUtxo.add(e,replaced) && commit )
+					{
+						mCommitment.remove(replaced);
+					}
+					if ( commit )
+					{
+						mCommitment.add(e);
+					}
+					UtxoKey *undo = mUndo.addAdded();
+					if ( undo )
+					{
+						undo->mHash0 = *(const uint64_t *)t.transactionHash;
+						undo->mHash1 = *(const uint32_t *)(t.transactionHash+8);
+						undo->mOutput = j;
+					}
 				}
-				fprintf(fph,"\r\n");
 			}
-			fprintf(fph,"\r\n");
 		}
+	}
 
+	// In history mode the UTXO set is kept only for the commitment, so it holds just the outputs which are part of it.
+	// Takes the outputs transaction 'i' of the block spends out of it and puts the transaction's own in.
+	void commitTransaction(const Block *block,uint32_t i)
+	{
+		const BlockTransaction &t = block->transactions[i];
+		for (uint32_t j=0; j<t.inputCount; j++)
 		{
-			fprintf(fph,"\r\n");
-			fprintf(fph,"NORMALIZED: Bitcoin Public Key Address Distribution Total Value by balance.\r\n");
-			fprintf(fph,"\r\n");
-			fprintf(fph,",");
-			for (uint32_t i=1; i<SS_COUNT; i++)
+			const BlockInput &input = t.inputs[j];
+			UtxoEntry spent;
+			if ( input.transactionIndex != 0xFFFFFFFF && mUtxo.spend(input.transactionHash,input.transactionIndex,spent) )
 			{
-				fprintf(fph,"\"%s\",", mStatLabel[i]);
+				mCommitment.remove(spent);
+				UtxoEntry *undo = mUndo.addSpent();
+				if ( undo )
+				{
+					*undo = spent;
+				}
 			}
-			fprintf(fph,"\r\n");
-			for (uint32_t i=0; i<mStatCount; i++)
+		}
+		for (uint32_t j=0; j<t.outputCount; j++)
+		{
+			UtxoEntry e;
+			UtxoEntry replaced;
+			e.set(t.transactionHash,j,t.outputs[j].value,0,block->blockIndex);
+			if ( mCommitment.computeDigest(t.transactionHash,j,block->blockIndex,i == 0,t.outputs[j],e.mDigest) )
 			{
-				StatRow &row = mStatistics[i];
-				time_t tnow(row.mTime);
-				struct tm beg;
-				beg = *localtime(&tnow);
-				fprintf(fph,"\"%s %d\",", months[beg.tm_mon], beg.tm_year+1900);
-				for (uint32_t j=1; j<SS_COUNT; j++)
+				if ( mUtxo.add(e,replaced) )
 				{
-					StatValue &v = row.mStats[j];
-					float value = (float)(v.mValue)*100.0f / (float)row.mValue;
-					fprintf(fph,"%0.4f,",value);
+					mCommitment.remove(replaced);
+				}
+				mCommitment.add(e);
+				UtxoKey *undo = mUndo.addAdded();
+				if ( undo )
+				{
+					undo->mHash0 = e.mHash0;
+					undo->mHash1 = e.mHash1;
+					undo->mOutput = j;
 				}
-				fprintf(fph,"\r\n");
 			}
-			fprintf(fph,"\r\n");
 		}
-
-
-		fclose(fph);
 	}
 
-protected:
-	BitcoinAddressHashMap		mAddresses;				// A hash map of every single bitcoin address ever referenced to a much shorter integer to save memory
-
-	uint32_t					mTransactionCount;
-	uint32_t					mTotalInputCount;
-	uint32_t					mTotalOutputCount;
-	Transaction					*mTransactions;
-	TransactionInput			*mInputs;
-	TransactionOutput			*mOutputs;
-	uint32_t					mBlockCount;
-	Transaction					**mBlocks;
-	Transaction					**mTransactionReferences;
-	uint32_t					mStatCount;
-	StatRow						mStatistics[MAX_STAT_COUNT];
-	const char					*mStatLabel[SS_COUNT];
-	uint64_t					mStatLimits[SS_COUNT];
-};
-
-#pragma warning(pop)
-
-// This is the implementation of the BlockChain parser interface
-class BlockChainImpl : public BlockChain
-{
-public:
-	BlockChainImpl(const char *rootPath)
+	// Under a memory budget the outputs this block spends which were spilled to disk are brought back first
+	void prefetchUtxo(const Block *block)
 	{
-		sprintf(mRootDir,"%s",rootPath);
-		mCurrentBlockData = mBlockDataBuffer;	// scratch buffers to read in up to 3 block.
-		mTransactionCount = 0;
-		mBlockIndex = 0;
-		mBlockBase = 0;
-		mReadCount = 0;
-		for (uint32_t i=0; i<MAX_BLOCK_FILES; i++)
+		uint32_t count = 0;
+		for (uint32_t i=0; i<block->transactionCount; i++)
 		{
-			mBlockChain[i] = NULL;
+			const BlockTransaction &t = block->transactions[i];
+			for (uint32_t j=0; j<t.inputCount && count<MAX_BLOCK_INPUTS; j++)
+			{
+				const BlockInput &input = t.inputs[j];
+				if ( input.transactionIndex != 0xFFFFFFFF )
+				{
+					UtxoKey &k = mUtxoKeys[count++];
+					k.mHash0 = *(const uint64_t *)input.transactionHash;
+					k.mHash1 = *(const uint32_t *)(input.transactionHash+8);
+					k.mOutput = input.transactionIndex;
+				}
+			}
 		}
-		mBlockCount = 0;
-		mScanCount = 0;
-		mBlockHeaders = NULL;
-		mLastBlockHeaderCount = 0;
-		mLastBlockHeader = NULL;
-		mTotalInputCount = 0;
-		mTotalOutputCount = 0;
-		mTotalTransactionCount = 0;
-		openBlock();	// open the input file
+		mUtxo.prefetch(mUtxoKeys,count,block->totalOutputCount+count);
 	}
 
-	// Close all blockchain files which have been opended so far
-	virtual ~BlockChainImpl(void)
+	// Gather up every pay-to-public-key output in the block.  Keys already in the public key cache resolve
+	// straight to their address; the rest are hashed in one batch.  Only the 20 byte hash160 is needed
+	// to look up the address so the checksum is never computed.  getOutputAddress then hands out the results
+	// as the outputs are visited in the same order.
+	void preparePublicKeys(const Block *block)
 	{
-		for (uint32_t i=0; i<mBlockIndex; i++)
+		uint32_t publicKeyCount = 0;
+		uint32_t missCount = 0;
+		for (uint32_t i=0; i<block->transactionCount; i++)
 		{
-			if ( mBlockChain[i] )
+			const BlockTransaction &t = block->transactions[i];
+			for (uint32_t j=0; j<t.outputCount; j++)
 			{
-				fclose(mBlockChain[i]);	// close the block-chain file pointer
+				const BlockOutput &output = t.outputs[j];
+				if ( output.publicKey && !output.isRipeMD160 && output.publicKey[0] == 0x04 && publicKeyCount < MAX_BLOCK_OUTPUTS )
+				{
+					uint32_t adr = mPublicKeyCache.find(output.publicKey);
+					mPublicKeys[publicKeyCount] = output.publicKey;
+					mPublicKeyAddress[publicKeyCount] = adr;
+					publicKeyCount++;
+					if ( adr == 0 )
+					{
+						mMissingKeys[missCount++] = output.publicKey;
+					}
+				}
 			}
 		}
-		delete []mBlockHeaders;
+		BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeysToHash160(mMissingKeys,missCount,mPublicKeyHash160);
+		mPublicKeyCount = publicKeyCount;
+		mPublicKeyIndex = 0;
+		mMissIndex = 0;
 	}
 
-	// Open the next data file in the block-chain sequence
-	bool openBlock(void)
+	// Returns the address index an output pays to, or zero if it has no recognized address
+	uint32_t getOutputAddress(const BlockOutput &output)
 	{
-		bool ret = false;
-
-		char scratch[512];
-#ifdef _MSC_VER
-		sprintf(scratch,"%s\\blk%05d.dat", mRootDir, mBlockIndex );	// get the filename
-#else
-		sprintf(scratch,"%s/blk%05d.dat", mRootDir, mBlockIndex );	// get the filename
-#endif
-		FILE *fph = fopen(scratch,"rb");
-		if ( fph )
-		{
-			fseek(fph,0L,SEEK_END);
-			mFileLength = ftell(fph);
-			fseek(fph,0L,SEEK_SET);
-			mBlockChain[mBlockIndex] = fph;
-			ret = true;
-			printf("Successfully opened block-chain input file '%s'\r\n", scratch );
-		}
-		else
-		{
-			printf("Failed to open block-chain input file '%s'\r\n", scratch );
-		}
-		if ( mBlockHeaderMap.size() )
+		uint32_t adr = 0;
+		if ( output.publicKey )
 		{
-			printf("Scanned %s block headers so far, %s since last time.\r\n", formatNumber(mBlockHeaderMap.size()), formatNumber(mBlockHeaderMap.size()-mLastBlockHeaderCount));
+			if ( output.isRipeMD160 )
+			{
+				mTransactionFactory.getAddress(output.publicKey,adr);
+			}
+			else if ( mPublicKeyIndex < mPublicKeyCount && mPublicKeys[mPublicKeyIndex] == output.publicKey )
+			{
+				adr = mPublicKeyAddress[mPublicKeyIndex];
+				if ( adr == 0 )
+				{
+					mTransactionFactory.getAddress(&mPublicKeyHash160[mMissIndex*20],adr);
+					mMissIndex++;
+					if ( adr )
+					{
+						mPublicKeyCache.insert(output.publicKey,adr);
+					}
+				}
+				mPublicKeyIndex++;
+			}
 		}
-
-		mLastBlockHeaderCount = mBlockHeaderMap.size();
-
-		return ret;
+		return adr;
 	}
 
-	virtual void release(void) 
-	{
-		delete this;
-	}
-
-	// Returns true if we successfully opened the block-chain input file
-	bool isValid(void)
-	{
-		return mBlockChain[0] ? true : false;
-	}
-
-	void processTransactions(Block &block)
+	// Points each queued input at the output it spends.  Each input needs the transaction map lookup and then the
+	// spent transaction's record, both almost always cache misses; rather than take them one input at a time the
+	// lookups for the whole batch go through findBatch and then all of the transaction records are prefetched.
+	void resolvePrevouts(void)
 	{
-		mTotalTransactionCount+=block.transactionCount;
-		for (uint32_t i=0; i<block.transactionCount; i++)
+		mTransactionMap.findBatch(mPrevoutHashes,mPrevoutCount,mPrevoutTransactions);
+		for (uint32_t i=0; i<mPrevoutCount; i++)
 		{
-			BlockTransaction &t = block.transactions[i];
-			Hash256 hash(t.transactionHash);
-			FileLocation f(hash,t.fileIndex,t.fileOffset,t.transactionLength,t.transactionIndex);
-			mTransactionMap.insert(f);
+			if ( mPrevoutTransactions[i] != TX_SLOT_EMPTY )
+			{
+				prefetchMemory(mTransactionFactory.getSingleTransaction(mPrevoutTransactions[i]));
+			}
 		}
-		// ok.. now make sure we can locate every input transaction!
-		for (uint32_t i=0; i<block.transactionCount; i++)
+		for (uint32_t i=0; i<mPrevoutCount; i++)
 		{
-			BlockTransaction &t = block.transactions[i];
-			mTotalInputCount+=t.inputCount;
-			mTotalOutputCount+=t.outputCount;
-			for (uint32_t j=0; j<t.inputCount; j++)
+			bool found = mPrevoutTransactions[i] != TX_SLOT_EMPTY;
+			assert(found);
+			if ( found )
 			{
-				BlockInput &input = t.inputs[j];
-				if ( input.transactionIndex != 0xFFFFFFFF )
+				const Transaction *previousTransaction = mTransactionFactory.getSingleTransaction(mPrevoutTransactions[i]);
+				if ( previousTransaction == NULL )
 				{
-					Hash256 thash(input.transactionHash);
-					FileLocation key(thash,0,0,0,0);
-					FileLocation *found = mTransactionMap.find(key);
-					if ( found == NULL )
+					printf("ERROR: FAILED TO LOCATE TRANSACTION!\r\n");
+				}
+				else
+				{
+					uint32_t outputIndex = mPrevoutOutputIndex[i];
+					uint32_t outputCount = mTransactionFactory.getOutputCount(mPrevoutTransactions[i]);
+					assert( outputIndex < outputCount );
+					if ( outputIndex < outputCount )
 					{
-						block.warning = true;
+						uint32_t output = previousTransaction->mFirstOutput+outputIndex;
+						mTransactionFactory.getInput(mPrevoutInputs[i]).mOutput = output;
+						mTransactionFactory.setSpentBy(output,mPrevoutSpender[i],mPrevoutSpenderInput[i]);
 					}
 				}
 			}
 		}
+		mPrevoutCount = 0;
 	}
 
-
-	virtual const Block *readBlock(uint32_t blockIndex)
+	virtual uint32_t gatherAddresses(void)
 	{
-		Block *ret = NULL;
+		mTransactionFactory.gatherAddresses();
+		return mTransactionFactory.getAddressCount();
+	}
 
-		if ( readBlock(mSingleBlock,blockIndex) )
+	virtual void reportCounts(void)
+	{
+		printf("Total Blocks: %s\r\n", formatNumber(mBlockCount) );
+		printf("Total Transactions: %s\r\n", formatNumber(mTotalTransactionCount));
+		printf("Total Inputs: %s\r\n", formatNumber(mTotalInputCount));
+		printf("Total Outputs: %s\r\n", formatNumber(mTotalOutputCount));
+		mTransactionMap.report("Transaction");
+		mBlockHeaderMap.report("Block header");
+		if ( mTransactionFactory.isUtxoMode() || mCommitment.isEnabled() )
 		{
-			ret = &mSingleBlock;
+			mUtxo.report();
 		}
-
-		return ret;
+		if ( mCommitment.isEnabled() )
+		{
+			mCommitment.report();
+		}
+		mTransactionFactory.reportCounts();
+		mPublicKeyCache.report();
 	}
 
-	virtual bool readBlock(BlockImpl &block,uint32_t blockIndex)
+	virtual void printTransactions(uint32_t blockIndex)
 	{
-		bool ret = false;
+		mTransactionFactory.printTransactions(blockIndex);
+	}
 
-		if ( blockIndex >= mBlockCount ) return false;
-		BlockHeader &header = *mBlockHeaders[blockIndex];
-		FILE *fph = mBlockChain[header.mFileIndex];
-		if ( fph )
+	virtual bool setUtxoMode(bool state)
+	{
+		if ( mTransactionFactory.getProcessedTransactionCount() )
 		{
-			block.blockIndex = blockIndex;
-			block.warning = false;
-			fseek(fph,header.mFileOffset,SEEK_SET);
-			gBlockIndex = blockIndex;
-			block.blockLength = header.mBlockLength;
-			block.blockReward = 0;
-			block.totalInputCount = 0;
-			block.totalOutputCount = 0;
-			block.fileIndex = header.mFileIndex;
-			block.fileOffset = header.mFileOffset;
-			block.blockLength = header.mBlockLength;
-
-			if ( blockIndex < (mBlockCount-2) )
-			{
-				BlockHeader *nextNext = mBlockHeaders[blockIndex+2];
-				block.nextBlockHash =  nextNext->mPreviousBlockHash;
-			}
+			printf("The processing mode cannot be changed once blocks have been processed.\r\n");
+			return false;
+		}
+		mTransactionFactory.setUtxoMode(state);
+		return true;
+	}
 
-			uint8_t *blockData = mBlockDataBuffer;
-			size_t r = fread(blockData,block.blockLength,1,fph); // read the rest of the block (less the 8 byte header we have already consumed)
-			if ( r == 1 )
-			{
-				BLOCKCHAIN_SHA256::computeSHA256(blockData,4+32+32+4+4+4,block.computedBlockHash);
-				BLOCKCHAIN_SHA256::computeSHA256(block.computedBlockHash,32,block.computedBlockHash);
-				ret = block.processBlockData(blockData,block.blockLength,mTransactionCount);
-				if ( ret )
-				{
-					processTransactions(block);
-				}
-			}
-			else
-			{
-				printf("Failed to read input block.  BlockChain corrupted.\r\n");
-			}
+	// The sizes of everything stored in a state image as compiled, folded into one value
+	static uint32_t getStateLayout(void)
+	{
+		uint32_t sizes[] = { (uint32_t)sizeof(void *), (uint32_t)sizeof(BlockHeader), (uint32_t)sizeof(Transaction), (uint32_t)sizeof(TransactionInput),
+							 (uint32_t)sizeof(TransactionOutput), (uint32_t)sizeof(SpentBy), (uint32_t)sizeof(BitcoinAddress), (uint32_t)sizeof(StatRow),
+							 (uint32_t)sizeof(StatAddress), (uint32_t)sizeof(UtxoEntry), HASH_SHARD_COUNT, HASH_CHUNK_SIZE };
+		uint32_t ret = 2166136261u;
+		for (uint32_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+		{
+			ret = (ret ^ sizes[i]) * 16777619u;
 		}
-		block.warning = gIsWarning;
-		gIsWarning = false;
 		return ret;
 	}
 
-	void printReverseHash(const uint8_t *hash)
+	virtual bool saveState(uint32_t statTime)
 	{
-		if ( hash )
+		if ( mTransactionFactory.isUtxoMode() )
 		{
-			for (uint32_t i=0; i<32; i++)
-			{
-				printf("%02x", hash[31-i] );
-			}
+			printf("The state image holds the transaction history; it cannot be saved in UTXO mode.\r\n");
+			return false;
 		}
-		else
+		if ( mBlockCount == 0 )
 		{
-			printf("NULL HASH");
+			printf("There is no block chain to save; scan the block headers first.\r\n");
+			return false;
 		}
-	}
-
-
-
-	virtual void printBlock(const Block *block) // prints the contents of the block to the console for debugging purposes
-	{
-		printf("==========================================================================================\r\n");
-		printf("Block #%s\r\n", formatNumber(block->blockIndex) );
-
-		printf("ComputedBlockHash: ");
-		printReverseHash(block->computedBlockHash);
-		printf("\r\n");
-
-		if ( block->previousBlockHash )
+		if ( mCommitment.isEnabled() && mUtxo.hasBudget() )
 		{
-			printf("PreviousBlockHash:");
-			printReverseHash(block->previousBlockHash);
-			printf("\r\n");
+			printf("The state image cannot hold a UTXO set commitment kept under a memory budget.\r\n");
+			return false;
 		}
-		if ( block->nextBlockHash )
+		if ( mPartlyProcessed )
 		{
-			printf("NextBlockHash:");
-			printReverseHash(block->nextBlockHash);
-			printf("\r\n");
+			printf("The last block was only partly processed; a state saved now could not be carried on from.\r\n");
+			return false;
 		}
+		FILE *fph = fopen(STATE_IMAGE_SCRATCH,"wb");
+		if ( fph == NULL )
+		{
+			printf("Failed to create '%s'\r\n", STATE_IMAGE_SCRATCH );
+			return false;
+		}
+		StateImageHeader h;
+		memset(&h,0,sizeof(h));
+		bool ok = fwrite(&h,sizeof(h),1,fph) == 1;
+		StateImageWriter w(fph,h);
 
+		w.begin(STATE_HEADERS);
+		w.write(mBlockHeaders,sizeof(BlockHeader)*(uint64_t)mBlockCount);
+		w.end(STATE_HEADERS);
 
-		printf("Merkle root: ");
-		printReverseHash(block->merkleRoot);
-		printf("\r\n");
+		mTransactionFactory.writeState(w);
 
-		printf("Number of Transactions: %s\r\n", formatNumber(block->transactionCount) );
-		printf("Timestamp : %s\r\n", getTimeString(block->timeStamp ) );
-		printf("Bits: %d Hex: %08X\r\n", block->bits, block->bits );
-		printf("Size: %0.10f KB or %s bytes.\r\n", (float)block->blockLength / 1024.0f, formatNumber(block->blockLength) );
-		printf("Version: %d\r\n", block->blockFormatVersion );
-		printf("Nonce: %u\r\n", block->nonce );
-		printf("BlockReward: %f\r\n", (float)block->blockReward / ONE_BTC );
+		w.begin(STATE_TRANSACTION_MAP);
+		{
+			uint64_t size;
+			bool mapOk = mTransactionMap.writeImage(fph,size);
+			w.wrote(mapOk,size);
+		}
+		w.end(STATE_TRANSACTION_MAP);
 
-		printf("%s transactions\r\n", formatNumber(block->transactionCount) );
-		for (uint32_t i=0; i<block->transactionCount; i++)
+		w.begin(STATE_COMMITMENT);
+		if ( mCommitment.isEnabled() )
 		{
-			const BlockTransaction &t = block->transactions[i];
-			printf("Transaction %s : %s inputs %s outputs. VersionNumber: %d\r\n", formatNumber(i), formatNumber(t.inputCount), formatNumber(t.outputCount), t.transactionVersionNumber );
-			printf("TransactionHash: ");
-			printReverseHash(t.transactionHash);
-			printf("\r\n");
-			for (uint32_t i=0; i<t.inputCount; i++)
-			{
-				const BlockInput &input = t.inputs[i];
-				printf("    Input %s : ResponsScriptLength: %s TransactionIndex: %s : TransactionHash: ", formatNumber(i), formatNumber(input.responseScriptLength), formatNumber(input.transactionIndex) );
+			mCommitment.writeState(w,mUtxo);
+		}
+		w.end(STATE_COMMITMENT);
 
-				printReverseHash(input.transactionHash);
+		memcpy(h.mMagic,STATE_IMAGE_MAGIC,sizeof(h.mMagic));
+		h.mVersion = STATE_IMAGE_VERSION;
+		h.mLayout = getStateLayout();
+		h.mProcessedBlocks = mTransactionFactory.getProcessedBlockCount();
+		h.mStatTime = statTime;
+		h.mTransactionCount = mTransactionCount;
+		h.mTotalTransactionCount = mTotalTransactionCount;
+		h.mTotalInputCount = mTotalInputCount;
+		h.mTotalOutputCount = mTotalOutputCount;
+		ok = ok && w.isOk();
+		ok = ok && fseek(fph,0L,SEEK_SET) == 0 && fwrite(&h,sizeof(h),1,fph) == 1;
+		ok = fclose(fph) == 0 && ok;
+		if ( !ok || !replaceFile(STATE_IMAGE_SCRATCH,STATE_IMAGE_FILE) )
+		{
+			printf("Failed to write the state image '%s'\r\n", STATE_IMAGE_FILE );
+			remove(STATE_IMAGE_SCRATCH);
+			return false;
+		}
+		uint64_t size = h.mSections[STATE_COMMITMENT].mOffset+h.mSections[STATE_COMMITMENT].mSize;
+		printf("Saved the state after %s processed blocks of %s to '%s' (%s MB).\r\n",
+			formatNumber(h.mProcessedBlocks),
+			formatNumber(mBlockCount),
+			STATE_IMAGE_FILE,
+			formatNumber((int32_t)(size>>20)));
+		return true;
+	}
 
-				printf("\r\n");
+	virtual uint32_t loadState(uint32_t &statTime)
+	{
+		if ( mBlockHeaderMap.size() || mTransactionFactory.getProcessedTransactionCount() )
+		{
+			printf("A state image can only be loaded before any block headers are scanned or blocks processed.\r\n");
+			return 0;
+		}
+		MappedFile image;
+		if ( !image.open(STATE_IMAGE_FILE) )
+		{
+			printf("Unable to open the state image '%s'\r\n", STATE_IMAGE_FILE );
+			return 0;
+		}
+		const uint8_t *data = image.getData();
+		uint64_t size = image.getSize();
+		StateImageHeader h;
+		bool ok = size >= sizeof(h);
+		if ( ok )
+		{
+			memcpy(&h,data,sizeof(h));
+			ok = memcmp(h.mMagic,STATE_IMAGE_MAGIC,sizeof(h.mMagic)) == 0 && h.mVersion == STATE_IMAGE_VERSION;
+			for (uint32_t i=0; i<STATE_SECTION_COUNT && ok; i++)
+			{
+				ok = h.mSections[i].mOffset <= size && h.mSections[i].mSize <= size-h.mSections[i].mOffset;
+			}
+		}
+		if ( !ok )
+		{
+			printf("'%s' is not a valid state image.\r\n", STATE_IMAGE_FILE );
+			return 0;
+		}
+		if ( h.mLayout != getStateLayout() )
+		{
+			printf("'%s' was written by a build with a different memory layout; it has to be saved again.\r\n", STATE_IMAGE_FILE );
+			return 0;
+		}
 
-				if ( input.transactionIndex != 0xFFFFFFFF )
-				{
-					const BlockTransaction *t = readSingleTransaction(input.transactionHash);
-					if ( t == NULL )
-					{
-						printf("ERROR: TransactionIndex[%d] FAILED TO LOCATE TRANSACTION FOR HASH: ", input.transactionIndex );
-						printReverseHash(input.transactionHash);
-						printf("\r\n");
-					}
-					else
-					{
-						if ( input.transactionIndex < t->outputCount )
-						{
-							const BlockOutput &o = t->outputs[input.transactionIndex];
-							if ( o.publicKey )
-							{
-								char scratch[256];
-								bool ok=true;
-								if ( o.isRipeMD160 )
-								{
-									uint8_t temp[25];
-									BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress(o.publicKey,temp);
-									BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(temp,scratch,256);
-								}
-								else
-								{
-									ok = BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeyToAscii(o.publicKey,scratch,256);
-								}
-								if ( ok )
-								{
-									printf("     Spending From Public Key: %s in the amount of: %0.4f\r\n", scratch, (float)o.value / ONE_BTC );
-								}
-								else
-								{
-									printf("ERROR: Unable to decode public key!\r\n");
-								}
-							}
-							else
-							{
-								printf("ERROR: No public key found for this previous output.\r\n");
-							}
-						}
-						else
-						{
-							printf("ERROR: Invalid transaction index!\r\n");
-						}
-					}
-				}
+		// The header chain; only the blocks of the best chain were saved, not the side chains.  They go back in the
+		// map in height order, so each one's parent is the entry before it.
+		uint32_t blockCount = (uint32_t)(h.mSections[STATE_HEADERS].mSize/sizeof(BlockHeader));
+		if ( !mBlockHeaders.ensure(blockCount) )
+		{
+			printf("'%s' holds more blocks than this build allows.\r\n", STATE_IMAGE_FILE );
+			return 0;
+		}
+		memcpy((void *)&mBlockHeaders[0],&data[h.mSections[STATE_HEADERS].mOffset],sizeof(BlockHeader)*(size_t)blockCount);
+		uint32_t lastFile = 0;
+		for (uint32_t i=0; i<blockCount; i++)
+		{
+			BlockHeader &header = mBlockHeaders[i];
+			if ( header.mHeight != i )
+			{
+				printf("Failed to restore the state from '%s'; the image is damaged.\r\n", STATE_IMAGE_FILE );
+				return 0;
 			}
-			for (uint32_t i=0; i<t.outputCount; i++)
+			header.mParent = i ? i-1 : HEADER_NO_PARENT;
+			mBlockHeaderMap.insert(header);
+			if ( header.mFileIndex > lastFile )
 			{
-				const BlockOutput &output = t.outputs[i];
-				printf("    Output: %s : %f BTC : ChallengeScriptLength: %s\r\n", formatNumber(i), (float)output.value / ONE_BTC, formatNumber(output.challengeScriptLength) );
-				if ( output.publicKey )
-				{
-					char scratch[256];
-					bool ok=true;
-					if ( output.isRipeMD160 )
-					{
-						uint8_t temp[25];
-						BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinRIPEMD160ToAddress(output.publicKey,temp);
-						BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAddressToAscii(temp,scratch,256);
-					}
-					else
-					{
-						ok = BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeyToAscii(output.publicKey,scratch,256);
-					}
-					if ( ok )
-					{
-						printf("PublicKey: %s : %s\r\n", scratch, output.isRipeMD160 ? "RIPEMD160" : "ECDSA" );
-					}
-					else
-					{
-						printf("Failed to encode the public key.\r\n");
-					}
-				}
-				else
-				{
-					printf("ERROR: Unable to derive a public key for this output!\r\n");
-				}
+				lastFile = header.mFileIndex;
+			}
+		}
+		mBlockCount = blockCount;
+		mLinkedHeaders = blockCount;
+		mBestHeader = blockCount ? blockCount-1 : HEADER_NO_PARENT;
+		mLastBlockHeaderCount = mBlockHeaderMap.size();
+		buildBlockTimes();
+		while ( mBlockIndex < lastFile && mBlockIndex+1 < MAX_BLOCK_FILES )
+		{
+			mBlockIndex++;
+			if ( !openBlock() )
+			{
+				break;
 			}
 		}
 
-		printf("==========================================================================================\r\n");
+		ok = mTransactionFactory.readState(h,data) &&
+			 mTransactionMap.readImage(&data[h.mSections[STATE_TRANSACTION_MAP].mOffset],h.mSections[STATE_TRANSACTION_MAP].mSize) &&
+			 (h.mSections[STATE_COMMITMENT].mSize == 0 || mCommitment.readState(&data[h.mSections[STATE_COMMITMENT].mOffset],h.mSections[STATE_COMMITMENT].mSize,mUtxo));
+		if ( !ok )
+		{
+			printf("Failed to restore the state from '%s'; the image is damaged.\r\n", STATE_IMAGE_FILE );
+			return 0;
+		}
+		mTransactionCount = h.mTransactionCount;
+		mTotalTransactionCount = h.mTotalTransactionCount;
+		mTotalInputCount = h.mTotalInputCount;
+		mTotalOutputCount = h.mTotalOutputCount;
+		statTime = h.mStatTime;
+		mProcessedStatCount = mTransactionFactory.getStatCount();
+		if ( h.mProcessedBlocks && h.mProcessedBlocks <= mBlockCount )
+		{
+			mProcessedTip = mBlockHeaders[h.mProcessedBlocks-1];
+		}
+		printf("Loaded the state after %s processed blocks of %s from '%s'.\r\n",
+			formatNumber(h.mProcessedBlocks),
+			formatNumber(mBlockCount),
+			STATE_IMAGE_FILE);
+		return h.mProcessedBlocks;
 	}
 
-	virtual const Block * processSingleBlock(const void *blockData,uint32_t blockLength) 
+	virtual void setUndoDepth(uint32_t blocks)
 	{
-		const Block *ret = NULL;
-		if ( blockLength < MAX_BLOCK_SIZE )
-		{
-			mSingleBlock.blockIndex = 0;
-			mSingleBlock.blockReward = 0;
-			mSingleBlock.totalInputCount = 0;
-			mSingleBlock.totalOutputCount = 0;
-			mSingleBlock.fileIndex = 0;
-			mSingleBlock.fileOffset =  0;
-			uint32_t transactionIndex=0;
-			mSingleBlock.processBlockData(blockData,blockLength,transactionIndex);
-			ret = static_cast< Block *>(&mSingleBlock);
-		}
-		return ret;
+		mUndo.setDepth(blocks);
 	}
 
-	virtual const BlockTransaction *processSingleTransaction(const void *transactionData,uint32_t transactionLength)
+	virtual uint32_t reorganize(uint32_t processedBlocks)
 	{
-		const BlockTransaction *ret = NULL;
-		if ( transactionLength < MAX_BLOCK_SIZE )
+		if ( processedBlocks == 0 )
 		{
-			mSingleBlock.blockIndex = 0;
-			mSingleBlock.blockReward = 0;
-			mSingleBlock.totalInputCount = 0;
-			mSingleBlock.totalOutputCount = 0;
-			mSingleBlock.fileIndex = 0;
-			mSingleBlock.fileOffset =  0;
-			ret = mSingleBlock.processTransactionData(transactionData,transactionLength);
+			return 0;
+		}
+		uint32_t fork = findFork(processedBlocks);
+		if ( fork == UNDO_NO_FORK )
+		{
+			printf("The best chain no longer holds the processed blocks and it leaves them further back than the undo records of the last %s blocks reach.\r\n", formatNumber(mUndo.getDepth()) );
+			return UNDO_NO_FORK;
 		}
-		return ret;
-
+		if ( fork < processedBlocks )
+		{
+			disconnect(fork);
+			printf("The best chain has changed; disconnected the last %s processed blocks, processing carries on from block #%s.\r\n", formatNumber(processedBlocks-fork), formatNumber(fork) );
+		}
+		else
+		{
+			// Only the rows gathered once processing reached the end go; they are gathered again when it next does
+			mTransactionFactory.truncateStatistics(mProcessedStatCount);
+		}
+		return fork;
 	}
 
-	virtual const BlockTransaction *readSingleTransaction(const uint8_t *transactionHash) 
+	// Returns how many of the processed blocks are still on the best chain; the newest undo record whose block is
+	// still at its height there marks the fork.  If none is, the block below the oldest record has to be.
+	uint32_t findFork(uint32_t processedBlocks) const
 	{
-		const BlockTransaction *ret = NULL;
-
-		Hash256 h(transactionHash);
-		FileLocation key(h,0,0,0,0);
-		FileLocation *found = mTransactionMap.find(key);
-		if ( found == NULL )
+		uint32_t count = mUndo.size();
+		if ( count == 0 || mUndo.get(count-1).mHeight+1 != processedBlocks ) // no records for the tip; fine if the chain still holds it
 		{
-			printf("ERROR: Unable to locate this transaction hash:");
-			printReverseHash(transactionHash);
-			printf("\r\n");
-			return NULL; 
+			return processedBlocks <= mBlockCount && mBlockHeaders[processedBlocks-1] == mProcessedTip ? processedBlocks : UNDO_NO_FORK;
 		}
-		const FileLocation &f = *found;
-		uint32_t fileIndex = f.mFileIndex;
-		uint32_t fileOffset = f.mFileOffset;
-		uint32_t transactionLength = f.mFileLength;
-
-		if ( fileIndex < MAX_BLOCK_FILES && mBlockChain[fileIndex] && transactionLength < MAX_BLOCK_SIZE )
+		for (uint32_t i=count; i>0; i--)
 		{
-			FILE *fph = mBlockChain[fileIndex];
-			uint32_t saveLocation = (uint32_t)ftell(fph);
-			fseek(fph,fileOffset,SEEK_SET);
-			uint32_t s = (uint32_t)ftell(fph);
-			if ( s == fileOffset )
-			{
-				uint8_t *blockData = mTransactionBlockBuffer;
-				size_t r = fread(blockData,transactionLength,1,fph);
-				if ( r == 1 ) // if we successfully read in the entire transaction
-				{
-					ret = processSingleTransaction(blockData,transactionLength);
-					if ( ret )
-					{
-						BlockTransaction *t = (BlockTransaction *)ret;
-						t->transactionIndex = f.mTransactionIndex;
-						t->fileIndex = fileIndex;
-						t->fileOffset = fileOffset;
-					}
-				}
-				else
-				{
-					assert(0);
-				}
-			}
-			else
+			const BlockUndo &u = mUndo.get(i-1);
+			if ( u.mHeight < mBlockCount && mBlockHeaders[u.mHeight] == u.mBlockHash )
 			{
-				assert(0);
+				return u.mHeight+1;
 			}
-			fseek(fph,saveLocation,SEEK_SET); // restore the file position back to it's previous location.
 		}
-		else
+		const BlockUndo &oldest = mUndo.get(0);
+		if ( oldest.mHeight == 0 || (oldest.mHeight <= mBlockCount && mBlockHeaders[oldest.mHeight-1] == oldest.mPreviousBlockHash) )
 		{
-			assert(0);
+			return oldest.mHeight;
 		}
-		return ret;
+		return UNDO_NO_FORK;
 	}
 
-	virtual void processTransactions(const Block *block) // process the transactions in this block and assign them to individual wallets
+	// Takes back every processed block from height 'fork' on, newest first
+	void disconnect(uint32_t fork)
 	{
-		if ( !block ) return;
-
-		Transaction *transactions = mTransactionFactory.getTransactions(block->transactionCount);
-		if ( !transactions ) return;
-
-		mTransactionFactory.markBlock(transactions);
-
-		for (uint32_t i=0; i<block->transactionCount; i++)
+		uint32_t first = fork-mUndo.get(0).mHeight;
+		if ( mTransactionFactory.isUtxoMode() || mCommitment.isEnabled() )
 		{
-
-			const BlockTransaction &t = block->transactions[i];
-			Transaction &trans = transactions[i];
-			trans.mBlock = block->blockIndex;
-			trans.mTime = block->timeStamp;
-			trans.mInputCount = t.inputCount;
-			trans.mOutputCount = t.outputCount;
-
-			trans.mInputs   = mTransactionFactory.getInputs(trans.mInputCount);
-			trans.mOutputs  = mTransactionFactory.getOutputs(trans.mOutputCount);
-
-			if ( trans.mInputs == NULL || trans.mOutputs == NULL )
+			for (uint32_t i=mUndo.size(); i>first; i--)
 			{
-				break;
+				disconnectUtxo(i-1);
 			}
-
-			for (uint32_t i=0; i<t.outputCount; i++)
+		}
+		const BlockUndo &u = mUndo.get(first);
+		mTransactionMap.truncate(u.mReadCount);
+		mTransactionFactory.truncate(u.mTransactionCount,u.mInputCount,u.mOutputCount,fork,u.mAddressCount,u.mStatCount);
+		mPublicKeyCache.forget(u.mAddressCount);
+		mTransactionCount = u.mReadCount;
+		mTotalTransactionCount = u.mTotalTransactionCount;
+		mTotalInputCount = u.mTotalInputCount;
+		mTotalOutputCount = u.mTotalOutputCount;
+		mProcessedTip = u.mPreviousBlockHash;
+		mProcessedStatCount = u.mStatCount;
+		mLookupBlock = 0xFFFFFFFF;
+		mUndo.truncate(first);
+	}
+
+	// Takes back what undo record 'i' says its block did to the UTXO set, the address totals and the commitment.  The
+	// outputs it spent go back before the ones it added are removed, so an output both added and spent within the
+	// block ends up gone.  An output which replaced an earlier duplicate of itself (the duplicate coinbases before
+	// BIP-30) is not put back.
+	void disconnectUtxo(uint32_t i)
+	{
+		AddressUndo *addresses;
+		for (uint32_t j=mUndo.getAddresses(i,addresses); j>0; j--)
+		{
+			mTransactionFactory.undoUtxo(addresses[j-1]);
+		}
+		UtxoEntry *spent;
+		UtxoKey *added;
+		uint32_t spentCount = mUndo.getSpent(i,spent);
+		uint32_t addedCount = mUndo.getAdded(i,added);
+		// Bring back any of the added outputs which were spilled, and make room for the spent ones; prefetch reorders
+		// the keys it is given, so it gets a copy
+		uint32_t keyCount = addedCount < MAX_BLOCK_INPUTS ? addedCount : MAX_BLOCK_INPUTS;
+		memcpy(mUtxoKeys,added,sizeof(UtxoKey)*keyCount);
+		mUtxo.prefetch(mUtxoKeys,keyCount,spentCount);
+		bool commit = mCommitment.isEnabled();
+		for (uint32_t j=spentCount; j>0; j--)
+		{
+			mUtxo.restore(spent[j-1]);
+			if ( commit )
 			{
-				const BlockOutput &output = t.outputs[i];
-				TransactionOutput &to = trans.mOutputs[i];
-
-				uint32_t adr = 0;
-
-				if ( output.publicKey )
-				{
-					if ( output.isRipeMD160 )
-					{
-						mTransactionFactory.getAddress(output.publicKey,adr);
-					}
-					else
-					{
-						uint8_t address[25];
-						BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinPublicKeyToAddress(output.publicKey,address);
-						mTransactionFactory.getAddress(&address[1],adr);
-					}
-				}
-				to.mAddress = adr;
-				to.mValue = output.value;
+				mCommitment.add(spent[j-1]);
 			}
-
-			for (uint32_t i=0; i<t.inputCount; i++)
+		}
+		for (uint32_t j=0; j<addedCount; j++)
+		{
+			UtxoEntry e;
+			if ( mUtxo.discard(added[j],e) && commit )
 			{
-				const BlockInput &input = t.inputs[i];
-				TransactionInput &tin = trans.mInputs[i];
-				tin.mOutput = NULL;
-
-				if ( input.transactionIndex != 0xFFFFFFFF )
-				{
-					Hash256 h(input.transactionHash);
-					FileLocation key(h,0,0,0,0);
-					FileLocation *found = mTransactionMap.find(key);
-					assert(found);
-					if ( found )
-					{
-						Transaction *previousTransaction = mTransactionFactory.getSingleTransaction(found->mTransactionIndex);
-						if ( previousTransaction == NULL )
-						{
-							printf("ERROR: FAILED TO LOCATE TRANSACTION!\r\n");
-						}
-						else
-						{
-							assert( input.transactionIndex < previousTransaction->mOutputCount );
-							if ( input.transactionIndex < previousTransaction->mOutputCount )
-							{
-								tin.mOutput = &previousTransaction->mOutputs[input.transactionIndex];
-								mTransactionFactory.getAddress(tin.mOutput->mAddress);
-							}
-						}
-					}
-				}
+				mCommitment.remove(e);
 			}
 		}
 	}
 
-	virtual uint32_t gatherAddresses(void)
+	virtual bool setUtxoCommitment(bool state)
 	{
-		mTransactionFactory.gatherAddresses();
-		return mTransactionFactory.getAddressCount();
+		if ( mTransactionFactory.getProcessedTransactionCount() )
+		{
+			printf("The UTXO set commitment can only be turned on or off before blocks are processed.\r\n");
+			return false;
+		}
+		mCommitment.setEnabled(state);
+		return true;
 	}
 
-	virtual void reportCounts(void)
+	virtual bool setUtxoBudget(uint32_t megabytes)
 	{
-		printf("Total Blocks: %s\r\n", formatNumber(mBlockCount) );
-		printf("Total Transactions: %s\r\n", formatNumber(mTotalTransactionCount));
-		printf("Total Inputs: %s\r\n", formatNumber(mTotalInputCount));
-		printf("Total Outputs: %s\r\n", formatNumber(mTotalOutputCount));
-		mTransactionFactory.reportCounts();
+		if ( mTransactionFactory.getProcessedTransactionCount() )
+		{
+			printf("The UTXO memory budget cannot be changed once blocks have been processed.\r\n");
+			return false;
+		}
+		return mUtxo.setBudget(megabytes);
 	}
 
-	virtual void printTransactions(uint32_t blockIndex)
+	virtual bool testUtxoBudget(uint32_t outputCount)
 	{
-		mTransactionFactory.printTransactions(blockIndex);
+		if ( mUtxo.hasBudget() )
+		{
+			printf("The self test uses the spill log '%s'; run it before setting a UTXO memory budget.\r\n", UTXO_SPILL_FILE );
+			return false;
+		}
+		return testUtxoSpill(outputCount);
+	}
+
+	virtual bool testTransactionIndex(uint32_t recordCount)
+	{
+		return ::testTransactionIndex(recordCount);
+	}
+
+	virtual void setHugePages(HugePageMode mode)
+	{
+		gHugePages = mode;
+		gHugePagesFailed = false;
+	}
+
+	virtual void freeze(void)
+	{
+		uint32_t threadCount = getProcessorCount();
+		printf("Freezing the transaction and address maps into minimal perfect hashes using %d threads.\r\n", threadCount );
+		mTransactionMap.freeze(threadCount);
+		mTransactionFactory.freeze(threadCount);
+		mTransactionMap.report("Transaction");
+		mTransactionFactory.reportAddressMap();
 	}
 
 	virtual void gatherStatistics(uint32_t stime,uint32_t zombieDate,bool record_addresses)
@@ -4980,16 +13539,22 @@ public:
 		if ( fph )
 		{
 			uint32_t magicID = 0;
-			uint32_t lastBlockRead = (uint32_t)ftell(fph);
+			// Reading blocks to process them moves the same file pointer, so the scan carries on from where it left off
+			if ( (uint32_t)ftell(fph) != mScanOffset )
+			{
+				fseek(fph,mScanOffset,SEEK_SET);
+			}
+			uint32_t lastBlockRead = mScanOffset;
+			uint32_t resumeOffset = lastBlockRead;
 			size_t r = fread(&magicID,sizeof(magicID),1,fph);	// Attempt to read the magic id for the next block
 			if ( r == 0 )
 			{
-				mBlockIndex++;	// advance to the next data file if we couldn't read any further in the current data file
-				if ( openBlock() )
+				if ( openNextBlock(resumeOffset) )	// advance to the next data file if we couldn't read any further in the current data file
 				{
 					fph = mBlockChain[mBlockIndex];
 					r = fread(&magicID,sizeof(magicID),1,fph); // if we opened up a new file; read the magic id from it's first block.
 					lastBlockRead = ftell(fph);
+					resumeOffset = 0;
 				}
 			}
 			// If after reading the previous block, we did not encounter a block header, we need to scan for the next block header..
@@ -5028,8 +13593,7 @@ public:
 				}
 				else
 				{
-					mBlockIndex++;	// advance to the next data file if we couldn't read any further in the current data file
-					if ( openBlock() )
+					if ( openNextBlock(resumeOffset) )	// advance to the next data file if we couldn't read any further in the current data file
 					{
 						fph = mBlockChain[mBlockIndex];
 						r = fread(&magicID,sizeof(magicID),1,fph); // if we opened up a new file; read the magic id from it's first block.
@@ -5065,38 +13629,161 @@ public:
 						{
 							Hash256 *blockHash = static_cast< Hash256 *>(&header);
 							memcpy(header.mPreviousBlockHash,prefix.mPreviousBlock,32);
+							header.mTimeStamp = prefix.mTimeStamp;
+							header.mVersion = prefix.mVersion;
+							header.mBits = prefix.mBits;
+							header.mNonce = prefix.mNonce;
 							BLOCKCHAIN_SHA256::computeSHA256((uint8_t *)&prefix,sizeof(prefix),(uint8_t *)blockHash);
 							BLOCKCHAIN_SHA256::computeSHA256((uint8_t *)blockHash,32,(uint8_t *)blockHash);
 							uint32_t currentFileOffset = ftell(fph); // get the current file offset.
 							uint32_t advance = header.mBlockLength - sizeof(BlockPrefix);
 							currentFileOffset+=advance;
 							fseek(fph,currentFileOffset,SEEK_SET); // skip past the block to get to the next header.
-							mLastBlockHeader = mBlockHeaderMap.insert(header);
+							// A block already seen, stored twice or scanned again after loading a state image, is only kept once
+							if ( mBlockHeaderMap.find(header) == NULL )
+							{
+								mBlockHeaderMap.insert(header);
+							}
 							ok = true;
 						}
 					}
 				}
 			}
+			mScanOffset = (uint32_t)ftell(mBlockChain[mBlockIndex]);
 		}
 		return ok;
 	}
 
+	// Moves on to the next data file.  If there is none yet, the current one is left where this read started so a
+	// later scan picks up any blocks written to it since, or the next file once it appears.
+	bool openNextBlock(uint32_t resumeOffset)
+	{
+		if ( (mBlockIndex+1) >= MAX_BLOCK_FILES )
+		{
+			return false;
+		}
+		mBlockIndex++;
+		if ( openBlock() )
+		{
+			return true;
+		}
+		mBlockIndex--;
+		fseek(mBlockChain[mBlockIndex],resumeOffset,SEEK_SET); // also clears the end of file indicator
+		return false;
+	}
+
 	virtual uint32_t getBlockCount(void) const 
 	{
 		return mBlockCount; 
 	}
 
+	virtual uint32_t getBlockTime(uint32_t blockIndex) const
+	{
+		return blockIndex < mBlockCount && mBlockTimes ? mBlockTimes[blockIndex] : 0;
+	}
+
+	// The first height whose running maximum timestamp is at or after 't'
+	uint32_t getFirstBlockAtTime(uint32_t t) const
+	{
+		uint32_t low = 0;
+		uint32_t high = mMaxBlockTimes ? mBlockCount : 0;
+		while ( low < high )
+		{
+			uint32_t mid = (low+high)/2;
+			if ( mMaxBlockTimes[mid] < t )
+			{
+				low = mid+1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		return low;
+	}
+
+	virtual void getBlockRange(uint32_t startTime,uint32_t endTime,uint32_t &firstBlock,uint32_t &endBlock) const
+	{
+		firstBlock = getFirstBlockAtTime(startTime);
+		endBlock = getFirstBlockAtTime(endTime);
+	}
+
 	virtual void printBlockHeaders(void) 
 	{
 		for (uint32_t i=0; i<mBlockCount; i++)
 		{
-			BlockHeader &h = *mBlockHeaders[i];
+			const BlockHeader &h = mBlockHeaders[i];
 			printf("Block #%d : prevBlockHash:", i );
 			printReverseHash(h.mPreviousBlockHash);
 			printf("\r\n");
 		}
 	}
 
+	// The header fields of the best chain as a time series, one row per block.  Everything comes from the records
+	// the header scan filled in, so no block is read.
+	virtual bool saveBlockHeaders(uint32_t firstBlock,uint32_t endBlock)
+	{
+		if ( endBlock > mBlockCount )
+		{
+			endBlock = mBlockCount;
+		}
+		if ( mBlockCount == 0 )
+		{
+			printf("There is no block chain to report on; scan the block headers first.\r\n");
+			return false;
+		}
+		FILE *fph = fopen(BLOCK_HEADERS_FILE,"wb");
+		if ( !fph )
+		{
+			printf("Failed to open the block header output file '%s' for write access.\r\n", BLOCK_HEADERS_FILE );
+			return false;
+		}
+		fprintf(fph,"Height,Hash,Time,Date,Interval,Version,Bits,Difficulty,Nonce,Size,ChainWork\r\n");
+		for (uint32_t i=firstBlock; i<endBlock; i++)
+		{
+			const BlockHeader &h = mBlockHeaders[i];
+			const uint8_t *hash = (const uint8_t *)&h.mWord0;
+			char hex[65];
+			for (uint32_t j=0; j<32; j++)
+			{
+				sprintf(&hex[j*2],"%02x", hash[31-j] );
+			}
+			// The difficulty is the target of difficulty one over this block's target, as the reference client shows it
+			uint32_t shift = (h.mBits>>24) & 0xFF;
+			double difficulty = (h.mBits & 0x00FFFFFF) ? (double)0x0000FFFF / (double)(h.mBits & 0x00FFFFFF) : 0;
+			for (; shift < 29; shift++)
+			{
+				difficulty*=256.0;
+			}
+			for (; shift > 29; shift--)
+			{
+				difficulty/=256.0;
+			}
+			char work[65];
+			fprintf(fph,"%u,%s,%u,\"%s\",%d,0x%08x,%08x,%0.8f,%u,%u,%s\r\n",
+				i,
+				hex,
+				h.mTimeStamp,
+				getTimeString(h.mTimeStamp),
+				i ? (int32_t)(h.mTimeStamp-mBlockHeaders[i-1].mTimeStamp) : 0,
+				h.mVersion,
+				h.mBits,
+				difficulty,
+				h.mNonce,
+				h.mBlockLength,
+				h.mChainWork.getHex(work));
+		}
+		bool ok = ferror(fph) == 0;
+		ok = fclose(fph) == 0 && ok;
+		if ( !ok )
+		{
+			printf("Failed to write the block header output file '%s'.\r\n", BLOCK_HEADERS_FILE );
+			return false;
+		}
+		printf("Saved the headers of %s blocks to '%s'.\r\n", formatNumber(endBlock > firstBlock ? endBlock-firstBlock : 0), BLOCK_HEADERS_FILE );
+		return true;
+	}
+
 	virtual uint32_t buildBlockChain(void) 
 	{
 		if ( mScanCount )
@@ -5106,30 +13793,40 @@ public:
 				formatNumber(mBlockHeaderMap.size()),
 				formatNumber( mBlockHeaderMap.size()-mLastBlockHeaderCount) );
 			printf("Building complete block-chain.\r\n");
-			// need to count the total number of blocks...
-
-			if ( mLastBlockHeader )
+			linkHeaders();
+			if ( mBestHeader != HEADER_NO_PARENT )
 			{
-				mBlockCount = 0;
-				const BlockHeader *scan = mLastBlockHeader;
-				while ( scan )
+				const BlockHeader *tip = mBlockHeaderMap.getKey(mBestHeader);
+				uint32_t blockCount = tip->mHeight+1;
+				if ( !mBlockHeaders.ensure(blockCount) )
 				{
-					Hash256 prevBlock(scan->mPreviousBlockHash);
-					scan = mBlockHeaderMap.find(prevBlock);
-					mBlockCount++;
+					printf("The best chain has %s blocks; this build allows at most %s.\r\n", formatNumber(blockCount), formatNumber(mBlockHeaders.getCapacity()) );
+					mScanCount = 0;
+					return mBlockCount;
 				}
-				printf("Found %s blocks and skipped %s orphan blocks.\r\n", formatNumber(mBlockCount), formatNumber(mBlockHeaderMap.size()-mBlockCount));
-				mBlockHeaders = new BlockHeader *[mBlockCount];
-				uint32_t index = mBlockCount-1;
-				scan = mLastBlockHeader;
-				while ( scan )
+				// Copied from the tip down until it meets the chain built last time; below a block they agree on,
+				// they agree on every block.  A later scan may have grown the chain or moved it to another branch.
+				uint32_t index = mBestHeader;
+				for (uint32_t i=blockCount; i>0; i--)
 				{
-					mBlockHeaders[index] = (BlockHeader *)scan;
-					Hash256 prevBlock(scan->mPreviousBlockHash);
-					scan = mBlockHeaderMap.find(prevBlock);
-					index--;
+					const BlockHeader &header = *mBlockHeaderMap.getKey(index);
+					if ( i <= mBlockCount && mBlockHeaders[i-1] == header )
+					{
+						break;
+					}
+					mBlockHeaders[i-1] = header;
+					index = header.mParent;
 				}
-
+				mBlockCount = blockCount;
+				mLookupBlock = 0xFFFFFFFF;
+				char scratch[65];
+				uint32_t linked = mBlockHeaderMap.size()-mUnlinkedCount;
+				printf("Found %s blocks with chain work %s; skipped %s side chain and %s orphan headers.\r\n",
+					formatNumber(mBlockCount),
+					tip->mChainWork.getHex(scratch),
+					formatNumber(linked-mBlockCount),
+					formatNumber(mUnlinkedCount));
+				buildBlockTimes();
 			}
 			mScanCount = 0;
 		}
@@ -5137,6 +13834,155 @@ public:
 		return mBlockCount;
 	}
 
+	// Links the headers scanned since last time to their parents in a single pass over the map's entries, which are
+	// numbered in the order they were read, giving each its height and the work of the chain up to it; the tip with
+	// the most work is the best chain.  A block is usually stored after its parent but not always, so the headers
+	// passed on the way up to a linked ancestor are linked on the way back down.  Headers which do not reach the
+	// genesis block yet are set aside and tried again after the next scan, in case their parents turn up.
+	void linkHeaders(void)
+	{
+		uint32_t count = mBlockHeaderMap.size();
+		uint32_t pending = mUnlinkedCount+(count-mLinkedHeaders);
+		if ( pending > mUnlinkedCapacity )
+		{
+			uint32_t *unlinked = new uint32_t[pending];
+			if ( mUnlinkedCount )
+			{
+				memcpy(unlinked,mUnlinked,sizeof(uint32_t)*mUnlinkedCount);
+			}
+			delete []mUnlinked;
+			mUnlinked = unlinked;
+			mUnlinkedCapacity = pending;
+		}
+		for (uint32_t i=0; i<mUnlinkedCount; i++)
+		{
+			mBlockHeaderMap.getKey(mUnlinked[i])->mHeight = HEADER_UNLINKED;
+		}
+		for (uint32_t i=mLinkedHeaders; i<count; i++)
+		{
+			mUnlinked[mUnlinkedCount++] = i;
+		}
+		mLinkedHeaders = count;
+		uint32_t remaining = 0;
+		for (uint32_t i=0; i<mUnlinkedCount; i++)
+		{
+			if ( !linkHeader(mUnlinked[i]) )
+			{
+				mUnlinked[remaining++] = mUnlinked[i];
+			}
+		}
+		mUnlinkedCount = remaining;
+	}
+
+	// Links header 'index' and any unlinked headers between it and its nearest linked ancestor; returns false if
+	// they do not reach the genesis block
+	bool linkHeader(uint32_t index)
+	{
+		uint32_t depth = 0;
+		const BlockHeader *base = NULL;	// The linked ancestor the walk stopped at; NULL for the genesis block
+		bool ok = false;
+		for (;;)
+		{
+			BlockHeader *h = mBlockHeaderMap.getKey(index);
+			if ( h->mHeight != HEADER_UNLINKED )
+			{
+				base = h;
+				ok = h->mHeight != HEADER_ORPHAN;
+				break;
+			}
+			if ( depth == mLinkStackCapacity )
+			{
+				mLinkStackCapacity = mLinkStackCapacity ? mLinkStackCapacity*2 : 1024;
+				uint32_t *stack = new uint32_t[mLinkStackCapacity];
+				if ( depth )
+				{
+					memcpy(stack,mLinkStack,sizeof(uint32_t)*depth);
+				}
+				delete []mLinkStack;
+				mLinkStack = stack;
+			}
+			mLinkStack[depth++] = index;
+			if ( isGenesis(*h) )
+			{
+				ok = true;
+				break;
+			}
+			if ( h->mParent == HEADER_NO_PARENT && !mBlockHeaderMap.find(BlockHeader(Hash256(h->mPreviousBlockHash)),h->mParent) )
+			{
+				h->mParent = HEADER_NO_PARENT;
+				break;
+			}
+			index = h->mParent;
+		}
+		while ( depth )
+		{
+			index = mLinkStack[--depth];
+			BlockHeader &h = *mBlockHeaderMap.getKey(index);
+			if ( !ok )
+			{
+				h.mHeight = HEADER_ORPHAN;
+				continue;
+			}
+			if ( h.mBits != mWorkBits || mWorkBits == 0 )
+			{
+				mWork.setBlockWork(h.mBits);
+				mWorkBits = h.mBits;
+			}
+			h.mChainWork = mWork;
+			if ( base )
+			{
+				h.mHeight = base->mHeight+1;
+				h.mChainWork.add(base->mChainWork);
+			}
+			else
+			{
+				h.mHeight = 0;
+			}
+			// On equal work the header read first wins, as the reference client keeps the tip it saw first
+			if ( mBestHeader == HEADER_NO_PARENT )
+			{
+				mBestHeader = index;
+			}
+			else
+			{
+				int cmp = h.mChainWork.compare(mBlockHeaderMap.getKey(mBestHeader)->mChainWork);
+				if ( cmp > 0 || (cmp == 0 && index < mBestHeader) )
+				{
+					mBestHeader = index;
+				}
+			}
+			base = &h;
+		}
+		return ok;
+	}
+
+	static inline bool isGenesis(const BlockHeader &h)
+	{
+		static const uint8_t zero[32] = { 0 };
+		return memcmp(h.mPreviousBlockHash,zero,32) == 0;
+	}
+
+	// Block timestamps only roughly increase; a block may claim an earlier time than its parent.  The running maximum
+	// does increase, so a binary search over it maps a time to a height.
+	void buildBlockTimes(void)
+	{
+		delete []mBlockTimes;
+		delete []mMaxBlockTimes;
+		mBlockTimes = new uint32_t[mBlockCount];
+		mMaxBlockTimes = new uint32_t[mBlockCount];
+		uint32_t maxTime = 0;
+		for (uint32_t i=0; i<mBlockCount; i++)
+		{
+			uint32_t t = mBlockHeaders[i].mTimeStamp;
+			if ( t > maxTime )
+			{
+				maxTime = t;
+			}
+			mBlockTimes[i] = t;
+			mMaxBlockTimes[i] = maxTime;
+		}
+	}
+
 	virtual bool readBlockHeaders(uint32_t maxBlock,uint32_t &blockCount)
 	{
 		if ( readBlockHeader() && mScanCount < maxBlock )
@@ -5151,9 +13997,66 @@ public:
 
 	virtual void printAddress(const char *address) 
 	{
+		// Addresses which were not seen in this run are looked up in the address directory, if there is one
+		uint8_t output[25];
+		if ( BLOCKCHAIN_BITCOIN_ADDRESS::bitcoinAsciiToAddress(address,output) && !mTransactionFactory.hasAddress(&output[1]) )
+		{
+			if ( !mAddressDirectoryOpened )
+			{
+				mAddressDirectoryOpened = true;
+				mAddressDirectory.open(ADDRESS_DIRECTORY_FILE,ADDRESS_POSTINGS_FILE);
+			}
+			const AddressDirectoryRecord *r = mAddressDirectory.find(&output[1]);
+			if ( r )
+			{
+				printDirectoryAddress(address,r);
+				return;
+			}
+		}
 		mTransactionFactory.printAddress(address);
 	}
 
+	void printDirectoryAddress(const char *address,const AddressDirectoryRecord *r)
+	{
+		printf("========================================\r\n");
+		printf("PublicKey: %s has %s transactions associated with it.\r\n", address, formatNumber(r->mTransactionCount) );
+		printf("Balance: %0.4f : TotalReceived: %0.4f TotalSpent: %0.4f\r\n", (float) (r->mTotalReceived-r->mTotalSent)/ONE_BTC, (float)r->mTotalReceived / ONE_BTC, (float) r->mTotalSent / ONE_BTC );
+		printf("Received %s times, spent %s times.\r\n", formatNumber(r->mOutputCount), formatNumber(r->mInputCount) );
+		if ( r->mFirstOutputTime )
+		{
+			printf("First Output Time: %s\r\n", getTimeString(r->mFirstOutputTime) );
+		}
+		if ( r->mLastInputTime )
+		{
+			printf("Last Input Time: %s\r\n", getTimeString(r->mLastInputTime) );
+		}
+		if ( r->mLastOutputTime )
+		{
+			printf("Last Output Time: %s\r\n", getTimeString(r->mLastOutputTime) );
+		}
+		mLookupBlock = 0xFFFFFFFF;
+		const uint32_t *postings = mAddressDirectory.getPostings(r);
+		for (uint32_t i=0; i<r->mPostingCount; i++)
+		{
+			uint32_t block = mAddressDirectory.getBlock(postings[i]);
+			const BlockTransaction *t = getBlockTransaction(block,postings[i]-mAddressDirectory.getBlockStart(block),mAddressDirectory.getBlockLocation(block));
+			printf("    Transaction #%s ", formatNumber(i) );
+			printReverseHash(t ? t->transactionHash : NULL);
+			printf(" From Block: %s time: %s\r\n", formatNumber(block), getTimeString(t ? mSingleBlock.timeStamp : 0) );
+		}
+		printf("========================================\r\n");
+		printf("\r\n");
+	}
+
+	virtual void saveAddressDirectory(void)
+	{
+		mAddressDirectory.close(); // the files are about to be replaced
+		mAddressDirectoryOpened = false;
+		BlockLocation *locations = getBlockLocations(mTransactionFactory.getProcessedBlockCount());
+		mTransactionFactory.saveAddressDirectory(ADDRESS_DIRECTORY_FILE,ADDRESS_POSTINGS_FILE,locations,getProcessorCount());
+		delete []locations;
+	}
+
 	virtual void printTopBalances(uint32_t tcount,uint32_t minBalance) 
 	{
 		mTransactionFactory.printTopBalances(tcount,minBalance);
@@ -5186,18 +14089,58 @@ public:
 	uint8_t						mBlockDataBuffer[MAX_BLOCK_SIZE];	// Holds one block of data
 	uint8_t						mTransactionBlockBuffer[MAX_BLOCK_SIZE];
 	uint32_t					mTransactionCount;
-	TransactionHashMap			mTransactionMap;	// A hash map to the seek file location of all transactions (by hash)
+	TransactionHashMap			mTransactionMap;	// A compact index from transaction hash to transaction index and seek file location
 	uint32_t					mLastBlockHeaderCount;
 
 	uint32_t					mTotalTransactionCount;
 	uint32_t					mTotalInputCount;
 	uint32_t					mTotalOutputCount;
 	uint32_t					mScanCount;
+	uint32_t					mScanOffset;			// Where the header scan left off in the current data file
 	uint32_t					mBlockCount;
-	BlockHeader					*mLastBlockHeader;
-	BlockHeader					**mBlockHeaders;
+	ArenaArray< BlockHeader >	mBlockHeaders;			// The headers of the best chain by height
+	uint32_t					mBestHeader;			// The block header map index of the tip of the best chain
+	uint32_t					mLinkedHeaders;			// How many of the map's headers the linking pass has seen
+	uint32_t					*mUnlinked;				// The map indices of headers which do not reach the genesis block yet
+	uint32_t					mUnlinkedCount;
+	uint32_t					mUnlinkedCapacity;
+	uint32_t					*mLinkStack;			// The headers passed on the way up to a linked ancestor
+	uint32_t					mLinkStackCapacity;
+	uint32_t					mWorkBits;				// The last target the work of a block was worked out for
+	ChainWork					mWork;					// and that work
+	uint32_t					*mBlockTimes;			// The timestamp of each block by height
+	uint32_t					*mMaxBlockTimes;		// The latest timestamp of any block up to and including this height
 	BlockHeaderMap				mBlockHeaderMap;		// A hash-map of all of the block headers
 	BitcoinTransactionFactory	mTransactionFactory;	// the factory that accumulates all transactions on a per-address basis
+	const uint8_t				*mPublicKeys[MAX_BLOCK_OUTPUTS];			// The public keys of the P2PK outputs in the block being processed
+	uint32_t					mPublicKeyAddress[MAX_BLOCK_OUTPUTS];		// The cached address of each of those keys; zero if it was not in the cache
+	const uint8_t				*mMissingKeys[MAX_BLOCK_OUTPUTS];			// The keys which were not in the cache and have to be hashed
+	uint32_t					mPrevoutCount;								// The number of inputs queued up to be resolved
+	Hash256						mPrevoutHashes[PREVOUT_BATCH];				// The hash of the transaction each queued input spends
+	uint32_t					mPrevoutInputs[PREVOUT_BATCH];				// The queued inputs
+	uint32_t					mPrevoutOutputIndex[PREVOUT_BATCH];			// Which output of that transaction is spent
+	uint32_t					mPrevoutSpender[PREVOUT_BATCH];				// The index of the transaction each queued input belongs to
+	uint32_t					mPrevoutSpenderInput[PREVOUT_BATCH];		// and which of its inputs it is
+	uint32_t					mPrevoutTransactions[PREVOUT_BATCH];		// The transaction index each one resolved to
+	uint8_t						mPublicKeyHash160[MAX_BLOCK_OUTPUTS*20];	// The batch computed hash160 of each of the missing keys
+	uint32_t					mPublicKeyCount;							// How many P2PK outputs preparePublicKeys found
+	uint32_t					mPublicKeyIndex;							// The next of them getOutputAddress will see
+	uint32_t					mMissIndex;									// The next of the batch computed hashes
+	UtxoMap						mUtxo;										// The unspent outputs when processing in UTXO mode
+	UtxoCommitment				mCommitment;								// The MuHash3072 of the UTXO set, when it is kept
+	UtxoKey						mUtxoKeys[MAX_BLOCK_INPUTS];				// The outputs spent by the block being processed
+	PublicKeyCache				mPublicKeyCache;							// Maps recently seen public keys directly to their address
+	TransactionIndexFile		mTransactionIndex;							// The persistent transaction hash to location index
+	bool						mTransactionIndexOpened;					// True once we have tried to map the index
+	SpentByFile					mSpentByFile;								// The mapped spent-by index used by trace
+	uint32_t					mLookupBlock;								// The block last read into mSingleBlock by getBlockTransaction
+	AddressDirectoryFile		mAddressDirectory;							// The mapped address directory
+	bool						mAddressDirectoryOpened;					// True once we have tried to map it
+	BlockUndoLog				mUndo;										// Undo records for the most recently processed blocks
+	Hash256						mProcessedTip;								// The hash of the last block processed
+	uint32_t					mProcessedStatCount;						// Statistics rows gathered by the end of the last block processed
+	bool						mProcessingFailed;							// A block could not be processed in full; nothing more is
+	bool						mPartlyProcessed;							// ...and it could not be taken back, so the state is not saved
 
 };
 
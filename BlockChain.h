@@ -186,6 +186,18 @@ public:
 	virtual uint32_t getBlockCount(void) const = 0; // Return the number of blocks found
 	virtual void printBlockHeaders(void) = 0;		// Print just the header information for all blocks
 
+	// Writes the height, hash, time, version, bits, difficulty, nonce, size and chain work of the blocks
+	// [firstBlock,endBlock) on the best chain to 'BlockHeaders.csv'.  It only needs the header scan; no block is read
+	// or processed.
+	virtual bool saveBlockHeaders(uint32_t firstBlock,uint32_t endBlock) = 0;
+
+	// The timestamp of a block, available as soon as the block chain has been built from the headers
+	virtual uint32_t getBlockTime(uint32_t blockIndex) const = 0;
+
+	// Maps the UTC time range [startTime,endTime) to the blocks [firstBlock,endBlock) mined in it.  Block timestamps
+	// are not strictly increasing, so a block belongs to the range in which the latest timestamp seen so far falls.
+	virtual void getBlockRange(uint32_t startTime,uint32_t endTime,uint32_t &firstBlock,uint32_t &endBlock) const = 0;
+
 	virtual void printBlock(const Block *block) = 0; // prints the contents of the block to the console for debugging purposes
 
 	// This will seek to a specific transaction in the blockchain and read it into memory.
@@ -194,7 +206,14 @@ public:
 	virtual const Block * readBlock(uint32_t blockIndex) = 0;	// use this method to read the next block in the block chain; if it returns null, the end of the block chain has been reached or there was a read error
 
 	// This will consume a great deal of memory, do not call this routine unless you building for 64bit and have a lot of memory.
-	virtual void processTransactions(const Block *b) = 0; // process the transactions in this block and assign them to individual wallets
+	// Returns false if the block could not be processed in full (out of memory, or too many records); the block is
+	// taken back if it has an undo record, and no more blocks can be processed.
+	virtual bool processTransactions(const Block *b) = 0; // process the transactions in this block and assign them to individual wallets
+
+	// Call instead of processTransactions for each block 'process' reads without gathering statistics.  Only the
+	// counts from before the block are recorded, so a later scan can still take it back if the best chain moves.
+	// Returns false in the same way as processTransactions.
+	virtual bool skipTransactions(const Block *b) = 0;
 
 	// Report the number of unique addresses used so far.
 	virtual uint32_t gatherAddresses(void) = 0;
@@ -209,12 +228,86 @@ public:
 
 	virtual void reportCounts(void) = 0;
 
+	// Once processing is complete the transaction and address maps stop changing; this rebuilds them as minimal
+	// perfect hashes which use much less memory for the read only queries which follow.
+	virtual void freeze(void) = 0;
+
+	// Builds, or brings up to date, the on-disk index from transaction hash to block file location and height.  Only
+	// the blocks added since the index was last written are read.
+	virtual void buildTransactionIndex(void) = 0;
+
+	// Prints where a transaction (given as the usual byte reversed hex string) is found using the on-disk index; this
+	// works in a fresh process without processing the block chain first.
+	virtual void lookupTransaction(const char *hash) = 0;
+
+	// Follows the outputs of this transaction forward through the transactions which spent them, up to 'hops' deep,
+	// using the spent-by index; the index is saved to disk first if more transactions have been processed since.
+	virtual void traceSpends(const char *hash,uint32_t hops) = 0;
+
 	virtual void printTransactions(uint32_t blockIndex) = 0;
 
+	// In UTXO mode only the unspent outputs are kept, not the transaction history, so memory follows the size of the
+	// UTXO set.  Address balances and the statistics reports still work; per address transaction lists, the spent-by
+	// index and the transaction map are not available.  Must be chosen before any blocks are processed.
+	virtual bool setUtxoMode(bool state) = 0;
+
+	// Limits the UTXO set to roughly this many megabytes; the oldest unspent outputs are moved out to an append-only
+	// log on disk and read back in batches when a block spends them.  The address table is not covered by the budget
+	// and stays in memory.  Must be chosen before any blocks are processed.
+	virtual bool setUtxoBudget(uint32_t megabytes) = 0;
+
+	// Checks the spill log against a UTXO map with no budget over this many made up outputs; returns false if any
+	// spend comes out differently.
+	virtual bool testUtxoBudget(uint32_t outputCount) = 0;
+
+	// Checks that a transaction index filled with this many made up records, some of them reusing an earlier hash the
+	// way the BIP-30 duplicates do, always finds the most recent record for a hash; returns false if any lookup differs.
+	virtual bool testTransactionIndex(uint32_t recordCount) = 0;
+
+	// Keeps the UTXO set commitment, the MuHash3072 of the unspent outputs which the reference client reports with
+	// 'gettxoutsetinfo muhash', up to date as blocks are processed; reportCounts shows it.  It works in either mode
+	// and costs a digest per unspent output.  Must be chosen before any blocks are processed.
+	virtual bool setUtxoCommitment(bool state) = 0;
+
+	enum HugePageMode
+	{
+		HP_OFF,						// Normal pages
+		HP_TRANSPARENT,				// Ask the kernel to back the big tables with transparent huge pages
+		HP_EXPLICIT,				// Take the hash tables from the reserved huge page pool; the record arrays use transparent huge pages
+	};
+
+	// Chooses the pages behind the transaction record arrays and the big hash tables; huge pages cut the TLB misses
+	// of their random access.  Only memory allocated after the call is affected, so choose it before scanning.
+	virtual void setHugePages(HugePageMode mode) = 0;
+
+	// Writes everything processing has built up, the transaction map and the header chain to 'BlockChainState.bin'.
+	// 'statTime' is the start of the statistics period in progress, handed back by loadState.
+	virtual bool saveState(uint32_t statTime) = 0;
+
+	// Restores a state image in a fresh parser, before any scan; returns how many blocks had been processed, so
+	// processing can carry on from there, or zero if the image could not be loaded.
+	virtual uint32_t loadState(uint32_t &statTime) = 0;
+
+	// Keeps undo records for this many of the most recently processed blocks; 100 unless changed, zero for none.
+	// Changing it drops the records kept so far.
+	virtual void setUndoDepth(uint32_t blocks) = 0;
+
+	// Call once the headers have been scanned again after 'processedBlocks' blocks were processed.  If the best chain
+	// no longer holds all of them, the ones past the fork are disconnected using their undo records.  Returns the
+	// block processing should carry on from, or 0xFFFFFFFF if the fork is further back than the records reach.
+	virtual uint32_t reorganize(uint32_t processedBlocks) = 0;
+
 	virtual bool readBlockHeaders(uint32_t maxBlock,uint32_t &blockCount)= 0;
 	virtual uint32_t buildBlockChain(void) = 0;
 
+	// Prints the summary and transactions of an address; addresses not processed in this run are looked up in the
+	// on-disk address directory written by saveAddressDirectory.
 	virtual void printAddress(const char *address) = 0;
+
+	// Writes the address directory, the per address totals keyed by hash160 plus the list of transactions of each
+	// address, so later runs can answer address queries without processing the block chain.
+	virtual void saveAddressDirectory(void) = 0;
+
 	virtual void printTopBalances(uint32_t tcount,uint32_t minBalance) = 0;
 	virtual void printOldest(uint32_t tcount,uint32_t minBalance) = 0;
 	virtual void zombieReport(uint32_t zdays,uint32_t minBalance) = 0;
@@ -403,4 +403,297 @@ void computeRIPEMD160(const void *_message,uint32_t length,uint8_t hashcode[20])
 
 }
 
+/********************************************************************/
+
+// Multi-buffer version of the compression function.  Each state word and each message word is stored as
+// RIPEMD160_LANES independent lanes so that the compiler can turn every round into a short vector operation.
+#define RIPEMD160_LANES 4
+
+#define RMD_LANES(op, a, b, c, d, e, x, s) \
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) op(a[l], b[l], c[l], d[l], e[l], X[x][l], s)
+
+static void compressLanes(uint32_t MDbuf[5][RIPEMD160_LANES], uint32_t X[16][RIPEMD160_LANES])
+{
+   uint32_t aa[RIPEMD160_LANES], bb[RIPEMD160_LANES], cc[RIPEMD160_LANES], dd[RIPEMD160_LANES], ee[RIPEMD160_LANES];
+   uint32_t aaa[RIPEMD160_LANES], bbb[RIPEMD160_LANES], ccc[RIPEMD160_LANES], ddd[RIPEMD160_LANES], eee[RIPEMD160_LANES];
+
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) {
+      aa[l] = aaa[l] = MDbuf[0][l];
+      bb[l] = bbb[l] = MDbuf[1][l];
+      cc[l] = ccc[l] = MDbuf[2][l];
+      dd[l] = ddd[l] = MDbuf[3][l];
+      ee[l] = eee[l] = MDbuf[4][l];
+   }
+
+   /* round 1 */
+   RMD_LANES(FF, aa, bb, cc, dd, ee,  0, 11);
+   RMD_LANES(FF, ee, aa, bb, cc, dd,  1, 14);
+   RMD_LANES(FF, dd, ee, aa, bb, cc,  2, 15);
+   RMD_LANES(FF, cc, dd, ee, aa, bb,  3, 12);
+   RMD_LANES(FF, bb, cc, dd, ee, aa,  4,  5);
+   RMD_LANES(FF, aa, bb, cc, dd, ee,  5,  8);
+   RMD_LANES(FF, ee, aa, bb, cc, dd,  6,  7);
+   RMD_LANES(FF, dd, ee, aa, bb, cc,  7,  9);
+   RMD_LANES(FF, cc, dd, ee, aa, bb,  8, 11);
+   RMD_LANES(FF, bb, cc, dd, ee, aa,  9, 13);
+   RMD_LANES(FF, aa, bb, cc, dd, ee, 10, 14);
+   RMD_LANES(FF, ee, aa, bb, cc, dd, 11, 15);
+   RMD_LANES(FF, dd, ee, aa, bb, cc, 12,  6);
+   RMD_LANES(FF, cc, dd, ee, aa, bb, 13,  7);
+   RMD_LANES(FF, bb, cc, dd, ee, aa, 14,  9);
+   RMD_LANES(FF, aa, bb, cc, dd, ee, 15,  8);
+
+   /* round 2 */
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  7,  7);
+   RMD_LANES(GG, dd, ee, aa, bb, cc,  4,  6);
+   RMD_LANES(GG, cc, dd, ee, aa, bb, 13,  8);
+   RMD_LANES(GG, bb, cc, dd, ee, aa,  1, 13);
+   RMD_LANES(GG, aa, bb, cc, dd, ee, 10, 11);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  6,  9);
+   RMD_LANES(GG, dd, ee, aa, bb, cc, 15,  7);
+   RMD_LANES(GG, cc, dd, ee, aa, bb,  3, 15);
+   RMD_LANES(GG, bb, cc, dd, ee, aa, 12,  7);
+   RMD_LANES(GG, aa, bb, cc, dd, ee,  0, 12);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  9, 15);
+   RMD_LANES(GG, dd, ee, aa, bb, cc,  5,  9);
+   RMD_LANES(GG, cc, dd, ee, aa, bb,  2, 11);
+   RMD_LANES(GG, bb, cc, dd, ee, aa, 14,  7);
+   RMD_LANES(GG, aa, bb, cc, dd, ee, 11, 13);
+   RMD_LANES(GG, ee, aa, bb, cc, dd,  8, 12);
+
+   /* round 3 */
+   RMD_LANES(HH, dd, ee, aa, bb, cc,  3, 11);
+   RMD_LANES(HH, cc, dd, ee, aa, bb, 10, 13);
+   RMD_LANES(HH, bb, cc, dd, ee, aa, 14,  6);
+   RMD_LANES(HH, aa, bb, cc, dd, ee,  4,  7);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  9, 14);
+   RMD_LANES(HH, dd, ee, aa, bb, cc, 15,  9);
+   RMD_LANES(HH, cc, dd, ee, aa, bb,  8, 13);
+   RMD_LANES(HH, bb, cc, dd, ee, aa,  1, 15);
+   RMD_LANES(HH, aa, bb, cc, dd, ee,  2, 14);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  7,  8);
+   RMD_LANES(HH, dd, ee, aa, bb, cc,  0, 13);
+   RMD_LANES(HH, cc, dd, ee, aa, bb,  6,  6);
+   RMD_LANES(HH, bb, cc, dd, ee, aa, 13,  5);
+   RMD_LANES(HH, aa, bb, cc, dd, ee, 11, 12);
+   RMD_LANES(HH, ee, aa, bb, cc, dd,  5,  7);
+   RMD_LANES(HH, dd, ee, aa, bb, cc, 12,  5);
+
+   /* round 4 */
+   RMD_LANES(II, cc, dd, ee, aa, bb,  1, 11);
+   RMD_LANES(II, bb, cc, dd, ee, aa,  9, 12);
+   RMD_LANES(II, aa, bb, cc, dd, ee, 11, 14);
+   RMD_LANES(II, ee, aa, bb, cc, dd, 10, 15);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  0, 14);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  8, 15);
+   RMD_LANES(II, bb, cc, dd, ee, aa, 12,  9);
+   RMD_LANES(II, aa, bb, cc, dd, ee,  4,  8);
+   RMD_LANES(II, ee, aa, bb, cc, dd, 13,  9);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  3, 14);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  7,  5);
+   RMD_LANES(II, bb, cc, dd, ee, aa, 15,  6);
+   RMD_LANES(II, aa, bb, cc, dd, ee, 14,  8);
+   RMD_LANES(II, ee, aa, bb, cc, dd,  5,  6);
+   RMD_LANES(II, dd, ee, aa, bb, cc,  6,  5);
+   RMD_LANES(II, cc, dd, ee, aa, bb,  2, 12);
+
+   /* round 5 */
+   RMD_LANES(JJ, bb, cc, dd, ee, aa,  4,  9);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  0, 15);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd,  5,  5);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc,  9, 11);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb,  7,  6);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa, 12,  8);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  2, 13);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd, 10, 12);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc, 14,  5);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb,  1, 12);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa,  3, 13);
+   RMD_LANES(JJ, aa, bb, cc, dd, ee,  8, 14);
+   RMD_LANES(JJ, ee, aa, bb, cc, dd, 11, 11);
+   RMD_LANES(JJ, dd, ee, aa, bb, cc,  6,  8);
+   RMD_LANES(JJ, cc, dd, ee, aa, bb, 15,  5);
+   RMD_LANES(JJ, bb, cc, dd, ee, aa, 13,  6);
+
+   /* parallel round 1 */
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee,  5,  8);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd, 14,  9);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  7,  9);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb,  0, 11);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  9, 13);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee,  2, 15);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd, 11, 15);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  4,  5);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb, 13,  7);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  6,  7);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee, 15,  8);
+   RMD_LANES(JJJ, eee, aaa, bbb, ccc, ddd,  8, 11);
+   RMD_LANES(JJJ, ddd, eee, aaa, bbb, ccc,  1, 14);
+   RMD_LANES(JJJ, ccc, ddd, eee, aaa, bbb, 10, 14);
+   RMD_LANES(JJJ, bbb, ccc, ddd, eee, aaa,  3, 12);
+   RMD_LANES(JJJ, aaa, bbb, ccc, ddd, eee, 12,  6);
+
+   /* parallel round 2 */
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  6,  9);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc, 11, 13);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb,  3, 15);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa,  7,  7);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee,  0, 12);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd, 13,  8);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc,  5,  9);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb, 10, 11);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa, 14,  7);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee, 15,  7);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  8, 12);
+   RMD_LANES(III, ddd, eee, aaa, bbb, ccc, 12,  7);
+   RMD_LANES(III, ccc, ddd, eee, aaa, bbb,  4,  6);
+   RMD_LANES(III, bbb, ccc, ddd, eee, aaa,  9, 15);
+   RMD_LANES(III, aaa, bbb, ccc, ddd, eee,  1, 13);
+   RMD_LANES(III, eee, aaa, bbb, ccc, ddd,  2, 11);
+
+   /* parallel round 3 */
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 15,  9);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  5,  7);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa,  1, 15);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee,  3, 11);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  7,  8);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 14,  6);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  6,  6);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa,  9, 14);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee, 11, 12);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  8, 13);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 12,  5);
+   RMD_LANES(HHH, ccc, ddd, eee, aaa, bbb,  2, 14);
+   RMD_LANES(HHH, bbb, ccc, ddd, eee, aaa, 10, 13);
+   RMD_LANES(HHH, aaa, bbb, ccc, ddd, eee,  0, 13);
+   RMD_LANES(HHH, eee, aaa, bbb, ccc, ddd,  4,  7);
+   RMD_LANES(HHH, ddd, eee, aaa, bbb, ccc, 13,  5);
+
+   /* parallel round 4 */
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb,  8, 15);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa,  6,  5);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  4,  8);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  1, 11);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc,  3, 14);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb, 11, 14);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa, 15,  6);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  0, 14);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  5,  6);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc, 12,  9);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb,  2, 12);
+   RMD_LANES(GGG, bbb, ccc, ddd, eee, aaa, 13,  9);
+   RMD_LANES(GGG, aaa, bbb, ccc, ddd, eee,  9, 12);
+   RMD_LANES(GGG, eee, aaa, bbb, ccc, ddd,  7,  5);
+   RMD_LANES(GGG, ddd, eee, aaa, bbb, ccc, 10, 15);
+   RMD_LANES(GGG, ccc, ddd, eee, aaa, bbb, 14,  8);
+
+   /* parallel round 5 */
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 12,  8);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee, 15,  5);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd, 10, 12);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  4,  9);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  1, 12);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa,  5,  5);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee,  8, 14);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd,  7,  6);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  6,  8);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  2, 13);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 13,  6);
+   RMD_LANES(FFF, aaa, bbb, ccc, ddd, eee, 14,  5);
+   RMD_LANES(FFF, eee, aaa, bbb, ccc, ddd,  0, 15);
+   RMD_LANES(FFF, ddd, eee, aaa, bbb, ccc,  3, 13);
+   RMD_LANES(FFF, ccc, ddd, eee, aaa, bbb,  9, 11);
+   RMD_LANES(FFF, bbb, ccc, ddd, eee, aaa, 11, 11);
+
+   /* combine results */
+   for (uint32_t l=0; l<RIPEMD160_LANES; l++) {
+      ddd[l] += cc[l] + MDbuf[1][l];               /* final result for MDbuf[0] */
+      MDbuf[1][l] = MDbuf[2][l] + dd[l] + eee[l];
+      MDbuf[2][l] = MDbuf[3][l] + ee[l] + aaa[l];
+      MDbuf[3][l] = MDbuf[4][l] + aa[l] + bbb[l];
+      MDbuf[4][l] = MDbuf[0][l] + bb[l] + ccc[l];
+      MDbuf[0][l] = ddd[l];
+   }
+}
+
+void computeRIPEMD160Batch(const void * const *inputs,uint32_t length,uint32_t count,uint8_t *hashcodes)
+{
+	uint32_t MDbuf[5][RIPEMD160_LANES];
+	uint32_t X[16][RIPEMD160_LANES];
+	const uint8_t *message[RIPEMD160_LANES];
+
+	for (uint32_t base=0; base<count; base+=RIPEMD160_LANES)
+	{
+		uint32_t lanes = count-base;
+		if ( lanes > RIPEMD160_LANES )
+		{
+			lanes = RIPEMD160_LANES;
+		}
+		// A partial group just recomputes its first message in the unused lanes; those results are discarded.
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			message[l] = (const uint8_t *)inputs[base + (l < lanes ? l : 0)];
+			MDbuf[0][l] = 0x67452301UL;
+			MDbuf[1][l] = 0xefcdab89UL;
+			MDbuf[2][l] = 0x98badcfeUL;
+			MDbuf[3][l] = 0x10325476UL;
+			MDbuf[4][l] = 0xc3d2e1f0UL;
+		}
+
+		/* process message in 16-word chunks */
+		for (uint32_t nbytes=length; nbytes > 63; nbytes-=64)
+		{
+			for (uint32_t i=0; i<16; i++)
+			{
+				for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+				{
+					X[i][l] = BYTES_TO_DWORD(message[l]+i*4);
+				}
+			}
+			for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+			{
+				message[l]+=64;
+			}
+			compressLanes(MDbuf, X);
+		}
+
+		/* finish: same padding as MDfinish, applied to every lane */
+		memset(X, 0, sizeof(X));
+		for (uint32_t i=0; i<(length&63); i++)
+		{
+			for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+			{
+				X[i>>2][l] ^= (uint32_t) message[l][i] << (8 * (i&3));
+			}
+		}
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			X[(length>>2)&15][l] ^= (uint32_t)1 << (8*(length&3) + 7);
+		}
+		if ((length & 63) > 55)
+		{
+			compressLanes(MDbuf, X);
+			memset(X, 0, sizeof(X));
+		}
+		for (uint32_t l=0; l<RIPEMD160_LANES; l++)
+		{
+			X[14][l] = length << 3;
+			X[15][l] = length >> 29;
+		}
+		compressLanes(MDbuf, X);
+
+		for (uint32_t l=0; l<lanes; l++)
+		{
+			uint8_t *hashcode = &hashcodes[(base+l)*(RMDsize/8)];
+			for (uint32_t i=0; i<RMDsize/8; i+=4)
+			{
+				hashcode[i]   = (uint8_t)(MDbuf[i>>2][l]);
+				hashcode[i+1] = (uint8_t)(MDbuf[i>>2][l] >>  8);
+				hashcode[i+2] = (uint8_t)(MDbuf[i>>2][l] >> 16);
+				hashcode[i+3] = (uint8_t)(MDbuf[i>>2][l] >> 24);
+			}
+		}
+	}
+}
+
 /************************ end of file rmd160.c **********************/
@@ -15,4 +15,11 @@ void computeRIPEMD160(const void *input,	// The input data to compute the hash f
 					  uint32_t length,		// The length of the input data
 					  uint8_t hashcode[20]); // The output hash of 160 bits (20 bytes)
 
+// Computes the RIPEMD160 hash of 'count' equally sized inputs at once.  The messages are processed several at a time
+// in interleaved lanes, which is considerably faster than calling computeRIPEMD160 on each one when hashing many short keys.
+void computeRIPEMD160Batch(const void * const *inputs,	// An array of 'count' pointers to the input data
+						   uint32_t length,				// The length of each input (all inputs must be the same length)
+						   uint32_t count,				// The number of inputs
+						   uint8_t *hashcodes);			// The output hashes; 20 bytes per input, stored consecutively
+
 #endif
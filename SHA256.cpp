@@ -502,3 +502,148 @@ void computeSHA256(const void *input,uint32_t size,uint8_t destHash[32])
 	sha256_finalize(&sc,destHash);
 }
 
+// Multi-buffer SHA256.  The state and message schedule of SHA256_LANES independent messages are stored
+// interleaved so that each round operates on every lane with the same instruction sequence; this lets the
+// compiler turn the inner lane loops into vector operations.
+#define SHA256_LANES 4
+
+#define BYTES_TO_BE_DWORD(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+static void SHA256GutsLanes(uint32_t hash[SHA256_HASH_WORDS][SHA256_LANES], uint32_t W[64][SHA256_LANES])
+{
+	uint32_t a[SHA256_LANES], b[SHA256_LANES], c[SHA256_LANES], d[SHA256_LANES];
+	uint32_t e[SHA256_LANES], f[SHA256_LANES], g[SHA256_LANES], h[SHA256_LANES];
+	uint32_t i, l;
+
+	for (i = 16; i < 64; i++)
+	{
+		for (l = 0; l < SHA256_LANES; l++)
+		{
+			W[i][l] = sigma1(W[i-2][l]) + W[i-7][l] + sigma0(W[i-15][l]) + W[i-16][l];
+		}
+	}
+
+	for (l = 0; l < SHA256_LANES; l++)
+	{
+		a[l] = hash[0][l];
+		b[l] = hash[1][l];
+		c[l] = hash[2][l];
+		d[l] = hash[3][l];
+		e[l] = hash[4][l];
+		f[l] = hash[5][l];
+		g[l] = hash[6][l];
+		h[l] = hash[7][l];
+	}
+
+	for (i = 0; i < 64; i++)
+	{
+		for (l = 0; l < SHA256_LANES; l++)
+		{
+			uint32_t t1 = h[l] + SIGMA1(e[l]) + Ch(e[l], f[l], g[l]) + K[i] + W[i][l];
+			uint32_t t2 = SIGMA0(a[l]) + Maj(a[l], b[l], c[l]);
+			h[l] = g[l];
+			g[l] = f[l];
+			f[l] = e[l];
+			e[l] = d[l] + t1;
+			d[l] = c[l];
+			c[l] = b[l];
+			b[l] = a[l];
+			a[l] = t1 + t2;
+		}
+	}
+
+	for (l = 0; l < SHA256_LANES; l++)
+	{
+		hash[0][l] += a[l];
+		hash[1][l] += b[l];
+		hash[2][l] += c[l];
+		hash[3][l] += d[l];
+		hash[4][l] += e[l];
+		hash[5][l] += f[l];
+		hash[6][l] += g[l];
+		hash[7][l] += h[l];
+	}
+}
+
+void computeSHA256Batch(const void * const *inputs,uint32_t size,uint32_t count,uint8_t *destHashes)
+{
+	uint32_t hash[SHA256_HASH_WORDS][SHA256_LANES];
+	uint32_t W[64][SHA256_LANES];
+	const uint8_t *data[SHA256_LANES];
+	uint8_t tail[SHA256_LANES][128];
+
+	uint32_t fullBlocks = size / 64;
+	uint32_t tailBytes = size & 63;
+	uint32_t tailBlocks = (tailBytes + 9 > 64) ? 2 : 1;
+	uint64_t totalLength = (uint64_t)size * 8;
+
+	for (uint32_t base = 0; base < count; base += SHA256_LANES)
+	{
+		uint32_t lanes = count - base;
+		if ( lanes > SHA256_LANES )
+		{
+			lanes = SHA256_LANES;
+		}
+		// A partial group just recomputes its first message in the unused lanes; those results are discarded.
+		for (uint32_t l = 0; l < SHA256_LANES; l++)
+		{
+			data[l] = (const uint8_t *)inputs[base + (l < lanes ? l : 0)];
+			hash[0][l] = 0x6a09e667L;
+			hash[1][l] = 0xbb67ae85L;
+			hash[2][l] = 0x3c6ef372L;
+			hash[3][l] = 0xa54ff53aL;
+			hash[4][l] = 0x510e527fL;
+			hash[5][l] = 0x9b05688cL;
+			hash[6][l] = 0x1f83d9abL;
+			hash[7][l] = 0x5be0cd19L;
+		}
+
+		for (uint32_t block = 0; block < fullBlocks; block++)
+		{
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				for (uint32_t l = 0; l < SHA256_LANES; l++)
+				{
+					W[i][l] = BYTES_TO_BE_DWORD(data[l] + block*64 + i*4);
+				}
+			}
+			SHA256GutsLanes(hash, W);
+		}
+
+		// Build the padded final block(s) for every lane
+		for (uint32_t l = 0; l < SHA256_LANES; l++)
+		{
+			uint8_t *t = tail[l];
+			memcpy(t, data[l] + fullBlocks*64, tailBytes);
+			memset(t + tailBytes, 0, tailBlocks*64 - tailBytes);
+			t[tailBytes] = 0x80;
+			for (uint32_t i = 0; i < 8; i++)
+			{
+				t[tailBlocks*64 - 1 - i] = (uint8_t)(totalLength >> (i*8));
+			}
+		}
+		for (uint32_t block = 0; block < tailBlocks; block++)
+		{
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				for (uint32_t l = 0; l < SHA256_LANES; l++)
+				{
+					W[i][l] = BYTES_TO_BE_DWORD(tail[l] + block*64 + i*4);
+				}
+			}
+			SHA256GutsLanes(hash, W);
+		}
+
+		for (uint32_t l = 0; l < lanes; l++)
+		{
+			uint8_t *dest = &destHashes[(base + l)*SHA256_HASH_SIZE];
+			for (uint32_t i = 0; i < SHA256_HASH_WORDS; i++)
+			{
+				dest[i*4]   = (uint8_t)(hash[i][l] >> 24);
+				dest[i*4+1] = (uint8_t)(hash[i][l] >> 16);
+				dest[i*4+2] = (uint8_t)(hash[i][l] >> 8);
+				dest[i*4+3] = (uint8_t)(hash[i][l]);
+			}
+		}
+	}
+}
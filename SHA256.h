@@ -17,4 +17,11 @@ void computeSHA256(const void *input,		// A pointer to the input data to have th
 				   uint32_t size,			// the length of the input data
 				   uint8_t destHash[32]);	// The output 256 bit (32 byte) hash
 
+// Computes the SHA256 hash of 'count' equally sized inputs at once.  The messages are processed several at a time
+// in interleaved lanes, which is considerably faster than calling computeSHA256 on each one when hashing many short keys.
+void computeSHA256Batch(const void * const *inputs,	// An array of 'count' pointers to the input data
+						uint32_t size,				// The length of each input (all inputs must be the same length)
+						uint32_t count,				// The number of inputs
+						uint8_t *destHashes);		// The output hashes; 32 bytes per input, stored consecutively
+
 #endif
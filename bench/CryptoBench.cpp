@@ -0,0 +1,501 @@
+// Micro benchmarks for the hashing and address encoding snippets.
+//
+// Build and run with 'make bench' from the root directory.  Every routine is timed on realistic input sizes
+// (32, 64, 80 and 250 bytes plus a one megabyte buffer) and reported as nanoseconds per call, cycles per byte
+// and throughput.  Before any timing is done, the batch and fast implementations are cross checked against
+// the single message and reference implementations as well as some known test vectors; the program returns
+// a non zero exit code if any of the checks fail.
+
+#include "../SHA256.h"
+#include "../RIPEMD160.h"
+#include "../Base58.h"
+#include "../BitcoinAddress.h"
+#include "../Bech32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#include <windows.h>
+#include <intrin.h>
+#define HAS_RDTSC 1
+#else
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC 1
+#else
+#define HAS_RDTSC 0
+#endif
+#endif
+
+#define MIN_BENCH_NANOSECONDS 200000000ULL	// Keep repeating each benchmark for at least 0.2 seconds
+#define BATCH_COUNT 64						// How many messages are handed to the batch routines per call
+#define MEGABYTE (1024*1024)
+
+static uint64_t getNanoseconds(void)
+{
+#ifdef _MSC_VER
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t getCycles(void)
+{
+#if HAS_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint8_t	gSink = 0;			// Results are folded into here so the compiler can't discard the work
+static uint32_t	gFailures = 0;
+
+// The interface every benchmark implements; 'run' performs 'iterations' calls and 'messagesPerCall' is how many
+// independent messages each call processes (more than one for the batch routines).
+class Bench
+{
+public:
+	virtual void run(uint32_t iterations) = 0;
+	virtual uint32_t messagesPerCall(void) const { return 1; }
+};
+
+static void report(const char *name,uint32_t size,Bench &b)
+{
+	b.run(1); // warm up
+	uint32_t iterations = 1;
+	uint64_t elapsed = 0;
+	uint64_t cycles = 0;
+	for (;;)
+	{
+		uint64_t startCycles = getCycles();
+		uint64_t start = getNanoseconds();
+		b.run(iterations);
+		elapsed = getNanoseconds()-start;
+		cycles = getCycles()-startCycles;
+		if ( elapsed >= MIN_BENCH_NANOSECONDS || iterations >= 0x40000000 )
+		{
+			break;
+		}
+		iterations*=2;
+	}
+	double messages = (double)iterations*(double)b.messagesPerCall();
+	double nsPerOp = (double)elapsed / messages;
+	double bytes = messages*(double)size;
+	double mbPerSecond = bytes / ((double)elapsed/1000000000.0) / (double)MEGABYTE;
+	if ( HAS_RDTSC )
+	{
+		printf("%-34s %8u %12.1f %12.2f %12.1f\r\n", name, size, nsPerOp, (double)cycles/bytes, mbPerSecond );
+	}
+	else
+	{
+		printf("%-34s %8u %12.1f %12s %12.1f\r\n", name, size, nsPerOp, "n/a", mbPerSecond );
+	}
+}
+
+static void check(bool ok,const char *what)
+{
+	if ( !ok )
+	{
+		printf("CROSS CHECK FAILED: %s\r\n", what );
+		gFailures++;
+	}
+}
+
+static void hexToBinary(const char *hex,uint8_t *output)
+{
+	uint32_t len = (uint32_t)strlen(hex)/2;
+	for (uint32_t i=0; i<len; i++)
+	{
+		char temp[3] = { hex[i*2], hex[i*2+1], 0 };
+		output[i] = (uint8_t)strtoul(temp,NULL,16);
+	}
+}
+
+// The public key paid to by the genesis block and its well known address
+static const char *gGenesisKey = "04678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5f";
+static const char *gGenesisAddress = "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa";
+
+static uint8_t *gData = NULL;				// MEGABYTE*BATCH_COUNT bytes of pseudo random input
+static const void *gInputs[BATCH_COUNT];	// BATCH_COUNT distinct input pointers into gData
+static uint8_t gOutput[BATCH_COUNT*32];
+
+static void crossCheck(void)
+{
+	uint8_t hash[32];
+	uint8_t expect[32];
+
+	// Known answer tests
+	computeSHA256("abc",3,hash);
+	hexToBinary("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",expect);
+	check(memcmp(hash,expect,32) == 0,"SHA256 of 'abc'");
+	computeRIPEMD160("abc",3,hash);
+	hexToBinary("8eb208f7e05d987a9b044a8e98c6b087f15a0bfc",expect);
+	check(memcmp(hash,expect,20) == 0,"RIPEMD160 of 'abc'");
+
+	// Every message length up to 300 bytes, for every partial batch size
+	for (uint32_t len=0; len<300; len++)
+	{
+		for (uint32_t count=1; count<=9; count++)
+		{
+			computeSHA256Batch(gInputs,len,count,gOutput);
+			for (uint32_t i=0; i<count; i++)
+			{
+				computeSHA256(gInputs[i],len,hash);
+				check(memcmp(hash,&gOutput[i*32],32) == 0,"computeSHA256Batch matches computeSHA256");
+			}
+			computeRIPEMD160Batch(gInputs,len,count,gOutput);
+			for (uint32_t i=0; i<count; i++)
+			{
+				computeRIPEMD160(gInputs[i],len,hash);
+				check(memcmp(hash,&gOutput[i*20],20) == 0,"computeRIPEMD160Batch matches computeRIPEMD160");
+			}
+		}
+	}
+
+	// Genesis block public key
+	uint8_t key[65];
+	uint8_t address[25];
+	char ascii[64];
+	hexToBinary(gGenesisKey,key);
+	check(bitcoinPublicKeyToAscii(key,ascii,sizeof(ascii)) && strcmp(ascii,gGenesisAddress) == 0,"genesis public key to ascii");
+	bitcoinPublicKeyToAddress(key,address);
+	check(bitcoinPublicKeyToHash160(key,hash) && memcmp(hash,&address[1],20) == 0,"bitcoinPublicKeyToHash160 matches bitcoinPublicKeyToAddress");
+	// A count which is not a multiple of the batch size, so the last partial batch is checked too
+	{
+		uint8_t keys[BATCH_COUNT+3][65];
+		const uint8_t *keyPointers[BATCH_COUNT+3];
+		uint8_t hashes[(BATCH_COUNT+3)*20];
+		for (uint32_t i=0; i<BATCH_COUNT+3; i++)
+		{
+			memcpy(keys[i],gInputs[i%BATCH_COUNT],65);
+			keys[i][0] = 0x04;
+			keys[i][1]^=(uint8_t)i;
+			keyPointers[i] = keys[i];
+		}
+		bitcoinPublicKeysToHash160(keyPointers,BATCH_COUNT+3,hashes);
+		for (uint32_t i=0; i<BATCH_COUNT+3; i++)
+		{
+			uint8_t single[20];
+			bitcoinPublicKeyToHash160(keys[i],single);
+			check(memcmp(single,&hashes[i*20],20) == 0,"bitcoinPublicKeysToHash160 matches bitcoinPublicKeyToHash160");
+		}
+	}
+	uint8_t rebuilt[25];
+	bitcoinRIPEMD160ToAddress(hash,rebuilt);
+	check(memcmp(rebuilt,address,25) == 0,"bitcoinRIPEMD160ToAddress matches bitcoinPublicKeyToAddress");
+	uint8_t decoded[25];
+	check(bitcoinAsciiToAddress(gGenesisAddress,decoded) && memcmp(decoded,address,25) == 0,"bitcoinAsciiToAddress of the genesis address");
+
+	// Base58 against the reference implementation; random addresses with a varying number of leading zero bytes
+	for (uint32_t i=0; i<20000; i++)
+	{
+		uint8_t number[25];
+		for (uint32_t j=0; j<25; j++)
+		{
+			number[j] = (uint8_t)rand();
+		}
+		for (uint32_t j=0; j<(i&3); j++)
+		{
+			number[j] = 0;
+		}
+		char fast[64];
+		char reference[64];
+		bool ok1 = encodeBase58(number,25,true,fast,sizeof(fast));
+		bool ok2 = encodeBase58Reference(number,25,true,reference,sizeof(reference));
+		check(ok1 && ok2 && strcmp(fast,reference) == 0,"encodeBase58 matches encodeBase58Reference");
+		uint8_t out1[25];
+		uint8_t out2[25];
+		uint32_t len1 = decodeBase58(fast,out1,25,true);
+		uint32_t len2 = decodeBase58Reference(fast,out2,25,true);
+		check(len1 == 25 && len2 == 25 && memcmp(out1,out2,25) == 0 && memcmp(out1,number,25) == 0,"decodeBase58 matches decodeBase58Reference");
+	}
+
+	// Bech32 test vectors from BIP-173 and BIP-350
+	uint8_t program[WITNESS_PROGRAM_MAX];
+	uint32_t version;
+	uint32_t programLength;
+	check(decodeSegwitAddress("bc","bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4",version,program,programLength) && version == 0 && programLength == 20,"bech32 version 0 address");
+	check(decodeSegwitAddress("bc","bc1p0xlxvlhemja6c4dqv22uapctqupfhlxm9h8z3k2e72q4k9hcz7vqzk5jj0",version,program,programLength) && version == 1 && programLength == 32,"bech32m version 1 address");
+	check(!decodeSegwitAddress("bc","bc1zw508d6qejxtdg4y5r3zarvaryvqyzf3du",version,program,programLength),"bech32 checksum rejected for version 2");
+}
+
+class BenchSHA256 : public Bench
+{
+public:
+	BenchSHA256(uint32_t size) : mSize(size) { }
+	virtual void run(uint32_t iterations)
+	{
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			computeSHA256(gInputs[i&(BATCH_COUNT-1)],mSize,gOutput);
+			gSink^=gOutput[0];
+		}
+	}
+	uint32_t mSize;
+};
+
+class BenchSHA256Batch : public Bench
+{
+public:
+	BenchSHA256Batch(uint32_t size) : mSize(size) { }
+	virtual void run(uint32_t iterations)
+	{
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			computeSHA256Batch(gInputs,mSize,BATCH_COUNT,gOutput);
+			gSink^=gOutput[0];
+		}
+	}
+	virtual uint32_t messagesPerCall(void) const { return BATCH_COUNT; }
+	uint32_t mSize;
+};
+
+class BenchRIPEMD160 : public Bench
+{
+public:
+	BenchRIPEMD160(uint32_t size) : mSize(size) { }
+	virtual void run(uint32_t iterations)
+	{
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			computeRIPEMD160(gInputs[i&(BATCH_COUNT-1)],mSize,gOutput);
+			gSink^=gOutput[0];
+		}
+	}
+	uint32_t mSize;
+};
+
+class BenchRIPEMD160Batch : public Bench
+{
+public:
+	BenchRIPEMD160Batch(uint32_t size) : mSize(size) { }
+	virtual void run(uint32_t iterations)
+	{
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			computeRIPEMD160Batch(gInputs,mSize,BATCH_COUNT,gOutput);
+			gSink^=gOutput[0];
+		}
+	}
+	virtual uint32_t messagesPerCall(void) const { return BATCH_COUNT; }
+	uint32_t mSize;
+};
+
+class BenchEncodeBase58 : public Bench
+{
+public:
+	BenchEncodeBase58(bool reference) : mReference(reference) { }
+	virtual void run(uint32_t iterations)
+	{
+		char output[64];
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			const uint8_t *address = (const uint8_t *)gInputs[i&(BATCH_COUNT-1)];
+			if ( mReference )
+			{
+				encodeBase58Reference(address,25,true,output,sizeof(output));
+			}
+			else
+			{
+				encodeBase58(address,25,true,output,sizeof(output));
+			}
+			gSink^=(uint8_t)output[1];
+		}
+	}
+	bool mReference;
+};
+
+class BenchDecodeBase58 : public Bench
+{
+public:
+	BenchDecodeBase58(bool reference) : mReference(reference)
+	{
+		for (uint32_t i=0; i<BATCH_COUNT; i++)
+		{
+			encodeBase58((const uint8_t *)gInputs[i],25,true,mStrings[i],sizeof(mStrings[i]));
+		}
+	}
+	virtual void run(uint32_t iterations)
+	{
+		uint8_t output[25];
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			const char *str = mStrings[i&(BATCH_COUNT-1)];
+			if ( mReference )
+			{
+				decodeBase58Reference(str,output,sizeof(output),true);
+			}
+			else
+			{
+				decodeBase58(str,output,sizeof(output),true);
+			}
+			gSink^=output[1];
+		}
+	}
+	bool mReference;
+	char mStrings[BATCH_COUNT][64];
+};
+
+class BenchPublicKeyToAddress : public Bench
+{
+public:
+	BenchPublicKeyToAddress(bool hash160Only) : mHash160Only(hash160Only)
+	{
+		for (uint32_t i=0; i<BATCH_COUNT; i++)
+		{
+			memcpy(mKeys[i],gInputs[i],65);
+			mKeys[i][0] = 0x04;
+		}
+	}
+	virtual void run(uint32_t iterations)
+	{
+		uint8_t output[25];
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			if ( mHash160Only )
+			{
+				bitcoinPublicKeyToHash160(mKeys[i&(BATCH_COUNT-1)],output);
+			}
+			else
+			{
+				bitcoinPublicKeyToAddress(mKeys[i&(BATCH_COUNT-1)],output);
+			}
+			gSink^=output[1];
+		}
+	}
+	bool mHash160Only;
+	uint8_t mKeys[BATCH_COUNT][65];
+};
+
+class BenchPublicKeysToHash160 : public Bench
+{
+public:
+	BenchPublicKeysToHash160(void)
+	{
+		for (uint32_t i=0; i<BATCH_COUNT; i++)
+		{
+			memcpy(mKeys[i],gInputs[i],65);
+			mKeys[i][0] = 0x04;
+			mKeyPointers[i] = mKeys[i];
+		}
+	}
+	virtual void run(uint32_t iterations)
+	{
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			bitcoinPublicKeysToHash160(mKeyPointers,BATCH_COUNT,mHashes);
+			gSink^=mHashes[1];
+		}
+	}
+	virtual uint32_t messagesPerCall(void) const { return BATCH_COUNT; }
+	uint8_t mKeys[BATCH_COUNT][65];
+	const uint8_t *mKeyPointers[BATCH_COUNT];
+	uint8_t mHashes[BATCH_COUNT*20];
+};
+
+class BenchRIPEMD160ToAddress : public Bench
+{
+public:
+	virtual void run(uint32_t iterations)
+	{
+		uint8_t output[25];
+		for (uint32_t i=0; i<iterations; i++)
+		{
+			bitcoinRIPEMD160ToAddress((const uint8_t *)gInputs[i&(BATCH_COUNT-1)],output);
+			gSink^=output[21];
+		}
+	}
+};
+
+int main(int argc,const char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	// Every input pointer gets its own megabyte so even the largest benchmark never hashes the same memory twice in a batch
+	gData = (uint8_t *)malloc((size_t)MEGABYTE*BATCH_COUNT);
+	srand(1);
+	for (size_t i=0; i<(size_t)MEGABYTE*BATCH_COUNT; i++)
+	{
+		gData[i] = (uint8_t)(rand()>>7);
+	}
+	for (uint32_t i=0; i<BATCH_COUNT; i++)
+	{
+		gInputs[i] = &gData[(size_t)i*MEGABYTE];
+	}
+
+	crossCheck();
+	printf("Cross checks: %s\r\n", gFailures ? "FAILED" : "passed" );
+	printf("\r\n");
+	printf("%-34s %8s %12s %12s %12s\r\n", "Benchmark", "Bytes", "ns/op", "cycles/byte", "MB/s" );
+
+	static const uint32_t sizes[5] = { 32, 64, 80, 250, MEGABYTE };
+	for (uint32_t i=0; i<5; i++)
+	{
+		BenchSHA256 b(sizes[i]);
+		report("computeSHA256",sizes[i],b);
+	}
+	for (uint32_t i=0; i<5; i++)
+	{
+		BenchSHA256Batch b(sizes[i]);
+		report("computeSHA256Batch",sizes[i],b);
+	}
+	for (uint32_t i=0; i<5; i++)
+	{
+		BenchRIPEMD160 b(sizes[i]);
+		report("computeRIPEMD160",sizes[i],b);
+	}
+	for (uint32_t i=0; i<5; i++)
+	{
+		BenchRIPEMD160Batch b(sizes[i]);
+		report("computeRIPEMD160Batch",sizes[i],b);
+	}
+	{
+		BenchEncodeBase58 b(false);
+		report("encodeBase58",25,b);
+	}
+	{
+		BenchEncodeBase58 b(true);
+		report("encodeBase58Reference",25,b);
+	}
+	{
+		BenchDecodeBase58 b(false);
+		report("decodeBase58",25,b);
+	}
+	{
+		BenchDecodeBase58 b(true);
+		report("decodeBase58Reference",25,b);
+	}
+	{
+		BenchPublicKeyToAddress b(false);
+		report("bitcoinPublicKeyToAddress",65,b);
+	}
+	{
+		BenchPublicKeyToAddress b(true);
+		report("bitcoinPublicKeyToHash160",65,b);
+	}
+	{
+		BenchPublicKeysToHash160 b;
+		report("bitcoinPublicKeysToHash160",65,b);
+	}
+	{
+		BenchRIPEMD160ToAddress b;
+		report("bitcoinRIPEMD160ToAddress",20,b);
+	}
+
+	printf("\r\n(sink %d)\r\n", gSink );
+	free(gData);
+	return gFailures ? 1 : 0;
+}
@@ -31,6 +31,8 @@ enum StatResolution
 	SR_LAST
 };
 
+#define SCAN_BATCH 1024 // How many block headers are read each time around the command loop
+
 enum CommandMode
 {
 	CM_NONE,	//
@@ -55,11 +57,22 @@ public:
 		mLastBlockScan = 0;
 		mLastBlockPrint = 0;
 		mFinishedScanning = false;
+		mSaveHeaders = false;
 		mCurrentBlock = NULL;
 		mLastTime = 0;
+		mPeriodStart = 0;
+		mPeriodEnd = 0;
+		mPeriodResolution = SR_LAST;
 		mSatoshiTime = 0;
 		mMinBalance = 1;
 		mRecordAddresses = false;
+		mUtxoMode = false;
+		mUtxoCommitment = false;
+		mChainLost = false;
+		mProcessFailed = false;
+		mWindow = false;
+		mWindowStart = 0;
+		mWindowEnd = 0;
 		mAddresses = NULL;
 		mMode = CM_NONE;
 
@@ -94,11 +107,27 @@ public:
 		printf("max_blocks            : Specifies the maximum number of blocks to read.\r\n");
 		printf("scan                  : Toggles scanning the blockchain headers pressing a key will pause or abort the scan.\r\n");
 		printf("process               : Toggle processing all blocks; warning uses a lot of memory!..\r\n");
-		printf("statistics            : Enables gathering detailed address/transaction statistics on the block chain\r\n");
+		printf("statistics            : Enables gathering detailed address/transaction statistics on the block chain; choose it before the first 'process'\r\n");
+		printf("utxo                  : Toggles processing with only the unspent outputs in memory instead of the full transaction history; choose it before the first 'process'.\r\n");
+		printf("utxo_budget <mb>      : Turns on UTXO mode and keeps the UTXO set under this many megabytes by spilling old outputs to disk; addresses stay in memory.\r\n");
+		printf("utxo_test <n>         : Checks the UTXO spill log against an unlimited UTXO set over <n> made up outputs (default 4,000,000).\r\n");
+		printf("txindex_test <n>      : Checks the transaction index finds the latest of duplicate hashes over <n> made up records (default 4,000,000).\r\n");
+		printf("muhash                : Toggles keeping the MuHash3072 UTXO set commitment ('gettxoutsetinfo muhash'); 'counts' reports it.\r\n");
+		printf("save_state            : Saves everything processed so far to 'BlockChainState.bin' so a later run can pick up from there.\r\n");
+		printf("load_state            : Loads 'BlockChainState.bin' in place of scanning; 'process' then carries on from the saved block.\r\n");
+		printf("undo_depth <n>        : Keeps undo records for the last <n> processed blocks (default 100) so a later 'scan' can follow a reorg.\r\n");
+		printf("huge_pages <mode>     : Backs the big tables with huge pages; 'off', 'transparent' or 'explicit' (the reserved pool).\r\n");
 		printf("\r\n");
 		printf("stop_scan             : Stop's the scan of the blockchain headers and just builds the blockchain from where we are at so far.\r\n");
 		printf("block <number>        : Will print the contents of this block.\r\n");
 		printf("counts                : Report block and transaction counts.\r\n");
+		printf("time_range <from> <to>: Reports the blocks mined between two UTC dates (YYYY-MM-DD[THH:MM:SS]).\r\n");
+		printf("time_window <from> <to>: Limits 'process', the statistics report and 'headers' to the blocks mined between two UTC dates; 'time_window off' clears it.\r\n");
+		printf("headers               : Writes the header fields of every block to 'BlockHeaders.csv' from the header scan alone; no blocks are processed.\r\n");
+		printf("freeze                : Once processing is done, shrinks the transaction and address maps for the queries which follow.\r\n");
+		printf("txindex               : Builds or updates the on-disk transaction index 'TransactionIndex.bin'.\r\n");
+		printf("txid <hash>           : Looks up transactions by hash in the on-disk transaction index.\r\n");
+		printf("trace <hash> <hops>   : Follows the outputs of a transaction forward through the transactions which spent them.\r\n");
 		printf("by_day                : Reports statistics by day.\r\n");
 		printf("by_month              : Reports statistics by month.\r\n");
 		printf("by_year               : Reports statistics by year.\r\n");
@@ -106,6 +135,7 @@ public:
 		printf("min_balance <n>       : Specifies the minimum balance to use when generating a report. Default is 1BTC\r\n");
 		printf("oldest <n>            : Outputs the <n> oldest addresses higher than min_balance\r\n");
 		printf("adr <n>               : Outputs the transaction history relative to a specific bitcoinaddres.\r\n");
+		printf("save_addresses        : Saves the on-disk address directory so later runs can answer 'adr' without processing.\r\n");
 		printf("zombie <days>         : Report statitics about zombie coins; contents of addresses not used since this many days.\r\n");
 		printf("record_addresses      : Toggles whether or not to record addresses when computing statistics.\r\n");
 		printf("load_record           : Debugging feature, tries to load previously recorded addresses.\r\n");
@@ -120,6 +150,48 @@ public:
 		mLastBlockScan = mBlockChain->buildBlockChain();
 		mCurrentBlock = mBlockChain->readBlock(0);
 		printf("Stopped scanning block headers early. Built block-chain with %d blocks found..\r\n", mLastBlockScan);
+		rejoinChain();
+		if ( mSaveHeaders )
+		{
+			saveBlockHeaders();
+			mSaveHeaders = false;
+		}
+	}
+
+	// A scan after blocks have been processed may find the best chain has grown, or has moved off some of the blocks
+	// already processed; those are disconnected and processing carries on from the last block both chains share.
+	void rejoinChain(void)
+	{
+		if ( mProcessBlock == 0 || mChainLost || mProcessFailed )
+		{
+			return;
+		}
+		uint32_t fork = mBlockChain->reorganize(mProcessBlock);
+		if ( fork == 0xFFFFFFFF )
+		{
+			printf("The processed state no longer matches the block chain; restart to process it again.\r\n");
+			mChainLost = true;
+			return;
+		}
+		if ( fork < mProcessBlock && mLastTime )
+		{
+			// The statistics period in progress may have begun in a disconnected block
+			uint32_t t = fork ? mBlockChain->getBlockTime(fork-1) : 0;
+			setPeriod(mLastTime);
+			if ( t < mPeriodStart || t >= mPeriodEnd )
+			{
+				mLastTime = t;
+				if ( mLastTime )
+				{
+					setPeriod(mLastTime);
+				}
+			}
+		}
+		mProcessBlock = fork;
+		if ( mProcessBlock < mBlockChain->getBlockCount() )
+		{
+			printf("Use 'process' to carry on from block #%d.\r\n", mProcessBlock );
+		}
 	}
 
 	bool process(void)
@@ -217,6 +289,176 @@ public:
 					}
 				}
 			}
+			else if ( strcmp(argv[0],"save_addresses") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot save the address directory while processing blocks; wait for processing to finish or pause it first.\r\n");
+				}
+				else
+				{
+					mBlockChain->saveAddressDirectory();
+				}
+			}
+			else if ( strcmp(argv[0],"utxo") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the processing mode while processing blocks.\r\n");
+				}
+				else if ( mProcessBlock )
+				{
+					printf("Cannot change the processing mode once blocks have been processed; restart to process them in the other mode.\r\n");
+				}
+				else if ( mBlockChain->setUtxoMode(!mUtxoMode) )
+				{
+					mUtxoMode = !mUtxoMode;
+					printf("UTXO mode is %s.\r\n", mUtxoMode ? "on; only unspent outputs are kept" : "off; the full transaction history is kept" );
+				}
+			}
+			else if ( strcmp(argv[0],"utxo_budget") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the memory budget while processing blocks.\r\n");
+				}
+				else if ( argc < 2 )
+				{
+					printf("Usage: utxo_budget <megabytes>\r\n");
+				}
+				else if ( mBlockChain->setUtxoMode(true) && mBlockChain->setUtxoBudget((uint32_t)atoi(argv[1])) )
+				{
+					mUtxoMode = true;
+					printf("UTXO mode is on with a memory budget of %s MB; older outputs spill to 'UtxoSpill.bin'.\r\n", argv[1] );
+				}
+			}
+			else if ( strcmp(argv[0],"utxo_test") == 0 )
+			{
+				uint32_t outputCount = 4000000;
+				if ( argc >= 2 )
+				{
+					outputCount = (uint32_t)atoi(argv[1]);
+				}
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot run the UTXO self test while processing blocks.\r\n");
+				}
+				else
+				{
+					mBlockChain->testUtxoBudget(outputCount);
+				}
+			}
+			else if ( strcmp(argv[0],"txindex_test") == 0 )
+			{
+				uint32_t recordCount = 4000000;
+				if ( argc >= 2 )
+				{
+					recordCount = (uint32_t)atoi(argv[1]);
+				}
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot run the transaction index self test while processing blocks.\r\n");
+				}
+				else
+				{
+					mBlockChain->testTransactionIndex(recordCount);
+				}
+			}
+			else if ( strcmp(argv[0],"muhash") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the UTXO set commitment while processing blocks.\r\n");
+				}
+				else if ( mBlockChain->setUtxoCommitment(!mUtxoCommitment) )
+				{
+					mUtxoCommitment = !mUtxoCommitment;
+					printf("The UTXO set commitment is %s.\r\n", mUtxoCommitment ? "on" : "off" );
+				}
+			}
+			else if ( strcmp(argv[0],"undo_depth") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the undo depth while processing blocks.\r\n");
+				}
+				else if ( argc < 2 )
+				{
+					printf("Usage: undo_depth <blocks>\r\n");
+				}
+				else
+				{
+					uint32_t depth = (uint32_t)atoi(argv[1]);
+					mBlockChain->setUndoDepth(depth);
+					printf("Keeping undo records for the last %d processed blocks.\r\n", depth );
+				}
+			}
+			else if ( strcmp(argv[0],"huge_pages") == 0 )
+			{
+				BlockChain::HugePageMode mode = BlockChain::HP_OFF;
+				bool ok = argc >= 2;
+				if ( ok && strcmp(argv[1],"transparent") == 0 )
+				{
+					mode = BlockChain::HP_TRANSPARENT;
+				}
+				else if ( ok && strcmp(argv[1],"explicit") == 0 )
+				{
+					mode = BlockChain::HP_EXPLICIT;
+				}
+				else if ( ok && strcmp(argv[1],"off") != 0 )
+				{
+					ok = false;
+				}
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the page size while processing blocks.\r\n");
+				}
+				else if ( !ok )
+				{
+					printf("Usage: huge_pages <off|transparent|explicit>\r\n");
+				}
+				else
+				{
+					mBlockChain->setHugePages(mode);
+					printf("Huge pages are %s for the tables allocated from now on.\r\n", argv[1] );
+				}
+			}
+			else if ( strcmp(argv[0],"save_state") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot save the state while processing blocks; pause processing first.\r\n");
+				}
+				else
+				{
+					mBlockChain->saveState(mLastTime);
+				}
+			}
+			else if ( strcmp(argv[0],"load_state") == 0 )
+			{
+				if ( mMode != CM_NONE || mLastBlockScan || mProcessBlock )
+				{
+					printf("The state can only be loaded before scanning or processing.\r\n");
+				}
+				else
+				{
+					uint32_t statTime = 0;
+					uint32_t processed = mBlockChain->loadState(statTime);
+					if ( processed )
+					{
+						mLastBlockScan = mBlockChain->getBlockCount();
+						mFinishedScanning = true;
+						mProcessTransactions = true;
+						mSatoshiTime = mBlockChain->getBlockTime(0);
+						mLastTime = statTime;
+						mProcessBlock = processed;
+						if ( processed < mLastBlockScan )
+						{
+							printf("Use 'process' to carry on from block #%d.\r\n", mProcessBlock );
+						}
+					}
+				}
+			}
 			else if ( strcmp(argv[0],"process") == 0 )
 			{
 				if ( mMode == CM_PROCESS )
@@ -230,24 +472,63 @@ public:
 					{
 						stopScanning();
 					}
-					mProcessBlock = 0;
-					mMode = CM_PROCESS;
-					printf("Beginning processing of %d blocks : Gathering Statistics=%s\r\n", 
-					mBlockChain->getBlockCount(), 
-					mProcessTransactions ? "true":"false");
+					if ( mChainLost )
+					{
+						printf("The processed state no longer matches the block chain; restart to process it again.\r\n");
+					}
+					else if ( mProcessFailed )
+					{
+						printf("Processing stopped at block #%d; restart to process past it.\r\n", mProcessBlock );
+					}
+					else if ( mProcessBlock && mProcessBlock >= mBlockChain->getBlockCount() )
+					{
+						printf("All %d blocks have been processed; 'scan' picks up any new ones.\r\n", mProcessBlock );
+					}
+					else if ( mProcessBlock && mProcessBlock >= getEndBlock() )
+					{
+						printf("All %d blocks up to the end of the time window have been processed; 'time_window off' lets processing carry on.\r\n", mProcessBlock );
+					}
+					else
+					{
+						mMode = CM_PROCESS; // carries on from mProcessBlock; a pause, a loaded state or a new scan leaves it part way through
+						if ( mWindow && !mProcessTransactions )
+						{
+							// Without statistics nothing is carried from one block to the next, so the blocks before the window can be skipped
+							uint32_t firstBlock;
+							uint32_t endBlock;
+							mBlockChain->getBlockRange(mWindowStart,mWindowEnd,firstBlock,endBlock);
+							if ( mProcessBlock < firstBlock )
+							{
+								mProcessBlock = firstBlock;
+							}
+						}
+						printf("Beginning processing of %d blocks : Gathering Statistics=%s\r\n", 
+						getEndBlock(), 
+						mProcessTransactions ? "true":"false");
+					}
 				}
 			}
 			else if ( strcmp(argv[0],"statistics") == 0 )
 			{
-				mProcessTransactions = mProcessTransactions ? false : true;
-				if ( mProcessTransactions )
+				// 'process' carries on from the last block processed, which only makes sense in the mode those blocks were processed in
+				if ( mMode == CM_PROCESS || mProcessBlock )
 				{
-					printf("Block Processing will gather statistics.\r\n");
-					printf("*** WARNING : This will consume an enormous amount of memory! ***\r\n");
+					printf("Statistics cannot be turned %s once blocks have been processed; restart to process them %s statistics.\r\n",
+						mProcessTransactions ? "off" : "on",
+						mProcessTransactions ? "without" : "with" );
 				}
 				else
 				{
-					printf("Block processing will not gather statistics.\r\n");
+					mProcessTransactions = mProcessTransactions ? false : true;
+					if ( mProcessTransactions )
+					{
+						printf("Block Processing will gather statistics.\r\n");
+						printf("*** WARNING : This will consume an enormous amount of memory! ***\r\n");
+					}
+					else
+					{
+						printf("Block processing will not gather statistics.\r\n");
+					}
 				}
 			}
 			else if ( strcmp(argv[0],"load_record") == 0 )
@@ -340,10 +621,129 @@ public:
 				mStatResolution = SR_YEAR;
 				printf("Gathering statistics every year.\r\n");
 			}
+			else if ( strcmp(argv[0],"time_range") == 0 )
+			{
+				uint32_t startTime;
+				uint32_t endTime;
+				if ( parseTimeRange(argc,argv,startTime,endTime) )
+				{
+					if ( mBlockChain->getBlockCount() == 0 )
+					{
+						printf("The block chain has not been built yet; scan the block headers first.\r\n");
+					}
+					else
+					{
+						printBlockRange(startTime,endTime);
+					}
+				}
+			}
+			else if ( strcmp(argv[0],"time_window") == 0 )
+			{
+				uint32_t startTime;
+				uint32_t endTime;
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot change the time window while processing blocks; pause processing first.\r\n");
+				}
+				else if ( argc >= 2 && strcmp(argv[1],"off") == 0 )
+				{
+					mWindow = false;
+					printf("The time window is off; processing and reports cover the whole block chain.\r\n");
+				}
+				else if ( parseTimeRange(argc,argv,startTime,endTime) )
+				{
+					mWindow = true;
+					mWindowStart = startTime;
+					mWindowEnd = endTime;
+					printf("Processing and reports are limited to the blocks mined from %s", getTimeString(startTime) );
+					printf(" to %s UTC.\r\n", getTimeString(endTime) );
+					if ( mBlockChain->getBlockCount() )
+					{
+						printBlockRange(startTime,endTime);
+					}
+				}
+			}
 			else if ( strcmp(argv[0],"counts") == 0 )
 			{
 				mBlockChain->reportCounts();
 			}
+			else if ( strcmp(argv[0],"freeze") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot freeze while processing blocks; wait for processing to finish or pause it first.\r\n");
+				}
+				else
+				{
+					mBlockChain->freeze();
+				}
+			}
+			else if ( strcmp(argv[0],"headers") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot write the block headers while processing blocks; wait for processing to finish or pause it first.\r\n");
+				}
+				else if ( mFinishedScanning )
+				{
+					saveBlockHeaders();
+				}
+				else
+				{
+					// Headers only: the scan reads just the 80 byte header and the length of each block
+					mSaveHeaders = true;
+					if ( mMode != CM_SCAN )
+					{
+						printf("Scanning block-chain re-started from block %d up to a maximum of %d blocks..\r\n", mLastBlockScan, mMaxBlock);
+						mMode = CM_SCAN;
+					}
+					printf("The block headers will be written to 'BlockHeaders.csv' once the scan finishes.\r\n");
+				}
+			}
+			else if ( strcmp(argv[0],"txindex") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot build the transaction index while processing blocks; wait for processing to finish or pause it first.\r\n");
+				}
+				else
+				{
+					if ( !mFinishedScanning )
+					{
+						stopScanning();
+					}
+					mBlockChain->buildTransactionIndex();
+					mCurrentBlock = NULL; // the index build reads blocks through the same buffer
+				}
+			}
+			else if ( strcmp(argv[0],"txid") == 0 )
+			{
+				for (uint32_t i=1; i<argc; i++)
+				{
+					mBlockChain->lookupTransaction(argv[i]);
+				}
+			}
+			else if ( strcmp(argv[0],"trace") == 0 )
+			{
+				if ( mMode == CM_PROCESS )
+				{
+					printf("Cannot trace while processing blocks; wait for processing to finish or pause it first.\r\n");
+				}
+				else if ( argc >= 2 )
+				{
+					uint32_t hops = 3;
+					if ( argc >= 3 )
+					{
+						hops = atoi(argv[2]);
+						if ( hops < 1 )
+						{
+							hops = 1;
+						}
+					}
+					mBlockChain->traceSpends(argv[1],hops);
+					mCurrentBlock = NULL; // the trace reads blocks through the same buffer
+				}
+			}
 			else if ( strcmp(argv[0],"block") == 0 )
 			{
 				if ( argc == 1 )
@@ -371,9 +771,10 @@ public:
 		switch ( mMode )
 		{
 			case CM_PROCESS:
-				if ( mProcessBlock < mBlockChain->getBlockCount() )
+				if ( mProcessBlock < getEndBlock() )
 				{
 					mCurrentBlock = mBlockChain->readBlock(mProcessBlock);
+					bool ok = true;
 					if ( mCurrentBlock && mProcessTransactions )
 					{
 
@@ -381,49 +782,49 @@ public:
 						{
 							mLastTime = mCurrentBlock->timeStamp;
 							mSatoshiTime = mCurrentBlock->timeStamp;
+							setPeriod(mLastTime);
 						}
 						else
 						{
 							uint32_t currentTime = mCurrentBlock->timeStamp;
-							time_t tnow(currentTime);
-							struct tm beg;
-							beg = *localtime(&tnow);
-							time_t tbefore(mLastTime);
-							struct tm before;
-							before = *localtime(&tbefore);
-							bool getStats = false;
-							switch ( mStatResolution )
+							if ( mPeriodResolution != mStatResolution ) // the resolution was changed part way through
 							{
-								case SR_DAY:
-									if ( beg.tm_yday != before.tm_yday )
-									{
-										getStats = true;
-									}
-									break;
-								case SR_MONTH:
-									if ( beg.tm_mon != before.tm_mon )
-									{
-										getStats = true;
-									}
-									break;
-								case SR_YEAR:
-									if ( beg.tm_year != before.tm_year )
-									{
-										getStats = true;
-									}
-									break;
+								setPeriod(mLastTime);
 							}
-							if ( getStats )
+							if ( currentTime < mPeriodStart || currentTime >= mPeriodEnd )
 							{
+								time_t tnow(currentTime);
+								struct tm beg;
+								beg = *localtime(&tnow);
+								time_t tbefore(mLastTime);
+								struct tm before;
+								before = *localtime(&tbefore);
 								const char *months[12] = { "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December" };
-								printf("Gathering statistics for %s %d, %d to %s %d, %d\r\n", 
-									months[before.tm_mon], before.tm_mday, before.tm_year+1900,
-									months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
-								mBlockChain->gatherStatistics(mLastTime,(uint32_t)zombieDate,mRecordAddresses);
+								// Every block has to be processed to resolve its inputs, but periods which end before the time window are left out of the report
+								if ( !mWindow || mPeriodEnd > mWindowStart )
+								{
+									printf("Gathering statistics for %s %d, %d to %s %d, %d\r\n", 
+										months[before.tm_mon], before.tm_mday, before.tm_year+1900,
+										months[beg.tm_mon], beg.tm_mday, beg.tm_year+1900);
+									mBlockChain->gatherStatistics(mLastTime,(uint32_t)zombieDate,mRecordAddresses);
+								}
 								mLastTime = currentTime;
+								setPeriod(mLastTime);
 							}
 						}
-						mBlockChain->processTransactions(mCurrentBlock);  // process transactions into individual addresses
+						ok = mBlockChain->processTransactions(mCurrentBlock);  // process transactions into individual addresses
+					}
+					else if ( mCurrentBlock )
+					{
+						ok = mBlockChain->skipTransactions(mCurrentBlock);
+					}
+					if ( !ok )
+					{
+						printf("Processing stopped at block #%d; the %d blocks before it can still be reported on.\r\n", mProcessBlock, mProcessBlock );
+						mProcessFailed = true;
+						mBlockChain->reportCounts();
+						mMode = CM_NONE;
+						break;
 					}
 					mProcessBlock++;
 					if ( (mProcessBlock%10000) == 0 )
@@ -433,7 +834,14 @@ public:
 				}
 				else
 				{
-					printf("Finished processing all blocks in the blockchain.\r\n");
+					if ( mProcessBlock < mBlockChain->getBlockCount() )
+					{
+						printf("Finished processing the blocks up to the end of the time window, #%d.\r\n", mProcessBlock-1 );
+					}
+					else
+					{
+						printf("Finished processing all blocks in the blockchain.\r\n");
+					}
 					mBlockChain->reportCounts();
 					if ( mProcessTransactions )
 					{
@@ -443,12 +851,16 @@ public:
 						mBlockChain->saveStatistics(mRecordAddresses);
 					}
 					mMode = CM_NONE;
-					mProcessBlock = 0;
 				}
 				break;
 			case CM_SCAN:
 				{
-					bool ok = mBlockChain->readBlockHeaders(mMaxBlock,mLastBlockScan);
+					// A batch of headers between looking for input; each one is only a short read and a seek
+					bool ok = true;
+					for (uint32_t i=0; i<SCAN_BATCH && ok; i++)
+					{
+						ok = mBlockChain->readBlockHeaders(mMaxBlock,mLastBlockScan);
+					}
 					if ( !ok )
 					{
 						mFinishedScanning = true;
@@ -457,6 +869,12 @@ public:
 						printf("Finished scanning block headers. Built block-chain with %d blocks found..\r\n", mLastBlockScan);
 						printf("To resolve transactions you must execute the 'process' command.\r\n");
 						printf("To gather statistics so you can ouput balances of individual addresses, you must execute the 'statistics' command prior to running the process command.\r\n");
+						rejoinChain();
+						if ( mSaveHeaders )
+						{
+							saveBlockHeaders();
+							mSaveHeaders = false;
+						}
 					}
 				}
 				break;
@@ -464,6 +882,135 @@ public:
 		return mMode != CM_EXIT;
 	}
 
+	// Processing stops at the end of the time window when one is set
+	uint32_t getEndBlock(void) const
+	{
+		uint32_t endBlock = mBlockChain->getBlockCount();
+		if ( mWindow )
+		{
+			uint32_t firstBlock;
+			mBlockChain->getBlockRange(mWindowStart,mWindowEnd,firstBlock,endBlock);
+		}
+		return endBlock;
+	}
+
+	void saveBlockHeaders(void)
+	{
+		uint32_t firstBlock = 0;
+		uint32_t endBlock = mBlockChain->getBlockCount();
+		if ( mWindow )
+		{
+			mBlockChain->getBlockRange(mWindowStart,mWindowEnd,firstBlock,endBlock);
+		}
+		mBlockChain->saveBlockHeaders(firstBlock,endBlock);
+	}
+
+	void printBlockRange(uint32_t startTime,uint32_t endTime)
+	{
+		uint32_t firstBlock;
+		uint32_t endBlock;
+		mBlockChain->getBlockRange(startTime,endTime,firstBlock,endBlock);
+		if ( firstBlock == endBlock )
+		{
+			printf("No blocks were mined in that time range.\r\n");
+		}
+		else
+		{
+			printf("%d blocks, #%d to #%d, were mined in that time range.\r\n", endBlock-firstBlock, firstBlock, endBlock-1 );
+			printf("Block #%d : %s\r\n", firstBlock, getTimeString(mBlockChain->getBlockTime(firstBlock)) );
+			printf("Block #%d : %s\r\n", endBlock-1, getTimeString(mBlockChain->getBlockTime(endBlock-1)) );
+		}
+	}
+
+	// Reads '<command> <from> [to]'; a missing end date means the one day from the start, but one which does not parse is an error
+	static bool parseTimeRange(uint32_t argc,const char **argv,uint32_t &startTime,uint32_t &endTime)
+	{
+		if ( argc < 2 || !parseTime(argv[1],startTime) )
+		{
+			printf("Usage: %s <from> <to>; dates are UTC as YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS.\r\n", argv[0] );
+			return false;
+		}
+		if ( argc < 3 )
+		{
+			endTime = startTime+60*60*24; // one day
+		}
+		else if ( !parseTime(argv[2],endTime) )
+		{
+			printf("Invalid end date '%s'; dates are UTC as YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS.\r\n", argv[2] );
+			return false;
+		}
+		if ( endTime <= startTime )
+		{
+			printf("The end date must come after the start date.\r\n");
+			return false;
+		}
+		return true;
+	}
+
+	// Works out the local time statistics period which contains 't' so each processed block only has to be compared
+	// against its bounds, rather than converted to local time.
+	void setPeriod(uint32_t t)
+	{
+		time_t tt(t);
+		struct tm p = *localtime(&tt);
+		p.tm_sec = 0;
+		p.tm_min = 0;
+		p.tm_hour = 0;
+		p.tm_isdst = -1;
+		if ( mStatResolution != SR_DAY )
+		{
+			p.tm_mday = 1;
+		}
+		if ( mStatResolution == SR_YEAR )
+		{
+			p.tm_mon = 0;
+		}
+		mPeriodStart = (uint32_t)mktime(&p);
+		switch ( mStatResolution )
+		{
+			case SR_DAY:
+				p.tm_mday++;
+				break;
+			case SR_MONTH:
+				p.tm_mon++;
+				break;
+			default:
+				p.tm_year++;
+				break;
+		}
+		p.tm_isdst = -1;
+		mPeriodEnd = (uint32_t)mktime(&p);
+		mPeriodResolution = mStatResolution;
+	}
+
+	// Parses a UTC date as YYYY-MM-DD, optionally followed by THH:MM:SS, or a plain count of seconds since 1970
+	static bool parseTime(const char *str,uint32_t &t)
+	{
+		int year,month,day;
+		int hour = 0;
+		int minute = 0;
+		int second = 0;
+		if ( sscanf(str,"%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) >= 3 )
+		{
+			if ( year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 )
+			{
+				return false;
+			}
+			// Days since 1970-01-01 for a date in the proleptic Gregorian calendar
+			int y = month <= 2 ? year-1 : year;
+			int era = y / 400;
+			int yoe = y - era*400;
+			int doy = (153*(month + (month > 2 ? -3 : 9)) + 2)/5 + day-1;
+			int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+			int days = era*146097 + doe - 719468;
+			t = (uint32_t)days*86400 + hour*3600 + minute*60 + second;
+			return true;
+		}
+		char *end;
+		t = (uint32_t)strtoul(str,&end,10);
+		return end != str && *end == 0;
+	}
+
 	const BlockChain::Block *getBlock(uint32_t index)
 	{
 		mCurrentBlock = mBlockChain->readBlock(index);
@@ -472,7 +1019,15 @@ public:
 
 	CommandMode				mMode;
 	bool					mRecordAddresses;
+	bool					mUtxoMode;
+	bool					mUtxoCommitment;
+	bool					mChainLost;			// A scan found the processed blocks are off the best chain beyond the undo records
+	bool					mProcessFailed;		// A block could not be processed; the state is kept but nothing more can be
+	bool					mWindow;			// Processing and reports are limited to [mWindowStart,mWindowEnd)
+	uint32_t				mWindowStart;
+	uint32_t				mWindowEnd;
 	bool					mFinishedScanning;
+	bool					mSaveHeaders;		// Write the block headers as soon as the scan finishes
 	bool					mProcessTransactions;
 	StatResolution			mStatResolution;
 	uint32_t				mProcessBlock;
@@ -482,6 +1037,9 @@ public:
 	const BlockChain::Block	*mCurrentBlock;
 	BlockChain				*mBlockChain;
 	uint32_t				mLastTime;
+	uint32_t				mPeriodStart;		// The statistics period holding mLastTime
+	uint32_t				mPeriodEnd;
+	StatResolution			mPeriodResolution;	// The resolution the period was computed for
 	uint32_t				mSatoshiTime;
 	uint32_t				mMinBalance;
 	BlockChainAddresses		*mAddresses;